@@ -31,6 +31,9 @@
 #include <sstream>
 #include <iostream>
 #include <vector>
+#include <chrono>
+#include <thread>
+#include "AsyncFileWriter.h"
 #include "Common/StreamSystemInfo.h"
 #include "Common/ErrorCodeToMessage.h"
 
@@ -39,10 +42,27 @@ namespace VmbAPI {
 namespace Examples {
 
 enum    { NUM_FRAMES=3, };
+// Action command keys, the cameras are configured with the same values
+enum    { ACTION_DEVICE_KEY=11, ACTION_GROUP_KEY=22, ACTION_GROUP_MASK=33, };
+// PTP needs a few seconds to elect a master and settle the slaves
+enum    { PTP_SYNC_TIMEOUT_MS=10000, PTP_SYNC_POLL_MS=250, };
+// Host clock drift against PTP stays well below a trigger tolerance for this long
+static const uint64_t PTP_RELATCH_NS = 10000000000ull;
+// Nominal frame rate, and the limit of a burst given by the millisecond command timer
+static const double NOMINAL_FPS = 15.0;
+static const double BURST_MAX_FPS = 1000.0;
 
 ApiController::ApiController()
     // Get a reference to the Vimba singleton
     : m_system( VimbaSystem::GetInstance() )
+    , m_bPtpMode( false )
+    , m_bBurstMode( false )
+    , m_bMotionDetection( false )
+    , m_eBackend( BACKEND_CPP )
+    , m_RawCapture( &m_DropDetector, &m_SyncMonitor, &m_ClockMapper, &m_MotionDetector )
+    , m_bPtpSynchronized( false )
+    , m_nPtpLatchTime( 0 )
+    , m_nPtpLatchHostNs( 0 )
 {
 }
 
@@ -143,6 +163,7 @@ VmbErrorType ApiController::StartContinuousImageAcquisition( const std::vector<s
 	std::cout << "Open camera" << std::endl;
 	VmbErrorType res;
 	m_pCameras.clear();
+	m_pFrameObservers.clear();
 	for (int i = 0; i < num_cam; i++) {
 		std::cout << rStrCameraIDs[i].c_str() << std::endl;
 		res = m_system.OpenCameraByID(rStrCameraIDs[i].c_str(), VmbAccessModeFull, m_pCamera);
@@ -179,18 +200,26 @@ VmbErrorType ApiController::StartContinuousImageAcquisition( const std::vector<s
         if( VmbErrorSuccess == res )
         {
 			std::cout << "Adjust Frame Rate" << std::endl;
+			std::vector<FeaturePtr> featuresFPS(num_cam);
+			m_FPS = m_bBurstMode ? BURST_MAX_FPS : NOMINAL_FPS;
 			for (int i = 0; i < num_cam; i++) {
-				m_FPS = 15.0;
-				FeaturePtr pFeatureFPS;  
-				res = SP_ACCESS(m_pCameras[i])->GetFeatureByName("AcquisitionFrameRateAbs", pFeatureFPS);
+				res = SP_ACCESS(m_pCameras[i])->GetFeatureByName("AcquisitionFrameRateAbs", featuresFPS[i]);
 				if (VmbErrorSuccess != res)
 				{
 					// lets try other
-					res = SP_ACCESS(m_pCameras[i])->GetFeatureByName("AcquisitionFrameRate", pFeatureFPS);
+					res = SP_ACCESS(m_pCameras[i])->GetFeatureByName("AcquisitionFrameRate", featuresFPS[i]);
 				}
-				if (VmbErrorSuccess == res)
+				double fMin = 0, fMax = 0;
+				if (m_bBurstMode && VmbErrorSuccess == res && VmbErrorSuccess == SP_ACCESS(featuresFPS[i])->GetRange(fMin, fMax) && fMax < m_FPS)
 				{
-					res = SP_ACCESS(pFeatureFPS)->SetValue(m_FPS);
+					// a burst runs at the rate of the slowest camera
+					m_FPS = fMax;
+				}
+			}
+			for (int i = 0; i < num_cam; i++) {
+				if (!SP_ISNULL(featuresFPS[i]))
+				{
+					res = SP_ACCESS(featuresFPS[i])->SetValue(m_FPS);
 				}
 			}
 			FeaturePtr pFeature;       // Any camera feature
@@ -215,13 +244,24 @@ VmbErrorType ApiController::StartContinuousImageAcquisition( const std::vector<s
 			// Set Action Command to camera
 			std::cout << "Set Action Command to camera" << std::endl;
 			for (int i = 0; i < num_cam; i++) {
-				int deviceKey = 11, groupKey = 22, groupMask = 33;
 				m_pCameras[i]->GetFeatureByName("ActionDeviceKey", pFeature);
-				pFeature->SetValue(deviceKey);
+				pFeature->SetValue(ACTION_DEVICE_KEY);
 				m_pCameras[i]->GetFeatureByName("ActionGroupKey", pFeature);
-				pFeature->SetValue(groupKey);
+				pFeature->SetValue(ACTION_GROUP_KEY);
 				m_pCameras[i]->GetFeatureByName("ActionGroupMask", pFeature);
-				pFeature->SetValue(groupMask);
+				pFeature->SetValue(ACTION_GROUP_MASK);
+			}
+
+			// Scheduled action commands need one PTP clock on all cameras
+			m_bPtpSynchronized = false;
+			if (m_bPtpMode)
+			{
+				std::cout << "Synchronize PTP" << std::endl;
+				m_bPtpSynchronized = SynchronizePtp();
+				if (!m_bPtpSynchronized)
+				{
+					std::cout << "PTP did not settle, falling back to immediate action commands" << std::endl;
+				}
 			}
 
 			//std::cout << "Set Payload Size" << std::endl;
@@ -243,9 +283,41 @@ VmbErrorType ApiController::StartContinuousImageAcquisition( const std::vector<s
 			if (VmbErrorSuccess == res)
 			{
 				std::cout << "Create Obvservers" << std::endl;
+				// time stamps count in device ticks, 10 s rolling windows
+				std::vector<double> tickFrequency(num_cam, 1e9);
+				for (int i = 0; i < num_cam; i++) {
+					VmbInt64_t nTickFrequency = 0;
+					if (VmbErrorSuccess == m_pCameras[i]->GetFeatureByName("GevTimestampTickFrequency", pFeature)
+						&& VmbErrorSuccess == pFeature->GetValue(nTickFrequency)
+						&& nTickFrequency > 0)
+					{
+						tickFrequency[i] = static_cast<double>(nTickFrequency);
+					}
+				}
+				// the trigger period is known before the first frame, a gap in the first frames is a loss too
+				m_DropDetector.reset(num_cam, NUM_FRAMES, tickFrequency, m_FPS);
+				m_ClockMapper.reset(tickFrequency);
+				// the grid starts with the first command, start with 20 ms of lead
+				m_PtpScheduler.reset(static_cast<uint64_t>(1e9 / m_FPS), 20000000);
+				m_SyncMonitor.reset(tickFrequency, static_cast<uint32_t>(m_FPS * 10), &m_ClockMapper);
+				m_MotionDetector.reset(m_bMotionDetection ? num_cam : 0, static_cast<VmbUint32_t>(m_nWidth), static_cast<VmbUint32_t>(m_nHeight));
+				if (BACKEND_C == m_eBackend)
+				{
+					// the settings stay on the devices, the VimbaC backend opens the cameras again for itself
+					std::cout << "Start VimbaC Image Acquisition" << std::endl;
+					for (int i = 0; i < num_cam; i++) {
+						m_pCameras[i]->Close();
+					}
+					res = static_cast<VmbErrorType>(m_RawCapture.open(rStrCameraIDs));
+					if (VmbErrorSuccess == res)
+					{
+						res = static_cast<VmbErrorType>(m_RawCapture.start(NUM_FRAMES));
+					}
+					return res;
+				}
 				for (int i = 0; i < num_cam; i++) {
 					// Create a frame observer for this camera (This will be wrapped in a shared_ptr so we don't delete it)
-					SP_SET(m_pFrameObserver, new FrameObserver(m_pCameras[i], i));
+					SP_SET(m_pFrameObserver, new FrameObserver(m_pCameras[i], i, &m_DropDetector, &m_SyncMonitor, &m_ClockMapper, &m_MotionDetector));
 					m_pFrameObservers.push_back(m_pFrameObserver);
 				}
 
@@ -275,6 +347,12 @@ VmbErrorType ApiController::StopContinuousImageAcquisition()
     // Stop streaming
 	std::cout << "stop : " << clock();
 	VmbErrorType f_res = VmbErrorSuccess;
+	if (BACKEND_C == m_eBackend)
+	{
+		// closes the cameras as well, the VimbaCPP handles were closed at the start
+		m_RawCapture.stop();
+		m_pCameras.clear();
+	}
 	for (int i = 0; i < m_pCameras.size(); i++)	{
 		m_pCameras[i]->StopContinuousImageAcquisition();
 		VmbErrorType res = m_pCameras[i]->Close();
@@ -352,55 +430,275 @@ double ApiController::GetFPS() const
 }
 
 //
-// Gets the oldest frame that has not been picked up yet
+// Queues a given frame to be filled by the API
+//
+// Parameters:
+//  [in]    pFrame          The frame to queue
 //
 // Returns:
-//  A frame shared pointer
+//  An API status code
 //
-FramePtr ApiController::GetFrame(int cam_index)
+VmbErrorType ApiController::QueueFrame( FramePtr pFrame, int cam_index )
 {
-    return SP_DYN_CAST( m_pFrameObservers[cam_index], FrameObserver )->GetFrame();
+    m_DropDetector.frameRequeued( cam_index );
+    return SP_ACCESS( m_pCameras[cam_index] )->QueueFrame( pFrame );
 }
 
 //
-// Clears all remaining frames that have not been picked up
+// Queues a frame of the VimbaC backend again
+//
+// Parameters:
+//  [in]    nIndex          The frame table index of the frame event
+//
+// Returns:
+//  An API status code
 //
-void ApiController::ClearFrameQueue()
+VmbErrorType ApiController::QueueRawFrame( VmbUint32_t nIndex )
 {
-	for (int i = 0; i < m_pFrameObservers.size(); i++) {
-		SP_DYN_CAST(m_pFrameObservers[i], FrameObserver)->ClearFrameQueue();
-	}
-    //SP_DYN_CAST( m_pFrameObserver,FrameObserver )->ClearFrameQueue();
+    return static_cast<VmbErrorType>( m_RawCapture.requeue( nIndex ));
 }
 
 //
-// Queues a given frame to be filled by the API
+// Returns the camera observer as QObject pointer to connect their signals to the view's slots
+//
+QObject* ApiController::GetCameraObserver()
+{
+    return SP_DYN_CAST( m_pCameraObserver, CameraObserver ).get();
+}
+
+//
+// Returns the detector that classifies the lost frames of all cameras
+//
+DropFrameDetector& ApiController::GetDropDetector()
+{
+    return m_DropDetector;
+}
+
+//
+// Returns the monitor that measures the synchronization of all cameras
+//
+SyncMonitor& ApiController::GetSyncMonitor()
+{
+    return m_SyncMonitor;
+}
+
+//
+// Returns the mapping of all device clocks onto the common host timeline
+//
+ClockMapper& ApiController::GetClockMapper()
+{
+    return m_ClockMapper;
+}
+
+//
+// Returns the execution time grid of the scheduled action commands
+//
+PtpScheduler& ApiController::GetPtpScheduler()
+{
+    return m_PtpScheduler;
+}
+
+//
+// Returns the motion measure of all cameras, fed by the frame observers
+//
+MotionDetector& ApiController::GetMotionDetector()
+{
+    return m_MotionDetector;
+}
+
+//
+// Measures the motion of every frame in the next acquisition
+//
+void ApiController::SetMotionDetection( bool bEnable )
+{
+    m_bMotionDetection = bEnable;
+}
+
+//
+// Enables IEEE 1588 on all cameras at the next start of an acquisition
+//
+void ApiController::SetPtpMode( bool bEnable )
+{
+    m_bPtpMode = bEnable;
+}
+
+//
+// Runs the next acquisition at the highest frame rate all cameras support
+//
+void ApiController::SetBurstMode( bool bEnable )
+{
+    m_bBurstMode = bEnable;
+}
+
+//
+// Selects the frame delivery of the next acquisition
+//
+void ApiController::SetCaptureBackend( capture_backend eBackend )
+{
+    m_eBackend = eBackend;
+}
+
+ApiController::capture_backend ApiController::GetCaptureBackend() const
+{
+    return m_eBackend;
+}
+
+//
+// Returns true if the running acquisition has all cameras on one PTP master
+//
+bool ApiController::IsPtpSynchronized() const
+{
+    return m_bPtpSynchronized;
+}
+
+//
+// Enables IEEE 1588 on all cameras and waits until they agree on one master
+//
+// Returns:
+//  True if one camera is master and all others are slaves
+//
+bool ApiController::SynchronizePtp()
+{
+    FeaturePtr pFeature;
+    for ( size_t i = 0; i < m_pCameras.size(); i++ )
+    {
+        if (    VmbErrorSuccess != SP_ACCESS( m_pCameras[i] )->GetFeatureByName( "GevIEEE1588", pFeature )
+             || VmbErrorSuccess != SP_ACCESS( pFeature )->SetValue( true ))
+        {
+            std::cout << "cam " << i << ": IEEE 1588 not supported" << std::endl;
+            return false;
+        }
+    }
+    for ( int waited = 0; waited <= PTP_SYNC_TIMEOUT_MS; waited += PTP_SYNC_POLL_MS )
+    {
+        int masters = 0, slaves = 0;
+        for ( size_t i = 0; i < m_pCameras.size(); i++ )
+        {
+            std::string status;
+            if (    VmbErrorSuccess == SP_ACCESS( m_pCameras[i] )->GetFeatureByName( "GevIEEE1588Status", pFeature )
+                 && VmbErrorSuccess == SP_ACCESS( pFeature )->GetValue( status ))
+            {
+                masters += "Master" == status ? 1 : 0;
+                slaves += "Slave" == status ? 1 : 0;
+            }
+        }
+        if ( 1 == masters && masters + slaves == static_cast<int>( m_pCameras.size() ))
+        {
+            std::cout << "PTP synchronized after " << waited << " ms" << std::endl;
+            QMutexLocker local_lock( &m_PtpLock );
+            m_nPtpLatchHostNs = 0;
+            return true;
+        }
+        std::this_thread::sleep_for( std::chrono::milliseconds( PTP_SYNC_POLL_MS ));
+    }
+    return false;
+}
+
+//
+// Estimates the current PTP time from the last latch of the first camera
+// and the host clock, latches again when the last latch is too old
+//
+// Returns:
+//  The PTP time in ns, 0 if the time could not be latched
+//
+VmbUint64_t ApiController::GetPtpTime()
+{
+    QMutexLocker local_lock( &m_PtpLock );
+    uint64_t nHostNs = AsyncIoService::nowNs();
+    if ( 0 == m_nPtpLatchHostNs || nHostNs - m_nPtpLatchHostNs > PTP_RELATCH_NS )
+    {
+        FeaturePtr pFeature;
+        VmbInt64_t nValue = 0;
+        if ( BACKEND_C == m_eBackend )
+        {
+            // the VimbaCPP handles are closed while the VimbaC backend runs
+            if (    0 == m_RawCapture.cameras()
+                 || VmbErrorSuccess != VmbFeatureCommandRun( m_RawCapture.handle( 0 ), "GevTimestampControlLatch" )
+                 || VmbErrorSuccess != VmbFeatureIntGet( m_RawCapture.handle( 0 ), "GevTimestampValue", &nValue ))
+            {
+                return 0;
+            }
+        }
+        else if (    m_pCameras.empty()
+                  || VmbErrorSuccess != SP_ACCESS( m_pCameras[0] )->GetFeatureByName( "GevTimestampControlLatch", pFeature )
+                  || VmbErrorSuccess != SP_ACCESS( pFeature )->RunCommand()
+                  || VmbErrorSuccess != SP_ACCESS( m_pCameras[0] )->GetFeatureByName( "GevTimestampValue", pFeature )
+                  || VmbErrorSuccess != SP_ACCESS( pFeature )->GetValue( nValue ))
+        {
+            return 0;
+        }
+        // the latch happened somewhere in the round trip, take its middle
+        const uint64_t nAfterNs = AsyncIoService::nowNs();
+        m_nPtpLatchHostNs = nHostNs + ( nAfterNs - nHostNs ) / 2;
+        m_nPtpLatchTime = static_cast<VmbUint64_t>( nValue );
+        nHostNs = nAfterNs;
+    }
+    return m_nPtpLatchTime + ( nHostNs - m_nPtpLatchHostNs );
+}
+
+//
+// Sends one action command to all cameras
 //
 // Parameters:
-//  [in]    pFrame          The frame to queue
+//  [in]    nExecutionTime  PTP time in ns at which the cameras trigger, 0 to trigger on arrival
 //
 // Returns:
 //  An API status code
 //
-VmbErrorType ApiController::QueueFrame( FramePtr pFrame, int cam_index )
+VmbErrorType ApiController::SendActionCommand( VmbUint64_t nExecutionTime )
 {
-    return SP_ACCESS( m_pCameras[cam_index] )->QueueFrame( pFrame );
+    FeaturePtr pFeature;
+    m_system.GetFeatureByName( "ActionDeviceKey", pFeature );
+    SP_ACCESS( pFeature )->SetValue( ACTION_DEVICE_KEY );
+    m_system.GetFeatureByName( "ActionGroupKey", pFeature );
+    SP_ACCESS( pFeature )->SetValue( ACTION_GROUP_KEY );
+    m_system.GetFeatureByName( "ActionGroupMask", pFeature );
+    SP_ACCESS( pFeature )->SetValue( ACTION_GROUP_MASK );
+    // transport layers without scheduled actions trigger on arrival
+    if ( VmbErrorSuccess == m_system.GetFeatureByName( "ActionScheduledTimeEnable", pFeature ))
+    {
+        SP_ACCESS( pFeature )->SetValue( 0 != nExecutionTime );
+        if ( 0 != nExecutionTime && VmbErrorSuccess == m_system.GetFeatureByName( "ActionScheduledTime", pFeature ))
+        {
+            SP_ACCESS( pFeature )->SetValue( static_cast<VmbInt64_t>( nExecutionTime ));
+        }
+    }
+    VmbErrorType res = m_system.GetFeatureByName( "ActionCommand", pFeature );
+    if ( VmbErrorSuccess == res )
+    {
+        res = SP_ACCESS( pFeature )->RunCommand();
+    }
+    return res;
 }
 
 //
-// Returns the camera observer as QObject pointer to connect their signals to the view's slots
+// Hands the frames of all cameras of the running acquisition to a consumer
 //
-QObject* ApiController::GetCameraObserver()
+// Parameters:
+//  [in]    pConsumer       The consumer, NULL queues the frames again without handing them on
+//
+void ApiController::SetFrameConsumer( IFrameConsumer *pConsumer )
 {
-    return SP_DYN_CAST( m_pCameraObserver, CameraObserver ).get();
+    for( size_t i = 0; i < m_pFrameObservers.size(); ++i )
+    {
+        // once per acquisition, the frames go straight to the consumer
+        FrameObserver *pObserver = SP_DYN_CAST( m_pFrameObservers[i], FrameObserver ).get();
+        if( NULL != pObserver )
+        {
+            pObserver->SetConsumer( pConsumer );
+        }
+    }
 }
 
 //
-// Returns the frame observer as QObject pointer to connect their signals to the view's slots
+// Hands the frames of the running VimbaC acquisition to a consumer
+//
+// Parameters:
+//  [in]    pConsumer       The consumer, NULL queues the frames again without handing them on
 //
-QObject* ApiController::GetFrameObserver( const int camera_index )
+void ApiController::SetRawFrameConsumer( IRawFrameConsumer *pConsumer )
 {
-    return SP_DYN_CAST( m_pFrameObservers[camera_index], FrameObserver ).get();
+    m_RawCapture.setConsumer( pConsumer );
 }
 
 //
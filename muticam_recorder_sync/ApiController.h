@@ -36,6 +36,8 @@
 
 #include "CameraObserver.h"
 #include "FrameObserver.h"
+#include "PtpScheduler.h"
+#include "VimbaCCapture.h"
 
 namespace AVT {
 namespace VmbAPI {
@@ -44,6 +46,15 @@ namespace Examples {
 class ApiController
 {
   public:
+    //
+    // Frame delivery of an acquisition: VimbaCPP frame observers or plain VimbaC callbacks
+    //
+    enum capture_backend
+    {
+        BACKEND_CPP,
+        BACKEND_C,
+    };
+
     ApiController();
     ~ApiController();
 
@@ -126,38 +137,132 @@ class ApiController
     CameraPtrVector     GetCameraList();
 
     //
-    // Gets the oldest frame that has not been picked up yet
+    // Queues a given frame to be filled by the API
+    //
+    // Parameters:
+    //  [in]    pFrame          The frame to queue
     //
     // Returns:
-    //  A frame shared pointer
+    //  An API status code
     //
-    FramePtr            GetFrame( int cam_index );
+    VmbErrorType        QueueFrame( FramePtr pFrame, int cam_index );
 
     //
-    // Queues a given frame to be filled by the API
+    // Returns the camera observer as QObject pointer to connect their signals to the view's slots
+    //
+    QObject*            GetCameraObserver();
+
+    //
+    // Hands the frames of all cameras of the running acquisition to a consumer,
+    // called on the Vimba threads. NULL queues the frames again without handing them on
+    // and returns once no callback is inside the old consumer, so it can be torn down
     //
     // Parameters:
-    //  [in]    pFrame          The frame to queue
+    //  [in]    pConsumer       The consumer, has to outlive the acquisition
+    //
+    void                SetFrameConsumer( IFrameConsumer *pConsumer );
+
+    //
+    // Hands the frames of the running VimbaC acquisition to a consumer, see SetFrameConsumer
+    //
+    // Parameters:
+    //  [in]    pConsumer       The consumer, has to outlive the acquisition
+    //
+    void                SetRawFrameConsumer( IRawFrameConsumer *pConsumer );
+
+    //
+    // Queues a frame of the VimbaC backend again
+    //
+    // Parameters:
+    //  [in]    nIndex          The frame table index of the frame event
     //
     // Returns:
     //  An API status code
     //
-    VmbErrorType        QueueFrame( FramePtr pFrame, int cam_index );
+    VmbErrorType        QueueRawFrame( VmbUint32_t nIndex );
 
     //
-    // Clears all remaining frames that have not been picked up
+    // Returns the detector that classifies the lost frames of all cameras
     //
-    void                ClearFrameQueue();
-    
+    DropFrameDetector&  GetDropDetector();
+
     //
-    // Returns the camera observer as QObject pointer to connect their signals to the view's slots
+    // Returns the monitor that measures the synchronization of all cameras
     //
-    QObject*            GetCameraObserver();
+    SyncMonitor&        GetSyncMonitor();
 
     //
-    // Returns the frame observer as QObject pointer to connect their signals to the view's slots
+    // Returns the mapping of all device clocks onto the common host timeline
     //
-    QObject*            GetFrameObserver( const int camera_index );
+    ClockMapper&        GetClockMapper();
+
+    //
+    // Returns the execution time grid of the scheduled action commands
+    //
+    PtpScheduler&       GetPtpScheduler();
+
+    //
+    // Returns the motion measure of all cameras, fed by the frame observers
+    //
+    MotionDetector&     GetMotionDetector();
+
+    //
+    // Measures the motion of every frame in the next acquisition
+    //
+    // Parameters:
+    //  [in]    bEnable     True to feed the motion gate of the recording
+    //
+    void                SetMotionDetection( bool bEnable );
+
+    //
+    // Enables IEEE 1588 on all cameras at the next start of an acquisition
+    //
+    // Parameters:
+    //  [in]    bEnable     True for scheduled action commands on the PTP clock
+    //
+    void                SetPtpMode( bool bEnable );
+
+    //
+    // Runs the next acquisition at the highest frame rate all cameras support
+    //
+    // Parameters:
+    //  [in]    bEnable     True for a burst into RAM, false for the nominal rate
+    //
+    void                SetBurstMode( bool bEnable );
+
+    //
+    // Selects the frame delivery of the next acquisition
+    //
+    // Parameters:
+    //  [in]    eBackend    BACKEND_C delivers to a IRawFrameConsumer, BACKEND_CPP to a IFrameConsumer
+    //
+    void                SetCaptureBackend( capture_backend eBackend );
+    capture_backend     GetCaptureBackend() const;
+
+    //
+    // Returns true if the running acquisition has all cameras on one PTP master
+    //
+    bool                IsPtpSynchronized() const;
+
+    //
+    // Estimates the current PTP time from the last latch of the first camera
+    // and the host clock, latches again when the last latch is too old
+    //
+    // Returns:
+    //  The PTP time in ns, 0 if the time could not be latched
+    //
+    VmbUint64_t         GetPtpTime();
+
+    //
+    // Sends one action command to all cameras
+    //
+    // Parameters:
+    //  [in]    nExecutionTime  PTP time in ns at which the cameras trigger, 0 to trigger on arrival
+    //
+    // Returns:
+    //  An API status code
+    //
+    VmbErrorType        SendActionCommand( VmbUint64_t nExecutionTime = 0 );
 
     //
     // Translates Vimba error codes to readable error messages
@@ -198,6 +303,40 @@ class ApiController
     VmbInt64_t                  m_nHeight;
     // The current FPS
     double                      m_FPS;
+    // Lost frame accounting, fed by the frame observers
+    DropFrameDetector           m_DropDetector;
+    // Time stamp spread between the cameras, fed by the frame observers
+    SyncMonitor                 m_SyncMonitor;
+    // Device clock to host clock fit of every camera
+    ClockMapper                 m_ClockMapper;
+    // Execution times of the scheduled action commands
+    PtpScheduler                m_PtpScheduler;
+    // IEEE 1588 requested for the next acquisition
+    bool                        m_bPtpMode;
+    // Highest common frame rate requested for the next acquisition
+    bool                        m_bBurstMode;
+    // Frame difference against the background of every camera
+    MotionDetector              m_MotionDetector;
+    // Motion measure requested for the next acquisition
+    bool                        m_bMotionDetection;
+    // Frame delivery of the next and the running acquisition
+    capture_backend             m_eBackend;
+    // Frame table and callbacks of the VimbaC backend
+    VimbaCCapture               m_RawCapture;
+    // All cameras of the running acquisition agree on one PTP master
+    bool                        m_bPtpSynchronized;
+    // Last PTP latch of the first camera and the host time it was taken at
+    VmbUint64_t                 m_nPtpLatchTime;
+    uint64_t                    m_nPtpLatchHostNs;
+    // Guards the latch against the trigger thread and the GUI thread
+    QMutex                      m_PtpLock;
+    //
+    // Enables IEEE 1588 on all cameras and waits until they agree on one master
+    //
+    // Returns:
+    //  True if one camera is master and all others are slaves
+    //
+    bool                        SynchronizePtp();
 };
 
 }}} // namespace AVT::VmbAPI::Examples
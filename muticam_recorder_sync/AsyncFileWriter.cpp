@@ -0,0 +1,437 @@
+#include "AsyncFileWriter.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#ifdef _WIN32
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+namespace
+{
+	const unsigned  IO_WORKERS = 2;
+	const unsigned  URING_DEPTH = 64;
+
+	uint8_t* allocAligned(size_t size)
+	{
+#ifdef _WIN32
+		return static_cast<uint8_t*>(_aligned_malloc(size, AsyncIoService::BLOCK_ALIGNMENT));
+#else
+		void *p = NULL;
+		return 0 == posix_memalign(&p, AsyncIoService::BLOCK_ALIGNMENT, size) ? static_cast<uint8_t*>(p) : NULL;
+#endif
+	}
+
+	void freeAligned(uint8_t *p)
+	{
+#ifdef _WIN32
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+
+	AsyncIoService::io_block* newBlock(AsyncFileWriter *pOwner)
+	{
+		AsyncIoService::io_block *pBlock = new AsyncIoService::io_block;
+		pBlock->Data = allocAligned(AsyncIoService::BLOCK_SIZE);
+		pBlock->Used = 0;
+		pBlock->Offset = 0;
+		pBlock->Submitted = 0;
+		pBlock->Owner = pOwner;
+		return pBlock;
+	}
+
+	void deleteBlock(AsyncIoService::io_block *pBlock)
+	{
+		freeAligned(pBlock->Data);
+		delete pBlock;
+	}
+}
+
+AsyncIoService& AsyncIoService::instance()
+{
+	static AsyncIoService service;
+	return service;
+}
+
+AsyncIoService::AsyncIoService()
+	: m_Stop(false)
+	, m_InFlight(0)
+	, m_pRing(NULL)
+{
+#ifdef HAVE_LIBURING
+	struct io_uring *pRing = new struct io_uring;
+	if (0 == io_uring_queue_init(URING_DEPTH, pRing, 0))
+	{
+		m_pRing = pRing;
+		m_Threads.push_back(std::thread(&AsyncIoService::uringLoop, this));
+		return;
+	}
+	delete pRing;
+	std::cout << "io_uring not available, using worker threads" << std::endl;
+#endif
+	for (unsigned i = 0; i < IO_WORKERS; ++i)
+	{
+		m_Threads.push_back(std::thread(&AsyncIoService::workerLoop, this));
+	}
+}
+
+AsyncIoService::~AsyncIoService()
+{
+	{
+		std::lock_guard<std::mutex> local_lock(m_Lock);
+		m_Stop = true;
+	}
+	m_Ready.notify_all();
+	for (size_t i = 0; i < m_Threads.size(); ++i)
+	{
+		m_Threads[i].join();
+	}
+#ifdef HAVE_LIBURING
+	if (NULL != m_pRing)
+	{
+		io_uring_queue_exit(static_cast<struct io_uring*>(m_pRing));
+		delete static_cast<struct io_uring*>(m_pRing);
+	}
+#endif
+}
+
+const char* AsyncIoService::backendName() const
+{
+	return NULL != m_pRing ? "io_uring" : "threads";
+}
+
+uint64_t AsyncIoService::nowNs()
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void AsyncIoService::submit(io_block *pBlock)
+{
+	pBlock->Submitted = nowNs();
+	m_InFlight.fetch_add(pBlock->Used, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> local_lock(m_Lock);
+		m_Pending.push_back(pBlock);
+	}
+	m_Ready.notify_one();
+}
+
+void AsyncIoService::complete(io_block *pBlock, bool ok)
+{
+	m_Latency.record((nowNs() - pBlock->Submitted) / 1000);
+	m_InFlight.fetch_sub(pBlock->Used, std::memory_order_relaxed);
+	pBlock->Owner->blockDone(pBlock, ok);
+}
+
+bool AsyncIoService::writeBlock(io_block *pBlock)
+{
+#ifdef _WIN32
+	OVERLAPPED position;
+	memset(&position, 0, sizeof(position));
+	position.Offset = static_cast<DWORD>(pBlock->Offset & 0xffffffff);
+	position.OffsetHigh = static_cast<DWORD>(pBlock->Offset >> 32);
+	DWORD written = 0;
+	return TRUE == WriteFile(pBlock->Owner->handle(), pBlock->Data, pBlock->Used, &written, &position)
+		&& written == pBlock->Used;
+#else
+	uint32_t done = 0;
+	while (done < pBlock->Used)
+	{
+		ssize_t res = pwrite(pBlock->Owner->handle(), pBlock->Data + done, pBlock->Used - done,
+			static_cast<off_t>(pBlock->Offset + done));
+		if (res <= 0)
+		{
+			return false;
+		}
+		done += static_cast<uint32_t>(res);
+	}
+	return true;
+#endif
+}
+
+//
+// Thread pool fallback, every worker takes a batch and writes it in file order
+//
+void AsyncIoService::workerLoop()
+{
+	std::vector<io_block*> batch;
+	batch.reserve(MAX_BATCH);
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> local_lock(m_Lock);
+			while (!m_Stop && m_Pending.empty())
+			{
+				m_Ready.wait(local_lock);
+			}
+			if (m_Pending.empty())
+			{
+				return;
+			}
+			while (!m_Pending.empty() && batch.size() < MAX_BATCH)
+			{
+				batch.push_back(m_Pending.front());
+				m_Pending.pop_front();
+			}
+		}
+		for (size_t i = 0; i < batch.size(); ++i)
+		{
+			complete(batch[i], writeBlock(batch[i]));
+		}
+		batch.clear();
+	}
+}
+
+//
+// io_uring backend, one submission per batch, then reap the batch
+//
+void AsyncIoService::uringLoop()
+{
+#ifdef HAVE_LIBURING
+	struct io_uring *pRing = static_cast<struct io_uring*>(m_pRing);
+	std::vector<io_block*> batch;
+	batch.reserve(MAX_BATCH);
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> local_lock(m_Lock);
+			while (!m_Stop && m_Pending.empty())
+			{
+				m_Ready.wait(local_lock);
+			}
+			if (m_Pending.empty())
+			{
+				return;
+			}
+			while (!m_Pending.empty() && batch.size() < MAX_BATCH && batch.size() < URING_DEPTH)
+			{
+				batch.push_back(m_Pending.front());
+				m_Pending.pop_front();
+			}
+		}
+		for (size_t i = 0; i < batch.size(); ++i)
+		{
+			struct io_uring_sqe *pSqe = io_uring_get_sqe(pRing);
+			io_uring_prep_write(pSqe, batch[i]->Owner->handle(), batch[i]->Data, batch[i]->Used, batch[i]->Offset);
+			io_uring_sqe_set_data(pSqe, batch[i]);
+		}
+		io_uring_submit(pRing);
+		for (size_t i = 0; i < batch.size(); ++i)
+		{
+			struct io_uring_cqe *pCqe = NULL;
+			if (0 != io_uring_wait_cqe(pRing, &pCqe))
+			{
+				break;
+			}
+			io_block *pBlock = static_cast<io_block*>(io_uring_cqe_get_data(pCqe));
+			const int res = pCqe->res;
+			io_uring_cqe_seen(pRing, pCqe);
+			// a short write is finished synchronously, it is rare enough
+			bool ok = res == static_cast<int>(pBlock->Used);
+			if (!ok && res > 0)
+			{
+				io_block rest = *pBlock;
+				rest.Data += res;
+				rest.Used -= res;
+				rest.Offset += res;
+				ok = writeBlock(&rest);
+			}
+			complete(pBlock, ok);
+		}
+		batch.clear();
+	}
+#endif
+}
+
+AsyncFileWriter::AsyncFileWriter(const std::string &fileName, uint32_t poolBlocks, uint32_t maxBlocks)
+	: m_FileName(fileName)
+	, m_Open(false)
+	, m_PoolBlocks(poolBlocks)
+	, m_MaxBlocks(maxBlocks < poolBlocks ? poolBlocks : maxBlocks)
+	, m_pCurrent(NULL)
+	, m_Offset(0)
+	, m_Outstanding(0)
+	, m_Overflow(0)
+	, m_Dropped(0)
+	, m_Failed(false)
+{
+#ifdef _WIN32
+	m_Handle = CreateFileA(fileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	m_Open = INVALID_HANDLE_VALUE != m_Handle;
+#else
+	m_Handle = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	m_Open = m_Handle >= 0;
+#endif
+	if (!m_Open)
+	{
+		std::cout << "could not open " << fileName << std::endl;
+		return;
+	}
+	// make sure the service threads exist before the first frame
+	AsyncIoService::instance();
+	for (uint32_t i = 0; i < poolBlocks; ++i)
+	{
+		AsyncIoService::io_block *pBlock = newBlock(this);
+		m_AllBlocks.push_back(pBlock);
+		m_FreeBlocks.push_back(pBlock);
+	}
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+	close();
+	for (size_t i = 0; i < m_AllBlocks.size(); ++i)
+	{
+		deleteBlock(m_AllBlocks[i]);
+	}
+}
+
+AsyncIoService::io_block* AsyncFileWriter::takeBlock()
+{
+	AsyncIoService::io_block *pBlock;
+	if (!m_FreeBlocks.empty())
+	{
+		pBlock = m_FreeBlocks.back();
+		m_FreeBlocks.pop_back();
+	}
+	else
+	{
+		// storage is behind, grow rather than stall the caller, append() checked the cap
+		pBlock = newBlock(this);
+		m_AllBlocks.push_back(pBlock);
+		++m_Overflow;
+	}
+	pBlock->Used = 0;
+	pBlock->Offset = m_Offset;
+	return pBlock;
+}
+
+void AsyncFileWriter::queueCurrent()
+{
+	if (NULL == m_pCurrent || 0 == m_pCurrent->Used)
+	{
+		return;
+	}
+	++m_Outstanding;
+	AsyncIoService::instance().submit(m_pCurrent);
+	m_pCurrent = NULL;
+}
+
+uint64_t AsyncFileWriter::append(const void *pData, size_t size)
+{
+	std::lock_guard<std::mutex> local_lock(m_Lock);
+	const uint64_t start = m_Offset;
+	if (!m_Open)
+	{
+		return start;
+	}
+	// all or nothing, a partial record would shift everything after it
+	const size_t room = NULL == m_pCurrent ? 0 : AsyncIoService::BLOCK_SIZE - m_pCurrent->Used;
+	const size_t needed = size <= room ? 0 : (size - room + AsyncIoService::BLOCK_SIZE - 1) / AsyncIoService::BLOCK_SIZE;
+	if (needed > m_FreeBlocks.size() + (m_MaxBlocks - m_AllBlocks.size()))
+	{
+		if (0 == m_Dropped)
+		{
+			std::cout << m_FileName << ": storage too slow, " << m_MaxBlocks << " I/O blocks in flight, dropping writes" << std::endl;
+		}
+		m_Dropped += size;
+		m_Failed.store(true);
+		return start;
+	}
+	const uint8_t *pSrc = static_cast<const uint8_t*>(pData);
+	while (size > 0)
+	{
+		if (NULL == m_pCurrent)
+		{
+			m_pCurrent = takeBlock();
+		}
+		size_t chunk = AsyncIoService::BLOCK_SIZE - m_pCurrent->Used;
+		if (chunk > size)
+		{
+			chunk = size;
+		}
+		memcpy(m_pCurrent->Data + m_pCurrent->Used, pSrc, chunk);
+		m_pCurrent->Used += static_cast<uint32_t>(chunk);
+		m_Offset += chunk;
+		pSrc += chunk;
+		size -= chunk;
+		if (AsyncIoService::BLOCK_SIZE == m_pCurrent->Used)
+		{
+			queueCurrent();
+		}
+	}
+	return start;
+}
+
+void AsyncFileWriter::flush()
+{
+	std::lock_guard<std::mutex> local_lock(m_Lock);
+	queueCurrent();
+}
+
+void AsyncFileWriter::close()
+{
+	std::unique_lock<std::mutex> local_lock(m_Lock);
+	if (!m_Open)
+	{
+		return;
+	}
+	queueCurrent();
+	while (0 != m_Outstanding)
+	{
+		m_Idle.wait(local_lock);
+	}
+#ifdef _WIN32
+	CloseHandle(m_Handle);
+#else
+	::close(m_Handle);
+#endif
+	m_Open = false;
+	if (0 != m_Overflow)
+	{
+		std::cout << m_FileName << " needed " << m_Overflow << " extra I/O blocks" << std::endl;
+	}
+	if (0 != m_Dropped)
+	{
+		std::cout << m_FileName << " dropped " << m_Dropped << " bytes" << std::endl;
+	}
+}
+
+void AsyncFileWriter::blockDone(AsyncIoService::io_block *pBlock, bool ok)
+{
+	if (!ok)
+	{
+		m_Failed.store(true);
+	}
+	bool extra = false;
+	{
+		std::lock_guard<std::mutex> local_lock(m_Lock);
+		// give overflow blocks back once the storage caught up
+		extra = m_AllBlocks.size() > m_PoolBlocks;
+		if (extra)
+		{
+			m_AllBlocks.erase(std::find(m_AllBlocks.begin(), m_AllBlocks.end(), pBlock));
+		}
+		else
+		{
+			m_FreeBlocks.push_back(pBlock);
+		}
+		--m_Outstanding;
+	}
+	if (extra)
+	{
+		deleteBlock(pBlock);
+	}
+	m_Idle.notify_all();
+}
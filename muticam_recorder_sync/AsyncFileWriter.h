@@ -0,0 +1,164 @@
+#ifndef ASYNC_FILE_WRITER_H_
+#define ASYNC_FILE_WRITER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LatencyHistogram.h"
+
+class AsyncFileWriter;
+
+//
+// Process wide I/O service behind all AsyncFileWriter instances.
+// Filled blocks are queued by the writers and submitted in batches, through
+// io_uring when the recorder is built with HAVE_LIBURING on Linux and by a
+// small pool of worker threads doing positioned writes otherwise.
+// Only the I/O threads ever touch the file system.
+//
+class AsyncIoService
+{
+public:
+	enum { BLOCK_SIZE = 1 << 20, BLOCK_ALIGNMENT = 4096, MAX_BATCH = 32 };
+
+	//
+	// one aligned write buffer, owned by a writer and lent to the service
+	//
+	struct io_block
+	{
+		uint8_t*            Data;
+		uint32_t            Used;
+		uint64_t            Offset;         // file offset, assigned when the block is queued
+		uint64_t            Submitted;      // steady clock in ns
+		AsyncFileWriter*    Owner;
+	};
+
+	static AsyncIoService& instance();
+
+	void submit(io_block *pBlock);
+	//
+	// Method: inFlightBytes()
+	//
+	// Purpose: bytes handed to the service and not yet on disk.
+	//
+	uint64_t inFlightBytes() const { return m_InFlight.load(std::memory_order_relaxed); }
+	//
+	// Method: latency()
+	//
+	// Purpose: queue to completion time of every block write in microseconds.
+	//
+	const LatencyHistogram& latency() const { return m_Latency; }
+	const char* backendName() const;
+
+	static uint64_t nowNs();
+
+private:
+	AsyncIoService();
+	~AsyncIoService();
+	AsyncIoService(const AsyncIoService&);
+	AsyncIoService& operator=(const AsyncIoService&);
+
+	void workerLoop();
+	void uringLoop();
+	void complete(io_block *pBlock, bool ok);
+	static bool writeBlock(io_block *pBlock);
+
+	std::mutex                  m_Lock;
+	std::condition_variable     m_Ready;
+	std::deque<io_block*>       m_Pending;
+	bool                        m_Stop;
+	std::vector<std::thread>    m_Threads;
+	std::atomic<uint64_t>       m_InFlight;
+	LatencyHistogram            m_Latency;
+	void*                       m_pRing;        // struct io_uring when available
+};
+
+//
+// Append-only file fed from recorder or callback threads.
+// append() copies into the current aligned block and returns without
+// touching the file; full blocks go to AsyncIoService. When all blocks are in
+// flight a new one is allocated instead of waiting, overflowBlocks() counts
+// these so a too small pool shows up in the logs. Extra blocks are freed
+// again once written. Past maxBlocks an append is dropped as a whole, counted
+// in droppedBytes() and the writer reports failed(): the file has a gap.
+//
+class AsyncFileWriter
+{
+public:
+	explicit AsyncFileWriter(const std::string &fileName, uint32_t poolBlocks = 4, uint32_t maxBlocks = 64);
+	~AsyncFileWriter();
+
+	bool isOpen() const { return m_Open; }
+	const std::string& fileName() const { return m_FileName; }
+
+	//
+	// Method: append()
+	//
+	// Purpose: queue bytes at the end of the file, never blocks on I/O.
+	//          Dropped if it needs more blocks than maxBlocks leaves.
+	//
+	// Returns: file offset the first byte will be written to
+	//
+	uint64_t append(const void *pData, size_t size);
+	uint64_t append(const std::string &text) { return append(text.data(), text.size()); }
+	//
+	// Method: flush()
+	//
+	// Purpose: hand the partially filled block to the service.
+	//
+	void flush();
+	//
+	// Method: close()
+	//
+	// Purpose: flush, wait until every block is written and close the file.
+	//          This is the only call that waits, do not use it on a frame path.
+	//
+	void close();
+
+	uint64_t bytesQueued() const { return m_Offset; }
+	uint32_t overflowBlocks() const { return m_Overflow; }
+	uint64_t droppedBytes() const { return m_Dropped; }
+	bool failed() const { return m_Failed.load(); }
+
+#ifdef _WIN32
+	void*               handle() const { return m_Handle; }
+#else
+	int                 handle() const { return m_Handle; }
+#endif
+
+private:
+	friend class AsyncIoService;
+	AsyncFileWriter(const AsyncFileWriter&);
+	AsyncFileWriter& operator=(const AsyncFileWriter&);
+
+	AsyncIoService::io_block* takeBlock();
+	void queueCurrent();
+	void blockDone(AsyncIoService::io_block *pBlock, bool ok);
+
+	std::string                             m_FileName;
+	bool                                    m_Open;
+#ifdef _WIN32
+	void*                                   m_Handle;
+#else
+	int                                     m_Handle;
+#endif
+	std::mutex                              m_Lock;
+	std::condition_variable                 m_Idle;
+	std::vector<AsyncIoService::io_block*>  m_AllBlocks;
+	std::vector<AsyncIoService::io_block*>  m_FreeBlocks;
+	uint32_t                                m_PoolBlocks;
+	uint32_t                                m_MaxBlocks;
+	AsyncIoService::io_block*               m_pCurrent;
+	uint64_t                                m_Offset;
+	uint32_t                                m_Outstanding;
+	uint32_t                                m_Overflow;
+	uint64_t                                m_Dropped;
+	std::atomic<bool>                       m_Failed;
+};
+
+#endif
@@ -0,0 +1,251 @@
+#include "BurstArena.h"
+#include <cstring>
+#include <iostream>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+	const VmbUint32_t   BURST_MAGIC = 0x54535242;   // "BRST"
+	const VmbUint64_t   SLOT_ALIGN = 64;            // slots start on cache lines
+	const VmbUint64_t   SMALL_PAGE = 4096;
+	const VmbUint64_t   HUGE_PAGE = 2ull << 20;     // MAP_HUGETLB default size
+
+#ifdef _WIN32
+	//
+	// large pages need the lock memory privilege in the process token,
+	// it has to be granted to the account first (Local Security Policy)
+	//
+	bool enableLockMemoryPrivilege()
+	{
+		HANDLE hToken = NULL;
+		if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken))
+		{
+			return false;
+		}
+		TOKEN_PRIVILEGES privileges;
+		privileges.PrivilegeCount = 1;
+		privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+		bool granted = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid)
+			&& AdjustTokenPrivileges(hToken, FALSE, &privileges, 0, NULL, NULL)
+			&& ERROR_SUCCESS == GetLastError();
+		CloseHandle(hToken);
+		return granted;
+	}
+#endif
+}
+
+BurstArena::BurstArena(int Cameras, VmbUint32_t FrameBytes, VmbUint32_t FramesPerCamera)
+	: m_pMemory(NULL)
+	, m_Bytes(0)
+	, m_LargePages(false)
+	, m_Cameras(Cameras > 0 ? Cameras : 0)
+	, m_FrameBytes(FrameBytes)
+	, m_FramesPerCamera(FramesPerCamera)
+	, m_SlotStride(((sizeof(frame_header) + FrameBytes + SLOT_ALIGN - 1) / SLOT_ALIGN) * SLOT_ALIGN)
+	, m_Full(false)
+	, m_Overruns(0)
+{
+	m_Count.reset(new std::atomic<VmbUint32_t>[m_Cameras > 0 ? m_Cameras : 1]);
+	clear();
+	const VmbUint64_t size = m_SlotStride * m_FramesPerCamera * m_Cameras;
+	if (0 == size)
+	{
+		return;
+	}
+#ifdef _WIN32
+	const SIZE_T largePage = GetLargePageMinimum();
+	if (0 != largePage && enableLockMemoryPrivilege())
+	{
+		m_Bytes = ((size + largePage - 1) / largePage) * largePage;
+		m_pMemory = static_cast<VmbUchar_t*>(VirtualAlloc(NULL, static_cast<SIZE_T>(m_Bytes), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+		m_LargePages = NULL != m_pMemory;
+	}
+	if (NULL == m_pMemory)
+	{
+		m_Bytes = ((size + SMALL_PAGE - 1) / SMALL_PAGE) * SMALL_PAGE;
+		m_pMemory = static_cast<VmbUchar_t*>(VirtualAlloc(NULL, static_cast<SIZE_T>(m_Bytes), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+	}
+#else
+	m_Bytes = ((size + HUGE_PAGE - 1) / HUGE_PAGE) * HUGE_PAGE;
+#ifdef MAP_HUGETLB
+	void *pMemory = mmap(NULL, m_Bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	m_LargePages = MAP_FAILED != pMemory;
+#else
+	void *pMemory = MAP_FAILED;
+#endif
+	if (MAP_FAILED == pMemory)
+	{
+		// no reserved huge pages, ask for transparent ones
+		pMemory = mmap(NULL, m_Bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+		if (MAP_FAILED != pMemory)
+		{
+			madvise(pMemory, m_Bytes, MADV_HUGEPAGE);
+		}
+#endif
+	}
+	m_pMemory = MAP_FAILED == pMemory ? NULL : static_cast<VmbUchar_t*>(pMemory);
+#endif
+	if (NULL == m_pMemory)
+	{
+		std::cout << "burst arena of " << m_Bytes << " bytes could not be allocated" << std::endl;
+		m_Bytes = 0;
+		return;
+	}
+	// fault every page in now, not during the burst
+	for (VmbUint64_t offset = 0; offset < m_Bytes; offset += SMALL_PAGE)
+	{
+		m_pMemory[offset] = 0;
+	}
+}
+
+BurstArena::~BurstArena()
+{
+	if (NULL != m_pMemory)
+	{
+#ifdef _WIN32
+		VirtualFree(m_pMemory, 0, MEM_RELEASE);
+#else
+		munmap(m_pMemory, m_Bytes);
+#endif
+	}
+}
+
+VmbUchar_t* BurstArena::slot(int cam, VmbUint32_t index) const
+{
+	return m_pMemory + (static_cast<VmbUint64_t>(cam) * m_FramesPerCamera + index) * m_SlotStride;
+}
+
+VmbUint32_t BurstArena::frames(int cam) const
+{
+	return cam >= 0 && cam < m_Cameras ? m_Count[cam].load(std::memory_order_acquire) : 0;
+}
+
+bool BurstArena::push(int cam, const VmbUchar_t *pData, VmbUint32_t DataSize, VmbUint32_t Width, VmbUint32_t Height,
+	VmbPixelFormat_t PixelFormat, VmbUint64_t FrameID, VmbUint64_t Timestamp, VmbUint64_t HostTime)
+{
+	if (NULL == m_pMemory || cam < 0 || cam >= m_Cameras || DataSize > m_FrameBytes)
+	{
+		return false;
+	}
+	// claim a slot, a full region stays full
+	VmbUint32_t index = m_Count[cam].load(std::memory_order_relaxed);
+	do
+	{
+		if (index >= m_FramesPerCamera)
+		{
+			m_Full.store(true, std::memory_order_release);
+			m_Overruns.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+	} while (!m_Count[cam].compare_exchange_weak(index, index + 1, std::memory_order_acq_rel));
+
+	VmbUchar_t *pSlot = slot(cam, index);
+	frame_header *pHeader = reinterpret_cast<frame_header*>(pSlot);
+	pHeader->Magic = BURST_MAGIC;
+	pHeader->DataSize = DataSize;
+	pHeader->Width = Width;
+	pHeader->Height = Height;
+	pHeader->PixelFormat = PixelFormat;
+	pHeader->Reserved = 0;
+	pHeader->FrameID = FrameID;
+	pHeader->Timestamp = Timestamp;
+	pHeader->HostTime = HostTime;
+	memcpy(pSlot + sizeof(frame_header), pData, DataSize);
+	if (index + 1 == m_FramesPerCamera)
+	{
+		m_Full.store(true, std::memory_order_release);
+	}
+	return true;
+}
+
+const BurstArena::frame_header* BurstArena::frame(int cam, VmbUint32_t index, const VmbUchar_t *&pData) const
+{
+	if (index >= frames(cam))
+	{
+		return NULL;
+	}
+	const VmbUchar_t *pSlot = slot(cam, index);
+	pData = pSlot + sizeof(frame_header);
+	return reinterpret_cast<const frame_header*>(pSlot);
+}
+
+void BurstArena::clear()
+{
+	for (int i = 0; i < m_Cameras; ++i)
+	{
+		m_Count[i].store(0);
+	}
+	m_Full.store(false);
+	m_Overruns.store(0);
+}
+
+BurstPool::BurstPool()
+	: m_Total(0)
+	, m_Cameras(0)
+	, m_FrameBytes(0)
+	, m_FramesPerCamera(0)
+{
+}
+
+bool BurstPool::reserve(int Count, int Cameras, VmbUint32_t FrameBytes, VmbUint32_t FramesPerCamera)
+{
+	QMutexLocker local_lock(&m_Lock);
+	if (Cameras != m_Cameras || FrameBytes != m_FrameBytes || FramesPerCamera != m_FramesPerCamera)
+	{
+		if (m_Free.size() != m_Total)
+		{
+			return false;
+		}
+		m_Free.clear();
+		m_Total = 0;
+		m_Cameras = Cameras;
+		m_FrameBytes = FrameBytes;
+		m_FramesPerCamera = FramesPerCamera;
+	}
+	while (m_Total < Count)
+	{
+		BurstArenaPtr pArena(new BurstArena(Cameras, FrameBytes, FramesPerCamera));
+		if (!pArena->isOpen())
+		{
+			break;
+		}
+		std::cout << "burst arena " << m_Total << ": " << (pArena->bytes() >> 20) << " MB"
+			<< (pArena->largePages() ? " on large pages" : "") << std::endl;
+		m_Free.push_back(pArena);
+		++m_Total;
+	}
+	return 0 != m_Total;
+}
+
+BurstArenaPtr BurstPool::acquire()
+{
+	QMutexLocker local_lock(&m_Lock);
+	if (m_Free.empty())
+	{
+		return BurstArenaPtr();
+	}
+	BurstArenaPtr pArena = m_Free.front();
+	m_Free.pop_front();
+	pArena->clear();
+	return pArena;
+}
+
+void BurstPool::release(const BurstArenaPtr &pArena)
+{
+	QMutexLocker local_lock(&m_Lock);
+	if (!pArena.isNull() && pArena->cameras() == m_Cameras && pArena->frameBytes() == m_FrameBytes && pArena->capacity() == m_FramesPerCamera)
+	{
+		m_Free.push_back(pArena);
+	}
+}
+
+int BurstPool::available()
+{
+	QMutexLocker local_lock(&m_Lock);
+	return m_Free.size();
+}
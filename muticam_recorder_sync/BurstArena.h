@@ -0,0 +1,138 @@
+#ifndef BURST_ARENA_H_
+#define BURST_ARENA_H_
+//qt include
+#include "QtCore/QSharedPointer"
+#include "QtCore/QList"
+#include "QtCore/QMutex"
+// std include
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "SpillRing.h"
+
+//
+// RAM arena for one burst of raw frames of all cameras.
+//
+// A burst runs the cameras far faster than the encoders can follow, so the
+// frames are only copied into memory that was allocated, and touched, before
+// the burst started: one region per camera with a fixed number of slots of
+// the same stride. The memory comes from large pages where the system grants
+// them (MEM_LARGE_PAGES on Windows, MAP_HUGETLB elsewhere) which keeps the
+// TLB misses of the copies down, and from normal pages otherwise.
+//
+// push() may be called concurrently for different cameras. Reading back with
+// frame() is only allowed once no push() runs anymore, after the
+// acquisition stopped.
+//
+class BurstArena
+{
+public:
+	typedef SpillRing::slot_header frame_header;    // same per frame header as the spill ring
+
+	//
+	// Method: BurstArena()
+	//
+	// Purpose: allocate and pre-fault the arena, check isOpen() afterwards.
+	//
+	BurstArena(int Cameras, VmbUint32_t FrameBytes, VmbUint32_t FramesPerCamera);
+	~BurstArena();
+
+	bool                isOpen()        const { return NULL != m_pMemory; }
+	bool                largePages()    const { return m_LargePages; }
+	VmbUint64_t         bytes()         const { return m_Bytes; }
+	int                 cameras()       const { return m_Cameras; }
+	VmbUint32_t         frameBytes()    const { return m_FrameBytes; }
+	VmbUint32_t         capacity()      const { return m_FramesPerCamera; }
+	VmbUint32_t         frames(int cam) const;
+	VmbUint64_t         overruns()      const { return m_Overruns.load(std::memory_order_relaxed); }
+	//
+	// Method: full()
+	//
+	// Purpose: true once any camera used up its region, the burst is over then.
+	//
+	bool                full()          const { return m_Full.load(std::memory_order_acquire); }
+	//
+	// Method: push()
+	//
+	// Purpose: copy one raw frame into the next slot of the camera.
+	//
+	// Returns: false if the region of the camera is full or the frame does not fit a slot
+	//
+	bool push(int cam, const VmbUchar_t *pData, VmbUint32_t DataSize, VmbUint32_t Width, VmbUint32_t Height,
+		VmbPixelFormat_t PixelFormat, VmbUint64_t FrameID, VmbUint64_t Timestamp, VmbUint64_t HostTime);
+	//
+	// Method: frame()
+	//
+	// Purpose: header and data of a stored frame, in arrival order per camera.
+	//
+	// Returns: NULL if there is no such frame
+	//
+	const frame_header* frame(int cam, VmbUint32_t index, const VmbUchar_t *&pData) const;
+	//
+	// Method: clear()
+	//
+	// Purpose: forget all frames, the memory stays allocated for the next burst.
+	//
+	void clear();
+
+private:
+	BurstArena(const BurstArena&);
+	BurstArena& operator=(const BurstArena&);
+
+	VmbUchar_t* slot(int cam, VmbUint32_t index) const;
+
+	VmbUchar_t*                 m_pMemory;
+	VmbUint64_t                 m_Bytes;            // allocated size, rounded to the page size
+	bool                        m_LargePages;
+	int                         m_Cameras;
+	VmbUint32_t                 m_FrameBytes;
+	VmbUint32_t                 m_FramesPerCamera;
+	VmbUint64_t                 m_SlotStride;
+	std::unique_ptr<std::atomic<VmbUint32_t>[]> m_Count;   // frames stored per camera
+	std::atomic<bool>           m_Full;
+	std::atomic<VmbUint64_t>    m_Overruns;         // frames that arrived after their region was full
+};
+typedef QSharedPointer<BurstArena> BurstArenaPtr;
+
+//
+// Arenas allocated once and reused, so arming a burst never allocates.
+// While one arena drains to disk the next burst fills another one.
+//
+class BurstPool
+{
+public:
+	BurstPool();
+	//
+	// Method: reserve()
+	//
+	// Purpose: make sure Count arenas of this layout exist. Arenas of another
+	//          layout are freed first, which needs all of them to be back.
+	//
+	// Returns: false if the layout changed while arenas are in use, or nothing could be allocated
+	//
+	bool reserve(int Count, int Cameras, VmbUint32_t FrameBytes, VmbUint32_t FramesPerCamera);
+	//
+	// Method: acquire()
+	//
+	// Purpose: take a cleared arena out of the pool, null if all are in use.
+	//
+	BurstArenaPtr acquire();
+	//
+	// Method: release()
+	//
+	// Purpose: give an arena back once its frames are written.
+	//
+	void release(const BurstArenaPtr &pArena);
+	int available();
+
+private:
+	QMutex                  m_Lock;
+	QList<BurstArenaPtr>    m_Free;
+	int                     m_Total;
+	int                     m_Cameras;
+	VmbUint32_t             m_FrameBytes;
+	VmbUint32_t             m_FramesPerCamera;
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include "BurstDrainer.h"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+	const int   DRAIN_QUEUE_DEPTH = 16;         // frames queued per recorder before feeding pauses
+	const int   DRAIN_POLL_MS = 2;
+}
+
+BurstDrainer::BurstDrainer(const BurstArenaPtr &pArena, const std::string &baseName, VmbFloat_t fps, VmbUint32_t Width, VmbUint32_t Height,
+	const RecorderSettings &settings, const std::vector<ColorSettings> &colors, const std::vector<RectifyMapPtr> &rectify)
+	: m_pArena(pArena)
+	, m_BaseName(baseName)
+	, m_FPS(fps)
+	, m_Width(Width)
+	, m_Height(Height)
+	, m_Settings(settings)
+	, m_Colors(colors)
+	, m_Rectify(rectify)
+	, m_Written(0)
+	, m_StopThread(false)
+{
+	// the sidecars and the drop detector belong to the live recording, which may restart while this runs
+	m_Settings.Sidecar = false;
+	m_Settings.DropDetector = &m_Drops;
+	m_Drops.reset(m_pArena->cameras(), 1);
+}
+
+BurstDrainer::~BurstDrainer()
+{
+}
+
+void BurstDrainer::run()
+{
+	typedef QSharedPointer<OpenCVRecorder> OpenCVRecorderPtr;
+	std::vector<OpenCVRecorderPtr> recorders(m_pArena->cameras());
+	VmbUint32_t frames = 0;
+	for (int cam = 0; cam < m_pArena->cameras(); ++cam)
+	{
+		frames = std::max(frames, m_pArena->frames(cam));
+		std::stringstream vid_name;
+		vid_name << m_BaseName << "_burst_cam" << std::setw(2) << std::setfill('0') << cam << ".avi";
+		RecorderSettings settings = m_Settings;
+		if (cam < static_cast<int>(m_Colors.size()))
+		{
+			settings.Color = m_Colors[cam];
+		}
+		if (cam < static_cast<int>(m_Rectify.size()))
+		{
+			settings.Rectify = m_Rectify[cam];
+		}
+		try
+		{
+			recorders[cam] = OpenCVRecorderPtr(new OpenCVRecorder(cam, vid_name.str().c_str(), m_FPS, m_Width, m_Height, settings));
+			recorders[cam]->start();
+		}
+		catch (const BaseException &bex)
+		{
+			std::cout << "burst cam " << cam << ": " << bex.Message().toStdString() << std::endl;
+		}
+	}
+	// trigger by trigger, so all encoders run side by side
+	for (VmbUint32_t index = 0; index < frames && !m_StopThread; ++index)
+	{
+		for (int cam = 0; cam < m_pArena->cameras(); ++cam)
+		{
+			const VmbUchar_t *pData = NULL;
+			const BurstArena::frame_header *pHeader = m_pArena->frame(cam, index, pData);
+			if (recorders[cam].isNull() || NULL == pHeader)
+			{
+				continue;
+			}
+			while (!m_StopThread && recorders[cam]->m_framequeue_size() >= DRAIN_QUEUE_DEPTH)
+			{
+				msleep(DRAIN_POLL_MS);
+			}
+			if (recorders[cam]->enqueueRaw(pData, pHeader->DataSize, pHeader->Width, pHeader->Height, static_cast<VmbPixelFormatType>(pHeader->PixelFormat),
+				pHeader->FrameID, pHeader->Timestamp, pHeader->HostTime))
+			{
+				++m_Written;
+			}
+		}
+	}
+	for (int cam = 0; cam < m_pArena->cameras(); ++cam)
+	{
+		if (recorders[cam].isNull())
+		{
+			continue;
+		}
+		// let the queue run empty, stopping drops what is still queued
+		while (!m_StopThread && 0 != recorders[cam]->m_framequeue_size())
+		{
+			msleep(DRAIN_POLL_MS);
+		}
+		recorders[cam]->stopThread();
+		recorders[cam]->wait();
+		recorders[cam].clear();
+	}
+	if (!m_Settings.Session.isNull())
+	{
+		m_Settings.Session->close();
+	}
+}
+
+VmbUint64_t BurstDrainer::dropped() const
+{
+	VmbUint64_t total = 0;
+	for (int cam = 0; cam < m_Drops.cameras(); ++cam)
+	{
+		total += m_Drops.lostTotal(cam);
+	}
+	// the burst session was created without a detector, it counts its late frames itself
+	if (!m_Settings.Session.isNull())
+	{
+		total += m_Settings.Session->lateFrames();
+	}
+	return total;
+}
+
+void BurstDrainer::stopThread()
+{
+	m_StopThread = true;
+}
@@ -0,0 +1,63 @@
+#ifndef BURST_DRAINER_H_
+#define BURST_DRAINER_H_
+//qt include
+#include "QtCore/QThread"
+// std include
+#include <string>
+#include <vector>
+
+#include "BurstArena.h"
+#include "OpenCVVideoRecorder.h"
+#include "drop_frame_detection.h"
+
+//
+// Encodes the frames of a finished burst in the background.
+//
+// Every camera gets a normal recorder, so a burst ends up in the same
+// containers, index files and manifest as a continuous recording. The
+// arena is fed into the recorders in trigger order and only as fast as
+// they encode, which keeps their queues short and spares the spill ring.
+// While this runs the arena stays out of the pool, the next burst fills
+// another one. The drainer outlives the acquisition, so its recorders count
+// their losses in a detector of their own, never in the live one.
+//
+class BurstDrainer: public QThread
+{
+	Q_OBJECT;
+
+	BurstArenaPtr           m_pArena;
+	std::string             m_BaseName;         // date prefix of the burst files
+	VmbFloat_t              m_FPS;              // capture rate of the burst, the rate of the videos
+	VmbUint32_t             m_Width;
+	VmbUint32_t             m_Height;
+	RecorderSettings        m_Settings;
+	std::vector<ColorSettings> m_Colors;        // per camera, the color of m_Settings for cameras without one
+	std::vector<RectifyMapPtr> m_Rectify;       // per camera, the maps of m_Settings for cameras without one
+	VmbUint64_t             m_Written;
+	DropFrameDetector       m_Drops;            // recorder drops and write errors of this burst
+	bool                    m_StopThread;
+
+	void run();
+public:
+	BurstDrainer(const BurstArenaPtr &pArena, const std::string &baseName, VmbFloat_t fps, VmbUint32_t Width, VmbUint32_t Height,
+		const RecorderSettings &settings, const std::vector<ColorSettings> &colors = std::vector<ColorSettings>(),
+		const std::vector<RectifyMapPtr> &rectify = std::vector<RectifyMapPtr>());
+	virtual ~BurstDrainer();
+	//
+	// Method: stopThread()
+	//
+	// Purpose: stop feeding frames, the recorders still close their files.
+	//
+	void stopThread();
+	const BurstArenaPtr& arena() const { return m_pArena; }
+	const std::string& baseName() const { return m_BaseName; }
+	VmbUint64_t written() const { return m_Written; }
+	//
+	// Method: dropped()
+	//
+	// Purpose: frames of the arena that did not reach the files, valid once the thread finished.
+	//
+	VmbUint64_t dropped() const;
+};
+
+#endif
@@ -0,0 +1,296 @@
+#include "ChunkedContainer.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#define mcr_fseek   _fseeki64
+#define mcr_ftell   _ftelli64
+#else
+#define mcr_fseek   fseeko
+#define mcr_ftell   ftello
+#endif
+
+namespace mcr
+{
+
+namespace
+{
+	struct crc_table
+	{
+		uint32_t    Values[256];
+		crc_table()
+		{
+			for (uint32_t i = 0; i < 256; ++i)
+			{
+				uint32_t c = i;
+				for (int k = 0; k < 8; ++k)
+				{
+					c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+				}
+				Values[i] = c;
+			}
+		}
+	};
+
+	bool sameOffset(const index_entry &a, const index_entry &b) { return a.Offset == b.Offset; }
+	bool beforeOffset(const index_entry &a, const index_entry &b) { return a.Offset < b.Offset; }
+}
+
+uint32_t crc32(const void *pData, size_t size)
+{
+	static const crc_table table;
+	const uint8_t *p = static_cast<const uint8_t*>(pData);
+	uint32_t c = 0xffffffffu;
+	for (size_t i = 0; i < size; ++i)
+	{
+		c = table.Values[(c ^ p[i]) & 0xff] ^ (c >> 8);
+	}
+	return c ^ 0xffffffffu;
+}
+
+Writer::Writer(const std::string &fileName, uint32_t Width, uint32_t Height, double FPS, uint32_t IndexInterval, uint32_t Tracks)
+	: m_File(fileName)
+	, m_IndexInterval(0 == IndexInterval ? 1 : IndexInterval)
+	, m_LastIndex(0)
+	, m_Frames(0)
+	, m_LastFrame(0)
+	, m_Released(false)
+{
+	m_EncodeParams.push_back(cv::IMWRITE_JPEG_QUALITY);
+	m_EncodeParams.push_back(90);
+	m_Pending.reserve(m_IndexInterval);
+	file_header header;
+	memset(&header, 0, sizeof(header));
+	header.Magic = FILE_MAGIC;
+	header.Version = VERSION;
+	header.Width = Width;
+	header.Height = Height;
+	header.FPS = FPS;
+	header.Tracks = Tracks;
+	m_File.append(&header, sizeof(header));
+}
+
+Writer::~Writer()
+{
+	release();
+}
+
+bool Writer::write(const cv::Mat &image)
+{
+	if (!cv::imencode(".jpg", image, m_Encoded, m_EncodeParams))
+	{
+		return false;
+	}
+	writeEncoded(0, m_Frames, 0, &m_Encoded[0], static_cast<uint32_t>(m_Encoded.size()));
+	return true;
+}
+
+uint64_t Writer::writeEncoded(uint16_t Track, uint64_t Sequence, uint64_t Aux, const void *pData, uint32_t Size)
+{
+	const uint64_t offset = writeChunk(CHUNK_FRAME, Track, Sequence, Aux, pData, Size);
+	++m_Frames;
+	m_LastFrame = offset;
+	return offset;
+}
+
+uint64_t Writer::writeChunk(uint16_t Type, uint16_t Track, uint64_t Sequence, uint64_t Aux, const void *pData, uint32_t Size)
+{
+	chunk_header header;
+	header.Magic = CHUNK_MAGIC;
+	header.Type = Type;
+	header.Track = Track;
+	header.Sequence = Sequence;
+	header.Size = Size;
+	header.Crc = crc32(pData, Size);
+	header.Aux = Aux;
+	const uint64_t offset = m_File.append(&header, sizeof(header));
+	m_File.append(pData, Size);
+	index_entry entry;
+	entry.Sequence = Sequence;
+	entry.Offset = offset;
+	entry.Track = Track;
+	entry.Reserved = 0;
+	m_Pending.push_back(entry);
+	if (m_Pending.size() >= m_IndexInterval)
+	{
+		writeIndex();
+	}
+	return offset;
+}
+
+//
+// Method: writeIndex()
+//
+// Purpose: append an index chunk for the pending frames and push the block
+//          to the I/O service, so a crash after this point keeps them.
+//
+void Writer::writeIndex()
+{
+	if (m_Pending.empty())
+	{
+		return;
+	}
+	chunk_header header;
+	header.Magic = CHUNK_MAGIC;
+	header.Type = CHUNK_INDEX;
+	header.Track = 0;
+	header.Sequence = m_Frames;
+	header.Size = static_cast<uint32_t>(m_Pending.size() * sizeof(index_entry));
+	header.Crc = crc32(&m_Pending[0], header.Size);
+	header.Aux = m_LastIndex;
+	m_LastIndex = m_File.append(&header, sizeof(header));
+	m_File.append(&m_Pending[0], header.Size);
+	m_File.flush();
+	m_Pending.clear();
+}
+
+void Writer::release()
+{
+	if (m_Released || !m_File.isOpen())
+	{
+		return;
+	}
+	m_Released = true;
+	writeIndex();
+	trailer end;
+	end.Magic = TRAILER_MAGIC;
+	end.Reserved = 0;
+	end.LastIndex = m_LastIndex;
+	end.Frames = m_Frames;
+	m_File.append(&end, sizeof(end));
+	m_File.close();
+}
+
+Reader::Reader()
+	: m_pFile(NULL)
+	, m_FileSize(0)
+{
+	memset(&m_Header, 0, sizeof(m_Header));
+}
+
+Reader::~Reader()
+{
+	close();
+}
+
+bool Reader::open(const std::string &fileName)
+{
+	close();
+	m_pFile = fopen(fileName.c_str(), "rb");
+	if (NULL == m_pFile)
+	{
+		return false;
+	}
+	mcr_fseek(m_pFile, 0, SEEK_END);
+	m_FileSize = static_cast<uint64_t>(mcr_ftell(m_pFile));
+	mcr_fseek(m_pFile, 0, SEEK_SET);
+	if (1 != fread(&m_Header, sizeof(m_Header), 1, m_pFile)
+		|| FILE_MAGIC != m_Header.Magic
+		|| VERSION != m_Header.Version)
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void Reader::close()
+{
+	if (NULL != m_pFile)
+	{
+		fclose(m_pFile);
+		m_pFile = NULL;
+	}
+}
+
+bool Reader::readChunk(uint64_t Offset, chunk_header &Header, std::vector<uchar> &Payload)
+{
+	if (NULL == m_pFile
+		|| Offset + sizeof(Header) > m_FileSize
+		|| 0 != mcr_fseek(m_pFile, static_cast<long long>(Offset), SEEK_SET)
+		|| 1 != fread(&Header, sizeof(Header), 1, m_pFile)
+		|| CHUNK_MAGIC != Header.Magic
+		|| Offset + sizeof(Header) + Header.Size > m_FileSize)
+	{
+		return false;
+	}
+	Payload.resize(Header.Size);
+	if (0 != Header.Size && 1 != fread(&Payload[0], Header.Size, 1, m_pFile))
+	{
+		return false;
+	}
+	return Header.Crc == crc32(Payload.empty() ? NULL : &Payload[0], Payload.size());
+}
+
+uint64_t Reader::scan(std::vector<chunk_info> &chunks)
+{
+	chunks.clear();
+	uint64_t offset = sizeof(file_header);
+	std::vector<uchar> payload;
+	chunk_info info;
+	while (readChunk(offset, info.Header, payload))
+	{
+		info.Offset = offset;
+		chunks.push_back(info);
+		offset += sizeof(chunk_header) + info.Header.Size;
+	}
+	return offset;
+}
+
+bool Reader::loadIndex(std::vector<index_entry> &index)
+{
+	index.clear();
+	if (NULL == m_pFile)
+	{
+		return false;
+	}
+	trailer end;
+	std::vector<uchar> payload;
+	chunk_header header;
+	if (m_FileSize >= sizeof(file_header) + sizeof(end)
+		&& 0 == mcr_fseek(m_pFile, static_cast<long long>(m_FileSize - sizeof(end)), SEEK_SET)
+		&& 1 == fread(&end, sizeof(end), 1, m_pFile)
+		&& TRAILER_MAGIC == end.Magic)
+	{
+		// walk the index chain backwards
+		uint64_t next = end.LastIndex;
+		bool ok = true;
+		while (0 != next)
+		{
+			if (!readChunk(next, header, payload) || CHUNK_INDEX != header.Type)
+			{
+				ok = false;
+				break;
+			}
+			const index_entry *pEntries = reinterpret_cast<const index_entry*>(&payload[0]);
+			index.insert(index.end(), pEntries, pEntries + payload.size() / sizeof(index_entry));
+			next = header.Aux;
+		}
+		if (ok)
+		{
+			std::sort(index.begin(), index.end(), beforeOffset);
+			index.erase(std::unique(index.begin(), index.end(), sameOffset), index.end());
+			return true;
+		}
+		index.clear();
+	}
+	// no or damaged trailer, fall back to the slow walk
+	std::vector<chunk_info> chunks;
+	scan(chunks);
+	for (size_t i = 0; i < chunks.size(); ++i)
+	{
+		if (CHUNK_INDEX != chunks[i].Header.Type)
+		{
+			index_entry entry;
+			entry.Sequence = chunks[i].Header.Sequence;
+			entry.Offset = chunks[i].Offset;
+			entry.Track = chunks[i].Header.Track;
+			entry.Reserved = 0;
+			index.push_back(entry);
+		}
+	}
+	return !index.empty();
+}
+
+} // namespace mcr
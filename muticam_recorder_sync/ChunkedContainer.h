@@ -0,0 +1,187 @@
+#ifndef CHUNKED_CONTAINER_H_
+#define CHUNKED_CONTAINER_H_
+// open cv include
+#include "opencv2/opencv.hpp"
+// std include
+#include <cstdint>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "AsyncFileWriter.h"
+
+//
+// MCR, the recorder's own chunked container.
+//
+// file   := file_header chunk* [trailer]
+// chunk  := chunk_header payload
+//
+// Every chunk carries its payload CRC, so a reader can walk the file from
+// the header and stop at the first torn chunk. Every IndexInterval frames
+// an index chunk lists the offsets of the frames written since the previous
+// index and links back to it; a clean close appends a trailer pointing at
+// the last index. A crashed file therefore loses at most the frames that
+// were still in the process, and nothing has to be fsync'ed per frame.
+//
+namespace mcr
+{
+	enum
+	{
+		FILE_MAGIC      = 0x3152434d,   // "MCR1"
+		CHUNK_MAGIC     = 0x4352434d,   // "MCRC"
+		TRAILER_MAGIC   = 0x4552434d,   // "MCRE"
+		VERSION         = 1,
+	};
+
+	enum chunk_type
+	{
+		CHUNK_FRAME     = 1,            // payload is one JPEG image
+		CHUNK_INDEX     = 2,            // payload is index_entry[], Aux is the previous index offset
+		CHUNK_META      = 3,            // payload is track specific metadata, see SessionContainer
+	};
+
+	struct file_header
+	{
+		uint32_t    Magic;
+		uint32_t    Version;
+		uint32_t    Width;
+		uint32_t    Height;
+		double      FPS;
+		uint32_t    Tracks;
+		uint32_t    Reserved[3];
+	};
+
+	struct chunk_header
+	{
+		uint32_t    Magic;
+		uint16_t    Type;
+		uint16_t    Track;
+		uint64_t    Sequence;           // frame number within the track
+		uint32_t    Size;               // payload bytes
+		uint32_t    Crc;                // crc32 of the payload
+		uint64_t    Aux;                // type specific
+	};
+
+	struct index_entry
+	{
+		uint64_t    Sequence;
+		uint64_t    Offset;             // offset of the chunk header
+		uint32_t    Track;
+		uint32_t    Reserved;
+	};
+
+	struct trailer
+	{
+		uint32_t    Magic;
+		uint32_t    Reserved;
+		uint64_t    LastIndex;          // offset of the last index chunk
+		uint64_t    Frames;
+	};
+
+	uint32_t crc32(const void *pData, size_t size);
+
+	//
+	// Writes an MCR file through the asynchronous I/O service
+	//
+	class Writer
+	{
+	public:
+		Writer(const std::string &fileName, uint32_t Width, uint32_t Height, double FPS, uint32_t IndexInterval, uint32_t Tracks = 1);
+		~Writer();
+
+		bool isOpened() const { return m_File.isOpen(); }
+		//
+		// Method: write()
+		//
+		// Purpose: JPEG encode a BGR image and append it as frame chunk of track 0.
+		//
+		bool write(const cv::Mat &image);
+		//
+		// Method: writeEncoded()
+		//
+		// Purpose: append an already encoded frame.
+		//
+		// Returns: offset of the chunk header
+		//
+		uint64_t writeEncoded(uint16_t Track, uint64_t Sequence, uint64_t Aux, const void *pData, uint32_t Size);
+		//
+		// Method: writeChunk()
+		//
+		// Purpose: append an indexed chunk of any type other than CHUNK_INDEX.
+		//
+		// Returns: offset of the chunk header
+		//
+		uint64_t writeChunk(uint16_t Type, uint16_t Track, uint64_t Sequence, uint64_t Aux, const void *pData, uint32_t Size);
+		//
+		// Method: release()
+		//
+		// Purpose: write the last index and the trailer, then close.
+		//
+		void release();
+		uint64_t bytesWritten() const { return m_File.bytesQueued(); }
+		uint64_t frames() const { return m_Frames; }
+		uint64_t lastFrameOffset() const { return m_LastFrame; }
+		// a block of the file could not be written, the file is damaged
+		bool failed() const { return m_File.failed(); }
+
+	private:
+		Writer(const Writer&);
+		Writer& operator=(const Writer&);
+		void writeIndex();
+
+		AsyncFileWriter             m_File;
+		uint32_t                    m_IndexInterval;
+		std::vector<index_entry>    m_Pending;          // frames since the last index
+		uint64_t                    m_LastIndex;
+		uint64_t                    m_Frames;
+		uint64_t                    m_LastFrame;        // chunk offset of the newest frame
+		std::vector<uchar>          m_Encoded;          // reused JPEG buffer
+		std::vector<int>            m_EncodeParams;
+		bool                        m_Released;
+	};
+
+	//
+	// Reads MCR files, including files without trailer
+	//
+	class Reader
+	{
+	public:
+		struct chunk_info
+		{
+			chunk_header    Header;
+			uint64_t        Offset;
+		};
+
+		Reader();
+		~Reader();
+		bool open(const std::string &fileName);
+		void close();
+		const file_header& header() const { return m_Header; }
+		//
+		// Method: scan()
+		//
+		// Purpose: walk all chunks from the start and verify their CRC.
+		//
+		// Returns: end offset of the last complete chunk
+		//
+		uint64_t scan(std::vector<chunk_info> &chunks);
+		//
+		// Method: loadIndex()
+		//
+		// Purpose: collect the frame index, from the trailer when present,
+		//          by scanning otherwise.
+		//
+		bool loadIndex(std::vector<index_entry> &index);
+		bool readChunk(uint64_t Offset, chunk_header &Header, std::vector<uchar> &Payload);
+
+	private:
+		Reader(const Reader&);
+		Reader& operator=(const Reader&);
+
+		FILE*           m_pFile;
+		file_header     m_Header;
+		uint64_t        m_FileSize;
+	};
+}
+
+#endif
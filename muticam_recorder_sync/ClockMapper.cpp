@@ -0,0 +1,197 @@
+#include "ClockMapper.h"
+#include <algorithm>
+#include "AsyncFileWriter.h"
+
+ClockMapper::ClockMapper()
+	: m_Epoch(0)
+	, m_Cameras(0)
+{
+	reset(std::vector<double>());
+}
+
+void ClockMapper::reset(const std::vector<double> &TickFrequency)
+{
+	QMutexLocker local_lock(&m_Lock);
+	m_Epoch = AsyncIoService::nowNs();
+	m_Cameras = static_cast<int>(TickFrequency.size());
+	m_Fit.reset(m_Cameras > 0 ? new camera_fit[m_Cameras] : NULL);
+	for (int i = 0; i < m_Cameras; ++i)
+	{
+		camera_fit &fit = m_Fit[i];
+		fit.HaveBase = false;
+		fit.DeviceBase = 0;
+		fit.HostBase = 0;
+		// GigE cameras without the feature count nanoseconds
+		fit.NominalSlope = TickFrequency[i] > 0 ? 1e9 / TickFrequency[i] : 1.0;
+		fit.BucketCount = 0;
+		fit.NextBucket = 0;
+		fit.BestFrames = 0;
+		fit.Slope = fit.NominalSlope;
+		fit.Intercept = 0;
+		fit.Fitted = false;
+		fit.NewBucket = false;
+		fit.Generation = 0;
+	}
+}
+
+void ClockMapper::observe(int cam, VmbUint64_t DeviceTicks, uint64_t HostNs)
+{
+	if (cam < 0 || cam >= m_Cameras)
+	{
+		return;
+	}
+	camera_fit &fit = m_Fit[cam];
+	// only update() competes for this lock, and only for a copy of the buckets
+	QMutexLocker local_lock(&fit.Lock);
+	if (!fit.HaveBase || DeviceTicks < fit.DeviceBase)
+	{
+		// first frame, or the camera clock was reset
+		fit.HaveBase = true;
+		fit.DeviceBase = DeviceTicks;
+		fit.HostBase = HostNs;
+		fit.BucketCount = 0;
+		fit.NextBucket = 0;
+		fit.BestFrames = 0;
+		fit.Slope = fit.NominalSlope;
+		fit.Intercept = 0;
+		fit.Fitted = false;
+		fit.NewBucket = false;
+		++fit.Generation;
+	}
+	sample s;
+	s.X = static_cast<double>(DeviceTicks - fit.DeviceBase);
+	s.Y = static_cast<double>(static_cast<int64_t>(HostNs - fit.HostBase));
+	// within one bucket the slope error is negligible, the current fit ranks the latency
+	if (0 == fit.BestFrames || s.Y - fit.Slope * s.X < fit.Best.Y - fit.Slope * fit.Best.X)
+	{
+		fit.Best = s;
+	}
+	if (!fit.Fitted)
+	{
+		// until the first fit the line runs through the least latency seen so far
+		fit.Intercept = std::min(fit.Intercept, s.Y - fit.Slope * s.X);
+	}
+	if (++fit.BestFrames < BUCKET_FRAMES)
+	{
+		return;
+	}
+	fit.Buckets[fit.NextBucket] = fit.Best;
+	fit.NextBucket = (fit.NextBucket + 1) % BUCKETS;
+	fit.BucketCount = std::min(fit.BucketCount + 1, static_cast<int>(BUCKETS));
+	fit.BestFrames = 0;
+	fit.NewBucket = true;
+}
+
+void ClockMapper::update()
+{
+	QMutexLocker local_lock(&m_Lock);
+	for (int i = 0; i < m_Cameras; ++i)
+	{
+		camera_fit &fit = m_Fit[i];
+		int bucketCount = 0;
+		uint32_t generation = 0;
+		{
+			QMutexLocker fit_lock(&fit.Lock);
+			if (!fit.NewBucket || fit.BucketCount < MIN_FIT_BUCKETS)
+			{
+				continue;
+			}
+			fit.NewBucket = false;
+			bucketCount = fit.BucketCount;
+			generation = fit.Generation;
+			std::copy(fit.Buckets, fit.Buckets + bucketCount, m_Buckets);
+		}
+		double slope = 0;
+		double intercept = 0;
+		if (!refit(m_Buckets, bucketCount, slope, intercept))
+		{
+			continue;
+		}
+		QMutexLocker fit_lock(&fit.Lock);
+		if (generation == fit.Generation)
+		{
+			fit.Slope = slope;
+			fit.Intercept = intercept;
+			fit.Fitted = true;
+		}
+	}
+}
+
+//
+// Method: refit()
+//
+// Purpose: Theil-Sen line through the bucket minima, caller holds m_Lock.
+//
+// Returns: false if the buckets do not define a slope
+//
+bool ClockMapper::refit(const sample *pBuckets, int BucketCount, double &Slope, double &Intercept)
+{
+	int slopes = 0;
+	for (int a = 0; a < BucketCount; ++a)
+	{
+		for (int b = a + 1; b < BucketCount; ++b)
+		{
+			const double dx = pBuckets[b].X - pBuckets[a].X;
+			if (0 != dx)
+			{
+				m_Scratch[slopes++] = (pBuckets[b].Y - pBuckets[a].Y) / dx;
+			}
+		}
+	}
+	if (0 == slopes)
+	{
+		return false;
+	}
+	std::nth_element(m_Scratch, m_Scratch + slopes / 2, m_Scratch + slopes);
+	Slope = m_Scratch[slopes / 2];
+	for (int i = 0; i < BucketCount; ++i)
+	{
+		m_Scratch[i] = pBuckets[i].Y - Slope * pBuckets[i].X;
+	}
+	std::nth_element(m_Scratch, m_Scratch + BucketCount / 2, m_Scratch + BucketCount);
+	Intercept = m_Scratch[BucketCount / 2];
+	return true;
+}
+
+bool ClockMapper::toCommonNs(int cam, VmbUint64_t DeviceTicks, int64_t &CommonNs) const
+{
+	if (cam < 0 || cam >= m_Cameras)
+	{
+		return false;
+	}
+	camera_fit &fit = m_Fit[cam];
+	QMutexLocker local_lock(&fit.Lock);
+	if (!fit.HaveBase)
+	{
+		return false;
+	}
+	// signed, a time stamp from before the first frame maps before it
+	const double x = DeviceTicks >= fit.DeviceBase
+		? static_cast<double>(DeviceTicks - fit.DeviceBase)
+		: -static_cast<double>(fit.DeviceBase - DeviceTicks);
+	CommonNs = static_cast<int64_t>(fit.HostBase - m_Epoch) + static_cast<int64_t>(fit.Intercept + fit.Slope * x);
+	return true;
+}
+
+double ClockMapper::driftPpm(int cam) const
+{
+	if (cam < 0 || cam >= m_Cameras)
+	{
+		return 0;
+	}
+	camera_fit &fit = m_Fit[cam];
+	QMutexLocker local_lock(&fit.Lock);
+	// a fast device clock needs fewer host ns per tick
+	return (fit.NominalSlope / fit.Slope - 1.0) * 1e6;
+}
+
+bool ClockMapper::fitted(int cam) const
+{
+	if (cam < 0 || cam >= m_Cameras)
+	{
+		return false;
+	}
+	camera_fit &fit = m_Fit[cam];
+	QMutexLocker local_lock(&fit.Lock);
+	return fit.Fitted;
+}
@@ -0,0 +1,119 @@
+#ifndef CLOCK_MAPPER_H_
+#define CLOCK_MAPPER_H_
+//qt include
+#include "QtCore/QMutex"
+// std include
+#include <cstdint>
+#include <memory>
+#include <vector>
+// allied vision include
+#include <VimbaCPP/Include/VimbaCPP.h>
+
+//
+// Maps the device clock of every camera onto one host timeline.
+//
+// Each frame gives a pair (device time stamp, host steady clock at arrival).
+// The host side carries a positive, jittery delivery latency, so the fit
+// follows the lower envelope: frames are collected in buckets, only the
+// sample with the least latency of each bucket is kept, and a Theil-Sen
+// line (median of the pairwise slopes, median intercept) is fitted through
+// the last BUCKETS of them once new buckets completed. Outliers can only
+// raise a bucket minimum, and a median ignores the few that do.
+//
+// The per frame work is O(1) and only takes the lock of its own camera. A
+// refit is O(BUCKETS^2) on fixed arrays and runs in update(), off the frame
+// observers, for every camera that completed a bucket since the last one.
+// Nothing allocates after reset().
+//
+// The common timeline is nanoseconds since reset() on the host steady
+// clock (AsyncIoService::nowNs()). It includes the minimum delivery latency
+// of the camera, which is the same for cameras with equal settings.
+//
+class ClockMapper
+{
+public:
+	enum { BUCKETS = 32, BUCKET_FRAMES = 32, MIN_FIT_BUCKETS = 4 };
+
+	ClockMapper();
+	//
+	// Method: reset()
+	//
+	// Purpose: start a new timeline. TickFrequency is the cached device
+	//          clock rate of every camera in Hz, it seeds the drift.
+	//
+	void reset(const std::vector<double> &TickFrequency);
+	//
+	// Method: observe()
+	//
+	// Purpose: add the time stamp pair of one frame, from the frame observer.
+	//
+	void observe(int cam, VmbUint64_t DeviceTicks, uint64_t HostNs);
+	//
+	// Method: update()
+	//
+	// Purpose: refit the cameras with new buckets, call periodically from
+	//          one thread, e.g. the metrics timer, never from an observer.
+	//
+	void update();
+	//
+	// Method: toCommonNs()
+	//
+	// Purpose: convert a device time stamp of a camera to the common timeline.
+	//
+	// Returns: false before the camera delivered its first frame
+	//
+	bool toCommonNs(int cam, VmbUint64_t DeviceTicks, int64_t &CommonNs) const;
+	//
+	// Method: driftPpm()
+	//
+	// Purpose: fitted rate of the device clock against the host in parts per million,
+	//          positive if the device clock runs fast.
+	//
+	double driftPpm(int cam) const;
+	//
+	// Method: fitted()
+	//
+	// Purpose: true once the drift of the camera is fitted, not just seeded.
+	//
+	bool fitted(int cam) const;
+	uint64_t epochNs() const { return m_Epoch; }
+
+private:
+	ClockMapper(const ClockMapper&);
+	ClockMapper& operator=(const ClockMapper&);
+
+	struct sample
+	{
+		double      X;              // device ticks since the first frame
+		double      Y;              // host ns since the first frame
+	};
+	struct camera_fit
+	{
+		QMutex      Lock;           // guards all of the fit, held for O(1) work only
+		bool        HaveBase;
+		VmbUint64_t DeviceBase;     // device ticks of the first frame
+		uint64_t    HostBase;       // host ns of the first frame
+		double      NominalSlope;   // ns per tick from the tick frequency
+		sample      Buckets[BUCKETS];
+		int         BucketCount;
+		int         NextBucket;
+		sample      Best;           // least latency sample of the open bucket
+		int         BestFrames;
+		double      Slope;          // ns per tick
+		double      Intercept;      // ns, host offset at device tick DeviceBase
+		bool        Fitted;
+		bool        NewBucket;      // a bucket completed since the last refit
+		uint32_t    Generation;     // counts base changes, a refit of an older base is dropped
+	};
+
+	bool refit(const sample *pBuckets, int BucketCount, double &Slope, double &Intercept);
+
+	QMutex              m_Lock;             // serializes reset() and update(), guards the scratch
+	uint64_t            m_Epoch;
+	int                 m_Cameras;
+	std::unique_ptr<camera_fit[]> m_Fit;    // one per camera, sized by reset()
+	sample              m_Buckets[BUCKETS];                     // copy of the buckets of a refit
+	double              m_Scratch[BUCKETS * (BUCKETS - 1) / 2]; // pairwise slopes of a refit
+};
+
+#endif
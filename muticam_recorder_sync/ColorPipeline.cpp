@@ -0,0 +1,323 @@
+#include "ColorPipeline.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define COLOR_SSE2
+#endif
+
+namespace
+{
+	std::string trim(const std::string &s)
+	{
+		const std::string::size_type first = s.find_first_not_of(" \t\r");
+		if (std::string::npos == first)
+		{
+			return std::string();
+		}
+		return s.substr(first, s.find_last_not_of(" \t\r") - first + 1);
+	}
+
+	bool parseNumbers(const std::string &value, float *pNumbers, int Count)
+	{
+		std::istringstream in(value);
+		for (int i = 0; i < Count; ++i)
+		{
+			if (!(in >> pNumbers[i]))
+			{
+				return false;
+			}
+		}
+		in >> std::ws;
+		return in.eof();
+	}
+
+	// the channel of the RGB settings a pixel channel holds
+	int rgbChannel(ColorPipeline::channel_order Order, int Channel)
+	{
+		return ColorPipeline::ORDER_BGR == Order ? 2 - Channel : Channel;
+	}
+}
+
+ColorSettings::ColorSettings()
+	: Gamma(1)
+{
+	for (int i = 0; i < 9; ++i)
+	{
+		Matrix[i] = 0 == i % 4 ? 1.0f : 0.0f;
+	}
+	Gain[0] = Gain[1] = Gain[2] = 1;
+}
+
+bool ColorSettings::identity() const
+{
+	for (int i = 0; i < 9; ++i)
+	{
+		if (Matrix[i] != (0 == i % 4 ? 1.0f : 0.0f))
+		{
+			return false;
+		}
+	}
+	return 1 == Gain[0] && 1 == Gain[1] && 1 == Gain[2] && 1 == Gamma;
+}
+
+ColorPipeline::ColorPipeline()
+	: m_Identity(true)
+	, m_Diagonal(true)
+	, m_Shift(0)
+{
+}
+
+bool ColorPipeline::compile(const ColorSettings &Settings, channel_order Order)
+{
+	m_Identity = true;
+	if (Settings.identity())
+	{
+		return true;
+	}
+	if (!(Settings.Gamma > 0))
+	{
+		return false;
+	}
+	// gains folded into the matrix, rows and columns in the order of the pixels
+	float folded[9];
+	float largest = 0;
+	m_Diagonal = true;
+	for (int out = 0; out < 3; ++out)
+	{
+		for (int in = 0; in < 3; ++in)
+		{
+			const int rgbOut = rgbChannel(Order, out), rgbIn = rgbChannel(Order, in);
+			const float k = Settings.Matrix[rgbOut * 3 + rgbIn] * Settings.Gain[rgbIn];
+			if (!(std::fabs(k) <= MAX_COEFFICIENT))
+			{
+				return false;
+			}
+			folded[out * 3 + in] = k;
+			largest = std::max(largest, std::fabs(k));
+			m_Diagonal = m_Diagonal && (out == in || 0 == k);
+		}
+	}
+
+	const int linearMax = (1 << LINEAR_BITS) - 1;
+	const double inverseGamma = 1.0 / Settings.Gamma;
+	for (int v = 0; v <= linearMax; ++v)
+	{
+		const double x = static_cast<double>(v) / linearMax;
+		m_OutputLut[v] = static_cast<uint8_t>(255 * (1 == Settings.Gamma ? x : std::pow(x, inverseGamma)) + 0.5);
+	}
+	// 8 bit input to 12 bit linear
+	const double inputScale = static_cast<double>(linearMax) / 255;
+	if (m_Diagonal)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			for (int in = 0; in < 256; ++in)
+			{
+				const long linear = std::lround(in * folded[c * 4] * inputScale);
+				m_ChannelLut[c][in] = m_OutputLut[std::min<long>(std::max<long>(linear, 0), linearMax)];
+			}
+		}
+	}
+	else
+	{
+		// as many fraction bits as the largest coefficient leaves in 16 bit, the rounding term too
+		const double scaled = largest * inputScale;
+		m_Shift = 14;
+		while (m_Shift > 1 && scaled * (1 << m_Shift) > 32767)
+		{
+			--m_Shift;
+		}
+		for (int i = 0; i < 9; ++i)
+		{
+			m_Coefficients[i] = static_cast<int16_t>(std::lround(folded[i] * inputScale * (1 << m_Shift)));
+		}
+	}
+	m_Identity = false;
+	return true;
+}
+
+void ColorPipeline::apply(uint8_t *pPixels, size_t Pixels) const
+{
+	if (m_Identity || NULL == pPixels)
+	{
+		return;
+	}
+	if (m_Diagonal)
+	{
+		applyDiagonal(pPixels, Pixels);
+	}
+	else
+	{
+		applyMatrix(pPixels, Pixels);
+	}
+}
+
+void ColorPipeline::applyDiagonal(uint8_t *pPixels, size_t Pixels) const
+{
+	for (uint8_t *pEnd = pPixels + Pixels * 3; pPixels != pEnd; pPixels += 3)
+	{
+		pPixels[0] = m_ChannelLut[0][pPixels[0]];
+		pPixels[1] = m_ChannelLut[1][pPixels[1]];
+		pPixels[2] = m_ChannelLut[2][pPixels[2]];
+	}
+}
+
+void ColorPipeline::applyMatrix(uint8_t *pPixels, size_t Pixels) const
+{
+	const int linearMax = (1 << LINEAR_BITS) - 1;
+	const int round = 1 << (m_Shift - 1);
+	size_t i = 0;
+#ifdef COLOR_SSE2
+	// _mm_madd_epi16 sums pairs: (c0, c1) times (in0, in1) and (c2, round) times (in2, 1)
+	__m128i pairs01[3], pairs2r[3];
+	for (int out = 0; out < 3; ++out)
+	{
+		const int16_t *k = m_Coefficients + out * 3;
+		pairs01[out] = _mm_set1_epi32(static_cast<int>(static_cast<uint16_t>(k[0]) | (static_cast<uint32_t>(static_cast<uint16_t>(k[1])) << 16)));
+		pairs2r[out] = _mm_set1_epi32(static_cast<int>(static_cast<uint16_t>(k[2]) | (static_cast<uint32_t>(round) << 16)));
+	}
+	const __m128i shift = _mm_cvtsi32_si128(m_Shift);
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i top = _mm_set1_epi16(static_cast<short>(linearMax));
+	for (; i + 8 <= Pixels; i += 8)
+	{
+		uint8_t *p = pPixels + i * 3;
+		// the pixels are packed by three, split them into channel planes
+		const __m128i c0 = _mm_setr_epi16(p[0], p[3], p[6], p[9], p[12], p[15], p[18], p[21]);
+		const __m128i c1 = _mm_setr_epi16(p[1], p[4], p[7], p[10], p[13], p[16], p[19], p[22]);
+		const __m128i c2 = _mm_setr_epi16(p[2], p[5], p[8], p[11], p[14], p[17], p[20], p[23]);
+		const __m128i in01Lo = _mm_unpacklo_epi16(c0, c1), in01Hi = _mm_unpackhi_epi16(c0, c1);
+		const __m128i in2Lo = _mm_unpacklo_epi16(c2, one), in2Hi = _mm_unpackhi_epi16(c2, one);
+		int16_t linear[3][8];
+		for (int out = 0; out < 3; ++out)
+		{
+			const __m128i lo = _mm_sra_epi32(_mm_add_epi32(_mm_madd_epi16(in01Lo, pairs01[out]), _mm_madd_epi16(in2Lo, pairs2r[out])), shift);
+			const __m128i hi = _mm_sra_epi32(_mm_add_epi32(_mm_madd_epi16(in01Hi, pairs01[out]), _mm_madd_epi16(in2Hi, pairs2r[out])), shift);
+			const __m128i clamped = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(lo, hi), zero), top);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(linear[out]), clamped);
+		}
+		for (int k = 0; k < 8; ++k)
+		{
+			p[k * 3] = m_OutputLut[linear[0][k]];
+			p[k * 3 + 1] = m_OutputLut[linear[1][k]];
+			p[k * 3 + 2] = m_OutputLut[linear[2][k]];
+		}
+	}
+#endif
+	for (; i < Pixels; ++i)
+	{
+		uint8_t *p = pPixels + i * 3;
+		const int in0 = p[0], in1 = p[1], in2 = p[2];
+		for (int out = 0; out < 3; ++out)
+		{
+			const int16_t *k = m_Coefficients + out * 3;
+			const int linear = (k[0] * in0 + k[1] * in1 + k[2] * in2 + round) >> m_Shift;
+			p[out] = m_OutputLut[std::min(std::max(linear, 0), linearMax)];
+		}
+	}
+}
+
+ColorStage::ColorStage(ColorPipeline::channel_order Order)
+	: m_Order(Order)
+	, m_Changed(false)
+{
+}
+
+void ColorStage::set(const ColorSettings &Settings)
+{
+	QMutexLocker local_lock(&m_Lock);
+	m_Pending = Settings;
+	m_Changed.store(true, std::memory_order_release);
+}
+
+void ColorStage::apply(uint8_t *pPixels, size_t Pixels)
+{
+	if (m_Changed.exchange(false, std::memory_order_acquire))
+	{
+		ColorSettings settings;
+		{
+			QMutexLocker local_lock(&m_Lock);
+			settings = m_Pending;
+		}
+		if (!m_Pipeline.compile(settings, m_Order))
+		{
+			std::cout << "color settings out of range, color correction off" << std::endl;
+		}
+	}
+	m_Pipeline.apply(pPixels, Pixels);
+}
+
+bool ColorConfig::load(const std::string &fileName, std::string &Error)
+{
+	std::ifstream in(fileName.c_str());
+	if (!in)
+	{
+		Error = "could not open " + fileName;
+		return false;
+	}
+	ColorSettings defaults;
+	std::map<std::string, ColorSettings> cameras;
+	ColorSettings *pCurrent = &defaults;
+	std::string line;
+	for (int lineNumber = 1; std::getline(in, line); ++lineNumber)
+	{
+		line = trim(line.substr(0, line.find('#')));
+		if (line.empty())
+		{
+			continue;
+		}
+		std::stringstream where;
+		where << fileName << ":" << lineNumber << ": ";
+		const std::string::size_type equal = line.find('=');
+		if (std::string::npos == equal)
+		{
+			Error = where.str() + "expected key = value";
+			return false;
+		}
+		const std::string key = trim(line.substr(0, equal));
+		const std::string value = trim(line.substr(equal + 1));
+		bool valid = true;
+		if ("camera" == key)
+		{
+			valid = !value.empty();
+			pCurrent = "default" == value ? &defaults : &cameras[value];
+		}
+		else if ("matrix" == key)
+		{
+			valid = parseNumbers(value, pCurrent->Matrix, 9);
+		}
+		else if ("gain" == key)
+		{
+			valid = parseNumbers(value, pCurrent->Gain, 3) && pCurrent->Gain[0] >= 0 && pCurrent->Gain[1] >= 0 && pCurrent->Gain[2] >= 0;
+		}
+		else if ("gamma" == key)
+		{
+			valid = parseNumbers(value, &pCurrent->Gamma, 1) && pCurrent->Gamma > 0;
+		}
+		else
+		{
+			Error = where.str() + "unknown key " + key;
+			return false;
+		}
+		if (!valid)
+		{
+			Error = where.str() + "bad value for " + key + ": " + value;
+			return false;
+		}
+	}
+	m_Default = defaults;
+	m_Cameras.swap(cameras);
+	return true;
+}
+
+ColorSettings ColorConfig::forCamera(const std::string &CameraID) const
+{
+	std::map<std::string, ColorSettings>::const_iterator it = m_Cameras.find(CameraID);
+	return m_Cameras.end() == it ? m_Default : it->second;
+}
@@ -0,0 +1,142 @@
+#ifndef COLOR_PIPELINE_H_
+#define COLOR_PIPELINE_H_
+//qt include
+#include "QtCore/QMutex"
+#include "QtCore/QSharedPointer"
+// std include
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+//
+// Color correction of one camera: white balance gains, a 3x3 matrix in RGB
+// order applied after the gains, and an output gamma.
+//
+struct ColorSettings
+{
+	float   Matrix[9];      // row major, out = Matrix * (Gain * in)
+	float   Gain[3];        // red, green, blue
+	float   Gamma;          // out = in ^ (1 / Gamma), 1 keeps the values linear
+
+	ColorSettings();
+	bool identity() const;
+};
+
+//
+// A ColorSettings compiled into integer tables, applied in place to 8 bit RGB or BGR pixels.
+//
+// compile() folds the gains into the matrix and scales it to 16 bit fixed
+// point with as many fraction bits as its largest coefficient allows. The
+// products are summed with SSE2 (_mm_madd_epi16, 8 pixels per step) into a
+// 12 bit linear value, which indexes a 4096 entry table holding the gamma
+// and the conversion back to 8 bit. A diagonal matrix needs no sums at all,
+// every channel then goes through a 256 entry table of its own.
+//
+// compile() is the expensive part, call it only when the settings change;
+// apply() costs a pass over the pixels.
+//
+class ColorPipeline
+{
+public:
+	enum channel_order { ORDER_RGB, ORDER_BGR };
+	enum { LINEAR_BITS = 12, MAX_COEFFICIENT = 32 };
+
+	ColorPipeline();
+	//
+	// Method: compile()
+	//
+	// Purpose: build the tables for the settings and the channel order of the pixels.
+	//
+	// Returns: false if a coefficient is out of +-MAX_COEFFICIENT or the gamma is not positive,
+	//          the pipeline then stays an identity
+	//
+	bool compile(const ColorSettings &Settings, channel_order Order);
+	bool identity() const { return m_Identity; }
+	//
+	// Method: apply()
+	//
+	// Purpose: correct Pixels packed 3 byte pixels in place.
+	//
+	void apply(uint8_t *pPixels, size_t Pixels) const;
+
+private:
+	void applyDiagonal(uint8_t *pPixels, size_t Pixels) const;
+	void applyMatrix(uint8_t *pPixels, size_t Pixels) const;
+
+	bool        m_Identity;
+	bool        m_Diagonal;
+	int         m_Shift;                        // fraction bits of the coefficients
+	int16_t     m_Coefficients[9];              // in the channel order of the pixels, scaled to 8 bit input
+	uint8_t     m_ChannelLut[3][256];           // diagonal matrix: the whole correction per channel
+	uint8_t     m_OutputLut[1 << LINEAR_BITS];  // 12 bit linear to 8 bit with gamma
+};
+
+//
+// A pipeline whose settings change on another thread than the one applying it.
+//
+// set() only stores the settings, the next apply() on the owning thread
+// compiles them, so a change never stalls the thread that converts frames.
+//
+class ColorStage
+{
+public:
+	ColorStage(ColorPipeline::channel_order Order = ColorPipeline::ORDER_RGB);
+	//
+	// Method: set()
+	//
+	// Purpose: new settings from any thread, compiled by the next apply().
+	//
+	void set(const ColorSettings &Settings);
+	void apply(uint8_t *pPixels, size_t Pixels);
+
+private:
+	ColorStage(const ColorStage&);
+	ColorStage& operator=(const ColorStage&);
+
+	ColorPipeline::channel_order    m_Order;
+	ColorPipeline                   m_Pipeline;     // owning thread only
+	QMutex                          m_Lock;         // guards m_Pending
+	ColorSettings                   m_Pending;
+	std::atomic<bool>               m_Changed;
+};
+typedef QSharedPointer<ColorStage> ColorStagePtr;
+
+//
+// Color settings per camera, read from a text file of "key = value" lines,
+// '#' starts a comment. A camera line starts the settings of a camera, the
+// ones before the first camera line and after "camera = default" apply to
+// every camera without settings of its own. Keys a camera does not set keep
+// their identity values:
+//
+//  camera = default | <id>
+//  matrix = <9 numbers, row major, RGB>
+//  gain   = <red> <green> <blue>
+//  gamma  = <n>
+//
+class ColorConfig
+{
+public:
+	//
+	// Method: load()
+	//
+	// Purpose: read a color file, unknown keys and bad values are errors.
+	//
+	// Returns: false with a message naming the line if the file is not valid
+	//
+	bool load(const std::string &fileName, std::string &Error);
+	void setDefault(const ColorSettings &Settings) { m_Default = Settings; }
+	//
+	// Method: forCamera()
+	//
+	// Purpose: the settings of a camera, the default ones if it has none.
+	//
+	ColorSettings forCamera(const std::string &CameraID) const;
+
+private:
+	ColorSettings                           m_Default;
+	std::map<std::string, ColorSettings>    m_Cameras;
+};
+
+#endif
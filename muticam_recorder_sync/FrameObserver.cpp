@@ -1,12 +1,32 @@
 #include <FrameObserver.h>
 #include <OpenCVVideoRecorder.h>
 #include <iostream>
+#include <thread>
 
 namespace AVT {
 namespace VmbAPI {
 namespace Examples {
 
 
+//
+// Sets the consumer of the frames, NULL queues every frame again right away.
+// Setting NULL returns once no callback is inside the old consumer anymore
+//
+// Parameters:
+//  [in]    pConsumer       The consumer, has to outlive the acquisition
+//
+void FrameObserver::SetConsumer( IFrameConsumer *pConsumer )
+{
+    // sequentially consistent with the callback: either it sees NULL, or we see it counted
+    m_pConsumer.store( pConsumer );
+    if( NULL == pConsumer )
+    {
+        while( 0 != m_nInCallback.load() )
+        {
+            std::this_thread::yield();
+        }
+    }
+}
 
 //
 // This is our callback routine that will be executed on every received frame.
@@ -18,69 +38,67 @@ namespace Examples {
 void FrameObserver::FrameReceived( const FramePtr pFrame )
 {
     bool bQueueDirectly = true;
-    VmbFrameStatusType eReceiveStatus;
+    // take the arrival time first, everything below adds latency
+    const uint64_t nArrivalNs = AsyncIoService::nowNs();
+    // counted before the consumer is loaded, SetConsumer( NULL ) waits for us
+    m_nInCallback.fetch_add( 1 );
+    IFrameConsumer *pConsumer = m_pConsumer.load();
 
-    if(     0 != receivers(SIGNAL(FrameReceivedSignal(int)) ) 
-        &&  VmbErrorSuccess == pFrame->GetReceiveStatus( eReceiveStatus ) )
+    if( NULL != m_pDropDetector )
     {
-        // Lock the frame queue
-        m_FramesMutex.lock();
+        m_pDropDetector->frameReceived( observer_id, pFrame );
+    }
+    VmbFrameStatusType eReceiveStatus = VmbFrameStatusInvalid;
+    const bool bHaveStatus = VmbErrorSuccess == pFrame->GetReceiveStatus( eReceiveStatus );
+    VmbUint64_t nFrameID = 0;
+    VmbUint64_t nTimestamp = 0;
+    const bool bHaveTimestamp =     bHaveStatus
+                                &&  VmbFrameStatusComplete == eReceiveStatus
+                                &&  VmbErrorSuccess == pFrame->GetFrameID( nFrameID )
+                                &&  VmbErrorSuccess == pFrame->GetTimestamp( nTimestamp );
+    if( bHaveTimestamp && NULL != m_pClockMapper )
+    {
+        m_pClockMapper->observe( observer_id, nTimestamp, nArrivalNs );
+    }
+    if( bHaveTimestamp && NULL != m_pSyncMonitor )
+    {
+        m_pSyncMonitor->frameArrived( observer_id, nFrameID, nTimestamp );
+    }
+    // on the raw buffer before the frame is handed on, the GUI thread only reads the result
+    if( bHaveTimestamp && NULL != m_pMotionDetector && m_pMotionDetector->enabled() )
+    {
+        m_pMotionDetector->process( observer_id, pFrame );
+    }
 
-        // Add frame to queue
-        m_Frames.push( pFrame );
-		push((double)clock(), observer_id);
+    if( NULL != pConsumer && bHaveStatus )
+    {
+		// the sidecar holds milliseconds on the common timeline, host arrival time until the camera is mapped
+		int64_t nCommonNs = static_cast<int64_t>( nArrivalNs - ( NULL != m_pClockMapper ? m_pClockMapper->epochNs() : 0 ) );
+		if( bHaveTimestamp && NULL != m_pClockMapper )
+		{
+			m_pClockMapper->toCommonNs( observer_id, nTimestamp, nCommonNs );
+		}
+		push( nCommonNs * 1e-6, observer_id );
 		//std::cout << "FrameObserver timeq address : " << &timequeue << std::endl;
-        // Unlock frame queue
-        m_FramesMutex.unlock();
-        // Emit the frame received signal
-
-
-        emit FrameReceivedSignal(eReceiveStatus * 10 + observer_id );
+        // Hand the frame on, the consumer queues it again
+        FrameEvent event;
+        event.Camera = observer_id;
+        event.Status = eReceiveStatus;
+        event.Frame = pFrame;
+        pConsumer->OnFrameReady( event );
         bQueueDirectly = false;
     }
+    m_nInCallback.fetch_sub( 1, std::memory_order_release );
 
     // If any error occurred we queue the frame without notification
     if( true == bQueueDirectly )
     {
+        if( NULL != m_pDropDetector )
+        {
+            m_pDropDetector->frameRequeued( observer_id );
+        }
         m_pCamera->QueueFrame( pFrame );
     }
 }
 
-//
-// After the view has been notified about a new frame it can pick it up.
-// It is then removed from the internal queue
-//
-// Returns:
-//  A shared pointer to the latest frame
-//
-FramePtr FrameObserver::GetFrame()
-{
-    // Lock the frame queue
-    m_FramesMutex.lock();
-    // Pop frame from queue
-    FramePtr res;
-    if( !m_Frames.empty() )
-    {
-        res = m_Frames.front();
-        m_Frames.pop();
-    }
-    // Unlock frame queue
-    m_FramesMutex.unlock();
-    return res;
-}
-
-//
-// Clears the internal (double buffering) frame queue
-//
-void FrameObserver::ClearFrameQueue()
-{
-    // Lock the frame queue
-    m_FramesMutex.lock();
-    // Clear the frame queue and release the memory
-    std::queue<FramePtr> empty;
-    std::swap( m_Frames, empty );
-    // Unlock the frame queue
-    m_FramesMutex.unlock();
-}
-
 }}} // namespace AVT::VmbAPI::Examples
@@ -29,65 +29,107 @@
 #ifndef AVT_VMBAPI_EXAMPLES_FRAMEOBSERVER
 #define AVT_VMBAPI_EXAMPLES_FRAMEOBSERVER
 
-#include <queue>
-
-#include <QObject>
-#include <QMutex>
+#include <atomic>
 
 #include <VimbaCPP/Include/VimbaCPP.h>
 
+#include "drop_frame_detection.h"
+#include "SyncMonitor.h"
+#include "ClockMapper.h"
+#include "MotionDetector.h"
+
 namespace AVT {
 namespace VmbAPI {
 namespace Examples {
 
-class FrameObserver : public QObject, virtual public IFrameObserver
+//
+// One received frame, handed from a frame observer to its consumer.
+// The consumer owns the frame and queues it again with ApiController::QueueFrame.
+//
+struct FrameEvent
 {
-    Q_OBJECT
+    int                 Camera;     // index of the camera in the running acquisition
+    VmbFrameStatusType  Status;     // receive status of the frame
+    FramePtr            Frame;
+
+    FrameEvent()
+        : Camera( -1 )
+        , Status( VmbFrameStatusInvalid )
+    {
+    }
+};
 
+//
+// Receives the frames of the frame observers.
+//
+// OnFrameReady() is called directly on the Vimba thread of the camera, without
+// a queue, a lock or a Qt meta call in between. Anything that has to reach the
+// GUI thread is the consumer's business, with a queued signal.
+//
+class IFrameConsumer
+{
   public:
-    // We pass the camera that will deliver the frames to the constructor
-    FrameObserver( CameraPtr pCamera, int id ) : IFrameObserver( pCamera ) { observer_id = id;}
-    
+    virtual ~IFrameConsumer() {}
+
     //
-    // This is our callback routine that will be executed on every received frame.
-    // Triggered by the API.
+    // Handles one frame, the consumer queues the frame again with ApiController::QueueFrame
     //
     // Parameters:
-    //  [in]    pFrame          The frame returned from the API
+    //  [in]    event           Camera index, receive status and the frame
     //
-    virtual void FrameReceived( const FramePtr pFrame );
+    virtual void OnFrameReady( const FrameEvent &event ) = 0;
+};
 
-    //
-    // After the view has been notified about a new frame it can pick it up.
-    // It is then removed from the internal queue
-    //
-    // Returns:
-    //  A shared pointer to the latest frame
-    //
-    FramePtr GetFrame();
+class FrameObserver : virtual public IFrameObserver
+{
+  public:
+    // We pass the camera that will deliver the frames to the constructor
+    // and the monitors that account every frame before it is handed on
+    FrameObserver( CameraPtr pCamera, int id, DropFrameDetector *pDropDetector = NULL, SyncMonitor *pSyncMonitor = NULL, ClockMapper *pClockMapper = NULL, MotionDetector *pMotionDetector = NULL )
+        : IFrameObserver( pCamera )
+        , m_pDropDetector( pDropDetector )
+        , m_pSyncMonitor( pSyncMonitor )
+        , m_pClockMapper( pClockMapper )
+        , m_pMotionDetector( pMotionDetector )
+        , m_pConsumer( NULL )
+        , m_nInCallback( 0 )
+    {
+        observer_id = id;
+    }
 
     //
-    // Clears the internal (double buffering) frame queue
+    // Sets the consumer of the frames, NULL queues every frame again right away.
+    // Setting NULL returns once no callback is inside the old consumer anymore
     //
-    void ClearFrameQueue();
-
-  private:
-    // Since a Qt signal cannot contain a whole frame
-    // the frame observer stores all FramePtr
-    std::queue<FramePtr> m_Frames;
-	
-    QMutex m_FramesMutex;
-	int observer_id;
-
-  signals:
+    // Parameters:
+    //  [in]    pConsumer       The consumer, has to outlive the acquisition
     //
-    // The frame received event (Qt signal) that notifies about a new incoming frame
+    void SetConsumer( IFrameConsumer *pConsumer );
+    
+    //
+    // This is our callback routine that will be executed on every received frame.
+    // Triggered by the API.
     //
     // Parameters:
-    //  [out]   status          The frame receive status
+    //  [in]    pFrame          The frame returned from the API
     //
-    void FrameReceivedSignal( int status );
+    virtual void FrameReceived( const FramePtr pFrame );
 
+  private:
+    // Index of the camera, any number of cameras
+	int observer_id;
+    // Classifies lost frames, may be NULL
+    DropFrameDetector *m_pDropDetector;
+    // Measures the time stamp spread between the cameras, may be NULL
+    SyncMonitor *m_pSyncMonitor;
+    // Maps the device clock onto the common host timeline, may be NULL
+    ClockMapper *m_pClockMapper;
+    // Measures the motion of every complete frame for the recording gate, may be NULL
+    MotionDetector *m_pMotionDetector;
+    // Gets every frame once the acquisition is set up, set from another thread
+    std::atomic<IFrameConsumer*> m_pConsumer;
+    // Callbacks that may have loaded m_pConsumer and not returned yet
+    std::atomic<int> m_nInCallback;
 };
 
 }}} // namespace AVT::VmbAPI::Examples
@@ -0,0 +1,744 @@
+#include "HeadlessRecorder.h"
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+// same as the GUI: frames kept while armed, motion pre- and post-roll
+#define MOTION_PREROLL_SECONDS 2
+#define MOTION_POSTROLL_SECONDS 3
+// frames the session file holds back for cameras that have not delivered a trigger yet
+#define SESSION_PENDING_MEGABYTES 512
+
+using AVT::VmbAPI::FramePtr;
+using AVT::VmbAPI::CameraPtrVector;
+
+namespace
+{
+	std::string trim(const std::string &s)
+	{
+		const std::string::size_type first = s.find_first_not_of(" \t\r");
+		if (std::string::npos == first)
+		{
+			return std::string();
+		}
+		return s.substr(first, s.find_last_not_of(" \t\r") - first + 1);
+	}
+
+	bool parseNumber(const std::string &value, double &Number)
+	{
+		std::istringstream in(value);
+		return (in >> Number) && in.eof() && Number >= 0;
+	}
+}
+
+HeadlessConfig::HeadlessConfig()
+	: Container(RecorderSettings::CONTAINER_AVI)
+	, Ptp(false)
+	, Backend(ApiController::BACKEND_CPP)
+	, TriggerPolicy(TriggerScheduler::POLICY_CONSTANT_RATE)
+	, PrerollSeconds(0)
+	, Motion(false)
+	, MotionScope(MotionGate::SCOPE_RIG)
+	, SpillMegabytes(1024)
+	, DurationSeconds(0)
+{
+}
+
+bool HeadlessConfig::load(const std::string &fileName, std::string &Error)
+{
+	std::ifstream in(fileName.c_str());
+	if (!in)
+	{
+		Error = "could not open " + fileName;
+		return false;
+	}
+	std::string line;
+	for (int lineNumber = 1; std::getline(in, line); ++lineNumber)
+	{
+		line = trim(line.substr(0, line.find('#')));
+		if (line.empty())
+		{
+			continue;
+		}
+		std::stringstream where;
+		where << fileName << ":" << lineNumber << ": ";
+		const std::string::size_type equal = line.find('=');
+		if (std::string::npos == equal)
+		{
+			Error = where.str() + "expected key = value";
+			return false;
+		}
+		const std::string key = trim(line.substr(0, equal));
+		const std::string value = trim(line.substr(equal + 1));
+		bool valid = true;
+		if ("cameras" == key)
+		{
+			Cameras.clear();
+			if ("all" != value)
+			{
+				std::stringstream ids(value);
+				std::string id;
+				while (std::getline(ids, id, ','))
+				{
+					if (!trim(id).empty())
+					{
+						Cameras.push_back(trim(id));
+					}
+				}
+				valid = !Cameras.empty();
+			}
+		}
+		else if ("output" == key)
+		{
+			Output = value;
+		}
+		else if ("container" == key)
+		{
+			if ("avi" == value)
+			{
+				Container = RecorderSettings::CONTAINER_AVI;
+			}
+			else if ("mcr" == value)
+			{
+				Container = RecorderSettings::CONTAINER_MCR;
+			}
+			else if ("session" == value)
+			{
+				Container = RecorderSettings::CONTAINER_SESSION;
+			}
+			else
+			{
+				valid = false;
+			}
+		}
+		else if ("ptp" == key)
+		{
+			valid = "0" == value || "1" == value;
+			Ptp = "1" == value;
+		}
+		else if ("backend" == key)
+		{
+			valid = "cpp" == value || "c" == value;
+			Backend = "c" == value ? ApiController::BACKEND_C : ApiController::BACKEND_CPP;
+		}
+		else if ("trigger_policy" == key)
+		{
+			if ("constant" == value)
+			{
+				TriggerPolicy = TriggerScheduler::POLICY_CONSTANT_RATE;
+			}
+			else if ("complete_sets" == value)
+			{
+				TriggerPolicy = TriggerScheduler::POLICY_COMPLETE_SETS;
+			}
+			else
+			{
+				valid = false;
+			}
+		}
+		else if ("preroll_seconds" == key)
+		{
+			valid = parseNumber(value, PrerollSeconds);
+		}
+		else if ("motion" == key)
+		{
+			Motion = "off" != value;
+			if ("camera" == value)
+			{
+				MotionScope = MotionGate::SCOPE_CAMERA;
+			}
+			else if ("rig" == value)
+			{
+				MotionScope = MotionGate::SCOPE_RIG;
+			}
+			else
+			{
+				valid = "off" == value;
+			}
+		}
+		else if ("color" == key)
+		{
+			std::string colorError;
+			if (!Colors.load(value, colorError))
+			{
+				Error = where.str() + colorError;
+				return false;
+			}
+		}
+		else if ("rectify" == key)
+		{
+			std::string rectifyError;
+			if (!Rectify.load(value, rectifyError))
+			{
+				Error = where.str() + rectifyError;
+				return false;
+			}
+		}
+		else if ("spill_mb" == key)
+		{
+			valid = parseNumber(value, SpillMegabytes);
+		}
+		else if ("duration_seconds" == key)
+		{
+			valid = parseNumber(value, DurationSeconds);
+		}
+		else
+		{
+			Error = where.str() + "unknown key " + key;
+			return false;
+		}
+		if (!valid)
+		{
+			Error = where.str() + "bad value for " + key + ": " + value;
+			return false;
+		}
+	}
+	if (RecorderSettings::CONTAINER_SESSION == Container && Motion && MotionGate::SCOPE_CAMERA == MotionScope)
+	{
+		// the session groups frames by trigger, a camera pausing on its own would leave every group incomplete
+		Error = fileName + ": container = session needs motion = rig or off";
+		return false;
+	}
+	return true;
+}
+
+HeadlessRecorder::HeadlessRecorder(const HeadlessConfig &Config)
+	: m_Config(Config)
+	, m_bStartedUp(false)
+	, m_bIsStreaming(false)
+	, m_bPrerollArmed(false)
+	, m_bMotionGated(false)
+	, m_nCameras(0)
+	, m_FramePeriodUs(0)
+	, m_StartNs(0)
+	, m_Ticks(0)
+	, m_DropAlertSeen(0)
+	, m_pSyncMetrics(NULL)
+{
+	VmbErrorType err = m_ApiController.StartUp();
+	Log("Starting Vimba " + m_ApiController.GetVersion(), err);
+	m_bStartedUp = VmbErrorSuccess == err;
+	m_SegmentFinalizer.start();
+}
+
+HeadlessRecorder::~HeadlessRecorder()
+{
+	stop();
+	// Let the last segments finish their index before we leave
+	m_SegmentFinalizer.stopThread();
+	m_SegmentFinalizer.wait();
+	if (m_bStartedUp)
+	{
+		m_ApiController.ShutDown();
+	}
+}
+
+//
+// Method: SelectCameras()
+//
+// Purpose: the configured camera IDs that are connected, all connected ones if none are configured.
+//
+std::vector<std::string> HeadlessRecorder::SelectCameras()
+{
+	std::vector<std::string> found;
+	CameraPtrVector cameras = m_ApiController.GetCameraList();
+	for (CameraPtrVector::const_iterator iter = cameras.begin(); cameras.end() != iter; ++iter)
+	{
+		std::string strCameraID;
+		if (VmbErrorSuccess == (*iter)->GetID(strCameraID))
+		{
+			found.push_back(strCameraID);
+		}
+	}
+	if (m_Config.Cameras.empty())
+	{
+		return found;
+	}
+	std::vector<std::string> selected;
+	for (size_t i = 0; i < m_Config.Cameras.size(); i++) {
+		if (std::find(found.begin(), found.end(), m_Config.Cameras[i]) == found.end())
+		{
+			Log("camera " + m_Config.Cameras[i] + " not found");
+			return std::vector<std::string>();
+		}
+		selected.push_back(m_Config.Cameras[i]);
+	}
+	return selected;
+}
+
+bool HeadlessRecorder::start()
+{
+	if (!m_bStartedUp || m_bIsStreaming)
+	{
+		return m_bIsStreaming;
+	}
+	std::vector<std::string> cameras = SelectCameras();
+	if (cameras.empty())
+	{
+		Log("no camera selected");
+		return false;
+	}
+	m_nCameras = static_cast<int>(cameras.size());
+	m_ApiController.SetPtpMode(m_Config.Ptp);
+	m_ApiController.SetCaptureBackend(m_Config.Backend);
+	m_ApiController.SetBurstMode(false);
+	m_ApiController.SetMotionDetection(m_Config.Motion);
+	VmbErrorType err = m_ApiController.StartContinuousImageAcquisition(cameras);
+	Log("Starting Acquisition", err);
+	if (VmbErrorSuccess != err)
+	{
+		return false;
+	}
+
+	time_t now = time(0);
+	tm *ltm = localtime(&now);
+	std::stringstream date;
+	date << m_Config.Output << 1900 + ltm->tm_year << "-"
+		<< std::setw(2) << std::setfill('0') << 1 + ltm->tm_mon << "-"
+		<< std::setw(2) << std::setfill('0') << ltm->tm_mday << "_"
+		<< std::setw(2) << std::setfill('0') << ltm->tm_hour
+		<< std::setw(2) << std::setfill('0') << ltm->tm_min
+		<< std::setw(2) << std::setfill('0') << ltm->tm_sec;
+	VmbUint32_t Width = m_ApiController.GetWidth();
+	VmbUint32_t Height = m_ApiController.GetHeight();
+	double FPS = m_ApiController.GetFPS();
+
+	RecorderSettings settings;
+	settings.Manifest = SessionManifestPtr(new SessionManifest(date.str() + "_manifest.txt"));
+	settings.Finalizer = &m_SegmentFinalizer;
+	settings.DropDetector = &m_ApiController.GetDropDetector();
+	settings.Container = m_Config.Container;
+	settings.FrameBytes = Width * Height * ((m_ApiController.GetPixelFormat() >> 16) & 0xff) / 8;
+	// pre-allocated by the recorders before the first frame arrives
+	settings.SpillBytes = SpillRing::budget(date.str(), static_cast<VmbUint64_t>(m_Config.SpillMegabytes * (1 << 20)), m_nCameras);
+	if (0 != m_Config.PrerollSeconds || m_Config.Motion)
+	{
+		const double seconds = 0 != m_Config.PrerollSeconds ? m_Config.PrerollSeconds : MOTION_PREROLL_SECONDS;
+		settings.PrerollFrames = std::max<VmbUint32_t>(1, static_cast<VmbUint32_t>(seconds * FPS));
+	}
+	if (RecorderSettings::CONTAINER_SESSION == m_Config.Container)
+	{
+		settings.Session = SessionContainerPtr(new SessionContainer(date.str() + "_session.mcr", m_nCameras, Width, Height, FPS,
+			static_cast<VmbUint64_t>(SESSION_PENDING_MEGABYTES) << 20, settings.DropDetector));
+		m_pSession = settings.Session;
+	}
+	m_pVideoRecorders.clear();
+	resetSidecars(m_nCameras);
+	try
+	{
+		for (int i = 0; i < m_nCameras; i++) {
+			std::stringstream vid_name;
+			vid_name << date.str() << "_cam" << std::setw(2) << std::setfill('0') << i << ".avi";
+			settings.Color = m_Config.Colors.forCamera(cameras[i]);
+			std::string rectifyError;
+			settings.Rectify = m_Config.Rectify.forCamera(cameras[i], Width, Height, rectifyError);
+			if (!rectifyError.empty())
+			{
+				Log(rectifyError + ", recorded without rectification");
+			}
+			OpenCVRecorderPtr pVideoRecorder = OpenCVRecorderPtr(new OpenCVRecorder(i, vid_name.str().c_str(), FPS, Width, Height, settings));
+			m_pVideoRecorders.push_back(pVideoRecorder);
+			pVideoRecorder->start();
+		}
+	}
+	catch (const BaseException &bex)
+	{
+		Log((bex.Function() + " :" + bex.Message()).toStdString());
+		m_pVideoRecorders.clear();
+		m_ApiController.StopContinuousImageAcquisition();
+		return false;
+	}
+	m_bMotionGated = m_Config.Motion;
+	m_bPrerollArmed = !m_Config.Motion && 0 != settings.PrerollFrames;
+	if (m_bMotionGated)
+	{
+		m_MotionGate.reset(m_nCameras, m_Config.MotionScope, static_cast<uint64_t>(MOTION_POSTROLL_SECONDS * 1e9));
+		m_GateApplied.assign(MotionGate::SCOPE_RIG == m_Config.MotionScope ? 1 : m_nCameras, false);
+		std::stringstream motionMsg;
+		motionMsg << "Motion gate armed per " << (MotionGate::SCOPE_RIG == m_Config.MotionScope ? "rig" : "camera")
+			<< ", " << settings.PrerollFrames << " frames pre-roll, " << MOTION_POSTROLL_SECONDS << " s post-roll";
+		Log(motionMsg.str());
+	}
+	else if (m_bPrerollArmed)
+	{
+		std::stringstream prerollMsg;
+		prerollMsg << "Pre-roll armed: " << settings.PrerollFrames << " frames per camera, waiting for the record event";
+		Log(prerollMsg.str());
+	}
+	// no event loop: the observers call straight into the recorders on their own threads,
+	// a frame is only queued again while we are streaming
+	m_bIsStreaming = true;
+	if (ApiController::BACKEND_C == m_Config.Backend)
+	{
+		m_ApiController.SetRawFrameConsumer(this);
+	}
+	else
+	{
+		m_ApiController.SetFrameConsumer(this);
+	}
+
+	m_DropAlertSeen = m_ApiController.GetDropDetector().alertSequence();
+	m_pSyncMetrics = new AsyncFileWriter(date.str() + "_sync.txt");
+	m_pSyncMetrics->append("# seconds\tpair\twindow p50 us\twindow p99 us\twindow max us\tsession p99 us\tsession max us\ttriggers\tmean / incomplete\n");
+	m_FramePeriodUs = 1e6 / FPS;
+	m_StartNs = AsyncIoService::nowNs();
+	m_Ticks = 0;
+	if (m_Config.Ptp)
+	{
+		Log(m_ApiController.IsPtpSynchronized() ? "PTP synchronized, scheduled triggers" : "PTP not synchronized, immediate triggers");
+	}
+	m_TriggerScheduler.reset(m_Config.TriggerPolicy, FPS);
+	Log(std::string("Trigger policy: ") + TriggerScheduler::policyName(m_TriggerScheduler.currentPolicy()));
+
+	// same trigger loop as the GUI
+	actt.setInterval([&]() {
+		if (!m_bIsStreaming)
+		{
+			return;
+		}
+		if (!m_TriggerScheduler.fire())
+		{
+			// the drop detector expects the gap, on the PTP grid the next slot jump accounts for it
+			if (!m_ApiController.IsPtpSynchronized())
+			{
+				m_ApiController.GetDropDetector().triggersSkipped(1);
+			}
+			return;
+		}
+		VmbUint64_t executionTime = 0;
+		if (m_ApiController.IsPtpSynchronized())
+		{
+			const VmbUint64_t ptpNow = m_ApiController.GetPtpTime();
+			uint64_t skippedSlots = 0;
+			executionTime = 0 != ptpNow ? m_ApiController.GetPtpScheduler().next(ptpNow, &skippedSlots) : 0;
+			m_ApiController.GetDropDetector().triggersSkipped(skippedSlots);
+			if (0 != ptpNow && 0 == executionTime)
+			{
+				return;
+			}
+		}
+		VmbErrorType lError = m_ApiController.SendActionCommand(executionTime);
+		if (VmbErrorSuccess != lError) std::cout << "[F]...Could not send Action Command. Reason: " << lError << std::endl;
+	}, static_cast<int>(1000 / FPS));
+	return true;
+}
+
+void HeadlessRecorder::stop()
+{
+	if (!m_bIsStreaming)
+	{
+		return;
+	}
+	actt.stopInterval();
+	// the GUI refuses to stop with a backlog, here the backlog is written before the files close
+	const uint64_t drainStartNs = AsyncIoService::nowNs();
+	for (;;)
+	{
+		int backlog = 0;
+		for (size_t i = 0; i < m_pVideoRecorders.size(); i++) {
+			backlog += m_pVideoRecorders[i]->m_framequeue_size();
+		}
+		if (0 == backlog)
+		{
+			break;
+		}
+		if (AsyncIoService::nowNs() - drainStartNs > static_cast<uint64_t>(DRAIN_TIMEOUT_MS) * 1000000)
+		{
+			std::stringstream strMsg;
+			strMsg << "Giving up on " << backlog << " queued frames";
+			Log(strMsg.str());
+			break;
+		}
+		QThread::msleep(TICK_MS);
+	}
+	// once these return no callback is inside the consumer, the recorders and sidecars can go
+	m_ApiController.SetFrameConsumer(NULL);
+	m_ApiController.SetRawFrameConsumer(NULL);
+	m_bIsStreaming = false;
+	for (size_t i = 0; i < m_pVideoRecorders.size(); i++) {
+		m_pVideoRecorders[i]->stopThread();
+		if (!m_pVideoRecorders[i]->wait(1000))
+		{
+			m_pVideoRecorders[i]->terminate();
+		}
+	}
+	m_pVideoRecorders.clear();
+	LogDropSummary();
+	{
+		std::stringstream triggerMsg;
+		triggerMsg << "Triggers: " << m_TriggerScheduler.fired() << " sent, " << m_TriggerScheduler.skipped()
+			<< " skipped for backpressure, final rate " << m_TriggerScheduler.rate() << " fps";
+		Log(triggerMsg.str());
+	}
+	if (m_bMotionGated)
+	{
+		const uint64_t nowNs = AsyncIoService::nowNs();
+		const double sessionNs = static_cast<double>(std::max<uint64_t>(1, nowNs - m_StartNs));
+		std::stringstream motionMsg;
+		motionMsg << "Motion gate: " << m_MotionGate.openings() << " openings, recorded";
+		const int gates = MotionGate::SCOPE_RIG == m_MotionGate.currentScope() ? 1 : m_nCameras;
+		for (int i = 0; i < gates; i++) {
+			if (1 != gates)
+			{
+				motionMsg << (0 == i ? " cam " : ", cam ") << i;
+			}
+			motionMsg << " " << std::fixed << std::setprecision(1) << 100.0 * m_MotionGate.openNs(i, nowNs) / sessionNs << "%";
+		}
+		motionMsg << " of the session";
+		Log(motionMsg.str());
+		m_bMotionGated = false;
+	}
+	m_bPrerollArmed = false;
+	if (NULL != m_pSyncMetrics)
+	{
+		// the triggers since the last tick
+		m_ApiController.GetClockMapper().update();
+		m_ApiController.GetSyncMonitor().update();
+		m_pSyncMetrics->append("# session histograms\n" + m_ApiController.GetSyncMonitor().formatHistograms());
+		m_pSyncMetrics->close();
+		if (m_pSyncMetrics->failed())
+		{
+			Log("Write error in sync metrics " + m_pSyncMetrics->fileName());
+		}
+		delete m_pSyncMetrics;
+		m_pSyncMetrics = NULL;
+	}
+	if (!m_pSession.isNull())
+	{
+		m_pSession->close();
+		std::stringstream sessionMsg;
+		sessionMsg << "Session file " << m_pSession->fileName() << " closed, "
+			<< m_pSession->incompleteTriggers() << " incomplete triggers, " << m_pSession->lateFrames() << " late frames";
+		if (m_pSession->failed())
+		{
+			sessionMsg << ", WRITE ERROR, the file is damaged";
+		}
+		Log(sessionMsg.str());
+		m_pSession.clear();
+	}
+	VmbErrorType err = m_ApiController.StopContinuousImageAcquisition();
+	// No callback can append time stamps anymore, close the sidecars
+	resetSidecars(0);
+	Log("Stopping Acquisition", err);
+}
+
+void HeadlessRecorder::recordEvent()
+{
+	if (!m_bIsStreaming || !m_bPrerollArmed)
+	{
+		Log("Record event ignored, no pre-roll armed");
+		return;
+	}
+	m_bPrerollArmed = false;
+	for (size_t i = 0; i < m_pVideoRecorders.size(); i++) {
+		if (!m_pVideoRecorders[i]->record())
+		{
+			std::stringstream strMsg;
+			strMsg << "cam " << i << ": could not open the recording";
+			Log(strMsg.str());
+		}
+	}
+	Log("Record event, pre-roll flushed");
+}
+
+bool HeadlessRecorder::tick()
+{
+	if (!m_bIsStreaming)
+	{
+		return false;
+	}
+	++m_Ticks;
+	// the frame callbacks only move the gates, the recordings open and pause here
+	ApplyMotionGate();
+	// new frame losses, only the newest event per camera is kept
+	const DropFrameDetector &detector = m_ApiController.GetDropDetector();
+	const uint64_t seq = detector.alertSequence();
+	if (seq != m_DropAlertSeen)
+	{
+		m_DropAlertSeen = seq;
+		for (int i = 0; i < detector.cameras(); i++) {
+			if (0 == detector.lostTotal(i))
+			{
+				continue;
+			}
+			const DropFrameDetector::drop_event event = detector.lastEvent(i);
+			std::stringstream strMsg;
+			strMsg << "cam " << i << ": " << event.Frames << " frame(s) lost at " << DropFrameDetector::stageName(event.Stage)
+				<< " before frame " << event.FrameID << ", " << detector.lostTotal(i) << " lost in total";
+			Log(strMsg.str());
+		}
+	}
+	// backpressure
+	std::vector<TriggerScheduler::recorder_load> loads;
+	for (size_t i = 0; i < m_pVideoRecorders.size(); i++) {
+		TriggerScheduler::recorder_load load;
+		load.Backlog = m_pVideoRecorders[i]->m_framequeue_size();
+		load.Capacity = m_pVideoRecorders[i]->queueCapacity();
+		load.Dropped = detector.lost(static_cast<int>(i), DropFrameDetector::STAGE_RECORDER);
+		loads.push_back(load);
+	}
+	std::string changes;
+	m_TriggerScheduler.update(AsyncIoService::nowNs(), loads, changes);
+	std::stringstream lines(changes);
+	std::string line;
+	while (std::getline(lines, line)) {
+		Log(line);
+	}
+	// the observers only store time stamps, fit the clocks first, the monitor compares on their timeline
+	m_ApiController.GetClockMapper().update();
+	m_ApiController.GetSyncMonitor().update();
+	// sync metrics once a second
+	const SyncMonitor &monitor = m_ApiController.GetSyncMonitor();
+	const uint64_t ticksPerSecond = 1000 / TICK_MS;
+	if (0 == m_Ticks % ticksPerSecond && monitor.cameras() >= 2 && NULL != m_pSyncMetrics)
+	{
+		m_pSyncMetrics->append(monitor.formatMetrics(static_cast<double>(m_Ticks / ticksPerSecond)));
+	}
+	return 0 == m_Config.DurationSeconds
+		|| AsyncIoService::nowNs() - m_StartNs < static_cast<uint64_t>(m_Config.DurationSeconds * 1e9);
+}
+
+//
+// Runs on the Vimba thread of the camera: motion gate, recorder queue and requeue, nothing else
+//
+void HeadlessRecorder::OnFrameReady(const FrameEvent &event)
+{
+	const int cam_index = event.Camera;
+	const FramePtr &pFrame = event.Frame;
+	if (!m_bIsStreaming || SP_ISNULL(pFrame) || cam_index < 0 || cam_index >= m_nCameras)
+	{
+		return;
+	}
+	if (VmbFrameStatusComplete == event.Status)
+	{
+		UpdateMotionGate(cam_index);
+		if (cam_index < static_cast<int>(m_pVideoRecorders.size()))
+		{
+			m_pVideoRecorders[cam_index]->enqueueFrame(*pFrame);
+		}
+		// all cameras got the same command, camera 0 verifies it once per trigger
+		VmbUint64_t timestamp = 0;
+		if (0 == cam_index && m_ApiController.IsPtpSynchronized() && VmbErrorSuccess == SP_ACCESS(pFrame)->GetTimestamp(timestamp))
+		{
+			m_ApiController.GetPtpScheduler().verify(timestamp);
+		}
+	}
+	m_ApiController.QueueFrame(pFrame, cam_index);
+}
+
+//
+// The same on the VimbaC backend, the frame fields come with the event
+//
+void HeadlessRecorder::OnRawFrame(const RawFrameEvent &event)
+{
+	const int cam_index = event.Camera;
+	if (!m_bIsStreaming || cam_index < 0 || cam_index >= m_nCameras)
+	{
+		return;
+	}
+	if (VmbFrameStatusComplete == event.Status)
+	{
+		UpdateMotionGate(cam_index);
+		if (cam_index < static_cast<int>(m_pVideoRecorders.size()))
+		{
+			m_pVideoRecorders[cam_index]->enqueueRaw(event.pData, event.ImageSize, event.Width, event.Height, event.PixelFormat,
+				event.FrameID, event.Timestamp, event.ArrivalNs);
+		}
+		if (0 == cam_index && m_ApiController.IsPtpSynchronized())
+		{
+			m_ApiController.GetPtpScheduler().verify(event.Timestamp);
+		}
+	}
+	m_ApiController.QueueRawFrame(event.Index);
+}
+
+//
+// Feeds the motion measure of a complete frame to the gate, returns false while the gate is closed
+//
+bool HeadlessRecorder::UpdateMotionGate(int cam_index)
+{
+	if (!m_bMotionGated)
+	{
+		return true;
+	}
+	// a change is applied by the next tick(), the pre-roll covers the delay
+	bool bOpened = false, bClosed = false;
+	return m_MotionGate.update(cam_index, m_ApiController.GetMotionDetector().lastChange(cam_index), AsyncIoService::nowNs(), bOpened, bClosed);
+}
+
+//
+// Records or pauses the recorders whose gate changed since the last tick, on the control thread
+//
+void HeadlessRecorder::ApplyMotionGate()
+{
+	if (!m_bMotionGated)
+	{
+		return;
+	}
+	for (size_t i = 0; i < m_GateApplied.size(); i++) {
+		const bool bOpen = m_MotionGate.isOpen(static_cast<int>(i));
+		if (bOpen != m_GateApplied[i])
+		{
+			m_GateApplied[i] = bOpen;
+			GateRecorders(static_cast<int>(i), bOpen);
+		}
+	}
+}
+
+void HeadlessRecorder::GateRecorders(int cam_index, bool bRecord)
+{
+	const bool rig = MotionGate::SCOPE_RIG == m_MotionGate.currentScope();
+	for (size_t i = 0; i < m_pVideoRecorders.size(); i++) {
+		if (!rig && static_cast<int>(i) != cam_index)
+		{
+			continue;
+		}
+		if (!bRecord)
+		{
+			m_pVideoRecorders[i]->pause();
+		}
+		else if (!m_pVideoRecorders[i]->record())
+		{
+			std::stringstream strMsg;
+			strMsg << "cam " << i << ": could not open the recording";
+			Log(strMsg.str());
+		}
+	}
+	std::stringstream strMsg;
+	strMsg << (rig ? std::string("rig") : "cam " + std::to_string(cam_index)) << (bRecord ? ": motion, recording" : ": no motion, paused");
+	Log(strMsg.str());
+}
+
+void HeadlessRecorder::LogDropSummary()
+{
+	const DropFrameDetector &detector = m_ApiController.GetDropDetector();
+	for (int i = 0; i < detector.cameras(); i++) {
+		std::stringstream strMsg;
+		strMsg << "cam " << i << ": " << detector.received(i) << " frames received, lost";
+		for (int s = 0; s < DropFrameDetector::STAGE_COUNT; s++) {
+			const DropFrameDetector::drop_stage stage = static_cast<DropFrameDetector::drop_stage>(s);
+			strMsg << " " << DropFrameDetector::stageName(stage) << " " << detector.lost(i, stage);
+		}
+		Log(strMsg.str());
+	}
+}
+
+//
+// Log lines go to stdout with a time stamp, for the service manager's journal
+//
+void HeadlessRecorder::Log(const std::string &strMsg)
+{
+	time_t now = time(0);
+	tm *ltm = localtime(&now);
+	std::cout << std::setw(2) << std::setfill('0') << ltm->tm_hour << ":"
+		<< std::setw(2) << std::setfill('0') << ltm->tm_min << ":"
+		<< std::setw(2) << std::setfill('0') << ltm->tm_sec << std::setfill(' ') << " " << strMsg << std::endl;
+}
+
+void HeadlessRecorder::Log(const std::string &strMsg, VmbErrorType eErr)
+{
+	Log(strMsg + "..." + m_ApiController.ErrorCodeToMessage(eErr));
+}
@@ -0,0 +1,150 @@
+#ifndef HEADLESS_RECORDER_H_
+#define HEADLESS_RECORDER_H_
+//qt include
+#include "QtCore/QSharedPointer"
+// std include
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "ApiController.h"
+#include "OpenCVVideoRecorder.h"
+#include "TriggerScheduler.h"
+#include "timercpp.h"
+
+using AVT::VmbAPI::Examples::ApiController;
+using AVT::VmbAPI::Examples::FrameEvent;
+using AVT::VmbAPI::Examples::IFrameConsumer;
+
+//
+// Options of a headless recording, read from a text file of "key = value"
+// lines, '#' starts a comment:
+//
+//  cameras          = all | <id>,<id>,...     cameras to record, all found by default
+//  output           = <path prefix>           prepended to the date prefix of all files
+//  container        = avi | mcr | session     segment files, crash safe MCR or one session file
+//  ptp              = 0 | 1                   scheduled action commands on the PTP clock
+//  backend          = cpp | c                 frames through VimbaCPP observers or plain VimbaC callbacks
+//  trigger_policy   = constant | complete_sets
+//  preroll_seconds  = <n>                     arm a pre-roll, the record event starts writing
+//  motion           = off | camera | rig      record only while there is motion, a session needs rig
+//  color            = <file>                  per camera color correction of the recordings, see ColorConfig
+//  rectify          = <file>                  per camera undistortion or rectification of the recordings, see RectifyConfig
+//  spill_mb         = <n>                     disk overflow ring per camera, 1024 by default, 0 disables it
+//  duration_seconds = <n>                     stop after this long, 0 runs until a stop signal
+//
+struct HeadlessConfig
+{
+	std::vector<std::string>        Cameras;            // empty for all cameras
+	std::string                     Output;
+	RecorderSettings::container_type Container;
+	bool                            Ptp;
+	ApiController::capture_backend  Backend;
+	TriggerScheduler::policy        TriggerPolicy;
+	double                          PrerollSeconds;
+	bool                            Motion;
+	MotionGate::scope               MotionScope;
+	ColorConfig                     Colors;             // identity for all cameras without a color file
+	RectifyConfig                   Rectify;            // no camera is rectified without a rectify file
+	double                          SpillMegabytes;     // capped by SpillRing::budget()
+	double                          DurationSeconds;
+
+	HeadlessConfig();
+	//
+	// Method: load()
+	//
+	// Purpose: read a config file, unknown keys and bad values are errors.
+	//
+	// Returns: false with a message naming the line if the file is not valid
+	//
+	bool load(const std::string &fileName, std::string &Error);
+};
+
+//
+// Recorder without a GUI, for rack machines without a display.
+//
+// Uses the same ApiController, frame observers and recorders as MultiCam.
+// The frame observers call OnFrameReady() directly on the Vimba threads, so
+// frames never pass an event loop, and nothing per frame touches a widget or
+// a preview. Everything periodic (drop alerts, backpressure, sync metrics,
+// the duration) runs from tick(), which the caller drives from its own loop.
+// Only QtCore is needed.
+//
+class HeadlessRecorder : public IFrameConsumer, public IRawFrameConsumer
+{
+public:
+	enum { TICK_MS = 250, DRAIN_TIMEOUT_MS = 30000 };
+
+	HeadlessRecorder(const HeadlessConfig &Config);
+	~HeadlessRecorder();
+	//
+	// Method: start()
+	//
+	// Purpose: open the cameras, create the recorders and start triggering.
+	//
+	// Returns: false if nothing is recording, the reason is logged
+	//
+	bool start();
+	//
+	// Method: stop()
+	//
+	// Purpose: stop triggering, write the recorder backlogs and close all files.
+	//
+	void stop();
+	//
+	// Method: recordEvent()
+	//
+	// Purpose: the record event of an armed pre-roll.
+	//
+	void recordEvent();
+	//
+	// Method: tick()
+	//
+	// Purpose: periodic work, call every TICK_MS.
+	//
+	// Returns: false once the configured duration is over
+	//
+	bool tick();
+	bool recording() const { return m_bIsStreaming; }
+	//
+	// Frame handler, run on the Vimba thread of the camera
+	//
+	virtual void OnFrameReady(const FrameEvent &event);
+	//
+	// The same for the frames of the VimbaC backend
+	//
+	virtual void OnRawFrame(const RawFrameEvent &event);
+
+private:
+	typedef QSharedPointer<OpenCVRecorder> OpenCVRecorderPtr;
+
+	void Log(const std::string &strMsg);
+	void Log(const std::string &strMsg, VmbErrorType eErr);
+	std::vector<std::string> SelectCameras();
+	bool UpdateMotionGate(int cam_index);
+	void ApplyMotionGate();
+	void GateRecorders(int cam_index, bool bRecord);
+	void LogDropSummary();
+
+	HeadlessConfig                  m_Config;
+	ApiController                   m_ApiController;
+	bool                            m_bStartedUp;
+	std::vector<OpenCVRecorderPtr>  m_pVideoRecorders;
+	SegmentFinalizer                m_SegmentFinalizer;
+	SessionContainerPtr             m_pSession;
+	ActionTimer                     actt;
+	TriggerScheduler                m_TriggerScheduler;
+	MotionGate                      m_MotionGate;
+	std::atomic<bool>               m_bIsStreaming;
+	bool                            m_bPrerollArmed;
+	bool                            m_bMotionGated;
+	std::vector<bool>               m_GateApplied;      // gate state the recorders follow, per camera or one for the rig
+	int                             m_nCameras;
+	double                          m_FramePeriodUs;
+	uint64_t                        m_StartNs;
+	uint64_t                        m_Ticks;
+	uint64_t                        m_DropAlertSeen;
+	AsyncFileWriter*                m_pSyncMetrics;
+};
+
+#endif
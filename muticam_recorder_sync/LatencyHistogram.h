@@ -0,0 +1,120 @@
+#ifndef LATENCY_HISTOGRAM_H_
+#define LATENCY_HISTOGRAM_H_
+
+#include <atomic>
+#include <cstdint>
+
+//
+// Lock-free log-linear histogram of non-negative integer samples
+// (microseconds, nanoseconds, ...). Every power of two is split into four
+// buckets, so a percentile read back is within 19% of the true value.
+// record() is wait-free and may be called from any thread.
+//
+class LatencyHistogram
+{
+public:
+	enum { SUB_BUCKETS = 4, BUCKETS = 64 * SUB_BUCKETS };
+
+	LatencyHistogram() { reset(); }
+
+	void record(uint64_t value)
+	{
+		m_Buckets[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+		m_Count.fetch_add(1, std::memory_order_relaxed);
+		uint64_t prev = m_Max.load(std::memory_order_relaxed);
+		while (value > prev && !m_Max.compare_exchange_weak(prev, value, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	void reset()
+	{
+		for (int i = 0; i < BUCKETS; ++i)
+		{
+			m_Buckets[i].store(0, std::memory_order_relaxed);
+		}
+		m_Count.store(0, std::memory_order_relaxed);
+		m_Max.store(0, std::memory_order_relaxed);
+	}
+
+	uint64_t count() const { return m_Count.load(std::memory_order_relaxed); }
+	uint64_t max() const { return m_Max.load(std::memory_order_relaxed); }
+
+	//
+	// Method: percentile()
+	//
+	// Purpose: upper bound of the bucket holding the given fraction (0..1) of samples.
+	//
+	uint64_t percentile(double fraction) const
+	{
+		const uint64_t total = count();
+		if (0 == total)
+		{
+			return 0;
+		}
+		uint64_t rank = static_cast<uint64_t>(fraction * total);
+		if (rank >= total)
+		{
+			rank = total - 1;
+		}
+		uint64_t seen = 0;
+		for (int i = 0; i < BUCKETS; ++i)
+		{
+			seen += m_Buckets[i].load(std::memory_order_relaxed);
+			if (seen > rank)
+			{
+				uint64_t upper = upperBound(i);
+				return upper < max() ? upper : max();
+			}
+		}
+		return max();
+	}
+
+	//
+	// Method: bucketCount()
+	//
+	// Purpose: raw bucket access for exporting the whole histogram.
+	//
+	uint64_t bucketCount(int bucket) const { return m_Buckets[bucket].load(std::memory_order_relaxed); }
+
+	static int bucketOf(uint64_t value)
+	{
+		if (value < SUB_BUCKETS)
+		{
+			return static_cast<int>(value);
+		}
+		int msb = 63;
+		while (0 == (value >> msb))
+		{
+			--msb;
+		}
+		// two bits below the leading one select the sub bucket
+		const int sub = static_cast<int>((value >> (msb - 2)) & (SUB_BUCKETS - 1));
+		return (msb - 1) * SUB_BUCKETS + sub;
+	}
+
+	static uint64_t upperBound(int bucket)
+	{
+		if (bucket < SUB_BUCKETS)
+		{
+			return static_cast<uint64_t>(bucket);
+		}
+		const int msb = bucket / SUB_BUCKETS + 1;
+		const uint64_t sub = static_cast<uint64_t>(bucket % SUB_BUCKETS);
+		if (msb >= 63)
+		{
+			return ~0ull;
+		}
+		return ((SUB_BUCKETS + sub + 1) << (msb - 2)) - 1;
+	}
+
+private:
+	LatencyHistogram(const LatencyHistogram&);
+	LatencyHistogram& operator=(const LatencyHistogram&);
+
+	std::atomic<uint64_t>   m_Buckets[BUCKETS];
+	std::atomic<uint64_t>   m_Count;
+	std::atomic<uint64_t>   m_Max;
+};
+
+#endif
@@ -0,0 +1,245 @@
+#include "MotionDetector.h"
+#include <algorithm>
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MOTION_SSE2
+#endif
+
+MotionDetector::MotionDetector()
+	: m_Cameras(0)
+	, m_Width(0)
+	, m_Height(0)
+	, m_ThumbWidth(0)
+	, m_ThumbHeight(0)
+{
+	reset(0, 0, 0);
+}
+
+void MotionDetector::reset(int Cameras, VmbUint32_t Width, VmbUint32_t Height)
+{
+	m_Cameras = Cameras > 0 ? Cameras : 0;
+	m_Width = Width;
+	m_Height = Height;
+	m_ThumbWidth = Width / SUBSAMPLE;
+	m_ThumbHeight = Height / SUBSAMPLE;
+	if (0 == m_ThumbWidth || 0 == m_ThumbHeight)
+	{
+		m_Cameras = 0;
+	}
+	// only between acquisitions, no observer reads the old state anymore
+	m_State.reset(new camera_state[m_Cameras > 0 ? m_Cameras : 1]);
+	for (int i = 0; i < m_Cameras; ++i)
+	{
+		camera_state &state = m_State[i];
+		const size_t size = static_cast<size_t>(m_ThumbWidth) * m_ThumbHeight;
+		state.Thumbnail.assign(size, 0);
+		state.Background.assign(size, 0);
+		state.HaveBackground = false;
+		state.Frames = 0;
+		state.ChangePpm.store(0);
+	}
+}
+
+//
+// Method: thumbnail()
+//
+// Purpose: one luminance sample per block of the raw frame.
+//
+void MotionDetector::thumbnail(const VmbUchar_t *pData, VmbPixelFormatType PixelFormat, uint8_t *pOut) const
+{
+	const VmbUint32_t bits = (PixelFormat >> 16) & 0xff;
+	if (8 == bits)
+	{
+		// mono or one Bayer mosaic, the 2x2 cell mixes all colors
+		for (VmbUint32_t ty = 0; ty < m_ThumbHeight; ++ty)
+		{
+			const VmbUchar_t *pRow0 = pData + static_cast<size_t>(ty) * SUBSAMPLE * m_Width;
+			const VmbUchar_t *pRow1 = pRow0 + m_Width;
+			for (VmbUint32_t tx = 0; tx < m_ThumbWidth; ++tx)
+			{
+				const VmbUint32_t x = tx * SUBSAMPLE;
+				*pOut++ = static_cast<uint8_t>((pRow0[x] + pRow0[x + 1] + pRow1[x] + pRow1[x + 1] + 2) >> 2);
+			}
+		}
+		return;
+	}
+	// packed RGB / BGR: the green byte, 16 bit: the high byte of little endian samples
+	const VmbUint32_t pixelBytes = (bits + 7) / 8;
+	const VmbUint32_t sampleOffset = pixelBytes > 1 ? 1 : 0;
+	for (VmbUint32_t ty = 0; ty < m_ThumbHeight; ++ty)
+	{
+		const VmbUchar_t *pRow = pData + static_cast<size_t>(ty) * SUBSAMPLE * m_Width * pixelBytes + sampleOffset;
+		for (VmbUint32_t tx = 0; tx < m_ThumbWidth; ++tx)
+		{
+			*pOut++ = pRow[static_cast<size_t>(tx) * SUBSAMPLE * pixelBytes];
+		}
+	}
+}
+
+double MotionDetector::process(int cam, const AVT::VmbAPI::FramePtr &pFrame)
+{
+	if (cam < 0 || cam >= m_Cameras)
+	{
+		return 0;
+	}
+	VmbUchar_t *pData = NULL;
+	VmbUint32_t nWidth = 0, nHeight = 0, nBufferSize = 0;
+	VmbPixelFormatType ePixelFormat;
+	if (VmbErrorSuccess != SP_ACCESS(pFrame)->GetImage(pData)
+		|| VmbErrorSuccess != SP_ACCESS(pFrame)->GetWidth(nWidth)
+		|| VmbErrorSuccess != SP_ACCESS(pFrame)->GetHeight(nHeight)
+		|| VmbErrorSuccess != SP_ACCESS(pFrame)->GetImageSize(nBufferSize)
+		|| VmbErrorSuccess != SP_ACCESS(pFrame)->GetPixelFormat(ePixelFormat))
+	{
+		return 0;
+	}
+	return process(cam, pData, nBufferSize, nWidth, nHeight, ePixelFormat);
+}
+
+double MotionDetector::process(int cam, const VmbUchar_t *pData, VmbUint32_t ImageSize, VmbUint32_t Width, VmbUint32_t Height, VmbPixelFormatType PixelFormat)
+{
+	if (cam < 0 || cam >= m_Cameras || NULL == pData || Width != m_Width || Height != m_Height
+		|| static_cast<VmbUint64_t>(ImageSize) * 8 < static_cast<VmbUint64_t>(Width) * Height * ((PixelFormat >> 16) & 0xff))
+	{
+		return 0;
+	}
+	camera_state &state = m_State[cam];
+	uint8_t *pThumb = &state.Thumbnail[0];
+	uint8_t *pBackground = &state.Background[0];
+	const size_t size = state.Thumbnail.size();
+	thumbnail(pData, PixelFormat, pThumb);
+	if (!state.HaveBackground)
+	{
+		std::copy(pThumb, pThumb + size, pBackground);
+		state.HaveBackground = true;
+		state.ChangePpm.store(0, std::memory_order_relaxed);
+		return 0;
+	}
+	const bool updateBackground = 0 == (++state.Frames % BACKGROUND_EVERY);
+	size_t changed = 0;
+	size_t i = 0;
+#ifdef MOTION_SSE2
+	const __m128i threshold = _mm_set1_epi8(static_cast<char>(DIFF_THRESHOLD));
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= size; i += 16)
+	{
+		const __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pThumb + i));
+		const __m128i background = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pBackground + i));
+		// |a - b| with saturating subtractions, then what is left above the threshold
+		const __m128i diff = _mm_or_si128(_mm_subs_epu8(current, background), _mm_subs_epu8(background, current));
+		const __m128i over = _mm_subs_epu8(diff, threshold);
+		// one bit per changed pixel, few of them in an idle scene
+		for (unsigned mask = ~static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(over, zero))) & 0xffff; 0 != mask; mask &= mask - 1)
+		{
+			++changed;
+		}
+		if (updateBackground)
+		{
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(pBackground + i), _mm_avg_epu8(current, background));
+		}
+	}
+#endif
+	for (; i < size; ++i)
+	{
+		const int diff = static_cast<int>(pThumb[i]) - static_cast<int>(pBackground[i]);
+		changed += (diff > DIFF_THRESHOLD || -diff > DIFF_THRESHOLD) ? 1 : 0;
+		if (updateBackground)
+		{
+			pBackground[i] = static_cast<uint8_t>((pThumb[i] + pBackground[i] + 1) >> 1);
+		}
+	}
+	const double change = static_cast<double>(changed) / size;
+	state.ChangePpm.store(static_cast<uint32_t>(change * 1e6), std::memory_order_relaxed);
+	return change;
+}
+
+double MotionDetector::lastChange(int cam) const
+{
+	return cam >= 0 && cam < m_Cameras ? m_State[cam].ChangePpm.load(std::memory_order_relaxed) * 1e-6 : 0;
+}
+
+MotionGate::MotionGate()
+	: m_Cameras(0)
+	, m_Scope(SCOPE_RIG)
+	, m_PostRollNs(0)
+	, m_OpenFraction(1)
+	, m_HoldFraction(1)
+	, m_Openings(0)
+{
+	reset(0, SCOPE_RIG, 0);
+}
+
+void MotionGate::reset(int Cameras, scope Scope, uint64_t PostRollNs, double OpenFraction, double HoldFraction)
+{
+	QMutexLocker local_lock(&m_Lock);
+	m_Cameras = Cameras > 0 ? Cameras : 0;
+	m_Scope = Scope;
+	m_PostRollNs = PostRollNs;
+	m_OpenFraction = OpenFraction;
+	m_HoldFraction = std::min(HoldFraction, OpenFraction);
+	gate_state closed;
+	closed.Open = false;
+	closed.LastMotionNs = 0;
+	closed.OpenedNs = 0;
+	closed.OpenTotalNs = 0;
+	m_Streak.assign(m_Cameras, 0);
+	m_Gate.assign(m_Cameras > 0 ? m_Cameras : 1, closed);
+	m_Openings = 0;
+}
+
+bool MotionGate::update(int cam, double Change, uint64_t NowNs, bool &Opened, bool &Closed)
+{
+	Opened = false;
+	Closed = false;
+	if (cam < 0 || cam >= m_Cameras)
+	{
+		return true;
+	}
+	QMutexLocker local_lock(&m_Lock);
+	gate_state &gate = m_Gate[SCOPE_RIG == m_Scope ? 0 : cam];
+	m_Streak[cam] = Change > m_OpenFraction ? m_Streak[cam] + 1 : 0;
+	if (!gate.Open)
+	{
+		if (m_Streak[cam] >= ON_FRAMES)
+		{
+			gate.Open = true;
+			gate.OpenedNs = NowNs;
+			gate.LastMotionNs = NowNs;
+			++m_Openings;
+			Opened = true;
+		}
+		return gate.Open;
+	}
+	if (Change > m_HoldFraction)
+	{
+		gate.LastMotionNs = NowNs;
+	}
+	else if (NowNs - gate.LastMotionNs > m_PostRollNs)
+	{
+		gate.Open = false;
+		gate.OpenTotalNs += NowNs - gate.OpenedNs;
+		Closed = true;
+	}
+	return gate.Open;
+}
+
+bool MotionGate::isOpen(int cam) const
+{
+	QMutexLocker local_lock(const_cast<QMutex*>(&m_Lock));
+	if (SCOPE_RIG != m_Scope && (cam < 0 || cam >= m_Cameras))
+	{
+		return false;
+	}
+	return m_Gate[SCOPE_RIG == m_Scope ? 0 : cam].Open;
+}
+
+uint64_t MotionGate::openNs(int cam, uint64_t NowNs) const
+{
+	QMutexLocker local_lock(const_cast<QMutex*>(&m_Lock));
+	if (SCOPE_RIG != m_Scope && (cam < 0 || cam >= m_Cameras))
+	{
+		return 0;
+	}
+	const gate_state &gate = m_Gate[SCOPE_RIG == m_Scope ? 0 : cam];
+	return gate.OpenTotalNs + (gate.Open ? NowNs - gate.OpenedNs : 0);
+}
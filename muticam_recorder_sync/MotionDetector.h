@@ -0,0 +1,150 @@
+#ifndef MOTION_DETECTOR_H_
+#define MOTION_DETECTOR_H_
+//qt include
+#include "QtCore/QMutex"
+// std include
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+// allied vision include
+#include <VimbaCPP/Include/VimbaCPP.h>
+
+//
+// Cheap motion measure on the raw frame, run in the frame observer.
+//
+// The raw buffer is reduced to a luminance thumbnail, one sample per
+// SUBSAMPLE x SUBSAMPLE block. For 8 bit Bayer and mono formats a sample is
+// the mean of the 2x2 cell at the block corner, which holds one pixel of
+// every color of the mosaic, so no debayering is needed. Other formats
+// sample one byte of the pixel (the green channel or the high byte).
+//
+// The thumbnail is compared against a background model with SSE2: the
+// result is the fraction of thumbnail pixels that differ from the
+// background by more than DIFF_THRESHOLD. The background follows the scene
+// slowly (a rounding average every BACKGROUND_EVERY frames), so lighting
+// drift and objects that stopped moving fade out within seconds.
+//
+// Every camera has its own state and is only touched by its observer thread.
+//
+class MotionDetector
+{
+public:
+	enum { SUBSAMPLE = 8, DIFF_THRESHOLD = 16, BACKGROUND_EVERY = 4 };
+
+	MotionDetector();
+	//
+	// Method: reset()
+	//
+	// Purpose: size the thumbnails before an acquisition starts, 0 cameras disables the detector.
+	//
+	void reset(int Cameras, VmbUint32_t Width, VmbUint32_t Height);
+	bool enabled() const { return 0 != m_Cameras; }
+	//
+	// Method: process()
+	//
+	// Purpose: measure the motion of a complete frame against the background of its camera.
+	//
+	// Returns: the changed fraction of the thumbnail, 0..1
+	//
+	double process(int cam, const AVT::VmbAPI::FramePtr &pFrame);
+	double process(int cam, const VmbUchar_t *pData, VmbUint32_t ImageSize, VmbUint32_t Width, VmbUint32_t Height, VmbPixelFormatType PixelFormat);
+	//
+	// Method: lastChange()
+	//
+	// Purpose: the result of the last process() of a camera.
+	//
+	double lastChange(int cam) const;
+
+private:
+	MotionDetector(const MotionDetector&);
+	MotionDetector& operator=(const MotionDetector&);
+
+	struct camera_state
+	{
+		std::vector<uint8_t>    Thumbnail;
+		std::vector<uint8_t>    Background;
+		bool                    HaveBackground;
+		uint32_t                Frames;
+		std::atomic<uint32_t>   ChangePpm;      // last changed fraction in parts per million
+	};
+
+	void thumbnail(const VmbUchar_t *pData, VmbPixelFormatType PixelFormat, uint8_t *pOut) const;
+
+	int                     m_Cameras;
+	VmbUint32_t             m_Width;
+	VmbUint32_t             m_Height;
+	VmbUint32_t             m_ThumbWidth;
+	VmbUint32_t             m_ThumbHeight;
+	std::unique_ptr<camera_state[]> m_State;    // one per camera, sized by reset()
+};
+
+//
+// Turns the motion measure into record and pause decisions, with hysteresis.
+//
+// The gate opens after ON_FRAMES frames in a row above the opening
+// threshold and stays open while the change stays above the lower holding
+// threshold; it closes PostRollNs after the last such frame. The pre-roll
+// comes from the recorders, which keep the last frames while paused.
+//
+// With SCOPE_RIG all cameras share one gate: motion seen by any camera
+// records all of them, so every trigger is recorded by every camera.
+//
+class MotionGate
+{
+public:
+	enum scope
+	{
+		SCOPE_CAMERA,                           // every camera records its own motion
+		SCOPE_RIG,                              // any camera records the whole rig
+	};
+	enum { ON_FRAMES = 3 };
+
+	MotionGate();
+	void reset(int Cameras, scope Scope, uint64_t PostRollNs, double OpenFraction = 0.005, double HoldFraction = 0.002);
+	//
+	// Method: update()
+	//
+	// Purpose: account the motion measure of one frame, from the frame threads.
+	//          Opened/Closed tell if the gate of this camera just changed.
+	//
+	// Returns: true if the camera records this frame
+	//
+	bool update(int cam, double Change, uint64_t NowNs, bool &Opened, bool &Closed);
+	scope       currentScope()      const { return m_Scope; }
+	uint64_t    openings()          const { return m_Openings; }
+	//
+	// Method: openNs()
+	//
+	// Purpose: time the gate of a camera (of the rig) was open, for the idle share.
+	//
+	uint64_t    openNs(int cam, uint64_t NowNs) const;
+	//
+	// Method: isOpen()
+	//
+	// Purpose: current state of the gate of a camera (of the rig), for a
+	//          control thread that applies the changes.
+	//
+	bool        isOpen(int cam) const;
+
+private:
+	struct gate_state
+	{
+		bool        Open;
+		uint64_t    LastMotionNs;
+		uint64_t    OpenedNs;
+		uint64_t    OpenTotalNs;
+	};
+
+	QMutex              m_Lock;
+	int                 m_Cameras;
+	scope               m_Scope;
+	uint64_t            m_PostRollNs;
+	double              m_OpenFraction;
+	double              m_HoldFraction;
+	std::vector<uint32_t>   m_Streak;           // frames in a row above the opening threshold
+	std::vector<gate_state> m_Gate;             // SCOPE_RIG uses the first one
+	uint64_t            m_Openings;
+};
+
+#endif
@@ -11,24 +11,86 @@
 #include <iostream>
 #include <ctime>
 #include <iomanip>
+#include <fstream>
 #include "MultiCam.h"
 #include "VimbaImageTransform/Include/VmbTransform.h"
 #define NUM_COLORS 3
 #define BIT_DEPTH 8
+// length of a burst and the number of bursts that can be in RAM at once
+#define BURST_SECONDS 5
+#define BURST_ARENAS 2
+// frames kept per camera before the record event while armed
+#define PREROLL_SECONDS 10
+// motion gate: kept before the motion unless the pre-roll is longer, recorded after it
+#define MOTION_PREROLL_SECONDS 2
+#define MOTION_POSTROLL_SECONDS 3
+// preview rate divider while the motion gate of a camera is closed
+#define MOTION_IDLE_PREVIEW_EVERY 8
+// per camera color settings of the color processing option, see ColorConfig
+#define COLOR_CONFIG_FILE "color.cfg"
+// per camera undistortion or rectification of the recordings, see RectifyConfig
+#define RECTIFY_CONFIG_FILE "rectify.cfg"
+// disk overflow ring per camera once the recorder queue is full, less if the disk is short
+#define SPILL_MEGABYTES 1024
+// frames the session file holds back for cameras that have not delivered a trigger yet
+#define SESSION_PENDING_MEGABYTES 512
 
 using AVT::VmbAPI::FramePtr;
 using AVT::VmbAPI::FeaturePtr;
 using AVT::VmbAPI::CameraPtrVector;
+
+// the QImage of a recorder preview holds a reference to its cv::Mat until Qt drops the pixels
+static void ReleasePreviewImage(void *pInfo)
+{
+    delete static_cast<cv::Mat*>(pInfo);
+}
+
 // class func
 MultiCam::MultiCam(QWidget *parent, Qt::WindowFlags flags)
     : QMainWindow(parent, flags)
     , m_bIsStreaming(false)
+    , m_DropAlertSeen(0)
+    , m_pSyncMetrics(NULL)
+    , m_SyncSeconds(0)
+    , m_SyncAlertTriggers(0)
+    , m_FramePeriodUs(0)
+    , m_bPrerollArmed(false)
+    , m_bMotionGated(false)
+    , m_MotionStartNs(0)
 {
     ui.setupUi(this);
     ui.m_LabelStream_1->setAlignment(Qt::AlignCenter);
     ui.m_LabelStream_2->setAlignment(Qt::AlignCenter);
     // Connect GUI events with event handlers
     QObject::connect(ui.m_ButtonStartStop, SIGNAL(clicked()), this, SLOT(OnBnClickedButtonStartstop()));
+    QObject::connect(&m_DropTimer, SIGNAL(timeout()), this, SLOT(OnDropCheck()));
+    QObject::connect(&m_SyncTimer, SIGNAL(timeout()), this, SLOT(OnSyncUpdate()));
+    QObject::connect(&m_BackpressureTimer, SIGNAL(timeout()), this, SLOT(OnBackpressureUpdate()));
+    // the only part of a frame that goes through Qt, the widgets belong to the GUI thread
+    QObject::connect(this, SIGNAL(PreviewReadySignal(int, QImage, bool)), this, SLOT(OnPreviewReady(int, QImage, bool)), Qt::QueuedConnection);
+    // the frame callbacks log too, direct on the GUI thread and queued from any other
+    QObject::connect(this, SIGNAL(LogSignal(QString)), this, SLOT(OnLog(QString)));
+    // opening a recording writes files, the capture callbacks leave it to the GUI thread
+    QObject::connect(this, SIGNAL(GateChangedSignal(int, bool)), this, SLOT(OnGateChanged(int, bool)), Qt::QueuedConnection);
+    QObject::connect(ui.m_ColorProcessingCheckBox, SIGNAL(stateChanged(int)), this, SLOT(OnColorProcessingChanged(int)));
+
+    // without a color file the option keeps its quick color to mono matrix for every camera
+    ColorSettings mono;
+    static const float Matrix[] = { 0.8f, 0.1f, 0.1f,
+                                    0.1f, 0.8f, 0.1f,
+                                    0.0f, 0.0f, 1.0f };
+    std::copy(Matrix, Matrix + 9, mono.Matrix);
+    m_ColorConfig.setDefault(mono);
+    if (std::ifstream(COLOR_CONFIG_FILE))
+    {
+        std::string colorError;
+        Log(m_ColorConfig.load(COLOR_CONFIG_FILE, colorError) ? std::string("Color settings from ") + COLOR_CONFIG_FILE : colorError);
+    }
+    if (std::ifstream(RECTIFY_CONFIG_FILE))
+    {
+        std::string rectifyError;
+        Log(m_RectifyConfig.load(RECTIFY_CONFIG_FILE, rectifyError) ? std::string("Rectification settings from ") + RECTIFY_CONFIG_FILE : rectifyError);
+    }
 
     // Start Vimba
     VmbErrorType err = m_ApiController.StartUp();
@@ -50,6 +112,7 @@ MultiCam::MultiCam(QWidget *parent, Qt::WindowFlags flags)
     }
     // open timer
     actt = ActionTimer();
+    m_SegmentFinalizer.start();
 }
 
 MultiCam::~MultiCam()
@@ -58,6 +121,17 @@ MultiCam::~MultiCam()
     if (true == m_bIsStreaming)
         OnBnClickedButtonStartstop();
 
+    // Bursts still encoding are written completely
+    for (size_t i = 0; i < m_BurstDrainers.size(); i++) {
+        m_BurstDrainers[i]->wait();
+        delete m_BurstDrainers[i];
+    }
+    m_BurstDrainers.clear();
+
+    // Let the last segments finish their index before we leave
+    m_SegmentFinalizer.stopThread();
+    m_SegmentFinalizer.wait();
+
     // Before we close the application we stop Vimba
     m_ApiController.ShutDown();
 
@@ -97,6 +171,7 @@ void MultiCam::OnBnClickedButtonStartstop()
     QList<QListWidgetItem*> selection = ui.m_ListBoxCameras->selectedItems();
     int num_cam = selection.size();
     bool flag = true;
+    m_selected_cameras.clear();
     for (int i = 0; i < num_cam; i++) {
         m_selected_cameras.push_back(m_cameras[ui.m_ListBoxCameras->row(selection[i])]);
         if (-1 >= ui.m_ListBoxCameras->row(selection[i])) flag = false;
@@ -108,10 +183,28 @@ void MultiCam::OnBnClickedButtonStartstop()
     if (flag)
     {
         std::cout << "aaaaaaaaaa\n";
+        if (m_bIsStreaming && m_bPrerollArmed)
+        {
+            // armed, this press is the record event, the next one stops
+            StartRecording();
+            return;
+        }
         if (false == m_bIsStreaming)
         {
             std::cout << "bbbbbbbbb\n";
             // Start acquisition
+            const bool burst = ui.m_BurstCheckBox->isChecked();
+            // partially checked gates every camera on its own motion, checked the whole rig
+            const bool motion = Qt::Unchecked != ui.m_MotionCheckBox->checkState() && !burst;
+            if (motion && Qt::PartiallyChecked == ui.m_MotionCheckBox->checkState() && ui.m_SessionFileCheckBox->isChecked())
+            {
+                // the session groups frames by trigger, a camera pausing on its own would leave every group incomplete
+                Log("A session file needs the motion gate of the whole rig, not one per camera");
+                return;
+            }
+            m_ApiController.SetPtpMode(ui.m_PtpCheckBox->isChecked());
+            m_ApiController.SetBurstMode(burst);
+            m_ApiController.SetMotionDetection(motion);
             err = m_ApiController.StartContinuousImageAcquisition(m_selected_cameras);
             time_t now = time(0);
             tm *ltm = localtime(&now);
@@ -128,12 +221,93 @@ void MultiCam::OnBnClickedButtonStartstop()
             double              FPS = m_ApiController.GetFPS();
             if (VmbErrorSuccess == err)
             {
-                try
+                RecorderSettings settings;
+                settings.Manifest = SessionManifestPtr(new SessionManifest(date.str() + "_manifest.txt"));
+                settings.Finalizer = &m_SegmentFinalizer;
+                settings.DropDetector = &m_ApiController.GetDropDetector();
+                if (ui.m_SessionFileCheckBox->isChecked())
+                {
+                    settings.Container = RecorderSettings::CONTAINER_SESSION;
+                }
+                else if (ui.m_CrashSafeCheckBox->isChecked())
+                {
+                    settings.Container = RecorderSettings::CONTAINER_MCR;
+                }
+                m_pVideoRecorders.clear();
+                m_Images.clear();
+                resetSidecars(num_cam);
+                // compiled by the recorder and preview threads, changed by the color processing option
+                m_CameraColors.assign(num_cam, ColorSettings());
+                m_PreviewColors.clear();
+                for (int i = 0; i < num_cam; i++) {
+                    if (ui.m_ColorProcessingCheckBox->isChecked())
+                    {
+                        m_CameraColors[i] = m_ColorConfig.forCamera(m_selected_cameras[i]);
+                    }
+                    m_PreviewColors.push_back(ColorStagePtr(new ColorStage(ColorPipeline::ORDER_RGB)));
+                    m_PreviewColors[i]->set(m_CameraColors[i]);
+                }
+                // maps come from their cache file, built from the calibration only when it changed
+                m_CameraRectify.assign(num_cam, RectifyMapPtr());
+                for (int i = 0; i < num_cam; i++) {
+                    std::string rectifyError;
+                    m_CameraRectify[i] = m_RectifyConfig.forCamera(m_selected_cameras[i], Width, Height, rectifyError);
+                    if (!rectifyError.empty())
+                    {
+                        Log(rectifyError + ", recorded without rectification");
+                    }
+                }
+                // bits per pixel are in the occupy byte of the pixel format
+                const VmbUint32_t frameBytes = Width * Height * ((m_ApiController.GetPixelFormat() >> 16) & 0xff) / 8;
+                settings.FrameBytes = frameBytes;
+                // pre-allocated by the recorders before the first frame arrives
+                settings.SpillBytes = SpillRing::budget(date.str(), static_cast<VmbUint64_t>(SPILL_MEGABYTES) << 20, num_cam);
+                if ((ui.m_PrerollCheckBox->isChecked() || motion) && !burst)
+                {
+                    settings.PrerollFrames = static_cast<VmbUint32_t>((ui.m_PrerollCheckBox->isChecked() ? PREROLL_SECONDS : MOTION_PREROLL_SECONDS) * FPS);
+                }
+                if (RecorderSettings::CONTAINER_SESSION == settings.Container)
+                {
+                    // a burst closes its own session file once it is drained
+                    // late frames of a burst are the drainer's, it reports them when the file is closed
+                    settings.Session = SessionContainerPtr(new SessionContainer(date.str() + (burst ? "_burst_session.mcr" : "_session.mcr"), num_cam, Width, Height, FPS,
+                        static_cast<VmbUint64_t>(SESSION_PENDING_MEGABYTES) << 20, burst ? NULL : settings.DropDetector));
+                    if (!burst)
+                    {
+                        m_pSession = settings.Session;
+                    }
+                }
+                if (burst)
+                {
+                    // frames only go to RAM, the recorders are created when the burst drains
+                    if (m_BurstPool.reserve(BURST_ARENAS, num_cam, frameBytes, static_cast<VmbUint32_t>(BURST_SECONDS * FPS)))
+                    {
+                        m_pBurstArena = m_BurstPool.acquire();
+                    }
+                    m_BurstName = date.str();
+                    m_BurstSettings = settings;
+                    std::stringstream burstMsg;
+                    if (m_pBurstArena.isNull())
+                    {
+                        burstMsg << "No burst arena free, " << m_BurstDrainers.size() << " bursts still draining";
+                        err = VmbErrorResources;
+                        m_ApiController.StopContinuousImageAcquisition();
+                    }
+                    else
+                    {
+                        burstMsg << "Burst armed: " << m_pBurstArena->capacity() << " frames per camera at " << FPS << " fps, "
+                            << (m_pBurstArena->bytes() >> 20) << " MB" << (m_pBurstArena->largePages() ? " on large pages" : "");
+                    }
+                    Log(burstMsg.str());
+                }
+                else try
                 {
                     for (int i = 0; i < num_cam; i++) {
                         std::stringstream vid_name;
                         vid_name << date.str() << "_cam" << std::setw(2) << std::setfill('0') << i << ".avi";
-                        OpenCVRecorderPtr m_pVideoRecorder = OpenCVRecorderPtr(new OpenCVRecorder(vid_name.str().c_str(), FPS, Width, Height));
+                        settings.Color = m_CameraColors[i];
+                        settings.Rectify = m_CameraRectify[i];
+                        OpenCVRecorderPtr m_pVideoRecorder = OpenCVRecorderPtr(new OpenCVRecorder(i, vid_name.str().c_str(), FPS, Width, Height, settings));
                         m_pVideoRecorders.push_back(m_pVideoRecorder);
                         m_pVideoRecorders[i]->start();
                     }
@@ -142,15 +316,38 @@ void MultiCam::OnBnClickedButtonStartstop()
                 {
                     Log((bex.Function() + " :" + bex.Message()).toStdString());
                 }
+                if (motion)
+                {
+                    // the recorders stay armed until the gate opens, the pre-roll covers the detection delay
+                    m_MotionGate.reset(num_cam, Qt::Checked == ui.m_MotionCheckBox->checkState() ? MotionGate::SCOPE_RIG : MotionGate::SCOPE_CAMERA,
+                        static_cast<uint64_t>(MOTION_POSTROLL_SECONDS * 1e9));
+                    m_MotionStartNs = AsyncIoService::nowNs();
+                    m_bMotionGated = true;
+                    std::stringstream motionMsg;
+                    motionMsg << "Motion gate armed per " << (MotionGate::SCOPE_RIG == m_MotionGate.currentScope() ? "rig" : "camera")
+                        << ", " << settings.PrerollFrames << " frames pre-roll, " << MOTION_POSTROLL_SECONDS << " s post-roll";
+                    Log(motionMsg.str());
+                }
+                else if (0 != settings.PrerollFrames)
+                {
+                    m_bPrerollArmed = true;
+                    std::stringstream prerollMsg;
+                    prerollMsg << "Pre-roll armed: " << settings.PrerollFrames << " frames per camera, press Record to keep them";
+                    Log(prerollMsg.str());
+                }
 
                 for (int i = 0; i < num_cam; i++) {
-                    QImage m_Image = QImage(Width, Height, QImage::Format_RGB888);
+                    // no preview during a burst, the callbacks only copy
+                    QImage m_Image = burst ? QImage() : QImage(Width, Height, QImage::Format_RGB888);
                     m_Images.push_back(m_Image);
-                    std::cout << "         Connect OnFrameReady         " << std::endl;
-
-                    // QueuedConnection: The slot is invoked when control returns to the event loop of the receiver's thread. The slot is executed in the receiver's thread.
-                    //QObject::connect(m_ApiController.GetFrameObserver(i), SIGNAL(FrameReceivedSignal(int)), this, SLOT(OnFrameReady(int)), Qt::QueuedConnection);
-                    QObject::connect(m_ApiController.GetFrameObserver(i), SIGNAL(FrameReceivedSignal(int)), this, SLOT(OnFrameReady(int)), Qt::DirectConnection);
+                }
+                LayoutPreviews(num_cam);
+                // the observers call OnFrameReady() directly on their Vimba threads from now on,
+                // a frame is only queued again while we are streaming
+                if (VmbErrorSuccess == err)
+                {
+                    m_bIsStreaming = true;
+                    m_ApiController.SetFrameConsumer(this);
                 }
             }
             else {
@@ -158,20 +355,54 @@ void MultiCam::OnBnClickedButtonStartstop()
             }
             Log("Starting Acquisition", err);
             m_bIsStreaming = VmbErrorSuccess == err;
+            if (m_bIsStreaming)
+            {
+                // alert within one frame period
+                m_DropAlertSeen = m_ApiController.GetDropDetector().alertSequence();
+                m_DropTimer.start(std::max(1, static_cast<int>(1000 / FPS)));
+                m_pSyncMetrics = new AsyncFileWriter(date.str() + "_sync.txt");
+                m_pSyncMetrics->append("# seconds\tpair\twindow p50 us\twindow p99 us\twindow max us\tsession p99 us\tsession max us\ttriggers\tmean / incomplete\n");
+                m_SyncSeconds = 0;
+                m_SyncAlertTriggers = 0;
+                m_FramePeriodUs = 1e6 / FPS;
+                m_SyncTimer.start(1000);
+                if (ui.m_PtpCheckBox->isChecked())
+                {
+                    Log(m_ApiController.IsPtpSynchronized() ? "PTP synchronized, scheduled triggers" : "PTP not synchronized, immediate triggers");
+                }
+                m_TriggerScheduler.reset(ui.m_CompleteSetsCheckBox->isChecked() ? TriggerScheduler::POLICY_COMPLETE_SETS : TriggerScheduler::POLICY_CONSTANT_RATE, FPS);
+                Log(std::string("Trigger policy: ") + TriggerScheduler::policyName(m_TriggerScheduler.currentPolicy()));
+                m_BackpressureTimer.start(250);
+            }
 
             // Start sending command
             actt.setInterval([&]() {
                 if (m_bIsStreaming) {
-                    int deviceKey = 11, groupKey = 22, groupMask = 33;
-                    FeaturePtr      pFeature;
-                    m_ApiController.m_system.GetFeatureByName("ActionDeviceKey", pFeature);
-                    pFeature->SetValue(deviceKey);
-                    m_ApiController.m_system.GetFeatureByName("ActionGroupKey", pFeature);
-                    pFeature->SetValue(groupKey);
-                    m_ApiController.m_system.GetFeatureByName("ActionGroupMask", pFeature);
-                    pFeature->SetValue(groupMask);
-                    m_ApiController.m_system.GetFeatureByName("ActionCommand", pFeature);
-                    VmbErrorType lError = pFeature->RunCommand();
+                    if (!m_TriggerScheduler.fire())
+                    {
+                        // a recorder is behind, no camera gets this trigger
+                        // the drop detector expects the gap, on the PTP grid the next slot jump accounts for it
+                        if (!m_ApiController.IsPtpSynchronized())
+                        {
+                            m_ApiController.GetDropDetector().triggersSkipped(1);
+                        }
+                        return;
+                    }
+                    // with PTP the cameras trigger on the grid, not when the command arrives
+                    VmbUint64_t executionTime = 0;
+                    if (m_ApiController.IsPtpSynchronized())
+                    {
+                        const VmbUint64_t ptpNow = m_ApiController.GetPtpTime();
+                        uint64_t skippedSlots = 0;
+                        executionTime = 0 != ptpNow ? m_ApiController.GetPtpScheduler().next(ptpNow, &skippedSlots) : 0;
+                        m_ApiController.GetDropDetector().triggersSkipped(skippedSlots);
+                        if (0 != ptpNow && 0 == executionTime)
+                        {
+                            // the timer is ahead of the grid, this slot is taken already
+                            return;
+                        }
+                    }
+                    VmbErrorType lError = m_ApiController.SendActionCommand(executionTime);
                     if (VmbErrorSuccess != lError) std::cout << "[F]...Could not send Action Command. Reason: " << lError << std::endl;
                 }
                 else {
@@ -190,14 +421,17 @@ void MultiCam::OnBnClickedButtonStartstop()
             actt.stopInterval();
 
             std::cout << "dddddd\n";
-            bool m_framequeue_empty = ((*m_pVideoRecorders[0]).m_framequeue_size() == 0);
-            for (int i = 1; i < num_cam; i++) {
-                m_framequeue_empty = m_framequeue_empty && ((*m_pVideoRecorders[i]).m_framequeue_size() == 0);
+            bool m_framequeue_empty = true;
+            for (size_t i = 0; i < m_pVideoRecorders.size(); i++) {
+                m_framequeue_empty = m_framequeue_empty && (m_pVideoRecorders[i].isNull() || (*m_pVideoRecorders[i]).m_framequeue_size() == 0);
             }
             if (m_framequeue_empty) {
                 std::cout << "ccccccccccccc\n";
-                for (int i = 0; i < num_cam; i++) {
-                    std::cout << i << " framequeue size is " << (*m_pVideoRecorders[i]).m_framequeue_size() << std::endl;
+                // once this returns no callback is inside OnFrameReady(), the recorders,
+                // the burst arena and the sidecars can go
+                m_ApiController.SetFrameConsumer(NULL);
+                m_bIsStreaming = false;
+                for (size_t i = 0; i < m_pVideoRecorders.size(); i++) {
                     if (!m_pVideoRecorders[i].isNull())
                     {
                         m_pVideoRecorders[i]->stopThread();
@@ -209,23 +443,110 @@ void MultiCam::OnBnClickedButtonStartstop()
                         m_pVideoRecorders[i].clear();
                     }
                 }
-                while (!timequeue.empty()) {
-                    double tmp = timequeue.front().first;
-                    int id = timequeue.front().second;
-
-                    fputs((std::to_string(tmp) + "\n").c_str(), pfile[id]);//check
-                    timequeue.pop();
+                m_DropTimer.stop();
+                LogDropSummary();
+                m_SyncTimer.stop();
+                OnSyncUpdate();
+                m_BackpressureTimer.stop();
+                if (m_bMotionGated)
+                {
+                    const uint64_t nowNs = AsyncIoService::nowNs();
+                    const double sessionNs = static_cast<double>(std::max<uint64_t>(1, nowNs - m_MotionStartNs));
+                    std::stringstream motionMsg;
+                    motionMsg << "Motion gate: " << m_MotionGate.openings() << " openings, recorded";
+                    const int gates = MotionGate::SCOPE_RIG == m_MotionGate.currentScope() ? 1 : static_cast<int>(m_Images.size());
+                    for (int i = 0; i < gates; i++) {
+                        if (1 != gates)
+                        {
+                            motionMsg << (0 == i ? " cam " : ", cam ") << i;
+                        }
+                        motionMsg << " " << std::fixed << std::setprecision(1) << 100.0 * m_MotionGate.openNs(i, nowNs) / sessionNs << "%";
+                    }
+                    motionMsg << " of the session";
+                    Log(motionMsg.str());
+                    m_bMotionGated = false;
                 }
-                for (int i = 0; i < num_cam; i++) {
-                    fclose(pfile[i]);
+                {
+                    std::stringstream triggerMsg;
+                    triggerMsg << "Triggers: " << m_TriggerScheduler.fired() << " sent, " << m_TriggerScheduler.skipped()
+                        << " skipped for backpressure, final rate " << m_TriggerScheduler.rate() << " fps";
+                    Log(triggerMsg.str());
+                }
+                // the selection may have changed while recording, the acquisition has one image per camera
+                for (int i = 0; i < static_cast<int>(m_Images.size()); i++) {
+                    const ClockMapper &mapper = m_ApiController.GetClockMapper();
+                    std::stringstream clockMsg;
+                    clockMsg << "cam " << i << ": device clock drift " << mapper.driftPpm(i) << " ppm"
+                        << (mapper.fitted(i) ? "" : " (not fitted)");
+                    Log(clockMsg.str());
+                }
+                if (m_ApiController.IsPtpSynchronized())
+                {
+                    const PtpScheduler &scheduler = m_ApiController.GetPtpScheduler();
+                    std::stringstream ptpMsg;
+                    ptpMsg << "PTP triggers: " << scheduler.scheduled() << " scheduled, "
+                        << scheduler.skipped() << " slots skipped, frames " << scheduler.onTime() << " on time, "
+                        << scheduler.late() << " late, deviation p99 " << scheduler.deviation().percentile(0.99)
+                        << "us, final lead " << scheduler.leadNs() / 1000 << "us";
+                    Log(ptpMsg.str());
+                }
+                if (NULL != m_pSyncMetrics)
+                {
+                    m_pSyncMetrics->append("# session histograms\n" + m_ApiController.GetSyncMonitor().formatHistograms());
+                    m_pSyncMetrics->close();
+                    if (m_pSyncMetrics->failed())
+                    {
+                        Log("Write error in sync metrics " + m_pSyncMetrics->fileName());
+                    }
+                    delete m_pSyncMetrics;
+                    m_pSyncMetrics = NULL;
+                }
+                ui.m_LabelSync->setText(QString("Sync: not recording"));
+                // all recorders are gone, write the buffered triggers and the index
+                if (!m_pSession.isNull())
+                {
+                    m_pSession->close();
+                    std::stringstream sessionMsg;
+                    sessionMsg << "Session file " << m_pSession->fileName() << " closed, "
+                        << m_pSession->incompleteTriggers() << " incomplete triggers, " << m_pSession->lateFrames() << " late frames";
+                    if (m_pSession->failed())
+                    {
+                        sessionMsg << ", WRITE ERROR, the file is damaged";
+                    }
+                    Log(sessionMsg.str());
+                    m_pSession.clear();
                 }
-
-                m_bIsStreaming = false;
                 // Stop acquisition
                 err = m_ApiController.StopContinuousImageAcquisition();
-                // Clear all frames that we have not picked up so far
-                m_ApiController.ClearFrameQueue();
-                for (int i = 0; i < num_cam; i++) m_Images[i] = QImage();
+                // No callback fills the arena anymore, encode it while the next burst can start
+                if (!m_pBurstArena.isNull())
+                {
+                    std::stringstream burstMsg;
+                    burstMsg << "Burst captured:";
+                    for (int i = 0; i < m_pBurstArena->cameras(); i++) {
+                        burstMsg << " cam " << i << " " << m_pBurstArena->frames(i);
+                    }
+                    burstMsg << " frames, " << m_pBurstArena->overruns() << " after the arena was full";
+                    Log(burstMsg.str());
+                    BurstDrainer *pDrainer = new BurstDrainer(m_pBurstArena, m_BurstName, m_ApiController.GetFPS(),
+                        m_ApiController.GetWidth(), m_ApiController.GetHeight(), m_BurstSettings, m_CameraColors, m_CameraRectify);
+                    QObject::connect(pDrainer, SIGNAL(finished()), this, SLOT(OnBurstDrained()), Qt::QueuedConnection);
+                    m_BurstDrainers.push_back(pDrainer);
+                    pDrainer->start();
+                    m_pBurstArena.clear();
+                    m_BurstSettings = RecorderSettings();
+                }
+                // No callback can append time stamps anymore, close the sidecars
+                resetSidecars(0);
+                const LatencyHistogram &ioLatency = AsyncIoService::instance().latency();
+                std::stringstream ioMsg;
+                ioMsg << "I/O " << AsyncIoService::instance().backendName()
+                    << " write latency p50 " << ioLatency.percentile(0.5)
+                    << "us p99 " << ioLatency.percentile(0.99)
+                    << "us max " << ioLatency.max() << "us, "
+                    << AsyncIoService::instance().inFlightBytes() << " bytes in flight";
+                Log(ioMsg.str());
+                for (size_t i = 0; i < m_Images.size(); i++) m_Images[i] = QImage();
 
                 Log("Stopping Acquisition", err);
             }
@@ -233,8 +554,13 @@ void MultiCam::OnBnClickedButtonStartstop()
 
         if (false == m_bIsStreaming)
         {
+            m_bPrerollArmed = false;
             ui.m_ButtonStartStop->setText(QString("Start Image Acquisition"));
         }
+        else if (m_bPrerollArmed)
+        {
+            ui.m_ButtonStartStop->setText(QString("Record (pre-roll armed)"));
+        }
         else
         {
             ui.m_ButtonStartStop->setText(QString("Stop Image Acquisition"));
@@ -244,31 +570,67 @@ void MultiCam::OnBnClickedButtonStartstop()
 }
 
 //
-// This event handler (Qt slot) is triggered through a Qt signal posted by the frame observer
+// Frame handler, called by the frame observers on the Vimba thread of the camera
 //
 // Parameters:
-//  [in]    status          The frame receive status (complete, incomplete, ...)
+//  [in]    event           Camera index, receive status (complete, incomplete, ...) and the frame
 //
-void MultiCam::OnFrameReady(int msg)
+void MultiCam::OnFrameReady(const FrameEvent &event)
 {
-    int status = msg / 10;
-    int cam_index = msg % 10;
+    const int status = event.Status;
+    const int cam_index = event.Camera;
     if (true == m_bIsStreaming)
     {
-        // Pick up frame
-        FramePtr pFrame = m_ApiController.GetFrame(cam_index);
-        if (SP_ISNULL(pFrame))
+        // a reference, copying a FramePtr locks the mutex of its reference count
+        const FramePtr &pFrame = event.Frame;
+        if (SP_ISNULL(pFrame) || cam_index < 0 || cam_index >= static_cast<int>(m_Images.size()))
         {
-            Log("frame pointer is NULL, late frame ready message");
+            Log("frame event without a frame of this acquisition");
             return;
         }
         // See if it is not corrupt
         if (VmbFrameStatusComplete == status)
         {
-            if (!m_pVideoRecorders[cam_index].isNull())
+            // the frame observer measured the motion of this frame before it signaled
+            bool bRecording = true;
+            if (m_bMotionGated)
             {
-                m_pVideoRecorders[cam_index]->enqueueFrame(*pFrame);
-
+                bool bOpened = false, bClosed = false;
+                bRecording = m_MotionGate.update(cam_index, m_ApiController.GetMotionDetector().lastChange(cam_index), AsyncIoService::nowNs(), bOpened, bClosed);
+                if (bOpened || bClosed)
+                {
+                    emit GateChangedSignal(cam_index, bOpened);
+                }
+            }
+            OpenCVRecorder *pRecorder = NULL;
+            if (!m_pBurstArena.isNull())
+            {
+                const VmbUchar_t *pData = NULL;
+                VmbUint32_t nBytes = 0, nWidth = 0, nHeight = 0;
+                VmbPixelFormatType eFormat;
+                VmbUint64_t frameID = 0, frameTimestamp = 0;
+                if (VmbErrorSuccess == SP_ACCESS(pFrame)->GetBuffer(pData)
+                    && VmbErrorSuccess == SP_ACCESS(pFrame)->GetBufferSize(nBytes)
+                    && VmbErrorSuccess == SP_ACCESS(pFrame)->GetWidth(nWidth)
+                    && VmbErrorSuccess == SP_ACCESS(pFrame)->GetHeight(nHeight)
+                    && VmbErrorSuccess == SP_ACCESS(pFrame)->GetPixelFormat(eFormat))
+                {
+                    SP_ACCESS(pFrame)->GetFrameID(frameID);
+                    SP_ACCESS(pFrame)->GetTimestamp(frameTimestamp);
+                    m_pBurstArena->push(cam_index, pData, nBytes, nWidth, nHeight, eFormat, frameID, frameTimestamp, AsyncIoService::nowNs());
+                }
+            }
+            else if (cam_index < static_cast<int>(m_pVideoRecorders.size()) && !m_pVideoRecorders[cam_index].isNull())
+            {
+                pRecorder = m_pVideoRecorders[cam_index].data();
+                pRecorder->enqueueFrame(*pFrame);
+            }
+            // PTP time stamps count ns, an off grid one means its action command came late
+            // all cameras got the same command, camera 0 verifies it once per trigger
+            VmbUint64_t timestamp = 0;
+            if (0 == cam_index && m_ApiController.IsPtpSynchronized() && VmbErrorSuccess == SP_ACCESS(pFrame)->GetTimestamp(timestamp))
+            {
+                m_ApiController.GetPtpScheduler().verify(timestamp);
             }
             VmbUchar_t *pBuffer;
             VmbErrorType err = SP_ACCESS(pFrame)->GetImage(pBuffer);
@@ -279,44 +641,33 @@ void MultiCam::OnFrameReady(int msg)
                 if (VmbErrorSuccess == err)
                 {
                     VmbPixelFormatType ePixelFormat = m_ApiController.GetPixelFormat();
-                    if (!m_Images[cam_index].isNull())
+                    // an idle camera is previewed at a fraction of the rate, debayering it costs as much as recording
+                    VmbUint64_t previewID = 0;
+                    const bool bPreview = bRecording || (VmbErrorSuccess == SP_ACCESS(pFrame)->GetFrameID(previewID) && 0 == previewID % MOTION_IDLE_PREVIEW_EVERY);
+                    cv::Mat converted;
+                    if (!m_Images[cam_index].isNull() && bPreview && NULL != pRecorder && pRecorder->takePreview(converted))
                     {
-                        // Copy it
-                        // We need that because Qt might repaint the view after we have released the frame already
-                        if (ui.m_ColorProcessingCheckBox->checkState() == Qt::Checked)
+                        // the recorder converts and corrects this camera anyway, show its newest BGR image instead of debayering twice
+                        // the view lags the live frame by the recorder backlog
+                        if (!converted.empty())
                         {
-                            static const VmbFloat_t Matrix[] = { 8.0f, 0.1f, 0.1f, // this matrix just makes a quick color to mono conversion
-                                                                    0.1f, 0.8f, 0.1f,
-                                                                    0.0f, 0.0f, 1.0f };
-
-                            if (VmbErrorSuccess != CopyToImage(pBuffer, ePixelFormat, m_Images[cam_index], Matrix))
-                            {
-                                ui.m_ColorProcessingCheckBox->setChecked(false);
-                            }
-
+                            cv::Mat *pShared = new cv::Mat(converted);
+                            emit PreviewReadySignal(cam_index, QImage(pShared->data, pShared->cols, pShared->rows, static_cast<int>(pShared->step),
+                                QImage::Format_RGB888, ReleasePreviewImage, pShared), true);
                         }
-                        else
+                    }
+                    else if (!m_Images[cam_index].isNull() && bPreview)
+                    {
+                        // Copy it
+                        // We need that because Qt might repaint the view after we have released the frame already
+                        if (VmbErrorSuccess == CopyToImage(pBuffer, ePixelFormat, m_Images[cam_index]))
                         {
-                            CopyToImage(pBuffer, ePixelFormat, m_Images[cam_index]);
+                            // tables compiled once per setting change, not a transform info per frame
+                            m_PreviewColors[cam_index]->apply(m_Images[cam_index].bits(), static_cast<size_t>(m_Images[cam_index].width()) * m_Images[cam_index].height());
                         }
 
-                        // Display it
-                        QSize s;
-                        switch (cam_index)
-                        {
-                        case 0:
-                            s = ui.m_LabelStream_1->size();
-                            ui.m_LabelStream_1->setPixmap(QPixmap::fromImage(m_Images[cam_index]).scaled(s, Qt::KeepAspectRatio));
-                            break;
-                        case 1:
-                            s = ui.m_LabelStream_2->size();
-                            ui.m_LabelStream_2->setPixmap(QPixmap::fromImage(m_Images[cam_index]).scaled(s, Qt::KeepAspectRatio));
-                            break;
-                        default:
-                            break;
-                        }
-                        //const QSize s = ui.m_LabelStream_2->size() ;
-                        //ui.m_LabelStream_2->setPixmap( QPixmap::fromImage( m_Images[cam_index] ).scaled(s,Qt::KeepAspectRatio ) );
+                        // Display it, the copy in the signal shares the pixels until the next frame is converted
+                        emit PreviewReadySignal(cam_index, m_Images[cam_index], false);
                     }
                 }
             }
@@ -336,6 +687,288 @@ void MultiCam::OnFrameReady(int msg)
     }
 }
 
+//
+// This event handler (Qt slot) is triggered by m_DropTimer and logs new frame losses
+//
+void MultiCam::OnDropCheck()
+{
+    // a burst ends when the first camera fills its part of the arena
+    if (m_bIsStreaming && !m_pBurstArena.isNull() && m_pBurstArena->full())
+    {
+        Log("Burst arena full, stopping");
+        OnBnClickedButtonStartstop();
+        return;
+    }
+    const DropFrameDetector &detector = m_ApiController.GetDropDetector();
+    const uint64_t seq = detector.alertSequence();
+    if (seq == m_DropAlertSeen)
+    {
+        return;
+    }
+    m_DropAlertSeen = seq;
+    // only the newest event per camera is kept, the counters hold the rest
+    for (int i = 0; i < detector.cameras(); i++) {
+        if (0 == detector.lostTotal(i))
+        {
+            continue;
+        }
+        const DropFrameDetector::drop_event event = detector.lastEvent(i);
+        std::stringstream strMsg;
+        strMsg << "cam " << i << ": " << event.Frames << " frame(s) lost at " << DropFrameDetector::stageName(event.Stage)
+            << " before frame " << event.FrameID << ", " << detector.lostTotal(i) << " lost in total";
+        Log(strMsg.str());
+    }
+}
+
+//
+// This event handler (Qt slot) is triggered by m_SyncTimer and shows the sync quality
+//
+void MultiCam::OnSyncUpdate()
+{
+    // the observers only store time stamps, fit the clocks first, the monitor compares on their timeline
+    m_ApiController.GetClockMapper().update();
+    m_ApiController.GetSyncMonitor().update();
+    const SyncMonitor &monitor = m_ApiController.GetSyncMonitor();
+    if (monitor.cameras() < 2)
+    {
+        return;
+    }
+    ++m_SyncSeconds;
+    const LatencyHistogram &window = monitor.lastWindow(monitor.spread());
+    std::stringstream strLabel;
+    strLabel << "Sync spread p50 " << window.percentile(0.5) << " us, p99 " << window.percentile(0.99)
+        << " us, max " << window.max() << " us | session max " << monitor.spread().Session.max()
+        << " us | " << monitor.triggers() << " triggers, " << monitor.incomplete() << " incomplete";
+    ui.m_LabelSync->setText(QString::fromStdString(strLabel.str()));
+    if (NULL != m_pSyncMetrics)
+    {
+        m_pSyncMetrics->append(monitor.formatMetrics(m_SyncSeconds));
+    }
+    // one alert per window that exceeds a tenth of the frame period
+    if (0 != window.count()
+        && window.percentile(0.99) > m_FramePeriodUs / 10
+        && monitor.triggers() >= m_SyncAlertTriggers + window.count())
+    {
+        m_SyncAlertTriggers = monitor.triggers();
+        std::stringstream strMsg;
+        strMsg << "Sync alert: p99 spread " << window.percentile(0.99) << " us exceeds " << static_cast<int>(m_FramePeriodUs / 10) << " us";
+        Log(strMsg.str());
+    }
+}
+
+//
+// This event handler (Qt slot) is triggered by m_BackpressureTimer and adapts the trigger rate
+//
+void MultiCam::OnBackpressureUpdate()
+{
+    const DropFrameDetector &detector = m_ApiController.GetDropDetector();
+    std::vector<TriggerScheduler::recorder_load> loads;
+    for (size_t i = 0; i < m_pVideoRecorders.size(); i++) {
+        if (m_pVideoRecorders[i].isNull())
+        {
+            continue;
+        }
+        TriggerScheduler::recorder_load load;
+        load.Backlog = m_pVideoRecorders[i]->m_framequeue_size();
+        load.Capacity = m_pVideoRecorders[i]->queueCapacity();
+        load.Dropped = detector.lost(static_cast<int>(i), DropFrameDetector::STAGE_RECORDER);
+        loads.push_back(load);
+    }
+    std::string changes;
+    m_TriggerScheduler.update(AsyncIoService::nowNs(), loads, changes);
+    std::stringstream lines(changes);
+    std::string line;
+    while (std::getline(lines, line)) {
+        Log(line);
+    }
+}
+
+//
+// Record event of an armed pre-roll: the recorders write what they kept and continue live
+//
+void MultiCam::StartRecording()
+{
+    if (!m_bIsStreaming || !m_bPrerollArmed)
+    {
+        return;
+    }
+    m_bPrerollArmed = false;
+    for (size_t i = 0; i < m_pVideoRecorders.size(); i++) {
+        if (!m_pVideoRecorders[i].isNull() && !m_pVideoRecorders[i]->record())
+        {
+            std::stringstream strMsg;
+            strMsg << "cam " << i << ": could not open the recording";
+            Log(strMsg.str());
+        }
+    }
+    Log("Record event, pre-roll flushed");
+    ui.m_ButtonStartStop->setText(QString("Stop Image Acquisition"));
+}
+
+//
+// This event handler (Qt slot) is triggered through GateChangedSignal and records or pauses the recorders
+//
+// Parameters:
+//  [in]    cam_index       The camera whose gate changed
+//  [in]    bRecord         True if the gate opened
+//
+void MultiCam::OnGateChanged(int cam_index, bool bRecord)
+{
+    // queued before the acquisition stopped
+    if (!m_bIsStreaming || !m_bMotionGated)
+    {
+        return;
+    }
+    GateRecorders(cam_index, bRecord);
+}
+
+//
+// Records or pauses the recorders of a motion gate, all of them with the rig scope.
+// Opens files, runs on the GUI thread
+//
+void MultiCam::GateRecorders(int cam_index, bool bRecord)
+{
+    const bool rig = MotionGate::SCOPE_RIG == m_MotionGate.currentScope();
+    for (size_t i = 0; i < m_pVideoRecorders.size(); i++) {
+        if ((!rig && static_cast<int>(i) != cam_index) || m_pVideoRecorders[i].isNull())
+        {
+            continue;
+        }
+        if (!bRecord)
+        {
+            m_pVideoRecorders[i]->pause();
+        }
+        else if (!m_pVideoRecorders[i]->record())
+        {
+            std::stringstream strMsg;
+            strMsg << "cam " << i << ": could not open the recording";
+            Log(strMsg.str());
+        }
+    }
+    std::stringstream strMsg;
+    strMsg << (rig ? std::string("rig") : "cam " + std::to_string(cam_index)) << (bRecord ? ": motion, recording" : ": no motion, paused");
+    Log(strMsg.str());
+}
+
+//
+// This event handler (Qt slot) is triggered when a burst drainer finished and returns its arena
+//
+void MultiCam::OnBurstDrained()
+{
+    for (size_t i = 0; i < m_BurstDrainers.size(); ) {
+        BurstDrainer *pDrainer = m_BurstDrainers[i];
+        if (!pDrainer->isFinished())
+        {
+            i++;
+            continue;
+        }
+        std::stringstream strMsg;
+        strMsg << "Burst " << pDrainer->baseName() << " written, " << pDrainer->written() << " frames, " << pDrainer->dropped() << " dropped";
+        Log(strMsg.str());
+        m_BurstPool.release(pDrainer->arena());
+        delete pDrainer;
+        m_BurstDrainers.erase(m_BurstDrainers.begin() + i);
+    }
+}
+
+void MultiCam::LogDropSummary()
+{
+    const DropFrameDetector &detector = m_ApiController.GetDropDetector();
+    for (int i = 0; i < detector.cameras(); i++) {
+        std::stringstream strMsg;
+        strMsg << "cam " << i << ": " << detector.received(i) << " frames received, lost";
+        for (int s = 0; s < DropFrameDetector::STAGE_COUNT; s++) {
+            const DropFrameDetector::drop_stage stage = static_cast<DropFrameDetector::drop_stage>(s);
+            strMsg << " " << DropFrameDetector::stageName(stage) << " " << detector.lost(i, stage);
+        }
+        Log(strMsg.str());
+    }
+}
+
+//
+// Tiles one preview label per camera over the area of the two designer labels
+//
+// Parameters:
+//  [in]    cameras         The number of cameras to preview
+//
+void MultiCam::LayoutPreviews(int cameras)
+{
+    for (size_t i = 0; i < m_PreviewLabels.size(); i++) {
+        delete m_PreviewLabels[i];
+    }
+    m_PreviewLabels.clear();
+    const QRect area = ui.m_LabelStream_1->geometry().united(ui.m_LabelStream_2->geometry());
+    ui.m_LabelStream_1->hide();
+    ui.m_LabelStream_2->hide();
+    if (cameras <= 0)
+    {
+        return;
+    }
+    // the column count that gives the largest 4:3 tiles, two cameras get about the designer labels
+    int columns = 1;
+    int best = 0;
+    for (int c = 1; c <= cameras; c++) {
+        const int rows = (cameras + c - 1) / c;
+        const int size = std::min(area.width() / c, area.height() / rows * 4 / 3);
+        if (size > best)
+        {
+            best = size;
+            columns = c;
+        }
+    }
+    const int rows = (cameras + columns - 1) / columns;
+    const int width = area.width() / columns;
+    const int height = area.height() / rows;
+    for (int i = 0; i < cameras; i++) {
+        QLabel *pLabel = new QLabel(ui.m_LabelStream_1->parentWidget());
+        pLabel->setGeometry(area.x() + (i % columns) * width, area.y() + (i / columns) * height, width - 2, height - 2);
+        pLabel->setAlignment(Qt::AlignCenter);
+        pLabel->show();
+        m_PreviewLabels.push_back(pLabel);
+    }
+}
+
+//
+// This event handler (Qt slot) is triggered through a Qt signal posted by OnFrameReady and shows a preview
+//
+// Parameters:
+//  [in]    cam_index       The camera of the preview
+//  [in]    image           The converted frame
+//  [in]    bBgr            The image is a BGR view of a recorder image labeled RGB888
+//
+void MultiCam::OnPreviewReady(int cam_index, QImage image, bool bBgr)
+{
+    if (!m_bIsStreaming || image.isNull() || cam_index >= static_cast<int>(m_PreviewLabels.size()))
+    {
+        return;
+    }
+    QLabel *pLabel = m_PreviewLabels[cam_index];
+    // scale first, the channel swap then only touches the label sized copy
+    const QImage scaled = image.scaled(pLabel->size(), Qt::KeepAspectRatio);
+    pLabel->setPixmap(QPixmap::fromImage(bBgr ? scaled.rgbSwapped() : scaled));
+}
+
+//
+// This event handler (Qt slot) is triggered by the color processing option and hands the new settings to preview and recorders
+//
+// Parameters:
+//  [in]    state           The check state of the option
+//
+void MultiCam::OnColorProcessingChanged(int state)
+{
+    for (size_t i = 0; i < m_CameraColors.size() && i < m_selected_cameras.size(); i++) {
+        m_CameraColors[i] = Qt::Checked == state ? m_ColorConfig.forCamera(m_selected_cameras[i]) : ColorSettings();
+        if (i < m_PreviewColors.size())
+        {
+            m_PreviewColors[i]->set(m_CameraColors[i]);
+        }
+        if (i < m_pVideoRecorders.size() && !m_pVideoRecorders[i].isNull())
+        {
+            m_pVideoRecorders[i]->setColor(m_CameraColors[i]);
+        }
+    }
+}
+
 //
 // This event handler (Qt slot) is triggered through a Qt signal posted by the camera observer
 //
@@ -378,7 +1011,7 @@ void MultiCam::OnCameraListChanged(int reason)
 //  [in]    ePixelFormat    The pixel format of the frame
 //  [out]   OutImage        The filled Qt image
 //
-VmbErrorType MultiCam::CopyToImage(VmbUchar_t *pInBuffer, VmbPixelFormat_t ePixelFormat, QImage &pOutImage, const float *Matrix /*= NULL */)
+VmbErrorType MultiCam::CopyToImage(VmbUchar_t *pInBuffer, VmbPixelFormat_t ePixelFormat, QImage &pOutImage)
 {
     const int           nHeight = m_ApiController.GetHeight();
     const int           nWidth = m_ApiController.GetWidth();
@@ -418,25 +1051,8 @@ VmbErrorType MultiCam::CopyToImage(VmbUchar_t *pInBuffer, VmbPixelFormat_t ePixe
     }
     SourceImage.Data = pInBuffer;
     DestImage.Data = pOutImage.bits();
-    // do color processing?
-    if (NULL != Matrix)
-    {
-        VmbTransformInfo TransformParameter;
-        Result = VmbSetColorCorrectionMatrix3x3(Matrix, &TransformParameter);
-        if (VmbErrorSuccess == Result)
-        {
-            Result = VmbImageTransform(&SourceImage, &DestImage, &TransformParameter, 1);
-        }
-        else
-        {
-            Log("could not set matrix t o transform info ", static_cast<VmbErrorType>(Result));
-            return static_cast<VmbErrorType>(Result);
-        }
-    }
-    else
-    {
-        Result = VmbImageTransform(&SourceImage, &DestImage, NULL, 0);
-    }
+    // color correction is applied afterwards by the preview color stage of the camera
+    Result = VmbImageTransform(&SourceImage, &DestImage, NULL, 0);
     if (VmbErrorSuccess != Result)
     {
         Log("could not transform image", static_cast<VmbErrorType>(Result));
@@ -480,7 +1096,7 @@ void MultiCam::UpdateCameraListBox()
 }
 
 //
-// Prints out a given logging string, error code and the descriptive representation of that error code
+// Prints out a given logging string, error code and the descriptive representation of that error code, from any thread
 //
 // Parameters:
 //  [in]    strMsg          A given message to be printed out
@@ -489,16 +1105,27 @@ void MultiCam::UpdateCameraListBox()
 void MultiCam::Log(std::string strMsg, VmbErrorType eErr)
 {
     strMsg += "..." + m_ApiController.ErrorCodeToMessage(eErr);
-    ui.m_ListLog->insertItem(0, QString::fromStdString(strMsg));
+    emit LogSignal(QString::fromStdString(strMsg));
 }
 
 //
-// Prints out a given logging string
+// Prints out a given logging string, from any thread
 //
 // Parameters:
 //  [in]    strMsg          A given message to be printed out
 //
 void MultiCam::Log(std::string strMsg)
 {
-    ui.m_ListLog->insertItem(0, QString::fromStdString(strMsg));
+    emit LogSignal(QString::fromStdString(strMsg));
+}
+
+//
+// This event handler (Qt slot) is triggered through LogSignal and adds a line to the log list
+//
+// Parameters:
+//  [in]    strMsg          The line to add
+//
+void MultiCam::OnLog(QString strMsg)
+{
+    ui.m_ListLog->insertItem(0, strMsg);
 }
@@ -24,11 +24,17 @@
 #include "ApiController.h"
 #include "OpenCVVideoRecorder.h"
 #include "timercpp.h"
+#include "TriggerScheduler.h"
+#include "BurstDrainer.h"
+#include <QTimer>
+#include <atomic>
 using AVT::VmbAPI::Examples::ApiController;
+using AVT::VmbAPI::Examples::FrameEvent;
+using AVT::VmbAPI::Examples::IFrameConsumer;
 
 
 
-class MultiCam : public QMainWindow
+class MultiCam : public QMainWindow, public IFrameConsumer
 {
     Q_OBJECT
 
@@ -36,10 +42,30 @@ public:
     MultiCam(QWidget *parent = 0, Qt::WindowFlags flags = 0);
     ~MultiCam();
 
+    //
+    // Frame handler, called by the frame observers on the Vimba thread of the camera.
+    // Feeds the recorders and hands previews to the GUI thread with PreviewReadySignal
+    //
+    // Parameters:
+    //  [in]    event           Camera index, receive status (complete, incomplete, ...) and the frame
+    //
+    virtual void OnFrameReady(const FrameEvent &event);
+
+public slots:
+    //
+    // Record event while a pre-roll is armed, the software trigger for other
+    // components. Runs in the GUI thread, connect with a queued connection.
+    //
+    void StartRecording();
+
 private:
     typedef QSharedPointer<OpenCVRecorder> OpenCVRecorderPtr;
     //OpenCVRecorderPtr m_pVideoRecorder;
     std::vector<OpenCVRecorderPtr> m_pVideoRecorders;
+    // Closes finished video segments in the background
+    SegmentFinalizer m_SegmentFinalizer;
+    // Shared file of all cameras while recording with the session option
+    SessionContainerPtr m_pSession;
     // The Qt GUI
     Ui::MultiCamClass ui;
     // Our controller that wraps API access
@@ -48,12 +74,82 @@ private:
     std::vector<std::string> m_cameras;
     // A list of selected camera IDs
     std::vector<std::string> m_selected_cameras;
-    // Are we streaming?
-    bool m_bIsStreaming;
+    // Are we streaming? Read by the frame callbacks
+    std::atomic<bool> m_bIsStreaming;
     // Our Qt image to display
     //QImage m_Image;
     std::vector<QImage> m_Images;
+    // One preview label per camera of the running acquisition, tiled over the designer labels
+    std::vector<QLabel*> m_PreviewLabels;
     ActionTimer actt;
+    // Polls the drop frame detector once per frame period
+    QTimer m_DropTimer;
+    // Alert sequence of the detector at the last poll
+    uint64_t m_DropAlertSeen;
+    // Refreshes the sync label and the sync metrics file once a second
+    QTimer m_SyncTimer;
+    // Metrics file of the sync monitor while recording
+    AsyncFileWriter* m_pSyncMetrics;
+    // Seconds since the start of the recording, for the metrics file
+    int m_SyncSeconds;
+    // Trigger count of the last window that raised a sync alert
+    uint64_t m_SyncAlertTriggers;
+    // Frame period of the running acquisition in us, alerts use a tenth of it
+    double m_FramePeriodUs;
+    // Thins out the action commands when a recorder falls behind
+    TriggerScheduler m_TriggerScheduler;
+    // Feeds the recorder backlogs to the trigger scheduler
+    QTimer m_BackpressureTimer;
+    // RAM arenas for bursts, allocated once
+    BurstPool m_BurstPool;
+    // Arena of the running burst, null while recording continuously
+    BurstArenaPtr m_pBurstArena;
+    // Date prefix and output options of the running burst
+    std::string m_BurstName;
+    RecorderSettings m_BurstSettings;
+    // Bursts that are still being encoded
+    std::vector<BurstDrainer*> m_BurstDrainers;
+    // Streaming into the pre-roll rings, waiting for the record event
+    bool m_bPrerollArmed;
+    // Records and pauses the recorders on the motion measure of the frame observers
+    MotionGate m_MotionGate;
+    // The running acquisition is motion gated, the recorders start paused
+    bool m_bMotionGated;
+    // Host time the motion gated acquisition started, for the recorded share
+    uint64_t m_MotionStartNs;
+    // Per camera color settings of the color processing option
+    ColorConfig m_ColorConfig;
+    // Color settings of the running acquisition per camera, identity while the option is off
+    std::vector<ColorSettings> m_CameraColors;
+    // Color correction of the previews that are not taken from a recorder, one per camera
+    std::vector<ColorStagePtr> m_PreviewColors;
+    // Per camera undistortion or rectification of the recordings
+    RectifyConfig m_RectifyConfig;
+    // Maps of the running acquisition per camera, null for cameras recorded as they are
+    std::vector<RectifyMapPtr> m_CameraRectify;
+
+    //
+    // Records or pauses the recorders of a motion gate, all of them with the rig scope.
+    // Opens files, runs on the GUI thread
+    //
+    // Parameters:
+    //  [in]    cam_index       The camera whose gate changed
+    //  [in]    bRecord         True if the gate opened
+    //
+    void GateRecorders(int cam_index, bool bRecord);
+
+    //
+    // Logs the per stage lost frame counters of every camera
+    //
+    void LogDropSummary();
+
+    //
+    // Tiles one preview label per camera over the area of the two designer labels
+    //
+    // Parameters:
+    //  [in]    cameras         The number of cameras to preview
+    //
+    void LayoutPreviews(int cameras);
 
     //
     // Queries and lists all known camera
@@ -61,7 +157,7 @@ private:
     void UpdateCameraListBox();
 
     //
-    // Prints out a given logging string, error code and the descriptive representation of that error code
+    // Prints out a given logging string, error code and the descriptive representation of that error code, from any thread
     //
     // Parameters:
     //  [in]    strMsg          A given message to be printed out
@@ -70,7 +166,7 @@ private:
     void Log(std::string strMsg, VmbErrorType eErr);
 
     //
-    // Prints out a given logging string
+    // Prints out a given logging string, from any thread
     //
     // Parameters:
     //  [in]    strMsg          A given message to be printed out
@@ -85,19 +181,29 @@ private:
     //  [in]    ePixelFormat    The pixel format of the frame
     //  [out]   OutImage        The filled Qt image
     //
-    VmbErrorType CopyToImage(VmbUchar_t *pInBuffer, VmbPixelFormat_t ePixelFormat, QImage &pOutImage, const float *Matrix = NULL);
+    VmbErrorType CopyToImage(VmbUchar_t *pInBuffer, VmbPixelFormat_t ePixelFormat, QImage &pOutImage);
 
 private slots:
     // The event handler for starting / stopping acquisition
     void OnBnClickedButtonStartstop();
 
     //
-    // This event handler (Qt slot) is triggered through a Qt signal posted by the frame observer
+    // This event handler (Qt slot) is triggered through a Qt signal posted by OnFrameReady and shows a preview
+    //
+    // Parameters:
+    //  [in]    cam_index       The camera of the preview
+    //  [in]    image           The converted frame, shared with m_Images or with the recorder of the camera
+    //  [in]    bBgr            The image is a BGR view of a recorder image labeled RGB888
+    //
+    void OnPreviewReady(int cam_index, QImage image, bool bBgr);
+
+    //
+    // This event handler (Qt slot) is triggered by the color processing option and hands the new settings to preview and recorders
     //
     // Parameters:
-    //  [in]    status          The frame receive status (complete, incomplete, ...)
+    //  [in]    state           The check state of the option
     //
-    void OnFrameReady(int msg);
+    void OnColorProcessingChanged(int state);
 
     //
     // This event handler (Qt slot) is triggered through a Qt signal posted by the camera observer
@@ -107,10 +213,63 @@ private slots:
     //
     void OnCameraListChanged(int reason);
 
+    //
+    // This event handler (Qt slot) is triggered by m_DropTimer and logs new frame losses
+    //
+    void OnDropCheck();
+
+    //
+    // This event handler (Qt slot) is triggered by m_SyncTimer and shows the sync quality
+    //
+    void OnSyncUpdate();
+
+    //
+    // This event handler (Qt slot) is triggered by m_BackpressureTimer and adapts the trigger rate
+    //
+    void OnBackpressureUpdate();
+
+    //
+    // This event handler (Qt slot) is triggered when a burst drainer finished and returns its arena
+    //
+    void OnBurstDrained();
+
+    //
+    // This event handler (Qt slot) is triggered through GateChangedSignal and records or pauses the recorders
+    //
+    // Parameters:
+    //  [in]    cam_index       The camera whose gate changed
+    //  [in]    bRecord         True if the gate opened
+    //
+    void OnGateChanged(int cam_index, bool bRecord);
+
+    //
+    // This event handler (Qt slot) is triggered through LogSignal and adds a line to the log list
+    //
+    // Parameters:
+    //  [in]    strMsg          The line to add
+    //
+    void OnLog(QString strMsg);
+
     void AcquisitionLoop(); // useless
 
 signals:
     void StartActionCommandSignal(); // useless
+
+    //
+    // A preview was converted on a Vimba thread or taken from the recorder, queued to the GUI thread
+    //
+    void PreviewReadySignal(int cam_index, QImage image, bool bBgr);
+
+    //
+    // A log line, queued to the GUI thread when it was written on a Vimba thread
+    //
+    void LogSignal(QString strMsg);
+
+    //
+    // The motion gate of a camera opened or closed on a Vimba thread, queued to the GUI thread
+    // that opens and pauses the recordings
+    //
+    void GateChangedSignal(int cam_index, bool bRecord);
 };
 
 #endif
\ No newline at end of file
@@ -1,14 +1,65 @@
 #include "OpenCVVideoRecorder.h"
 #include <windows.h>
+#include <atomic>
+#include <memory>
 
 
-std::string file[num_camera];
-FILE* pfile[num_camera];
-std::queue<std::pair<double, int>> timequeue;
-errno_t err;
+// time stamp sidecar of every camera, NULL while not recording. A slot is set once per
+// acquisition, by the recorder of the camera on any thread, while the frame observers read it.
+// The writers are only freed by resetSidecars(), once no observer runs
+static std::unique_ptr<std::atomic<AsyncFileWriter*>[]> sidecar;
+static int sidecarCount = 0;
 
+//
+// appends one host time stamp to the sidecar of a camera,
+// only copies into the writer's buffer, the file is written by the I/O service
+//
 void push(double a, int id){
-	timequeue.push({ a, id });
+	AsyncFileWriter *pWriter = id >= 0 && id < sidecarCount ? sidecar[id].load(std::memory_order_acquire) : NULL;
+	if (NULL != pWriter)
+	{
+		// same text as std::to_string, without a heap allocation per frame
+		char line[64];
+		int length = snprintf(line, sizeof(line), "%f\n", a);
+		if (length > 0)
+		{
+			pWriter->append(line, length < static_cast<int>(sizeof(line)) ? length : sizeof(line) - 1);
+		}
+	}
+}
+
+void resetSidecars(int cameras)
+{
+	for (int i = 0; i < sidecarCount; i++)
+	{
+		AsyncFileWriter *pWriter = sidecar[i].exchange(NULL);
+		if (NULL != pWriter)
+		{
+			pWriter->close();
+			if (pWriter->failed())
+			{
+				std::cout << "write error in sidecar " << pWriter->fileName() << std::endl;
+			}
+			delete pWriter;
+		}
+	}
+	sidecarCount = cameras > 0 ? cameras : 0;
+	sidecar.reset(new std::atomic<AsyncFileWriter*>[sidecarCount]);
+	for (int i = 0; i < sidecarCount; i++)
+	{
+		sidecar[i].store(NULL);
+	}
+}
+
+//
+// opens the sidecar of a camera unless it is open already, the observers see it from the next frame on
+//
+static void openSidecar(int id, const std::string &fileName)
+{
+	if (NULL == sidecar[id].load(std::memory_order_relaxed))
+	{
+		sidecar[id].store(new AsyncFileWriter(fileName), std::memory_order_release);
+	}
 }
 BaseException::BaseException(const char*fun, const char* msg)
 	{
@@ -33,7 +84,15 @@ VideoRecorderException::~VideoRecorderException() throw() {}
 VmbUint32_t OpenCVRecorder::maxQueueElements() const { return 3000; }
 	
 int OpenCVRecorder::m_framequeue_size() {
-	return m_FrameQueue.size();
+	QMutexLocker local_lock(&m_ClassLock);
+	// an armed pre-roll is no backlog, it is never written unless recording starts
+	return m_FrameQueue.size() + (m_pSpill.isNull() ? 0 : m_pSpill->size())
+		+ (m_pPreroll.isNull() || m_Armed ? 0 : m_pPreroll->size());
+}
+
+VmbUint64_t OpenCVRecorder::queueCapacity() {
+	QMutexLocker local_lock(&m_ClassLock);
+	return (m_pPreroll.isNull() ? maxQueueElements() : m_pPreroll->capacity()) + (m_pSpill.isNull() ? 0 : m_pSpill->capacity());
 }
 	void OpenCVRecorder::run()
 	{
@@ -51,34 +110,106 @@ int OpenCVRecorder::m_framequeue_size() {
 
 			double timetmp;
 			int id;
-			FrameStorePtr tmp;			
+			FrameStorePtr tmp;
+			const SpillRing::slot_header *pSpilled = NULL;
+			const VmbUchar_t *pSpilledData = NULL;
+			bool fromPreroll = false;
+			frame_meta meta;
 			{
 				// two class events unlock the queue
 				// first if a frame arrives enqueueFrame wakes the condition
 				// second if the thread is stopped we are woken up
 				// the while loop is necessary because a condition can be woken up by the system
 				QMutexLocker local_lock(&m_ClassLock);
-				while (!m_StopThread && m_FrameQueue.empty())
+				while (!m_StopThread && m_FrameQueue.empty() && (m_pSpill.isNull() || m_pSpill->empty())
+					&& (m_pPreroll.isNull() || m_Armed || m_pPreroll->empty()))
 				{
 					m_FramesAvailable.wait(local_lock.mutex());
 				}
 				if (!m_StopThread)
 				{
-
-					tmp = m_FrameQueue.front();
-					m_FrameQueue.pop_front();
-					
+					// memory frames are always older than spilled ones
+					if (!m_FrameQueue.empty())
+					{
+						tmp = m_FrameQueue.front();
+						m_FrameQueue.pop_front();
+					}
+					else if (!m_pPreroll.isNull() && !m_Armed && !m_pPreroll->empty())
+					{
+						// encoded in place, the slot stays ours until pop
+						pSpilled = m_pPreroll->front(pSpilledData);
+						fromPreroll = true;
+					}
+					else
+					{
+						// the slot stays ours until pop, enqueueFrame never writes a used slot
+						pSpilled = m_pSpill->front(pSpilledData);
+					}
 				}
 			}// scope for the lock, from now one we don't need the class lock
-			if (!m_StopThread)
+			// a frame taken off the queue is written even if a stop came in meanwhile
+			if (!tmp.isNull() || NULL != pSpilled)
 			{
 				static QMutex timestp;
 				timestp.lock();
-				convertImage(*tmp);
+				if (NULL != pSpilled)
+				{
+					convertImage(pSpilledData, pSpilled->Width, pSpilled->Height, pSpilled->PixelFormat);
+					meta.FrameID = pSpilled->FrameID;
+					meta.Timestamp = pSpilled->Timestamp;
+					meta.HostTime = pSpilled->HostTime;
+				}
+				else
+				{
+					convertImage(*tmp);
+					meta.FrameID = tmp->frameID();
+					meta.Timestamp = tmp->timestamp();
+					meta.HostTime = tmp->hostTime();
+				}
+				// roll over at a frame boundary, a failing writer ends the recording
+				if (segmentFull())
+				{
+					closeSegment();
+					if (!openSegment())
+					{
+						std::cout << "could not open segment " << m_SegmentName << std::endl;
+						timestp.unlock();
+						break;
+					}
+				}
 				std::cout << "before write time is : " << clock() << "\n";
-				m_VideoWriter << m_ConvertImage;
+				if (m_pVideoWriter->write(m_ConvertImage, meta) && !m_pVideoWriter->failed())
+				{
+					++m_SegmentFrames;
+				}
+				else
+				{
+					// the frame is lost like an overwritten one, the segment is marked in the manifest
+					if (!m_SegmentFailed)
+					{
+						std::cout << "write error in " << m_SegmentName << std::endl;
+						m_SegmentFailed = true;
+					}
+					if (NULL != m_Settings.DropDetector)
+					{
+						m_Settings.DropDetector->recorderDropped(cam_id, meta.FrameID);
+					}
+				}
 				std::cout << "after write time is : " << clock() << "\n";
 				timestp.unlock();
+				publishPreview();
+				if (NULL != pSpilled)
+				{
+					QMutexLocker local_lock(&m_ClassLock);
+					if (fromPreroll)
+					{
+						m_pPreroll->pop();
+					}
+					else
+					{
+						m_pSpill->pop();
+					}
+				}
 				
 				/*
 								if (count < 3000) {
@@ -101,37 +232,145 @@ int OpenCVRecorder::m_framequeue_size() {
 				std::cout << "avg is :" << avg / 3000 << "\n";
 				std::cout << "maxtime is :" << maxtime << "\n";
 		 */
+		closeSegment();
+	}
+
+	//
+	// Method: createSpill()
+	//
+	// Purpose: pre-allocate the overflow ring of the settings, called by the
+	//          constructor before any frame arrives. m_pSpill stays null if the
+	//          ring is disabled or could not be created.
+	//
+	void OpenCVRecorder::createSpill()
+	{
+		if (0 == m_Settings.SpillBytes || 0 == m_Settings.FrameBytes)
+		{
+			return;
+		}
+		SpillRingPtr pSpill(new SpillRing(m_SpillPath, m_Settings.FrameBytes, m_Settings.SpillBytes));
+		if (!pSpill->isOpen())
+		{
+			std::cout << "spill disabled for " << m_SpillPath << std::endl;
+			return;
+		}
+		m_pSpill = pSpill;
 	}
 
 	bool OpenCVRecorder::convertImage(frame_store &frame)
+	{
+		return convertImage(frame.data(), frame.width(), frame.height(), frame.pixelFormat());
+	}
+
+	bool OpenCVRecorder::convertImage(const VmbUchar_t *pData, VmbUint32_t Width, VmbUint32_t Height, VmbPixelFormat_t PixelFormat)
 	{
 		VmbImage srcImage;
 		VmbImage dstImage;
 		srcImage.Size = sizeof(srcImage);
 		dstImage.Size = sizeof(dstImage);
-		VmbSetImageInfoFromPixelFormat(frame.pixelFormat(), frame.width(), frame.height(), &srcImage);
+		VmbSetImageInfoFromPixelFormat(PixelFormat, Width, Height, &srcImage);
 		VmbSetImageInfoFromPixelFormat(VmbPixelFormatBgr8, m_ConvertImage.cols, m_ConvertImage.rows, &dstImage);
-		srcImage.Data = frame.data();
+		srcImage.Data = const_cast<VmbUchar_t*>(pData);
 		dstImage.Data = m_ConvertImage.data;
-		return VmbErrorSuccess == VmbImageTransform(&srcImage, &dstImage, NULL, 0);
+		if (VmbErrorSuccess != VmbImageTransform(&srcImage, &dstImage, NULL, 0))
+		{
+			return false;
+		}
+		m_Color.apply(m_ConvertImage.data, static_cast<size_t>(m_ConvertImage.rows) * m_ConvertImage.cols);
+		// remap cannot work in place, the rectified frame becomes the converted one
+		if (!m_Settings.Rectify.isNull() && m_Settings.Rectify->apply(m_ConvertImage, m_RectifyImage))
+		{
+			cv::swap(m_ConvertImage, m_RectifyImage);
+		}
+		return true;
+	}
+
+	//
+	// Method: publishPreview()
+	//
+	// Purpose: hand the image just written to a waiting preview. The buffers
+	//          swap, the next frame is converted into the previous preview
+	//          unless the preview still holds it.
+	//
+	void OpenCVRecorder::publishPreview()
+	{
+		{
+			QMutexLocker local_lock(&m_PreviewLock);
+			if (!m_PreviewWanted)
+			{
+				return;
+			}
+			m_PreviewWanted = false;
+			cv::swap(m_ConvertImage, m_PreviewImage);
+		}
+		// cv::Mat counts its references atomically, one is ours
+		if (m_ConvertImage.empty() || m_ConvertImage.u->refcount > 1)
+		{
+			m_ConvertImage = cv::Mat(m_PreviewImage.rows, m_PreviewImage.cols, CV_8UC3);
+		}
+	}
 
+	bool OpenCVRecorder::takePreview(cv::Mat &Image)
+	{
+		{
+			QMutexLocker local_lock(&m_ClassLock);
+			if (!m_pPreroll.isNull() && m_Armed)
+			{
+				return false;
+			}
+		}
+		QMutexLocker local_lock(&m_PreviewLock);
+		// still wanted means nothing was published since the last call
+		// a reference stays with the recorder, the next publish swaps the buffers again
+		Image = m_PreviewWanted ? cv::Mat() : m_PreviewImage;
+		m_PreviewWanted = true;
+		return true;
 	}
 
-	OpenCVRecorder::OpenCVRecorder(const QString &fileName, VmbFloat_t fps, VmbUint32_t Width, VmbUint32_t Height)
+	OpenCVRecorder::OpenCVRecorder(int cam_index, const QString &fileName, VmbFloat_t fps, VmbUint32_t Width, VmbUint32_t Height, const RecorderSettings &settings)
 		: m_StopThread(false)
+		, m_Settings(settings)
 #ifdef _MSC_VER // codec selection only supported by Windows
-		//, m_VideoWriter(fileName.toStdString(), FOURCC_USER_SELECT, fps, cv::Size(Width, Height), true)
-		, m_VideoWriter(fileName.toStdString(), FOURCC_MJPEG, fps, cv::Size(Width, Height), true)
+		//, m_Fourcc(FOURCC_USER_SELECT)
+		, m_Fourcc(FOURCC_MJPEG)
 #else
-		, m_VideoWriter(fileName.toStdString(), FOURCC_X264, fps, cv::Size(Width, Height), true)
+		, m_Fourcc(FOURCC_X264)
 #endif
+		, m_FPS(fps)
+		, m_Segment(-1)
+		, m_SegmentFrames(0)
+		, m_SegmentFailed(false)
 		, m_ConvertImage(Height, Width, CV_8UC3)
+		, m_PreviewWanted(false)
+		, m_Color(ColorPipeline::ORDER_BGR)
+		, m_Armed(false)
+		, m_Pausing(false)
+		, m_SpillPath(fileName.toStdString() + ".spill")
+		, cam_id(cam_index)
 	{
 
-		int id = fileName.toStdString().at(22)-'0';
-		cam_id = id;
-		file[id] = fileName.toStdString();
-		err = fopen_s(&pfile[id], (file[id] + ".txt").c_str(), "w");
+		// the sidecar table is sized by resetSidecars() for the acquisition
+		if (cam_id < 0 || (m_Settings.Sidecar && cam_id >= sidecarCount))
+		{
+			throw VideoRecorderException(__FUNCTION__, "camera index out of range");
+		}
+		const int id = cam_id;
+		m_FileName = fileName.toStdString();
+		m_Color.set(m_Settings.Color);
+		if (0 != m_Settings.PrerollFrames)
+		{
+			m_pPreroll = PrerollRingPtr(new PrerollRing(m_Settings.FrameBytes, m_Settings.PrerollFrames));
+			if (!m_pPreroll->isOpen())
+			{
+				throw VideoRecorderException(__FUNCTION__, "could not allocate pre-roll");
+			}
+			m_Armed = true;
+		}
+		createSpill();
+		if (m_Settings.Sidecar && !m_Armed)
+		{
+			openSidecar(id, m_FileName + ".txt");
+		}
 		std::cout << "id is " << id << std::endl;
 		std::cout << fileName.toStdString() << std::endl;
 
@@ -140,11 +379,151 @@ int OpenCVRecorder::m_framequeue_size() {
 					std::cout << "bb";
 				}
 		*/
-		if (!m_VideoWriter.isOpened())
+		std::string::size_type dot = m_FileName.rfind('.');
+		m_BaseName = m_FileName.substr(0, dot);
+		m_Extension = std::string::npos == dot ? std::string(".avi") : m_FileName.substr(dot);
+		if (RecorderSettings::CONTAINER_MCR == m_Settings.Container)
+		{
+			m_Extension = ".mcr";
+		}
+		if (!m_Armed && !openSegment())
 		{
 			throw VideoRecorderException(__FUNCTION__, "could not open recorder");
 		}
 	}
+
+	bool OpenCVRecorder::record()
+	{
+		QMutexLocker local_lock(&m_ClassLock);
+		m_Pausing = false;
+		if (!m_Armed)
+		{
+			return true;
+		}
+		// output is opened by the first event only, later ones continue it after a pause
+		if (m_Segment < 0)
+		{
+			// the time stamps of the pre-roll are in the seek index, the sidecar starts with the event
+			if (m_Settings.Sidecar)
+			{
+				openSidecar(cam_id, m_FileName + ".txt");
+			}
+			if (!openSegment())
+			{
+				return false;
+			}
+		}
+		m_Armed = false;
+		m_FramesAvailable.wakeOne();
+		return true;
+	}
+
+	void OpenCVRecorder::pause()
+	{
+		QMutexLocker local_lock(&m_ClassLock);
+		if (!m_pPreroll.isNull() && !m_Armed)
+		{
+			m_Pausing = true;
+		}
+	}
+
+	bool OpenCVRecorder::armed()
+	{
+		QMutexLocker local_lock(&m_ClassLock);
+		return m_Armed;
+	}
+
+	//
+	// Method: openSegment()
+	//
+	// Purpose: start the next output file <base>_NNN<ext> and list it in the manifest.
+	//
+	// Returns: false if the writer could not be opened
+	//
+	bool OpenCVRecorder::openSegment()
+	{
+		++m_Segment;
+		m_SegmentFrames = 0;
+		m_SegmentFailed = false;
+		char suffix[16];
+		sprintf(suffix, "_%03d", m_Segment);
+		m_SegmentName = m_BaseName + suffix + m_Extension;
+		const cv::Size size(m_ConvertImage.cols, m_ConvertImage.rows);
+		if (RecorderSettings::CONTAINER_SESSION == m_Settings.Container)
+		{
+			// the session file is shared, the manifest entry names it once per camera
+			m_SegmentName = m_Settings.Session.isNull() ? std::string() : m_Settings.Session->fileName();
+			m_pVideoWriter = VideoSinkPtr(new SessionSink(m_Settings.Session, cam_id));
+		}
+		else if (RecorderSettings::CONTAINER_MCR == m_Settings.Container)
+		{
+			m_pVideoWriter = VideoSinkPtr(new McrSink(m_SegmentName, m_FPS, size, m_Settings.IndexInterval, cam_id, m_Segment));
+		}
+		else
+		{
+			m_pVideoWriter = VideoSinkPtr(new AviSink(m_SegmentName, m_Fourcc, m_FPS, size, cam_id, m_Segment));
+		}
+		if (!m_pVideoWriter->isOpened())
+		{
+			return false;
+		}
+		if (!m_Settings.Manifest.isNull())
+		{
+			m_Settings.Manifest->segmentOpened(cam_id, m_Segment, m_SegmentName);
+		}
+		return true;
+	}
+
+	//
+	// Method: closeSegment()
+	//
+	// Purpose: hand the current writer to the finalizer, or release it here without one.
+	//
+	void OpenCVRecorder::closeSegment()
+	{
+		if (m_pVideoWriter.isNull())
+		{
+			return;
+		}
+		if (NULL != m_Settings.Finalizer)
+		{
+			m_Settings.Finalizer->finalize(m_pVideoWriter, m_Settings.Manifest, m_SegmentName, cam_id, m_Segment, m_SegmentFrames);
+		}
+		else
+		{
+			m_pVideoWriter->release();
+			if (!m_Settings.Manifest.isNull())
+			{
+				m_Settings.Manifest->segmentClosed(cam_id, m_Segment, m_SegmentName, m_SegmentFrames, m_pVideoWriter->failed());
+			}
+		}
+		m_pVideoWriter.clear();
+	}
+
+	//
+	// Method: segmentFull()
+	//
+	// Purpose: check the rotation limits, called before a frame is written.
+	//          The file size is only polled every 64 frames.
+	//
+	bool OpenCVRecorder::segmentFull() const
+	{
+		if (0 == m_SegmentFrames
+			|| RecorderSettings::CONTAINER_SESSION == m_Settings.Container)
+		{
+			return false;
+		}
+		if (0 != m_Settings.SegmentMinutes
+			&& m_SegmentFrames >= static_cast<VmbUint64_t>(m_FPS * 60.0 * m_Settings.SegmentMinutes))
+		{
+			return true;
+		}
+		if (0 != m_Settings.SegmentBytes && 0 == (m_SegmentFrames & 63))
+		{
+			return m_pVideoWriter->bytesWritten() >= m_Settings.SegmentBytes;
+		}
+		return false;
+	}
 	OpenCVRecorder::~OpenCVRecorder() { 
 
 	}
@@ -153,6 +532,14 @@ int OpenCVRecorder::m_framequeue_size() {
 		QMutexLocker local_lock(&m_ClassLock);
 		m_StopThread = true;
 		m_FrameQueue.clear();
+		if (!m_pSpill.isNull())
+		{
+			m_pSpill->clear();
+		}
+		if (!m_pPreroll.isNull())
+		{
+			m_pPreroll->clear();
+		}
 		m_FramesAvailable.wakeOne();
 	}
 	bool OpenCVRecorder::enqueueFrame(const AVT::VmbAPI::Frame &frame)
@@ -161,6 +548,9 @@ int OpenCVRecorder::m_framequeue_size() {
 		VmbUint32_t         Height;
 		VmbUint32_t         BufferSize;
 		VmbPixelFormatType  PixelFormat;
+		VmbUint64_t         FrameID(0);
+		VmbUint64_t         Timestamp(0);
+		const VmbUint64_t   HostTime = AsyncIoService::nowNs();
 		const VmbUchar_t*   pBuffer(NULL);
 
 		if (VmbErrorSuccess == frame.GetPixelFormat(PixelFormat)
@@ -169,35 +559,93 @@ int OpenCVRecorder::m_framequeue_size() {
 			&& VmbErrorSuccess == frame.GetBufferSize(BufferSize)
 			&& VmbErrorSuccess == frame.GetBuffer(pBuffer))
 		{
-			if (m_ConvertImage.cols == Width
-				&& m_ConvertImage.rows == Height)
+			frame.GetFrameID(FrameID);
+			frame.GetTimestamp(Timestamp);
+			return enqueueRaw(pBuffer, BufferSize, Width, Height, PixelFormat, FrameID, Timestamp, HostTime);
+		}
+		return false;
+	}
+	bool OpenCVRecorder::enqueueRaw(const VmbUchar_t *pBuffer, VmbUint32_t BufferSize, VmbUint32_t Width, VmbUint32_t Height, VmbPixelFormatType PixelFormat,
+		VmbUint64_t FrameID, VmbUint64_t Timestamp, VmbUint64_t HostTime)
+	{
+		if (m_ConvertImage.cols == Width
+			&& m_ConvertImage.rows == Height)
+		{
+			QMutexLocker local_lock(&m_ClassLock);
+			if (!m_pPreroll.isNull())
 			{
-				QMutexLocker local_lock(&m_ClassLock);
-				FrameStorePtr pFrame;
-				// in case we reached the maximum number of queued frames
-				// take of the oldest and reuse it to store the newly arriving frame
-				if (m_FrameQueue.size() >= static_cast<FrameQueue::size_type>(maxQueueElements()))
-				{
-					std::cout << "m_frame_queue is full\n";
-					pFrame = m_FrameQueue.front();
-					m_FrameQueue.pop_front();
-					if (!pFrame->equal(Width, Height, PixelFormat))
+				// a pause takes effect once run() wrote everything, the ring may overwrite from then on
+				if (m_Pausing && m_pPreroll->empty() && (m_pSpill.isNull() || m_pSpill->empty()))
+				{
+					m_Pausing = false;
+					m_Armed = true;
+				}
+				// the ring is the memory tier, armed it drops its oldest frame, recording it fills up
+				if ((m_pSpill.isNull() || m_pSpill->empty())
+					&& m_pPreroll->push(pBuffer, BufferSize, Width, Height, PixelFormat, FrameID, Timestamp, HostTime, m_Armed))
+				{
+					if (!m_Armed)
 					{
-						pFrame.clear();
+						m_FramesAvailable.wakeOne();
 					}
+					return true;
 				}
-				if (pFrame.isNull())
+				if (!m_pSpill.isNull() && m_pSpill->push(pBuffer, BufferSize, Width, Height, PixelFormat, FrameID, Timestamp, HostTime))
 				{
-					pFrame = FrameStorePtr(new frame_store(pBuffer, BufferSize, Width, Height, PixelFormat));
+					m_FramesAvailable.wakeOne();
+					return true;
 				}
-				else
+				std::cout << "pre-roll ring is full\n";
+				if (NULL != m_Settings.DropDetector)
+				{
+					m_Settings.DropDetector->recorderDropped(cam_id, FrameID);
+				}
+				return false;
+			}
+			// once frames are spilled every newer frame has to follow them to keep the order,
+			// a full ring drops the new frame, the queued and spilled ones are older
+			if (!m_pSpill.isNull()
+				&& (!m_pSpill->empty() || m_FrameQueue.size() >= static_cast<FrameQueue::size_type>(maxQueueElements())))
+			{
+				if (m_pSpill->push(pBuffer, BufferSize, Width, Height, PixelFormat, FrameID, Timestamp, HostTime))
+				{
+					m_FramesAvailable.wakeOne();
+					return true;
+				}
+				if (NULL != m_Settings.DropDetector)
+				{
+					m_Settings.DropDetector->recorderDropped(cam_id, FrameID);
+				}
+				return false;
+			}
+			FrameStorePtr pFrame;
+			// in case we reached the maximum number of queued frames
+			// take of the oldest and reuse it to store the newly arriving frame
+			if (m_FrameQueue.size() >= static_cast<FrameQueue::size_type>(maxQueueElements()))
+			{
+				std::cout << "m_frame_queue is full\n";
+				pFrame = m_FrameQueue.front();
+				m_FrameQueue.pop_front();
+				if (NULL != m_Settings.DropDetector)
 				{
-					pFrame->setData(pBuffer, BufferSize);
+					m_Settings.DropDetector->recorderDropped(cam_id, pFrame->frameID());
 				}
-				m_FrameQueue.push_back(pFrame);
-				m_FramesAvailable.wakeOne();
-				return true;
+				if (!pFrame->equal(Width, Height, PixelFormat))
+				{
+					pFrame.clear();
+				}
+			}
+			if (pFrame.isNull())
+			{
+				pFrame = FrameStorePtr(new frame_store(pBuffer, BufferSize, Width, Height, PixelFormat, FrameID, Timestamp, HostTime));
+			}
+			else
+			{
+				pFrame->setData(pBuffer, BufferSize, FrameID, Timestamp, HostTime);
 			}
+			m_FrameQueue.push_back(pFrame);
+			m_FramesAvailable.wakeOne();
+			return true;
 		}
 		return false;
 	}
@@ -19,16 +19,26 @@
 #include <stdio.h>
 #include <iostream>
 #include <queue>
+#include "SpillRing.h"
+#include "PrerollRing.h"
+#include "SessionManifest.h"
+#include "AsyncFileWriter.h"
+#include "SessionContainer.h"
+#include "drop_frame_detection.h"
+#include "ColorPipeline.h"
+#include "RectifyMap.h"
 
-#define num_camera 2
-
-extern std::queue<std::pair<double, int>> timequeue;
-extern FILE* pfile[num_camera];
-extern std::string file[num_camera];
-
-
+//
+// appends a time stamp to the sidecar of a camera, nothing while the camera does not record,
+// called by the frame observers
+//
 void push(double a, int id);
 //
+// closes the sidecars of the last acquisition and makes room for the cameras of the next one,
+// only while no frame observer runs
+//
+void resetSidecars(int cameras);
+//
 // Base exception
 //
 class BaseException: public std::exception
@@ -50,6 +60,46 @@ public:
 	~VideoRecorderException() throw();
 };
 //
+// Output options of one recorder
+//
+struct RecorderSettings
+{
+	enum container_type
+	{
+		CONTAINER_AVI,                          // cv::VideoWriter, unreadable if the process dies
+		CONTAINER_MCR,                          // chunked JPEG container with periodic index, see ChunkedContainer.h
+		CONTAINER_SESSION,                      // one track of Session, shared by all cameras, never rotated
+	};
+	container_type          Container;
+	VmbUint32_t             IndexInterval;      // MCR: frames between two index chunks
+	VmbUint32_t             SegmentMinutes;     // roll to a new file after this many minutes of frames, 0 disables
+	VmbUint64_t             SegmentBytes;       // roll to a new file once it grows past this size, 0 disables
+	SessionManifestPtr      Manifest;           // lists every segment of the session, may be null
+	SegmentFinalizer*       Finalizer;          // closes old segments in the background, inline release if null
+	SessionContainerPtr     Session;            // CONTAINER_SESSION: the shared multi track file
+	DropFrameDetector*      DropDetector;       // told about queue overwrites, may be null
+	bool                    Sidecar;            // open the time stamp sidecar the frame observer appends to
+	VmbUint32_t             PrerollFrames;      // frames kept before the record event, 0 records right away
+	VmbUint32_t             FrameBytes;         // raw frame size, sizes the pre-roll and spill slots
+	VmbUint64_t             SpillBytes;         // disk overflow ring of the queue, see SpillRing::budget(), 0 disables it
+	ColorSettings           Color;              // color correction of the written frames, identity by default
+	RectifyMapPtr           Rectify;            // undistortion or rectification of the written frames, none if null
+
+	RecorderSettings()
+		: Container(CONTAINER_AVI)
+		, IndexInterval(30)
+		, SegmentMinutes(10)
+		, SegmentBytes(2ull << 30)
+		, Finalizer(NULL)
+		, DropDetector(NULL)
+		, Sidecar(true)
+		, PrerollFrames(0)
+		, FrameBytes(0)
+		, SpillBytes(0)
+	{
+	}
+};
+//
 // Video recorder using open cv VideoWriter 
 //
 class OpenCVRecorder: public QThread
@@ -82,17 +132,24 @@ class OpenCVRecorder: public QThread
 		VmbUint32_t                 m_Width;            // frame width
 		VmbUint32_t                 m_Height;           // frame height
 		VmbPixelFormat_t            m_PixelFormat;      // frame pixel format
+		VmbUint64_t                 m_FrameID;          // camera frame ID
+		VmbUint64_t                 m_Timestamp;        // camera time stamp
+		VmbUint64_t                 m_HostTime;         // steady clock ns at enqueue
 	public:
 		//
 		// Method: frame_store()
 		//
 		// Purpose: default constructing frame store from data pointer and dimensions
 		//
-		frame_store(const VmbUchar_t *pBuffer, VmbUint32_t BufferByteSize, VmbUint32_t Width, VmbUint32_t Height, VmbPixelFormatType PixelFormat)
+		frame_store(const VmbUchar_t *pBuffer, VmbUint32_t BufferByteSize, VmbUint32_t Width, VmbUint32_t Height, VmbPixelFormatType PixelFormat,
+			VmbUint64_t FrameID, VmbUint64_t Timestamp, VmbUint64_t HostTime)
 			: m_Data(pBuffer, pBuffer + BufferByteSize)
 			, m_Width(Width)
 			, m_Height(Height)
 			, m_PixelFormat(PixelFormat)
+			, m_FrameID(FrameID)
+			, m_Timestamp(Timestamp)
+			, m_HostTime(HostTime)
 		{
 		}
 		//
@@ -109,15 +166,18 @@ class OpenCVRecorder: public QThread
 		//
 		// Method: setData
 		//
-		// Purpose: copy data into frame store from matching source
+		// Purpose: copy data and frame meta data into frame store from matching source
 		//
 		// Returns: false if data size not equal to internal buffer size
 		//
-		bool setData(const VmbUchar_t *Buffer, VmbUint32_t BufferSize)
+		bool setData(const VmbUchar_t *Buffer, VmbUint32_t BufferSize, VmbUint64_t FrameID, VmbUint64_t Timestamp, VmbUint64_t HostTime)
 		{
 			if (BufferSize == dataSize())
 			{
 				std::copy(Buffer, Buffer + BufferSize, m_Data.begin());
+				m_FrameID = FrameID;
+				m_Timestamp = Timestamp;
+				m_HostTime = HostTime;
 				return true;
 			}
 			return false;
@@ -141,6 +201,24 @@ class OpenCVRecorder: public QThread
 		//
 		VmbUint32_t         height()        const { return m_Height; }
 		//
+		// Methode: frameID()
+		//
+		// Purpose: get the camera frame ID.
+		//
+		VmbUint64_t         frameID()       const { return m_FrameID; }
+		//
+		// Methode: timestamp()
+		//
+		// Purpose: get the camera time stamp.
+		//
+		VmbUint64_t         timestamp()     const { return m_Timestamp; }
+		//
+		// Methode: hostTime()
+		//
+		// Purpose: get the host time the frame was queued at.
+		//
+		VmbUint64_t         hostTime()      const { return m_HostTime; }
+		//
 		// Methode: dataSize()
 		//
 		// Purpose: get buffer size of internal data.
@@ -161,27 +239,105 @@ class OpenCVRecorder: public QThread
 	};
     typedef QSharedPointer<frame_store> FrameStorePtr;  // shared pointer to frame store data
     typedef QList<FrameStorePtr>        FrameQueue;     // queue of frames tore pointers
+    typedef QSharedPointer<SpillRing>   SpillRingPtr;   // shared pointer to the disk overflow ring
 
-    cv::VideoWriter         m_VideoWriter;              // OpenCV VideoWriter
+    VideoSinkPtr            m_pVideoWriter;             // output of the current segment
+    RecorderSettings        m_Settings;                 // segment limits, manifest and finalizer
+    std::string             m_FileName;                 // file name given to the constructor, the sidecar appends .txt
+    std::string             m_BaseName;                 // file name without extension, segments append _NNN
+    std::string             m_Extension;                // container extension including the dot
+    std::string             m_SegmentName;              // file name of the current segment
+    int                     m_Fourcc;                   // codec of all segments
+    VmbFloat_t              m_FPS;                      // nominal frame rate, used for time based rotation
+    int                     m_Segment;                  // index of the current segment
+    VmbUint64_t             m_SegmentFrames;            // frames written into the current segment
+    bool                    m_SegmentFailed;            // a write into the current segment failed, logged once per segment
 
     cv::Mat                 m_ConvertImage;             // storage for converted image, data should only be accessed inside run
                                                         // size and format are const while thread runs
+    cv::Mat                 m_PreviewImage;             // last converted image handed to the preview, swapped with m_ConvertImage
+    bool                    m_PreviewWanted;            // the preview asked for a frame since the last publishPreview
+    QMutex                  m_PreviewLock;              // guards m_PreviewImage and m_PreviewWanted
+    ColorStage              m_Color;                    // color correction of m_ConvertImage, applied inside run
+    cv::Mat                 m_RectifyImage;             // remap target, swapped with m_ConvertImage after every frame
 
     FrameQueue              m_FrameQueue;               // frame data queue for frames that are to be saved into video stream
+    SpillRingPtr            m_pSpill;                   // overflow ring file, frames go here while m_FrameQueue is full
+                                                        // or while older frames are still spilled, null if disabled
+    PrerollRingPtr          m_pPreroll;                 // with a pre-roll: the memory tier instead of m_FrameQueue
+    bool                    m_Armed;                    // pre-roll only, nothing is written before record()
+    bool                    m_Pausing;                  // pre-roll only, arms again once the backlog is written
+    std::string             m_SpillPath;                // path of the overflow ring file
     bool                    m_StopThread;               // flag to signal that the thread has to finish
     QMutex                  m_ClassLock;                // shared data lock
     QWaitCondition          m_FramesAvailable;          // queue frame available condition
 
 	void run();
+	void createSpill();
+	bool openSegment();
+	void closeSegment();
+	bool segmentFull() const;
 	bool convertImage(frame_store &frame);
+	bool convertImage(const VmbUchar_t *pData, VmbUint32_t Width, VmbUint32_t Height, VmbPixelFormat_t PixelFormat);
+	void publishPreview();
 public:
 	int cam_id = -1;
 
-	OpenCVRecorder(const QString &fileName, VmbFloat_t fps, VmbUint32_t Width, VmbUint32_t Height);
+	OpenCVRecorder(int cam_index, const QString &fileName, VmbFloat_t fps, VmbUint32_t Width, VmbUint32_t Height, const RecorderSettings &settings = RecorderSettings());
 	virtual ~OpenCVRecorder();
 	void stopThread();
 	bool enqueueFrame(const AVT::VmbAPI::Frame &frame);
+	//
+	// Method: record()
+	//
+	// Purpose: record event of an armed recorder. Opens the output, the
+	//          pre-roll is written first and the live frames follow it.
+	//
+	// Returns: false if the output could not be opened
+	//
+	bool record();
+	//
+	// Method: pause()
+	//
+	// Purpose: stop writing after the frames queued so far, the recorder
+	//          keeps a pre-roll again and the segment stays open for the
+	//          next record(). Only for recorders with a pre-roll.
+	//
+	void pause();
+	bool armed();
+	//
+	// Method: enqueueRaw()
+	//
+	// Purpose: queue a raw frame that was stored earlier, e.g. by a burst, with its original meta data.
+	//
+	bool enqueueRaw(const VmbUchar_t *pBuffer, VmbUint32_t BufferSize, VmbUint32_t Width, VmbUint32_t Height, VmbPixelFormatType PixelFormat,
+		VmbUint64_t FrameID, VmbUint64_t Timestamp, VmbUint64_t HostTime);
 	int m_framequeue_size();
+	//
+	// Method: queueCapacity()
+	//
+	// Purpose: frames the recorder can hold in memory and spilled before it drops one.
+	//
+	VmbUint64_t queueCapacity();
+	//
+	// Method: takePreview()
+	//
+	// Purpose: the BGR image of the newest frame the recorder converted, for
+	//          the preview of frames that are recorded anyway. Image shares the
+	//          buffer with the recorder, which converts into a different one
+	//          as long as the caller holds it.
+	//
+	// Returns: false while the recorder does not convert the live frames
+	//          (armed pre-roll), the caller converts the frame itself. Image is
+	//          empty if no frame was converted since the last call.
+	//
+	bool takePreview(cv::Mat &Image);
+	//
+	// Method: setColor()
+	//
+	// Purpose: new color correction, from the next converted frame on.
+	//
+	void setColor(const ColorSettings &Settings) { m_Color.set(Settings); }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include "PrerollRing.h"
+#include <cstring>
+#include <iostream>
+#include <new>
+
+namespace
+{
+	const VmbUint32_t   PREROLL_MAGIC = 0x4c4f5250;     // "PROL"
+	const VmbUint64_t   SLOT_ALIGN = 64;                // slotCount start on cache lines
+}
+
+PrerollRing::PrerollRing(VmbUint32_t frameBytes, VmbUint32_t slotCount)
+	: m_FrameBytes(frameBytes)
+	, m_SlotStride(((sizeof(slot_header) + frameBytes + SLOT_ALIGN - 1) / SLOT_ALIGN) * SLOT_ALIGN)
+	, m_SlotCount(0)
+	, m_Head(0)
+	, m_Tail(0)
+	, m_Overwritten(0)
+{
+	if (0 == frameBytes || 0 == slotCount)
+	{
+		return;
+	}
+	try
+	{
+		// value initialised, every page is touched before the first frame
+		m_Memory.resize(static_cast<size_t>(m_SlotStride * slotCount));
+		m_SlotCount = slotCount;
+	}
+	catch (const std::bad_alloc&)
+	{
+		std::cout << "pre-roll ring of " << slotCount << " frames could not be allocated" << std::endl;
+	}
+}
+
+bool PrerollRing::push(const VmbUchar_t *pData, VmbUint32_t DataSize, VmbUint32_t Width, VmbUint32_t Height,
+	VmbPixelFormat_t PixelFormat, VmbUint64_t FrameID, VmbUint64_t Timestamp, VmbUint64_t HostTime, bool Overwrite)
+{
+	if (!isOpen() || DataSize > m_FrameBytes)
+	{
+		return false;
+	}
+	if (full())
+	{
+		if (!Overwrite)
+		{
+			return false;
+		}
+		++m_Head;
+		++m_Overwritten;
+	}
+	VmbUchar_t *pSlot = slot(m_Tail);
+	slot_header *pHeader = reinterpret_cast<slot_header*>(pSlot);
+	pHeader->Magic = PREROLL_MAGIC;
+	pHeader->DataSize = DataSize;
+	pHeader->Width = Width;
+	pHeader->Height = Height;
+	pHeader->PixelFormat = PixelFormat;
+	pHeader->Reserved = 0;
+	pHeader->FrameID = FrameID;
+	pHeader->Timestamp = Timestamp;
+	pHeader->HostTime = HostTime;
+	memcpy(pSlot + sizeof(slot_header), pData, DataSize);
+	++m_Tail;
+	return true;
+}
+
+const PrerollRing::slot_header* PrerollRing::front(const VmbUchar_t *&pData) const
+{
+	if (empty())
+	{
+		return NULL;
+	}
+	const VmbUchar_t *pSlot = &m_Memory[(m_Head % m_SlotCount) * m_SlotStride];
+	pData = pSlot + sizeof(slot_header);
+	return reinterpret_cast<const slot_header*>(pSlot);
+}
+
+void PrerollRing::pop()
+{
+	if (!empty())
+	{
+		++m_Head;
+	}
+}
+
+void PrerollRing::clear()
+{
+	m_Head = m_Tail;
+}
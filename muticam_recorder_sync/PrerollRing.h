@@ -0,0 +1,69 @@
+#ifndef PREROLL_RING_H_
+#define PREROLL_RING_H_
+//qt include
+#include "QtCore/QSharedPointer"
+// std include
+#include <vector>
+
+#include "SpillRing.h"
+
+//
+// Fixed size ring of raw frames in memory, the last seconds before a record event.
+//
+// All slots are allocated by the constructor. While the recorder is armed a
+// push overwrites the oldest frame once the ring is full, so it always holds
+// the pre-roll. After the record event the ring becomes the memory queue of
+// the recorder: the encoder reads the slots in place, oldest first, and the
+// live frames keep following in the same ring, so there is neither a gap
+// nor a second copy between pre-roll and live frames.
+//
+// Like SpillRing the ring is not locked, the owner serialises the calls. The
+// slot returned by front() stays valid until pop(), a push never overwrites
+// it unless overwriting was asked for.
+//
+class PrerollRing
+{
+public:
+	typedef SpillRing::slot_header slot_header;     // same per slot header as the spill ring
+
+	PrerollRing(VmbUint32_t frameBytes, VmbUint32_t slotCount);
+
+	bool                isOpen()    const { return 0 != m_SlotCount; }
+	VmbUint32_t         capacity()  const { return m_SlotCount; }
+	VmbUint32_t         size()      const { return static_cast<VmbUint32_t>(m_Tail - m_Head); }
+	bool                empty()     const { return m_Tail == m_Head; }
+	bool                full()      const { return size() >= m_SlotCount; }
+	VmbUint64_t         overwritten() const { return m_Overwritten; }
+	//
+	// Method: push()
+	//
+	// Purpose: copy a frame into the next slot.
+	//          With Overwrite a full ring drops its oldest frame first.
+	//
+	// Returns: false if the ring is full and must not overwrite, or the frame is too large
+	//
+	bool push(const VmbUchar_t *pData, VmbUint32_t DataSize, VmbUint32_t Width, VmbUint32_t Height,
+		VmbPixelFormat_t PixelFormat, VmbUint64_t FrameID, VmbUint64_t Timestamp, VmbUint64_t HostTime, bool Overwrite);
+	//
+	// Method: front()
+	//
+	// Purpose: oldest frame, NULL if the ring is empty.
+	//
+	const slot_header* front(const VmbUchar_t *&pData) const;
+	void pop();
+	void clear();
+
+private:
+	VmbUchar_t* slot(VmbUint64_t sequence) { return &m_Memory[(sequence % m_SlotCount) * m_SlotStride]; }
+
+	std::vector<VmbUchar_t>     m_Memory;
+	VmbUint32_t                 m_FrameBytes;
+	VmbUint64_t                 m_SlotStride;
+	VmbUint32_t                 m_SlotCount;
+	VmbUint64_t                 m_Head;             // sequence of the oldest frame
+	VmbUint64_t                 m_Tail;             // sequence of the next frame
+	VmbUint64_t                 m_Overwritten;      // frames that fell out of the pre-roll
+};
+typedef QSharedPointer<PrerollRing> PrerollRingPtr;
+
+#endif
@@ -0,0 +1,133 @@
+#include "PtpScheduler.h"
+
+PtpScheduler::PtpScheduler()
+{
+	reset(1000000000ull / 15, 20000000);
+}
+
+void PtpScheduler::reset(uint64_t PeriodNs, uint64_t LeadNs, uint64_t MinLeadNs, uint64_t MaxLeadNs, uint64_t ToleranceNs)
+{
+	QMutexLocker local_lock(&m_Lock);
+	m_Period = 0 == PeriodNs ? 1 : PeriodNs;
+	m_MinLead = MinLeadNs;
+	m_MaxLead = MaxLeadNs < MinLeadNs ? MinLeadNs : MaxLeadNs;
+	m_Lead = LeadNs < m_MinLead ? m_MinLead : (LeadNs > m_MaxLead ? m_MaxLead : LeadNs);
+	m_Tolerance = ToleranceNs;
+	m_HaveGrid = false;
+	m_GridStart = 0;
+	m_LastSlot = 0;
+	m_Scheduled = 0;
+	m_Skipped = 0;
+	m_OnTime = 0;
+	m_Late = 0;
+	m_Streak = 0;
+	m_Deviation.reset();
+}
+
+uint64_t PtpScheduler::next(uint64_t PtpNowNs, uint64_t *pSkipped)
+{
+	QMutexLocker local_lock(&m_Lock);
+	if (NULL != pSkipped)
+	{
+		*pSkipped = 0;
+	}
+	const uint64_t earliest = PtpNowNs + m_Lead;
+	if (!m_HaveGrid)
+	{
+		m_HaveGrid = true;
+		m_GridStart = earliest;
+		m_LastSlot = 0;
+		++m_Scheduled;
+		return m_GridStart;
+	}
+	// first slot not before the earliest time, never one that was handed out already
+	uint64_t slot = earliest <= m_GridStart ? 0 : (earliest - m_GridStart + m_Period - 1) / m_Period;
+	if (slot < m_LastSlot)
+	{
+		// the host timer runs ahead of the grid, queueing further ahead would grow without bound
+		return 0;
+	}
+	if (slot == m_LastSlot)
+	{
+		// timer jitter, one slot of slack
+		slot = m_LastSlot + 1;
+	}
+	m_Skipped += slot - m_LastSlot - 1;
+	if (NULL != pSkipped)
+	{
+		*pSkipped = slot - m_LastSlot - 1;
+	}
+	m_LastSlot = slot;
+	++m_Scheduled;
+	return m_GridStart + slot * m_Period;
+}
+
+bool PtpScheduler::verify(uint64_t DeviceTimestampNs)
+{
+	QMutexLocker local_lock(&m_Lock);
+	if (!m_HaveGrid)
+	{
+		return true;
+	}
+	// distance to the nearest grid slot, in [-period/2, period/2)
+	const int64_t period = static_cast<int64_t>(m_Period);
+	int64_t offset = static_cast<int64_t>((DeviceTimestampNs - m_GridStart) % m_Period);
+	if (DeviceTimestampNs < m_GridStart)
+	{
+		offset = -static_cast<int64_t>((m_GridStart - DeviceTimestampNs) % m_Period);
+	}
+	if (offset >= period / 2)
+	{
+		offset -= period;
+	}
+	else if (offset < -period / 2)
+	{
+		offset += period;
+	}
+	m_Deviation.record(static_cast<uint64_t>(offset < 0 ? -offset : offset) / 1000);
+	if (offset <= static_cast<int64_t>(m_Tolerance) && offset >= -static_cast<int64_t>(m_Tolerance))
+	{
+		++m_OnTime;
+		if (++m_Streak >= SHRINK_AFTER)
+		{
+			// punctual for a while, give back a tenth of the lead
+			m_Streak = 0;
+			m_Lead = m_Lead - m_Lead / 10 < m_MinLead ? m_MinLead : m_Lead - m_Lead / 10;
+		}
+		return true;
+	}
+	++m_Late;
+	m_Streak = 0;
+	m_Lead = 2 * m_Lead > m_MaxLead ? m_MaxLead : 2 * m_Lead;
+	return false;
+}
+
+uint64_t PtpScheduler::leadNs() const
+{
+	QMutexLocker local_lock(&m_Lock);
+	return m_Lead;
+}
+
+uint64_t PtpScheduler::scheduled() const
+{
+	QMutexLocker local_lock(&m_Lock);
+	return m_Scheduled;
+}
+
+uint64_t PtpScheduler::skipped() const
+{
+	QMutexLocker local_lock(&m_Lock);
+	return m_Skipped;
+}
+
+uint64_t PtpScheduler::onTime() const
+{
+	QMutexLocker local_lock(&m_Lock);
+	return m_OnTime;
+}
+
+uint64_t PtpScheduler::late() const
+{
+	QMutexLocker local_lock(&m_Lock);
+	return m_Late;
+}
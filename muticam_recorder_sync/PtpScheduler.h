@@ -0,0 +1,99 @@
+#ifndef PTP_SCHEDULER_H_
+#define PTP_SCHEDULER_H_
+//qt include
+#include "QtCore/QMutex"
+// std include
+#include <cstdint>
+
+#include "LatencyHistogram.h"
+
+//
+// Execution times for scheduled action commands.
+//
+// With IEEE 1588 enabled all cameras share one PTP clock, so an action
+// command can carry a future execution time and every camera exposes at
+// that time no matter when the command reached it. The scheduler puts the
+// triggers on a fixed grid t0 + k * period in PTP nanoseconds and picks
+// the first free grid slot at least LeadNs ahead of the current PTP time.
+//
+// Verification needs no bookkeeping per command: a frame exposed on time
+// has a device time stamp on the grid, within ToleranceNs which has to cover
+// the trigger latency of the camera. A command that arrived after its
+// execution time makes the camera expose on arrival, off the grid. The lead
+// time adapts to that: a late frame doubles it, a long run of punctual
+// frames shrinks it again.
+//
+// Only plain integers go in and out, so the logic runs unchanged against
+// synthetic clocks with arbitrary offsets.
+//
+class PtpScheduler
+{
+public:
+	PtpScheduler();
+	//
+	// Method: reset()
+	//
+	// Purpose: start a new grid, the first slot is placed on the first call of next().
+	//
+	void reset(uint64_t PeriodNs, uint64_t LeadNs, uint64_t MinLeadNs = 2000000, uint64_t MaxLeadNs = 500000000, uint64_t ToleranceNs = 100000);
+	//
+	// Method: next()
+	//
+	// Purpose: execution time of the next action command.
+	//          PtpNowNs is the current PTP time as well as the host knows it.
+	//
+	//          pSkipped, if given, gets the number of grid slots jumped over
+	//          by this call, they leave a gap in the frame time stamps.
+	//
+	// Returns: execution time in PTP ns, 0 if the next free slot is already
+	//          covered, the caller skips this command then
+	//
+	uint64_t next(uint64_t PtpNowNs, uint64_t *pSkipped = NULL);
+	//
+	// Method: verify()
+	//
+	// Purpose: check the device time stamp (PTP ns) of a received frame
+	//          against the grid and tune the lead time. Call it once per
+	//          trigger, with the frame of one camera: every frame counts
+	//          toward the late and punctual streaks.
+	//
+	// Returns: false if the frame was exposed off the grid, its action command was late
+	//
+	bool verify(uint64_t DeviceTimestampNs);
+
+	uint64_t    leadNs()        const;
+	uint64_t    scheduled()     const;
+	uint64_t    skipped()       const;      // grid slots jumped over because the lead grew or the timer lagged
+	uint64_t    onTime()        const;
+	uint64_t    late()          const;
+	//
+	// Method: deviation()
+	//
+	// Purpose: |time stamp - grid slot| in us of all verified frames.
+	//
+	const LatencyHistogram& deviation() const { return m_Deviation; }
+
+private:
+	PtpScheduler(const PtpScheduler&);
+	PtpScheduler& operator=(const PtpScheduler&);
+
+	enum { SHRINK_AFTER = 256 };                // punctual frames in a row before the lead shrinks
+
+	mutable QMutex      m_Lock;
+	uint64_t            m_Period;
+	uint64_t            m_Lead;
+	uint64_t            m_MinLead;
+	uint64_t            m_MaxLead;
+	uint64_t            m_Tolerance;
+	bool                m_HaveGrid;
+	uint64_t            m_GridStart;            // t0
+	uint64_t            m_LastSlot;             // index of the newest scheduled slot
+	uint64_t            m_Scheduled;
+	uint64_t            m_Skipped;
+	uint64_t            m_OnTime;
+	uint64_t            m_Late;
+	uint64_t            m_Streak;               // punctual frames since the last late one
+	LatencyHistogram    m_Deviation;
+};
+
+#endif
@@ -0,0 +1,379 @@
+#include "RectifyMap.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+	const char MAGIC[4] = { 'R', 'M', 'P', '1' };
+
+	std::string trim(const std::string &s)
+	{
+		const std::string::size_type first = s.find_first_not_of(" \t\r");
+		if (std::string::npos == first)
+		{
+			return std::string();
+		}
+		return s.substr(first, s.find_last_not_of(" \t\r") - first + 1);
+	}
+
+	template <class T> bool parseValue(const std::string &value, T &Result)
+	{
+		std::istringstream in(value);
+		if (!(in >> Result))
+		{
+			return false;
+		}
+		in >> std::ws;
+		return in.eof();
+	}
+
+	void hashBytes(uint64_t &Hash, const void *pData, size_t Bytes)
+	{
+		const unsigned char *p = static_cast<const unsigned char*>(pData);
+		for (size_t i = 0; i < Bytes; ++i)
+		{
+			Hash ^= p[i];
+			Hash *= 1099511628211ull;
+		}
+	}
+
+	// FNV-1a of the calibration file and everything else the maps depend on
+	bool cacheKey(const RectifySettings &Settings, int Width, int Height, uint64_t &Key)
+	{
+		std::ifstream in(Settings.Calibration.c_str(), std::ios::binary);
+		if (!in)
+		{
+			return false;
+		}
+		const std::vector<char> content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		Key = 14695981039346656037ull;
+		if (!content.empty())
+		{
+			hashBytes(Key, &content[0], content.size());
+		}
+		hashBytes(Key, &Settings.RigCamera, sizeof(Settings.RigCamera));
+		hashBytes(Key, &Settings.Stereo, sizeof(Settings.Stereo));
+		hashBytes(Key, &Settings.Alpha, sizeof(Settings.Alpha));
+		hashBytes(Key, &Width, sizeof(Width));
+		hashBytes(Key, &Height, sizeof(Height));
+		// 0 is the key of a map file without a calibration
+		if (0 == Key)
+		{
+			Key = 1;
+		}
+		return true;
+	}
+
+	// a camera<n> node of rig.xml, R and T map camera 0 into camera n
+	bool readRigCamera(const cv::FileStorage &fs, int Camera, const cv::Size &size, cv::Mat &K, cv::Mat &D, cv::Mat &R, cv::Mat &T, std::string &Error)
+	{
+		std::stringstream name;
+		name << "camera" << Camera;
+		const cv::FileNode node = fs[name.str()];
+		if (node.empty())
+		{
+			Error = "no " + name.str() + " in the calibration";
+			return false;
+		}
+		cv::Size calibrated;
+		node["image_size"] >> calibrated;
+		node["intrinsic"] >> K;
+		node["distortion"] >> D;
+		node["R"] >> R;
+		node["T"] >> T;
+		if (K.empty() || D.empty() || R.empty() || T.empty())
+		{
+			Error = name.str() + " is incomplete";
+			return false;
+		}
+		if (calibrated.area() > 0 && calibrated != size)
+		{
+			std::stringstream message;
+			message << name.str() << " was calibrated for " << calibrated.width << "x" << calibrated.height;
+			Error = message.str();
+			return false;
+		}
+		return true;
+	}
+}
+
+RectifySettings::RectifySettings()
+	: RigCamera(-1)
+	, Stereo(-1)
+	, Alpha(0)
+{
+}
+
+bool RectifyMap::load(const RectifySettings &Settings, int Width, int Height, std::string &Error)
+{
+	uint64_t key = 0;
+	if (!Settings.Calibration.empty() && !cacheKey(Settings, Width, Height, key))
+	{
+		Error = "could not open " + Settings.Calibration;
+		return false;
+	}
+	if (!Settings.MapFile.empty() && read(Settings.MapFile, Width, Height, key))
+	{
+		return true;
+	}
+	if (Settings.Calibration.empty())
+	{
+		std::stringstream message;
+		message << Settings.MapFile << " has no maps for " << Width << "x" << Height;
+		Error = message.str();
+		return false;
+	}
+	if (!build(Settings, Width, Height, Error))
+	{
+		return false;
+	}
+	// a missing cache only costs the build on the next start
+	if (!Settings.MapFile.empty() && !write(Settings.MapFile, key))
+	{
+		std::cout << "could not write " << Settings.MapFile << std::endl;
+	}
+	return true;
+}
+
+bool RectifyMap::build(const RectifySettings &Settings, int Width, int Height, std::string &Error)
+{
+	cv::FileStorage fs(Settings.Calibration, cv::FileStorage::READ);
+	if (!fs.isOpened())
+	{
+		Error = "could not read " + Settings.Calibration;
+		return false;
+	}
+	const cv::Size size(Width, Height);
+	cv::Mat K, D, R, P, T;
+	if (Settings.RigCamera < 0)
+	{
+		fs["intrinsic"] >> K;
+		fs["distortion"] >> D;
+		if (K.empty() || D.empty())
+		{
+			Error = "no intrinsic and distortion in " + Settings.Calibration;
+			return false;
+		}
+	}
+	else if (!readRigCamera(fs, Settings.RigCamera, size, K, D, R, T, Error))
+	{
+		return false;
+	}
+
+	if (Settings.Stereo >= 0)
+	{
+		cv::Mat K2, D2, R2, T2;
+		if (!readRigCamera(fs, Settings.Stereo, size, K2, D2, R2, T2, Error))
+		{
+			return false;
+		}
+		// the lower rig index is the first camera of the pair, both cameras compute the same rectification
+		const bool first = Settings.RigCamera < Settings.Stereo;
+		const cv::Mat &K1st = first ? K : K2, &D1st = first ? D : D2, &R1st = first ? R : R2, &T1st = first ? T : T2;
+		const cv::Mat &K2nd = first ? K2 : K, &D2nd = first ? D2 : D, &R2nd = first ? R2 : R, &T2nd = first ? T2 : T;
+		cv::Mat relativeR = R2nd * R1st.t();
+		cv::Mat relativeT = T2nd - relativeR * T1st;
+		cv::Mat rect1, rect2, proj1, proj2, Q;
+		cv::stereoRectify(K1st, D1st, K2nd, D2nd, size, relativeR, relativeT, rect1, rect2, proj1, proj2, Q,
+			cv::CALIB_ZERO_DISPARITY, Settings.Alpha, size);
+		R = first ? rect1 : rect2;
+		P = first ? proj1 : proj2;
+	}
+	else
+	{
+		R.release();
+		P = cv::getOptimalNewCameraMatrix(K, D, size, Settings.Alpha, size);
+	}
+	cv::initUndistortRectifyMap(K, D, R, P, size, CV_16SC2, m_Map1, m_Map2);
+	return true;
+}
+
+bool RectifyMap::read(const std::string &fileName, int Width, int Height, uint64_t Key)
+{
+	std::ifstream in(fileName.c_str(), std::ios::binary);
+	char magic[4];
+	uint32_t width = 0, height = 0;
+	uint64_t key = 0;
+	if (!in.read(magic, 4) || 0 != memcmp(magic, MAGIC, 4)
+		|| !in.read(reinterpret_cast<char*>(&width), sizeof(width))
+		|| !in.read(reinterpret_cast<char*>(&height), sizeof(height))
+		|| !in.read(reinterpret_cast<char*>(&key), sizeof(key)))
+	{
+		return false;
+	}
+	// without a calibration any maps of the right size will do
+	if (static_cast<int>(width) != Width || static_cast<int>(height) != Height || (0 != Key && key != Key))
+	{
+		return false;
+	}
+	cv::Mat map1(Height, Width, CV_16SC2), map2(Height, Width, CV_16UC1);
+	if (!in.read(reinterpret_cast<char*>(map1.data), map1.total() * map1.elemSize())
+		|| !in.read(reinterpret_cast<char*>(map2.data), map2.total() * map2.elemSize()))
+	{
+		return false;
+	}
+	m_Map1 = map1;
+	m_Map2 = map2;
+	return true;
+}
+
+bool RectifyMap::write(const std::string &fileName, uint64_t Key) const
+{
+	// written next to the old one and renamed, a crash never leaves half a map
+	const std::string tmp = fileName + ".tmp";
+	{
+		std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+		const uint32_t width = m_Map1.cols, height = m_Map1.rows;
+		out.write(MAGIC, 4);
+		out.write(reinterpret_cast<const char*>(&width), sizeof(width));
+		out.write(reinterpret_cast<const char*>(&height), sizeof(height));
+		out.write(reinterpret_cast<const char*>(&Key), sizeof(Key));
+		out.write(reinterpret_cast<const char*>(m_Map1.data), m_Map1.total() * m_Map1.elemSize());
+		out.write(reinterpret_cast<const char*>(m_Map2.data), m_Map2.total() * m_Map2.elemSize());
+		if (!out)
+		{
+			return false;
+		}
+	}
+	::remove(fileName.c_str());
+	return 0 == ::rename(tmp.c_str(), fileName.c_str());
+}
+
+bool RectifyMap::apply(const cv::Mat &Source, cv::Mat &Target) const
+{
+	if (m_Map1.empty() || Source.rows != m_Map1.rows || Source.cols != m_Map1.cols)
+	{
+		return false;
+	}
+	Target.create(Source.rows, Source.cols, Source.type());
+	// a stripe of output rows only reads the band of source rows its maps point to
+	const int stripes = std::max(1, Source.rows / STRIPE_ROWS);
+	cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range &range)
+	{
+		for (int s = range.start; s < range.end; ++s)
+		{
+			const int first = Source.rows * s / stripes;
+			const int last = Source.rows * (s + 1) / stripes;
+			cv::Mat stripe = Target.rowRange(first, last);
+			cv::remap(Source, stripe, m_Map1.rowRange(first, last), m_Map2.rowRange(first, last), cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+		}
+	});
+	return true;
+}
+
+bool RectifyConfig::load(const std::string &fileName, std::string &Error)
+{
+	std::ifstream in(fileName.c_str());
+	if (!in)
+	{
+		Error = "could not open " + fileName;
+		return false;
+	}
+	std::map<std::string, RectifySettings> cameras;
+	RectifySettings *pCurrent = NULL;
+	std::string line;
+	for (int lineNumber = 1; std::getline(in, line); ++lineNumber)
+	{
+		line = trim(line.substr(0, line.find('#')));
+		if (line.empty())
+		{
+			continue;
+		}
+		std::stringstream where;
+		where << fileName << ":" << lineNumber << ": ";
+		const std::string::size_type equal = line.find('=');
+		if (std::string::npos == equal)
+		{
+			Error = where.str() + "expected key = value";
+			return false;
+		}
+		const std::string key = trim(line.substr(0, equal));
+		const std::string value = trim(line.substr(equal + 1));
+		if ("camera" == key)
+		{
+			if (value.empty())
+			{
+				Error = where.str() + "bad value for camera";
+				return false;
+			}
+			pCurrent = &cameras[value];
+			continue;
+		}
+		if (NULL == pCurrent)
+		{
+			Error = where.str() + key + " before the first camera";
+			return false;
+		}
+		bool valid = true;
+		if ("calibration" == key)
+		{
+			valid = !value.empty();
+			pCurrent->Calibration = value;
+		}
+		else if ("rig_camera" == key)
+		{
+			valid = parseValue(value, pCurrent->RigCamera) && pCurrent->RigCamera >= 0;
+		}
+		else if ("stereo" == key)
+		{
+			valid = parseValue(value, pCurrent->Stereo) && pCurrent->Stereo >= 0;
+		}
+		else if ("alpha" == key)
+		{
+			valid = parseValue(value, pCurrent->Alpha) && pCurrent->Alpha >= 0 && pCurrent->Alpha <= 1;
+		}
+		else if ("maps" == key)
+		{
+			valid = !value.empty();
+			pCurrent->MapFile = value;
+		}
+		else
+		{
+			Error = where.str() + "unknown key " + key;
+			return false;
+		}
+		if (!valid)
+		{
+			Error = where.str() + "bad value for " + key + ": " + value;
+			return false;
+		}
+	}
+	for (std::map<std::string, RectifySettings>::const_iterator it = cameras.begin(); it != cameras.end(); ++it)
+	{
+		if (it->second.Stereo >= 0 && (it->second.RigCamera < 0 || it->second.RigCamera == it->second.Stereo))
+		{
+			Error = fileName + ": camera " + it->first + ": stereo needs the rig_camera of another camera";
+			return false;
+		}
+		if (!it->second.enabled())
+		{
+			Error = fileName + ": camera " + it->first + ": needs a calibration or maps";
+			return false;
+		}
+	}
+	m_Cameras.swap(cameras);
+	return true;
+}
+
+RectifyMapPtr RectifyConfig::forCamera(const std::string &CameraID, int Width, int Height, std::string &Error) const
+{
+	Error.clear();
+	std::map<std::string, RectifySettings>::const_iterator it = m_Cameras.find(CameraID);
+	if (m_Cameras.end() == it)
+	{
+		return RectifyMapPtr();
+	}
+	QSharedPointer<RectifyMap> pMap(new RectifyMap);
+	if (!pMap->load(it->second, Width, Height, Error))
+	{
+		Error = "camera " + CameraID + ": " + Error;
+		return RectifyMapPtr();
+	}
+	return pMap;
+}
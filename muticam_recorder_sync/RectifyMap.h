@@ -0,0 +1,116 @@
+#ifndef RECTIFY_MAP_H_
+#define RECTIFY_MAP_H_
+// open cv include
+#include "opencv2/opencv.hpp"
+//qt include
+#include "QtCore/QSharedPointer"
+// std include
+#include <cstdint>
+#include <map>
+#include <string>
+
+//
+// Where the maps of one camera come from. A camera without a calibration
+// and without a map file is not rectified.
+//
+struct RectifySettings
+{
+	std::string     Calibration;    // cmx_dis.xml (intrinsic, distortion) or rig.xml of the calibration tool
+	int             RigCamera;      // rig.xml: the camera<n> node, -1 for a single camera file
+	int             Stereo;         // rig.xml: rectify as a stereo pair with camera<n>, -1 only undistorts
+	double          Alpha;          // 0 keeps only valid pixels, 1 keeps every source pixel
+	std::string     MapFile;        // binary cache of the maps, built from Calibration if missing or stale
+
+	RectifySettings();
+	bool enabled() const { return !Calibration.empty() || !MapFile.empty(); }
+};
+
+//
+// Undistortion or stereo rectification of one camera as fixed point remap tables.
+//
+// The maps are CV_16SC2 integer source positions plus a CV_16UC1 index into
+// OpenCV's interpolation table, the fast path of cv::remap. Building them
+// from the calibration costs a float map of the whole frame, so they are
+// cached in MapFile:
+//
+//  "RMP1", uint32 width, uint32 height, uint64 key,
+//  int16 map1[width * height * 2], uint16 map2[width * height]
+//
+// The key hashes the calibration file and the settings, a cache built from
+// another calibration is rebuilt. A map file without a calibration is used
+// as it is.
+//
+// apply() remaps the frame in horizontal stripes on OpenCV's thread pool,
+// every stripe reads only the source rows its maps point to.
+//
+class RectifyMap
+{
+public:
+	enum { STRIPE_ROWS = 64 };
+
+	//
+	// Method: load()
+	//
+	// Purpose: the maps of a camera for frames of Width x Height, from the map file if it is
+	//          current, otherwise built from the calibration and written to the map file.
+	//
+	// Returns: false with a message if neither gives maps of the frame size
+	//
+	bool load(const RectifySettings &Settings, int Width, int Height, std::string &Error);
+	//
+	// Method: apply()
+	//
+	// Purpose: rectify the 8 bit Source into Target, Target is (re)allocated to the Source size.
+	//
+	// Returns: false if the frame size is not the size of the maps, Target is untouched then
+	//
+	bool apply(const cv::Mat &Source, cv::Mat &Target) const;
+	cv::Size size() const { return m_Map1.size(); }
+
+private:
+	bool build(const RectifySettings &Settings, int Width, int Height, std::string &Error);
+	bool read(const std::string &fileName, int Width, int Height, uint64_t Key);
+	bool write(const std::string &fileName, uint64_t Key) const;
+
+	cv::Mat     m_Map1;     // CV_16SC2
+	cv::Mat     m_Map2;     // CV_16UC1
+};
+typedef QSharedPointer<const RectifyMap> RectifyMapPtr;
+
+//
+// Rectification settings per camera, read from a text file of "key = value"
+// lines, '#' starts a comment. A camera line starts the settings of a
+// camera, cameras without one are recorded as they are:
+//
+//  camera      = <id>
+//  calibration = <cmx_dis.xml | rig.xml>
+//  rig_camera  = <n>
+//  stereo      = <n>
+//  alpha       = <0..1>
+//  maps        = <file>
+//
+class RectifyConfig
+{
+public:
+	//
+	// Method: load()
+	//
+	// Purpose: read a rectify file, unknown keys and bad values are errors.
+	//
+	// Returns: false with a message naming the line if the file is not valid
+	//
+	bool load(const std::string &fileName, std::string &Error);
+	//
+	// Method: forCamera()
+	//
+	// Purpose: the maps of a camera for frames of Width x Height.
+	//
+	// Returns: null if the camera is not rectified or its maps could not be loaded, Error says why
+	//
+	RectifyMapPtr forCamera(const std::string &CameraID, int Width, int Height, std::string &Error) const;
+
+private:
+	std::map<std::string, RectifySettings>  m_Cameras;
+};
+
+#endif
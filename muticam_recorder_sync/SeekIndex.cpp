@@ -0,0 +1,145 @@
+#include "SeekIndex.h"
+#include <cstring>
+
+#ifdef _WIN32
+#define seek_fseek  _fseeki64
+#define seek_ftell  _ftelli64
+#else
+#define seek_fseek  fseeko
+#define seek_ftell  ftello
+#endif
+
+namespace seek
+{
+
+namespace
+{
+	uint64_t keyOf(const record &Record, key_type Key)
+	{
+		switch (Key)
+		{
+		case KEY_FRAME_ID:  return Record.FrameID;
+		case KEY_TIMESTAMP: return Record.Timestamp;
+		default:            return Record.HostTime;
+		}
+	}
+}
+
+IndexWriter::IndexWriter(const std::string &fileName, int Camera, int Segment, double FPS, uint32_t FlushInterval)
+	: m_File(fileName, 2)
+	, m_FlushInterval(0 == FlushInterval ? 1 : FlushInterval)
+	, m_Records(0)
+{
+	file_header header;
+	memset(&header, 0, sizeof(header));
+	header.Magic = FILE_MAGIC;
+	header.Version = VERSION;
+	header.Camera = Camera;
+	header.Segment = Segment;
+	header.FPS = FPS;
+	m_File.append(&header, sizeof(header));
+}
+
+IndexWriter::~IndexWriter()
+{
+	close();
+}
+
+void IndexWriter::add(uint64_t FrameID, uint64_t Timestamp, uint64_t HostTime, uint64_t Offset)
+{
+	record entry;
+	entry.FrameID = FrameID;
+	entry.Timestamp = Timestamp;
+	entry.HostTime = HostTime;
+	entry.Ordinal = m_Records;
+	entry.Offset = Offset;
+	m_File.append(&entry, sizeof(entry));
+	if (0 == ++m_Records % m_FlushInterval)
+	{
+		m_File.flush();
+	}
+}
+
+void IndexWriter::close()
+{
+	m_File.close();
+}
+
+IndexReader::IndexReader()
+	: m_pFile(NULL)
+	, m_Records(0)
+{
+	memset(&m_Header, 0, sizeof(m_Header));
+}
+
+IndexReader::~IndexReader()
+{
+	close();
+}
+
+bool IndexReader::open(const std::string &fileName)
+{
+	close();
+	m_pFile = fopen(fileName.c_str(), "rb");
+	if (NULL == m_pFile)
+	{
+		return false;
+	}
+	if (1 != fread(&m_Header, sizeof(m_Header), 1, m_pFile)
+		|| FILE_MAGIC != m_Header.Magic
+		|| VERSION != m_Header.Version)
+	{
+		close();
+		return false;
+	}
+	seek_fseek(m_pFile, 0, SEEK_END);
+	const uint64_t fileSize = static_cast<uint64_t>(seek_ftell(m_pFile));
+	// a torn last record is not counted
+	m_Records = (fileSize - sizeof(file_header)) / sizeof(record);
+	return true;
+}
+
+void IndexReader::close()
+{
+	if (NULL != m_pFile)
+	{
+		fclose(m_pFile);
+		m_pFile = NULL;
+	}
+	m_Records = 0;
+}
+
+bool IndexReader::read(uint64_t Position, record &Record)
+{
+	return NULL != m_pFile
+		&& Position < m_Records
+		&& 0 == seek_fseek(m_pFile, static_cast<long long>(sizeof(file_header) + Position * sizeof(record)), SEEK_SET)
+		&& 1 == fread(&Record, sizeof(Record), 1, m_pFile);
+}
+
+uint64_t IndexReader::lowerBound(key_type Key, uint64_t Value)
+{
+	uint64_t first = 0;
+	uint64_t count = m_Records;
+	record probe;
+	while (count > 0)
+	{
+		const uint64_t step = count / 2;
+		if (!read(first + step, probe))
+		{
+			return m_Records;
+		}
+		if (keyOf(probe, Key) < Value)
+		{
+			first += step + 1;
+			count -= step + 1;
+		}
+		else
+		{
+			count = step;
+		}
+	}
+	return first;
+}
+
+}
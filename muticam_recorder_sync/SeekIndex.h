@@ -0,0 +1,123 @@
+#ifndef SEEK_INDEX_H_
+#define SEEK_INDEX_H_
+// std include
+#include <cstdint>
+#include <stdio.h>
+#include <string>
+
+#include "AsyncFileWriter.h"
+
+//
+// Seek index, one <segment>.idx file next to every recorded segment.
+//
+// file   := file_header record*
+//
+// One fixed size record per written frame, in write order. Frame ID, device
+// time stamp and host time all grow monotonically within a segment, so a
+// reader binary searches any of them directly in the file and only touches
+// O(log n) records. A crashed index just ends with a partial record, which
+// the reader ignores.
+//
+namespace seek
+{
+	enum
+	{
+		FILE_MAGIC      = 0x4958434d,   // "MCXI"
+		VERSION         = 1,
+	};
+
+	const uint64_t NO_OFFSET = ~0ull;   // container without byte addressable frames (AVI)
+
+	struct file_header
+	{
+		uint32_t    Magic;
+		uint32_t    Version;
+		int32_t     Camera;
+		int32_t     Segment;
+		double      FPS;
+	};
+
+	struct record
+	{
+		uint64_t    FrameID;            // camera frame ID
+		uint64_t    Timestamp;          // camera time stamp in device ticks
+		uint64_t    HostTime;           // steady clock ns when the frame reached the recorder
+		uint64_t    Ordinal;            // frame number within the segment
+		uint64_t    Offset;             // chunk header offset in the container, NO_OFFSET if unknown
+	};
+
+	enum key_type
+	{
+		KEY_FRAME_ID,
+		KEY_TIMESTAMP,
+		KEY_HOST_TIME,
+	};
+
+	//
+	// Appends records through the asynchronous I/O service
+	//
+	class IndexWriter
+	{
+	public:
+		IndexWriter(const std::string &fileName, int Camera, int Segment, double FPS, uint32_t FlushInterval = 64);
+		~IndexWriter();
+
+		bool isOpened() const { return m_File.isOpen(); }
+		//
+		// Method: add()
+		//
+		// Purpose: queue the record of the frame just written, never blocks.
+		//          Every FlushInterval records the block is handed to the service.
+		//
+		void add(uint64_t FrameID, uint64_t Timestamp, uint64_t HostTime, uint64_t Offset);
+		//
+		// Method: close()
+		//
+		// Purpose: wait until all records are written, see AsyncFileWriter::close().
+		//
+		void close();
+		uint64_t records() const { return m_Records; }
+		bool failed() const { return m_File.failed(); }
+
+	private:
+		IndexWriter(const IndexWriter&);
+		IndexWriter& operator=(const IndexWriter&);
+
+		AsyncFileWriter     m_File;
+		uint32_t            m_FlushInterval;
+		uint64_t            m_Records;
+	};
+
+	//
+	// Random access to the records of an index file
+	//
+	class IndexReader
+	{
+	public:
+		IndexReader();
+		~IndexReader();
+		bool open(const std::string &fileName);
+		void close();
+		const file_header& header() const { return m_Header; }
+		uint64_t size() const { return m_Records; }
+		bool read(uint64_t Position, record &Record);
+		//
+		// Method: lowerBound()
+		//
+		// Purpose: binary search for the first record whose key is not less than Value.
+		//
+		// Returns: its position, size() if every key is less
+		//
+		uint64_t lowerBound(key_type Key, uint64_t Value);
+
+	private:
+		IndexReader(const IndexReader&);
+		IndexReader& operator=(const IndexReader&);
+
+		FILE*           m_pFile;
+		file_header     m_Header;
+		uint64_t        m_Records;
+	};
+}
+
+#endif
@@ -0,0 +1,201 @@
+#include "SessionContainer.h"
+#include "AsyncFileWriter.h"
+#include <algorithm>
+#include <iostream>
+
+SessionContainer::SessionContainer(const std::string &fileName, uint32_t Cameras, uint32_t Width, uint32_t Height, double FPS,
+	uint64_t MaxPendingBytes, DropFrameDetector *pDropDetector)
+	: m_FileName(fileName)
+	, m_Writer(fileName, Width, Height, FPS, 30 * (Cameras + 1), Cameras + 1)
+	, m_Cameras(Cameras)
+	, m_MaxPendingBytes(MaxPendingBytes)
+	, m_SilentNs(static_cast<uint64_t>(SILENT_PERIODS * 1e9 / (FPS > 0 ? FPS : 1)))
+	, m_pDropDetector(pDropDetector)
+	, m_HaveLatest(Cameras, false)
+	, m_Latest(Cameras, 0)
+	, m_LastSubmitNs(Cameras, 0)
+	, m_Started(false)
+	, m_PendingBytes(0)
+	, m_HaveBase(false)
+	, m_BaseFrameID(0)
+	, m_NextFrameID(0)
+	, m_Incomplete(0)
+	, m_Late(0)
+	, m_Closed(false)
+{
+	m_Meta.reserve(Cameras);
+}
+
+SessionContainer::~SessionContainer()
+{
+	close();
+}
+
+void SessionContainer::submit(uint32_t Camera, VmbUint64_t FrameID, VmbUint64_t Timestamp, const uchar *pData, size_t Size)
+{
+	QMutexLocker local_lock(&m_Lock);
+	if (m_Closed || Camera >= m_Cameras)
+	{
+		return;
+	}
+	if (m_HaveBase && FrameID < m_NextFrameID)
+	{
+		++m_Late;
+		if (NULL != m_pDropDetector)
+		{
+			m_pDropDetector->recorderDropped(static_cast<int>(Camera), FrameID);
+		}
+		return;
+	}
+	const uint64_t nowNs = AsyncIoService::nowNs();
+	if (!m_Started)
+	{
+		// cameras that have not submitted yet are silent from the first frame on, not from the file creation
+		m_Started = true;
+		std::fill(m_LastSubmitNs.begin(), m_LastSubmitNs.end(), nowNs);
+	}
+	m_LastSubmitNs[Camera] = nowNs;
+	m_HaveLatest[Camera] = true;
+	m_Latest[Camera] = std::max(m_Latest[Camera], FrameID);
+	trigger_group &group = m_Groups[FrameID];
+	if (group.Frames.empty())
+	{
+		group.Received = 0;
+		group.Bytes = 0;
+		group.Frames.resize(m_Cameras);
+	}
+	pending_frame &frame = group.Frames[Camera];
+	if (!frame.Present)
+	{
+		++group.Received;
+	}
+	group.Bytes -= frame.Data.size();
+	m_PendingBytes -= frame.Data.size();
+	frame.Present = true;
+	frame.FrameID = FrameID;
+	frame.Timestamp = Timestamp;
+	frame.Data.assign(pData, pData + Size);
+	group.Bytes += Size;
+	m_PendingBytes += Size;
+	writeReady(false);
+}
+
+//
+// Method: passed()
+//
+// Purpose: every camera missing in the group has submitted a newer frame,
+//          it lost this trigger, or has been silent for SILENT_PERIODS, it is dead.
+//
+bool SessionContainer::passed(uint64_t FrameID, const trigger_group &group, uint64_t NowNs) const
+{
+	for (uint32_t i = 0; i < m_Cameras; ++i)
+	{
+		if (!group.Frames[i].Present
+			&& (!m_HaveLatest[i] || m_Latest[i] <= FrameID)
+			&& NowNs - m_LastSubmitNs[i] < m_SilentNs)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+//
+// Method: writeReady()
+//
+// Purpose: write the oldest groups while no camera can add to them or the buffered frames take too much memory.
+//
+void SessionContainer::writeReady(bool all)
+{
+	const uint64_t nowNs = AsyncIoService::nowNs();
+	while (!m_Groups.empty())
+	{
+		GroupMap::iterator oldest = m_Groups.begin();
+		const bool complete = oldest->second.Received == m_Cameras;
+		const bool overfull = m_PendingBytes > m_MaxPendingBytes;
+		if (!all && !complete && !overfull && !passed(oldest->first, oldest->second, nowNs))
+		{
+			break;
+		}
+		if (!complete)
+		{
+			++m_Incomplete;
+		}
+		if (!m_HaveBase)
+		{
+			m_HaveBase = true;
+			m_BaseFrameID = oldest->first;
+		}
+		writeGroup(oldest->first - m_BaseFrameID, oldest->second);
+		m_NextFrameID = oldest->first + 1;
+		m_PendingBytes -= oldest->second.Bytes;
+		m_Groups.erase(oldest);
+	}
+}
+
+void SessionContainer::writeGroup(uint64_t Trigger, trigger_group &group)
+{
+	m_Meta.clear();
+	for (uint32_t i = 0; i < m_Cameras; ++i)
+	{
+		if (group.Frames[i].Present)
+		{
+			meta_entry entry;
+			entry.Track = i;
+			entry.Reserved = 0;
+			entry.FrameID = group.Frames[i].FrameID;
+			entry.Timestamp = group.Frames[i].Timestamp;
+			m_Meta.push_back(entry);
+		}
+	}
+	// metadata first, so a reader seeking to a trigger finds the group head
+	m_Writer.writeChunk(mcr::CHUNK_META, static_cast<uint16_t>(m_Cameras), Trigger, group.Received,
+		&m_Meta[0], static_cast<uint32_t>(m_Meta.size() * sizeof(meta_entry)));
+	for (uint32_t i = 0; i < m_Cameras; ++i)
+	{
+		pending_frame &frame = group.Frames[i];
+		if (frame.Present)
+		{
+			m_Writer.writeEncoded(static_cast<uint16_t>(i), Trigger, frame.Timestamp, &frame.Data[0], static_cast<uint32_t>(frame.Data.size()));
+		}
+	}
+}
+
+void SessionContainer::close()
+{
+	QMutexLocker local_lock(&m_Lock);
+	if (m_Closed)
+	{
+		return;
+	}
+	writeReady(true);
+	m_Writer.release();
+	m_Closed = true;
+	if (0 != m_Incomplete || 0 != m_Late)
+	{
+		std::cout << "session container: " << m_Incomplete << " incomplete triggers, " << m_Late << " late frames" << std::endl;
+	}
+}
+
+namespace
+{
+	struct meta_before
+	{
+		bool operator()(const mcr::index_entry &a, uint64_t trigger) const { return a.Sequence < trigger; }
+	};
+}
+
+bool SessionContainer::seekTrigger(const std::vector<mcr::index_entry> &index, uint32_t metaTrack, uint64_t Trigger, uint64_t &Offset)
+{
+	// the file is sorted by trigger, so the index sorted by offset is sorted by trigger too
+	std::vector<mcr::index_entry>::const_iterator it = std::lower_bound(index.begin(), index.end(), Trigger, meta_before());
+	for (; it != index.end() && it->Sequence == Trigger; ++it)
+	{
+		if (it->Track == metaTrack)
+		{
+			Offset = it->Offset;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,135 @@
+#ifndef SESSION_CONTAINER_H_
+#define SESSION_CONTAINER_H_
+//qt include
+#include "QtCore/QSharedPointer"
+#include "QtCore/QMutex"
+// std include
+#include <map>
+#include <string>
+#include <vector>
+// allied vision include
+#include <VimbaCPP/Include/VimbaCPP.h>
+
+#include "ChunkedContainer.h"
+#include "drop_frame_detection.h"
+
+//
+// One MCR file for a whole session.
+//
+// Track n holds the JPEG frames of camera n, the metadata track (index
+// Cameras) holds one CHUNK_META per trigger listing frame ID and device
+// time stamp of every camera. Recorder threads submit encoded frames in any
+// order across cameras, each camera in frame order; a trigger is written as
+// one group, metadata first, as soon as every camera delivered it, moved
+// past it or submitted nothing for SILENT_PERIODS frame periods. Buffered
+// frames are capped at MaxPendingBytes, above it the oldest groups are
+// written incomplete. The file is therefore a single sequential stream
+// sorted by trigger and every frame chunk's Sequence is its trigger index,
+// counted from the first trigger written.
+//
+// The frame ID is the common trigger reference: all streams are started
+// before the first action command, so the frame IDs of all cameras count
+// the same triggers from the same start. A camera that lost its first frames
+// still lands on the right trigger. A recorder that falls behind keeps
+// submitting, just older frames, so it is not silent; a dead camera is. A
+// frame arriving for a trigger that is written already is lost and counted
+// as a recorder drop.
+//
+class SessionContainer
+{
+public:
+	//
+	// per camera record of the metadata track
+	//
+	struct meta_entry
+	{
+		uint32_t    Track;
+		uint32_t    Reserved;
+		uint64_t    FrameID;
+		uint64_t    Timestamp;      // device ticks
+	};
+
+	enum { SILENT_PERIODS = 8 };
+
+	SessionContainer(const std::string &fileName, uint32_t Cameras, uint32_t Width, uint32_t Height, double FPS,
+		uint64_t MaxPendingBytes, DropFrameDetector *pDropDetector = NULL);
+	~SessionContainer();
+
+	bool isOpened() const { return m_Writer.isOpened(); }
+	const std::string& fileName() const { return m_FileName; }
+	uint32_t metaTrack() const { return m_Cameras; }
+	//
+	// Method: submit()
+	//
+	// Purpose: hand over one encoded frame of a camera, copies the data.
+	//          The trigger index is derived from the frame ID.
+	//
+	void submit(uint32_t Camera, VmbUint64_t FrameID, VmbUint64_t Timestamp, const uchar *pData, size_t Size);
+	//
+	// Method: close()
+	//
+	// Purpose: write all buffered triggers, complete or not, and finish the file.
+	//
+	void close();
+	uint64_t incompleteTriggers() const { return m_Incomplete; }
+	uint64_t lateFrames() const { return m_Late; }
+	bool failed() const { return m_Writer.failed(); }
+
+	//
+	// Method: seekTrigger()
+	//
+	// Purpose: random access for readers, offset of the first chunk of a
+	//          trigger group (its metadata chunk) in a finished session file.
+	//
+	// Returns: false if the trigger is not in the index
+	//
+	static bool seekTrigger(const std::vector<mcr::index_entry> &index, uint32_t metaTrack, uint64_t Trigger, uint64_t &Offset);
+
+private:
+	SessionContainer(const SessionContainer&);
+	SessionContainer& operator=(const SessionContainer&);
+
+	struct pending_frame
+	{
+		bool                Present;
+		VmbUint64_t         FrameID;
+		VmbUint64_t         Timestamp;
+		std::vector<uchar>  Data;
+		pending_frame() : Present(false), FrameID(0), Timestamp(0) {}
+	};
+	struct trigger_group
+	{
+		uint32_t                    Received;
+		uint64_t                    Bytes;          // encoded data of all frames
+		std::vector<pending_frame>  Frames;
+	};
+	typedef std::map<uint64_t, trigger_group> GroupMap;
+
+	bool passed(uint64_t FrameID, const trigger_group &group, uint64_t NowNs) const;
+	void writeReady(bool all);
+	void writeGroup(uint64_t Trigger, trigger_group &group);
+
+	QMutex                      m_Lock;
+	std::string                 m_FileName;
+	mcr::Writer                 m_Writer;
+	uint32_t                    m_Cameras;
+	uint64_t                    m_MaxPendingBytes;
+	uint64_t                    m_SilentNs;         // a camera submitting nothing for this long is passed
+	DropFrameDetector*          m_pDropDetector;    // told about late frames, may be null
+	std::vector<bool>           m_HaveLatest;
+	std::vector<VmbUint64_t>    m_Latest;           // newest frame ID submitted per camera
+	std::vector<uint64_t>       m_LastSubmitNs;     // per camera, the first submit of any camera starts all clocks
+	bool                        m_Started;
+	GroupMap                    m_Groups;           // keyed by frame ID
+	uint64_t                    m_PendingBytes;     // encoded data in m_Groups
+	bool                        m_HaveBase;
+	VmbUint64_t                 m_BaseFrameID;      // frame ID of trigger 0, the first group written
+	VmbUint64_t                 m_NextFrameID;      // frame IDs below are written, late frames are dropped
+	uint64_t                    m_Incomplete;
+	uint64_t                    m_Late;
+	std::vector<meta_entry>     m_Meta;             // reused metadata payload
+	bool                        m_Closed;
+};
+typedef QSharedPointer<SessionContainer> SessionContainerPtr;
+
+#endif
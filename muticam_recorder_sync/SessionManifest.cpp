@@ -0,0 +1,115 @@
+#include "SessionManifest.h"
+#include <iostream>
+
+SessionManifest::SessionManifest(const std::string &fileName)
+	: m_pFile(NULL)
+{
+	m_pFile = fopen(fileName.c_str(), "w");
+	if (NULL == m_pFile)
+	{
+		std::cout << "could not open manifest " << fileName << std::endl;
+	}
+}
+
+SessionManifest::~SessionManifest()
+{
+	if (NULL != m_pFile)
+	{
+		fclose(m_pFile);
+	}
+}
+
+void SessionManifest::segmentOpened(int cam_id, int segment, const std::string &fileName)
+{
+	QMutexLocker local_lock(&m_Lock);
+	if (NULL != m_pFile)
+	{
+		fprintf(m_pFile, "open\t%d\t%d\t%s\n", cam_id, segment, fileName.c_str());
+		fflush(m_pFile);
+	}
+}
+
+void SessionManifest::segmentClosed(int cam_id, int segment, const std::string &fileName, VmbUint64_t frames, bool writeFailed)
+{
+	QMutexLocker local_lock(&m_Lock);
+	if (NULL != m_pFile)
+	{
+		fprintf(m_pFile, "%s\t%d\t%d\t%s\t%llu\n", writeFailed ? "failed" : "closed", cam_id, segment, fileName.c_str(), static_cast<unsigned long long>(frames));
+		fflush(m_pFile);
+	}
+}
+
+SegmentFinalizer::SegmentFinalizer()
+	: m_StopThread(false)
+{
+}
+
+SegmentFinalizer::~SegmentFinalizer()
+{
+}
+
+void SegmentFinalizer::run()
+{
+	for (;;)
+	{
+		segment_job job;
+		{
+			QMutexLocker local_lock(&m_ClassLock);
+			while (!m_StopThread && m_Jobs.empty())
+			{
+				m_JobsAvailable.wait(local_lock.mutex());
+			}
+			// queued jobs are still done after stop, we must not lose an index
+			if (m_Jobs.empty())
+			{
+				return;
+			}
+			job = m_Jobs.front();
+			m_Jobs.pop_front();
+		}
+		bool writeFailed = false;
+		if (!job.Writer.isNull())
+		{
+			// release waits for all queued blocks, the error state is final after it
+			job.Writer->release();
+			writeFailed = job.Writer->failed();
+		}
+		if (!job.Manifest.isNull())
+		{
+			job.Manifest->segmentClosed(job.CamId, job.Segment, job.FileName, job.Frames, writeFailed);
+		}
+		if (writeFailed)
+		{
+			std::cout << "write error in " << job.FileName << ", the segment is damaged" << std::endl;
+		}
+		std::cout << "finalized " << job.FileName << std::endl;
+	}
+}
+
+void SegmentFinalizer::finalize(const VideoSinkPtr &writer, const SessionManifestPtr &manifest,
+	const std::string &fileName, int cam_id, int segment, VmbUint64_t frames)
+{
+	segment_job job;
+	job.Writer = writer;
+	job.Manifest = manifest;
+	job.FileName = fileName;
+	job.CamId = cam_id;
+	job.Segment = segment;
+	job.Frames = frames;
+	QMutexLocker local_lock(&m_ClassLock);
+	m_Jobs.push_back(job);
+	m_JobsAvailable.wakeOne();
+}
+
+void SegmentFinalizer::stopThread()
+{
+	QMutexLocker local_lock(&m_ClassLock);
+	m_StopThread = true;
+	m_JobsAvailable.wakeOne();
+}
+
+int SegmentFinalizer::pending()
+{
+	QMutexLocker local_lock(&m_ClassLock);
+	return m_Jobs.size();
+}
@@ -0,0 +1,89 @@
+#ifndef SESSION_MANIFEST_H_
+#define SESSION_MANIFEST_H_
+//qt include
+#include "QtCore/QSharedPointer"
+#include "QtCore/QList"
+#include "QtCore/QMutex"
+#include "QtCore/QWaitCondition"
+#include "QtCore/QThread"
+// allied vision include
+#include <VimbaCPP/Include/VimbaCPP.h>
+#include "VideoSink.h"
+// std include
+#include <string>
+#include <stdio.h>
+
+//
+// List of all segments written in one recording session.
+// One line is appended when a segment is opened and one when it has been
+// finalized, so a manifest of an aborted session still names every file.
+// A segment with a write error is finalized as "failed" instead of "closed".
+//
+class SessionManifest
+{
+	FILE*                   m_pFile;
+	QMutex                  m_Lock;
+public:
+	SessionManifest(const std::string &fileName);
+	~SessionManifest();
+	bool isOpen() const { return NULL != m_pFile; }
+	//
+	// Method: segmentOpened()
+	//
+	// Purpose: note a new segment before the first frame is written into it.
+	//
+	void segmentOpened(int cam_id, int segment, const std::string &fileName);
+	//
+	// Method: segmentClosed()
+	//
+	// Purpose: note a segment whose container has been finalized, writeFailed
+	//          if a block of the container or its index did not reach the disk.
+	//
+	void segmentClosed(int cam_id, int segment, const std::string &fileName, VmbUint64_t frames, bool writeFailed);
+};
+typedef QSharedPointer<SessionManifest> SessionManifestPtr;
+
+//
+// Closes finished video segments off the recorder threads.
+// cv::VideoWriter writes the container index on release, which can take
+// seconds for large files, so recorders hand their old sink over and
+// continue with the next segment right away.
+//
+class SegmentFinalizer: public QThread
+{
+	Q_OBJECT;
+	struct segment_job
+	{
+		VideoSinkPtr                Writer;
+		SessionManifestPtr          Manifest;
+		std::string                 FileName;
+		int                         CamId;
+		int                         Segment;
+		VmbUint64_t                 Frames;
+	};
+	QList<segment_job>      m_Jobs;
+	bool                    m_StopThread;
+	QMutex                  m_ClassLock;
+	QWaitCondition          m_JobsAvailable;
+
+	void run();
+public:
+	SegmentFinalizer();
+	virtual ~SegmentFinalizer();
+	//
+	// Method: finalize()
+	//
+	// Purpose: queue a sink for release, returns immediately.
+	//
+	void finalize(const VideoSinkPtr &writer, const SessionManifestPtr &manifest,
+		const std::string &fileName, int cam_id, int segment, VmbUint64_t frames);
+	//
+	// Method: stopThread()
+	//
+	// Purpose: finish all queued jobs, then end the thread.
+	//
+	void stopThread();
+	int pending();
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include "SpillRing.h"
+#include <cstring>
+#include <iostream>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/statvfs.h>
+#endif
+
+namespace
+{
+	const VmbUint32_t   SPILL_MAGIC = 0x4c495053;   // "SPIL"
+	const VmbUint64_t   SPILL_PAGE = 4096;
+}
+
+SpillRing::SpillRing(const std::string &path, VmbUint32_t frameBytes, VmbUint64_t maxBytes)
+	: m_Path(path)
+	, m_SlotStride(((sizeof(slot_header) + frameBytes + SPILL_PAGE - 1) / SPILL_PAGE) * SPILL_PAGE)
+	, m_SlotCount(0)
+	, m_Head(0)
+	, m_Tail(0)
+	, m_pView(NULL)
+#ifdef _WIN32
+	, m_hFile(INVALID_HANDLE_VALUE)
+	, m_hMapping(NULL)
+#else
+	, m_Fd(-1)
+#endif
+{
+	VmbUint64_t count = maxBytes / m_SlotStride;
+	if (0 == frameBytes || 0 == count)
+	{
+		return;
+	}
+	m_SlotCount = static_cast<VmbUint32_t>(count);
+	const VmbUint64_t fileSize = m_SlotStride * m_SlotCount;
+#ifdef _WIN32
+	m_hFile = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (INVALID_HANDLE_VALUE == m_hFile)
+	{
+		std::cout << "spill file could not be created " << path << std::endl;
+		return;
+	}
+	// pre-allocate the whole ring so writing never extends the file
+	LARGE_INTEGER end;
+	end.QuadPart = static_cast<LONGLONG>(fileSize);
+	if (!SetFilePointerEx(m_hFile, end, NULL, FILE_BEGIN) || !SetEndOfFile(m_hFile))
+	{
+		std::cout << "spill file could not be pre-allocated " << path << std::endl;
+		return;
+	}
+	m_hMapping = CreateFileMappingA(m_hFile, NULL, PAGE_READWRITE,
+		static_cast<DWORD>(fileSize >> 32), static_cast<DWORD>(fileSize & 0xffffffff), NULL);
+	if (NULL == m_hMapping)
+	{
+		std::cout << "spill file could not be mapped " << path << std::endl;
+		return;
+	}
+	m_pView = static_cast<VmbUchar_t*>(MapViewOfFile(m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+#else
+	m_Fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (m_Fd < 0)
+	{
+		std::cout << "spill file could not be created " << path << std::endl;
+		return;
+	}
+	// pre-allocate the whole ring so writing never extends the file
+	if (0 != posix_fallocate(m_Fd, 0, static_cast<off_t>(fileSize)))
+	{
+		std::cout << "spill file could not be pre-allocated " << path << std::endl;
+		return;
+	}
+	void *pView = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_Fd, 0);
+	if (MAP_FAILED != pView)
+	{
+		madvise(pView, fileSize, MADV_SEQUENTIAL);
+		m_pView = static_cast<VmbUchar_t*>(pView);
+	}
+#endif
+	if (NULL == m_pView)
+	{
+		std::cout << "spill file view could not be created " << path << std::endl;
+	}
+}
+
+VmbUint64_t SpillRing::budget(const std::string &path, VmbUint64_t maxBytes, int Rings)
+{
+	const std::string::size_type slash = path.find_last_of("/\\");
+	const std::string directory = std::string::npos == slash ? std::string(".") : path.substr(0, slash + 1);
+	VmbUint64_t freeBytes = 0;
+#ifdef _WIN32
+	ULARGE_INTEGER available;
+	if (GetDiskFreeSpaceExA(directory.c_str(), &available, NULL, NULL))
+	{
+		freeBytes = available.QuadPart;
+	}
+#else
+	struct statvfs fs;
+	if (0 == statvfs(directory.c_str(), &fs))
+	{
+		freeBytes = static_cast<VmbUint64_t>(fs.f_bavail) * fs.f_frsize;
+	}
+#endif
+	const VmbUint64_t share = freeBytes / 4 / static_cast<VmbUint64_t>(Rings > 0 ? Rings : 1);
+	return share < maxBytes ? share : maxBytes;
+}
+
+SpillRing::~SpillRing()
+{
+#ifdef _WIN32
+	if (NULL != m_pView)
+	{
+		UnmapViewOfFile(m_pView);
+	}
+	if (NULL != m_hMapping)
+	{
+		CloseHandle(m_hMapping);
+	}
+	if (INVALID_HANDLE_VALUE != m_hFile)
+	{
+		CloseHandle(m_hFile);
+		DeleteFileA(m_Path.c_str());
+	}
+#else
+	if (NULL != m_pView)
+	{
+		munmap(m_pView, m_SlotStride * m_SlotCount);
+	}
+	if (m_Fd >= 0)
+	{
+		close(m_Fd);
+		unlink(m_Path.c_str());
+	}
+#endif
+}
+
+bool SpillRing::push(const VmbUchar_t *pBuffer, VmbUint32_t BufferSize, VmbUint32_t Width, VmbUint32_t Height, VmbPixelFormat_t PixelFormat,
+	VmbUint64_t FrameID, VmbUint64_t Timestamp, VmbUint64_t HostTime)
+{
+	if (NULL == m_pView
+		|| full()
+		|| sizeof(slot_header) + BufferSize > m_SlotStride)
+	{
+		return false;
+	}
+	VmbUchar_t *pSlot = slot(m_Tail);
+	slot_header header;
+	header.Magic = SPILL_MAGIC;
+	header.DataSize = BufferSize;
+	header.Width = Width;
+	header.Height = Height;
+	header.PixelFormat = PixelFormat;
+	header.Reserved = 0;
+	header.FrameID = FrameID;
+	header.Timestamp = Timestamp;
+	header.HostTime = HostTime;
+	memcpy(pSlot, &header, sizeof(header));
+	memcpy(pSlot + sizeof(header), pBuffer, BufferSize);
+	++m_Tail;
+	return true;
+}
+
+const SpillRing::slot_header* SpillRing::front(const VmbUchar_t *&pData) const
+{
+	if (NULL == m_pView || empty())
+	{
+		pData = NULL;
+		return NULL;
+	}
+	const VmbUchar_t *pSlot = slot(m_Head);
+	pData = pSlot + sizeof(slot_header);
+	return reinterpret_cast<const slot_header*>(pSlot);
+}
+
+void SpillRing::pop()
+{
+	if (!empty())
+	{
+		++m_Head;
+	}
+}
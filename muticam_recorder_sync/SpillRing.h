@@ -0,0 +1,112 @@
+#ifndef SPILL_RING_H_
+#define SPILL_RING_H_
+
+#include <string>
+
+#include "VimbaImageTransform/Include/VmbTransform.h"
+#include <VimbaCPP/Include/VimbaCPP.h>
+
+//
+// Overflow tier for the recorder frame queue.
+// Raw frames are appended to a pre-allocated, memory-mapped ring file when
+// the in-memory queue is full and are read back in the same order once the
+// encoder catches up. Every slot has the same stride, so writes and reads
+// walk the file strictly sequentially.
+//
+// The ring itself is not locked. The owner serialises push/pop/clear
+// (OpenCVRecorder does it with its class lock); the slot returned by front()
+// stays valid until pop() is called.
+//
+class SpillRing
+{
+public:
+	//
+	// per slot header, stored in front of the raw frame data
+	//
+	struct slot_header
+	{
+		VmbUint32_t         Magic;
+		VmbUint32_t         DataSize;
+		VmbUint32_t         Width;
+		VmbUint32_t         Height;
+		VmbPixelFormat_t    PixelFormat;
+		VmbUint32_t         Reserved;
+		VmbUint64_t         FrameID;
+		VmbUint64_t         Timestamp;
+		VmbUint64_t         HostTime;
+	};
+
+	//
+	// Method: SpillRing()
+	//
+	// Purpose: create and pre-allocate the ring file.
+	//          Capacity is the number of whole slots fitting into maxBytes.
+	//          Check isOpen() afterwards, a failing ring just stays disabled.
+	//
+	SpillRing(const std::string &path, VmbUint32_t frameBytes, VmbUint64_t maxBytes);
+	~SpillRing();
+	//
+	// Method: budget()
+	//
+	// Purpose: bytes one of Rings rings next to path may pre-allocate: maxBytes,
+	//          but all rings together take at most a quarter of the free disk
+	//          space, the rest is left to the recordings.
+	//
+	static VmbUint64_t budget(const std::string &path, VmbUint64_t maxBytes, int Rings);
+
+	bool                isOpen()    const { return NULL != m_pView; }
+	VmbUint32_t         capacity()  const { return m_SlotCount; }
+	VmbUint32_t         size()      const { return static_cast<VmbUint32_t>(m_Tail - m_Head); }
+	bool                empty()     const { return m_Tail == m_Head; }
+	bool                full()      const { return size() >= m_SlotCount; }
+	//
+	// Method: push()
+	//
+	// Purpose: append a frame at the tail.
+	//
+	// Returns: false if the ring is full, closed or the frame does not fit a slot
+	//
+	bool push(const VmbUchar_t *pBuffer, VmbUint32_t BufferSize, VmbUint32_t Width, VmbUint32_t Height, VmbPixelFormat_t PixelFormat,
+		VmbUint64_t FrameID, VmbUint64_t Timestamp, VmbUint64_t HostTime);
+	//
+	// Method: front()
+	//
+	// Purpose: get the oldest spilled frame without removing it.
+	//
+	// Returns: NULL if the ring is empty, pData points into the mapping
+	//
+	const slot_header*  front(const VmbUchar_t *&pData) const;
+	//
+	// Method: pop()
+	//
+	// Purpose: release the oldest slot for reuse.
+	//
+	void pop();
+	//
+	// Method: clear()
+	//
+	// Purpose: drop all spilled frames.
+	//
+	void clear() { m_Head = m_Tail; }
+
+private:
+	SpillRing(const SpillRing&);
+	SpillRing& operator=(const SpillRing&);
+
+	VmbUchar_t*         slot(VmbUint64_t n) const { return m_pView + (n % m_SlotCount) * m_SlotStride; }
+
+	std::string         m_Path;
+	VmbUint64_t         m_SlotStride;       // header + payload rounded up to the page size
+	VmbUint32_t         m_SlotCount;
+	VmbUint64_t         m_Head;             // next slot to read, counts monotonically
+	VmbUint64_t         m_Tail;             // next slot to write, counts monotonically
+	VmbUchar_t*         m_pView;
+#ifdef _WIN32
+	void*               m_hFile;
+	void*               m_hMapping;
+#else
+	int                 m_Fd;
+#endif
+};
+
+#endif
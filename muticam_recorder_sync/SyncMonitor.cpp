@@ -0,0 +1,320 @@
+#include "SyncMonitor.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+
+namespace
+{
+	const uint64_t  NO_TRIGGER = ~0ull;
+	const double    DRIFT_GAIN = 1.0 / 256;     // offsets follow drift over a few hundred triggers
+}
+
+SyncMonitor::SyncMonitor()
+	: m_Cameras(0)
+	, m_WindowTriggers(1)
+	, m_HaveNext(false)
+	, m_NextTrigger(0)
+	, m_pClockMapper(NULL)
+	, m_HaveOffset(false)
+	, m_Mapped(false)
+	, m_Active(0)
+	, m_Triggers(0)
+	, m_Incomplete(0)
+{
+	reset(std::vector<double>(), 1);
+}
+
+void SyncMonitor::reset(const std::vector<double> &TickFrequency, uint32_t WindowTriggers, const ClockMapper *pClockMapper)
+{
+	QMutexLocker local_lock(&m_Lock);
+	m_pClockMapper = pClockMapper;
+	m_Cameras = static_cast<int>(TickFrequency.size());
+	m_WindowTriggers = 0 == WindowTriggers ? 1 : WindowTriggers;
+	m_UsPerTick.resize(m_Cameras);
+	for (int i = 0; i < m_Cameras; ++i)
+	{
+		// GigE cameras without the feature count nanoseconds
+		m_UsPerTick[i] = TickFrequency[i] > 0 ? 1e6 / TickFrequency[i] : 1e-3;
+	}
+	m_Rings.reset(m_Cameras > 0 ? new camera_ring[m_Cameras] : NULL);
+	for (int i = 0; i < m_Cameras; ++i)
+	{
+		camera_ring &ring = m_Rings[i];
+		ring.First.store(NO_TRIGGER);
+		ring.Newest.store(0);
+		for (int s = 0; s < SLOTS; ++s)
+		{
+			ring.Stamps[s].FrameID.store(NO_TRIGGER);
+			ring.Stamps[s].Timestamp.store(0);
+		}
+	}
+	m_HaveNext = false;
+	m_NextTrigger = 0;
+	m_OffsetUs.assign(m_Cameras, 0);
+	m_Timestamp.assign(m_Cameras, 0);
+	m_Raw.assign(m_Cameras, 0);
+	m_Corrected.assign(m_Cameras, 0);
+	m_HaveOffset = false;
+	m_Mapped = false;
+	const int pairs = m_Cameras * (m_Cameras - 1) / 2;
+	m_Pairs.reset(pairs > 0 ? new skew_stats[pairs] : NULL);
+	for (int p = -1; p < pairs; ++p)
+	{
+		skew_stats &stats = p < 0 ? m_Spread : m_Pairs[p];
+		stats.Session.reset();
+		stats.Window[0].reset();
+		stats.Window[1].reset();
+		stats.SumUs.store(0);
+	}
+	m_Active.store(0);
+	m_Triggers.store(0);
+	m_Incomplete.store(0);
+}
+
+int SyncMonitor::pairIndex(int a, int b) const
+{
+	if (a > b)
+	{
+		std::swap(a, b);
+	}
+	// row a of the upper triangle starts after the rows above it
+	return a * (2 * m_Cameras - a - 1) / 2 + (b - a - 1);
+}
+
+void SyncMonitor::frameArrived(int cam, VmbUint64_t FrameID, VmbUint64_t Timestamp)
+{
+	if (cam < 0 || cam >= m_Cameras || m_Cameras < 2)
+	{
+		return;
+	}
+	camera_ring &ring = m_Rings[cam];
+	stamp &entry = ring.Stamps[FrameID % SLOTS];
+	entry.FrameID.store(NO_TRIGGER, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	entry.Timestamp.store(Timestamp, std::memory_order_relaxed);
+	entry.FrameID.store(FrameID, std::memory_order_release);
+	if (NO_TRIGGER == ring.First.load(std::memory_order_relaxed))
+	{
+		ring.First.store(FrameID, std::memory_order_release);
+	}
+	if (FrameID > ring.Newest.load(std::memory_order_relaxed))
+	{
+		ring.Newest.store(FrameID, std::memory_order_release);
+	}
+}
+
+//
+// Method: read()
+//
+// Purpose: the time stamp of a trigger from the ring of a camera.
+//
+// Returns: false if the camera did not deliver it or has overwritten it since
+//
+bool SyncMonitor::read(const camera_ring &ring, uint64_t Trigger, VmbUint64_t &Timestamp) const
+{
+	const stamp &entry = ring.Stamps[Trigger % SLOTS];
+	if (entry.FrameID.load(std::memory_order_acquire) != Trigger)
+	{
+		return false;
+	}
+	Timestamp = entry.Timestamp.load(std::memory_order_relaxed);
+	// a writer that started meanwhile has changed the frame ID first
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return entry.FrameID.load(std::memory_order_relaxed) == Trigger;
+}
+
+void SyncMonitor::update()
+{
+	QMutexLocker local_lock(&m_Lock);
+	if (m_Cameras < 2)
+	{
+		return;
+	}
+	uint64_t oldest = NO_TRIGGER;
+	uint64_t newest = 0;
+	uint64_t passed = NO_TRIGGER;          // every camera delivered or moved past the triggers up to here
+	bool started = true;
+	for (int i = 0; i < m_Cameras; ++i)
+	{
+		const uint64_t first = m_Rings[i].First.load(std::memory_order_acquire);
+		const uint64_t last = m_Rings[i].Newest.load(std::memory_order_acquire);
+		if (NO_TRIGGER == first)
+		{
+			// nothing is passed before every camera sent a frame
+			started = false;
+			continue;
+		}
+		oldest = std::min(oldest, first);
+		newest = std::max(newest, last);
+		passed = std::min(passed, last);
+	}
+	if (NO_TRIGGER == oldest)
+	{
+		return;
+	}
+	if (!m_HaveNext)
+	{
+		m_HaveNext = true;
+		m_NextTrigger = oldest;
+	}
+	// the newest camera has overwritten older triggers, a silent camera must not stall the rest
+	if (newest >= SLOTS && m_NextTrigger < newest - SLOTS + 1)
+	{
+		m_Incomplete.fetch_add(newest - SLOTS + 1 - m_NextTrigger, std::memory_order_relaxed);
+		m_NextTrigger = newest - SLOTS + 1;
+	}
+	for (; started && m_NextTrigger <= passed; ++m_NextTrigger)
+	{
+		bool complete = true;
+		for (int i = 0; i < m_Cameras && complete; ++i)
+		{
+			complete = read(m_Rings[i], m_NextTrigger, m_Timestamp[i]);
+		}
+		if (complete)
+		{
+			evaluate();
+		}
+		else
+		{
+			// some camera lost it
+			m_Incomplete.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+}
+
+//
+// Method: evaluate()
+//
+// Purpose: record spread and pair skews of the complete trigger in m_Timestamp, caller holds m_Lock.
+//
+void SyncMonitor::evaluate()
+{
+	std::vector<double> &raw = m_Raw;
+	// the mapped timeline is used as soon as every camera is fitted
+	bool mapped = NULL != m_pClockMapper;
+	for (int i = 0; i < m_Cameras && mapped; ++i)
+	{
+		int64_t commonNs = 0;
+		mapped = m_pClockMapper->fitted(i) && m_pClockMapper->toCommonNs(i, m_Timestamp[i], commonNs);
+		raw[i] = commonNs * 1e-3;
+	}
+	if (!mapped)
+	{
+		for (int i = 0; i < m_Cameras; ++i)
+		{
+			raw[i] = static_cast<double>(m_Timestamp[i]) * m_UsPerTick[i];
+		}
+	}
+	if (mapped != m_Mapped)
+	{
+		// switching timelines, take the offsets again
+		m_Mapped = mapped;
+		m_HaveOffset = false;
+	}
+	std::vector<double> &corrected = m_Corrected;
+	const double base = raw[0];
+	for (int i = 0; i < m_Cameras; ++i)
+	{
+		raw[i] -= base;
+		if (!m_HaveOffset)
+		{
+			// the mapped timeline is common to all cameras already
+			m_OffsetUs[i] = m_Mapped ? 0 : raw[i];
+		}
+		corrected[i] = raw[i] - m_OffsetUs[i];
+	}
+	m_HaveOffset = true;
+
+	double earliest = corrected[0];
+	double latest = corrected[0];
+	for (int i = 1; i < m_Cameras; ++i)
+	{
+		earliest = std::min(earliest, corrected[i]);
+		latest = std::max(latest, corrected[i]);
+	}
+	record(m_Spread, static_cast<int64_t>(latest - earliest));
+	for (int a = 0; a < m_Cameras; ++a)
+	{
+		for (int b = a + 1; b < m_Cameras; ++b)
+		{
+			record(m_Pairs[pairIndex(a, b)], static_cast<int64_t>(corrected[b] - corrected[a]));
+		}
+	}
+	// follow the clock drift, after the skew was taken, the mapper has removed it already
+	for (int i = 1; i < m_Cameras && !m_Mapped; ++i)
+	{
+		m_OffsetUs[i] += DRIFT_GAIN * corrected[i];
+	}
+
+	const uint64_t triggers = m_Triggers.fetch_add(1, std::memory_order_relaxed) + 1;
+	if (0 == triggers % m_WindowTriggers)
+	{
+		// the filled window becomes the one readers see, the old one is reused
+		const int next = 1 - m_Active.load(std::memory_order_relaxed);
+		m_Spread.Window[next].reset();
+		const int pairs = m_Cameras * (m_Cameras - 1) / 2;
+		for (int p = 0; p < pairs; ++p)
+		{
+			m_Pairs[p].Window[next].reset();
+		}
+		m_Active.store(next, std::memory_order_release);
+	}
+}
+
+void SyncMonitor::record(skew_stats &stats, int64_t skewUs)
+{
+	const uint64_t magnitude = static_cast<uint64_t>(skewUs < 0 ? -skewUs : skewUs);
+	stats.Session.record(magnitude);
+	stats.Window[m_Active.load(std::memory_order_relaxed)].record(magnitude);
+	stats.SumUs.fetch_add(skewUs, std::memory_order_relaxed);
+}
+
+std::string SyncMonitor::formatMetrics(double SessionSeconds) const
+{
+	std::stringstream line;
+	const LatencyHistogram &spreadWindow = lastWindow(m_Spread);
+	line << SessionSeconds << "\tspread\t" << spreadWindow.percentile(0.5)
+		<< "\t" << spreadWindow.percentile(0.99)
+		<< "\t" << spreadWindow.max()
+		<< "\t" << m_Spread.Session.percentile(0.99)
+		<< "\t" << m_Spread.Session.max()
+		<< "\t" << triggers() << "\t" << incomplete() << "\n";
+	for (int a = 0; a < m_Cameras; ++a)
+	{
+		for (int b = a + 1; b < m_Cameras; ++b)
+		{
+			const skew_stats &stats = pair(a, b);
+			const LatencyHistogram &window = lastWindow(stats);
+			const uint64_t count = stats.Session.count();
+			line << SessionSeconds << "\t" << a << "-" << b << "\t" << window.percentile(0.5)
+				<< "\t" << window.percentile(0.99)
+				<< "\t" << window.max()
+				<< "\t" << stats.Session.percentile(0.99)
+				<< "\t" << stats.Session.max()
+				<< "\t" << count
+				<< "\t" << (0 == count ? 0 : stats.SumUs.load(std::memory_order_relaxed) / static_cast<int64_t>(count)) << "\n";
+		}
+	}
+	return line.str();
+}
+
+std::string SyncMonitor::formatHistograms() const
+{
+	std::stringstream text;
+	for (int p = -1; p < m_Cameras * (m_Cameras - 1) / 2; ++p)
+	{
+		const skew_stats &stats = p < 0 ? m_Spread : m_Pairs[p];
+		text << (p < 0 ? std::string("spread") : "pair " + std::to_string(p));
+		for (int i = 0; i < LatencyHistogram::BUCKETS; ++i)
+		{
+			const uint64_t n = stats.Session.bucketCount(i);
+			if (0 != n)
+			{
+				text << "\t<=" << LatencyHistogram::upperBound(i) << "us:" << n;
+			}
+		}
+		text << "\n";
+	}
+	return text.str();
+}
@@ -0,0 +1,154 @@
+#ifndef SYNC_MONITOR_H_
+#define SYNC_MONITOR_H_
+//qt include
+#include "QtCore/QMutex"
+// std include
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+// allied vision include
+#include <VimbaCPP/Include/VimbaCPP.h>
+
+#include "LatencyHistogram.h"
+#include "ClockMapper.h"
+
+//
+// Measures how well the cameras are synchronized.
+//
+// Frames are grouped by trigger, the frame ID is the common reference like
+// in SessionContainer. frameArrived() only stores the time stamp in a ring
+// of its own camera, lock-free; update() runs off the frame observers and
+// evaluates every trigger all cameras delivered or moved past. For every
+// complete trigger the device time stamps are converted to microseconds,
+// corrected by the clock offset of each camera against camera 0, and the
+// spread (latest minus earliest) as well as the skew of every camera pair
+// go into lock-free histograms.
+//
+// Without a common time base a constant offset between two cameras cannot
+// be told apart from their clock offset, so the offsets are taken from the
+// first complete trigger and then follow slow drift only. What is measured
+// is how much the trigger to exposure latency moves between cameras, which
+// is what breaks synchronized captures. Once a ClockMapper has fitted every
+// camera the time stamps are compared on its common timeline instead, which
+// also shows constant offsets, within the accuracy of the mapping.
+//
+// Every histogram exists twice: one for the whole session and a rolling
+// pair of windows, the one being filled and the last complete one.
+//
+class SyncMonitor
+{
+public:
+	enum { SLOTS = 4096 };                      // triggers each camera keeps for update(), seconds at burst rates
+
+	//
+	// skew statistics of one camera pair, or of the spread
+	//
+	struct skew_stats
+	{
+		LatencyHistogram        Session;            // |skew| in us since reset
+		LatencyHistogram        Window[2];          // |skew| in us, rolling windows
+		std::atomic<int64_t>    SumUs;              // signed sum, for the mean
+	};
+
+	SyncMonitor();
+	//
+	// Method: reset()
+	//
+	// Purpose: configure the cameras before an acquisition starts, may allocate.
+	//          TickFrequency holds the device clock rate of every camera in Hz.
+	//          WindowTriggers is the length of one rolling window.
+	//
+	void reset(const std::vector<double> &TickFrequency, uint32_t WindowTriggers, const ClockMapper *pClockMapper = NULL);
+	//
+	// Method: frameArrived()
+	//
+	// Purpose: store the time stamp of a frame, called from the frame observer
+	//          of the camera, one thread per camera. O(1), no lock, never allocates.
+	//
+	void frameArrived(int cam, VmbUint64_t FrameID, VmbUint64_t Timestamp);
+	//
+	// Method: update()
+	//
+	// Purpose: evaluate the stored triggers, call periodically from one thread,
+	//          e.g. the metrics timer. A trigger older than SLOTS frames of the
+	//          newest camera counts as incomplete. O(cameras^2) per trigger,
+	//          never allocates.
+	//
+	void update();
+
+	int                 cameras()               const { return m_Cameras; }
+	int                 pairIndex(int a, int b) const;
+	const skew_stats&   spread()                const { return m_Spread; }
+	const skew_stats&   pair(int a, int b)      const { return m_Pairs[pairIndex(a, b)]; }
+	//
+	// Method: lastWindow()
+	//
+	// Purpose: the window histogram that was filled last, for rolling percentiles.
+	//
+	const LatencyHistogram& lastWindow(const skew_stats &stats) const { return stats.Window[1 - m_Active.load(std::memory_order_acquire)]; }
+	uint64_t            triggers()              const { return m_Triggers.load(std::memory_order_relaxed); }
+	uint64_t            incomplete()            const { return m_Incomplete.load(std::memory_order_relaxed); }
+	//
+	// Method: formatMetrics()
+	//
+	// Purpose: one text line per pair and one for the spread, for the metrics file.
+	//
+	std::string         formatMetrics(double SessionSeconds) const;
+	//
+	// Method: formatHistograms()
+	//
+	// Purpose: the non empty buckets of all session histograms.
+	//
+	std::string         formatHistograms() const;
+
+private:
+	SyncMonitor(const SyncMonitor&);
+	SyncMonitor& operator=(const SyncMonitor&);
+
+	//
+	// one time stamp of a camera ring, written like a seqlock: FrameID is
+	// NO_TRIGGER while the time stamp changes
+	//
+	struct stamp
+	{
+		std::atomic<uint64_t>       FrameID;
+		std::atomic<uint64_t>       Timestamp;
+	};
+	//
+	// written by the observer of the camera only
+	//
+	struct camera_ring
+	{
+		std::atomic<uint64_t>       First;      // frame ID of the first frame, NO_TRIGGER before
+		std::atomic<uint64_t>       Newest;
+		stamp                       Stamps[SLOTS];
+	};
+
+	bool read(const camera_ring &ring, uint64_t Trigger, VmbUint64_t &Timestamp) const;
+	void evaluate();
+	void record(skew_stats &stats, int64_t skewUs);
+
+	QMutex                      m_Lock;             // serializes reset() and update(), never taken per frame
+	int                         m_Cameras;
+	uint32_t                    m_WindowTriggers;
+	std::vector<double>         m_UsPerTick;
+	std::unique_ptr<camera_ring[]> m_Rings;         // one per camera, sized by reset()
+	bool                        m_HaveNext;
+	uint64_t                    m_NextTrigger;      // oldest trigger update() has not evaluated
+	const ClockMapper*          m_pClockMapper;     // drift source, may be null
+	bool                        m_HaveOffset;
+	bool                        m_Mapped;           // offsets refer to the mapped timeline
+	std::vector<double>         m_OffsetUs;         // clock of camera n minus clock of camera 0
+	std::vector<VmbUint64_t>    m_Timestamp;        // scratch of update(), the trigger being evaluated
+	std::vector<double>         m_Raw;              // scratch of evaluate()
+	std::vector<double>         m_Corrected;
+	skew_stats                  m_Spread;
+	std::unique_ptr<skew_stats[]> m_Pairs;          // upper triangle, see pairIndex()
+	std::atomic<int>            m_Active;           // window being filled
+	std::atomic<uint64_t>       m_Triggers;
+	std::atomic<uint64_t>       m_Incomplete;
+};
+
+#endif
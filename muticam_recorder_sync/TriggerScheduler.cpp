@@ -0,0 +1,186 @@
+#include "TriggerScheduler.h"
+#include <algorithm>
+#include <sstream>
+
+const double TriggerScheduler::HIGH_WATERMARK = 0.5;
+const double TriggerScheduler::LOW_WATERMARK = 0.05;
+const double TriggerScheduler::STOP_WATERMARK = 0.9;
+const double TriggerScheduler::MIN_RATE_FRACTION = 1.0 / 16;
+
+namespace
+{
+	const uint32_t  RATIO_ONE = 1u << 16;
+	const double    THROUGHPUT_GAIN = 0.25;     // smoothing of the throughput estimate per update
+	const double    RATE_MARGIN = 0.9;          // stay below the slowest recorder so its backlog drains
+	const double    RECOVER_STEP = 1.0 / 20;    // additive increase, part of the nominal rate per update
+}
+
+TriggerScheduler::TriggerScheduler()
+	: m_Policy(POLICY_CONSTANT_RATE)
+	, m_NominalRate(1)
+	, m_Ratio(RATIO_ONE)
+	, m_Hold(false)
+	, m_Credit(0)
+	, m_Fired(0)
+	, m_Skipped(0)
+{
+	reset(POLICY_CONSTANT_RATE, 1);
+}
+
+void TriggerScheduler::reset(policy Policy, double NominalRate)
+{
+	m_Policy = Policy;
+	m_NominalRate = NominalRate > 0 ? NominalRate : 1;
+	m_Ratio.store(RATIO_ONE);
+	m_Hold.store(false);
+	m_Credit = 0;
+	m_Fired.store(0);
+	m_Skipped.store(0);
+	m_HaveLast = false;
+	m_LastNs = 0;
+	m_LastFired = 0;
+	m_LastBacklog.clear();
+	m_LastDropped.clear();
+	m_Throughput.clear();
+}
+
+bool TriggerScheduler::fire()
+{
+	if (!m_Hold.load(std::memory_order_relaxed))
+	{
+		// one trigger per full credit, the skipped ticks spread evenly
+		m_Credit += m_Ratio.load(std::memory_order_relaxed);
+		if (m_Credit >= RATIO_ONE)
+		{
+			m_Credit -= RATIO_ONE;
+			m_Fired.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	m_Skipped.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+double TriggerScheduler::rate() const
+{
+	return m_NominalRate * m_Ratio.load(std::memory_order_relaxed) / RATIO_ONE;
+}
+
+bool TriggerScheduler::update(uint64_t NowNs, const std::vector<recorder_load> &Recorders, std::string &Changes)
+{
+	const int recorders = static_cast<int>(Recorders.size());
+	const uint64_t fired = m_Fired.load(std::memory_order_relaxed);
+	if (!m_HaveLast || NowNs <= m_LastNs || static_cast<size_t>(recorders) != m_Throughput.size())
+	{
+		// first call, or the recorders changed: start over from this load
+		m_LastBacklog.assign(recorders, 0);
+		m_LastDropped.assign(recorders, 0);
+		m_Throughput.assign(recorders, m_NominalRate);
+		m_HaveLast = true;
+		m_LastNs = NowNs;
+		m_LastFired = fired;
+		for (int i = 0; i < recorders; ++i)
+		{
+			m_LastBacklog[i] = Recorders[i].Backlog;
+			m_LastDropped[i] = Recorders[i].Dropped;
+		}
+		return false;
+	}
+	const double seconds = (NowNs - m_LastNs) * 1e-9;
+	const double sent = static_cast<double>(fired - m_LastFired);
+	bool dropped = false;
+	bool growing = false;
+	double fill = 0;
+	double slowest = m_NominalRate;
+	for (int i = 0; i < recorders; ++i)
+	{
+		const recorder_load &load = Recorders[i];
+		const double growth = static_cast<double>(load.Backlog) - static_cast<double>(m_LastBacklog[i]);
+		// every trigger sent adds a frame, what did not show up in the backlog was written
+		const double written = std::max(0.0, sent - growth) / seconds;
+		m_Throughput[i] += THROUGHPUT_GAIN * (written - m_Throughput[i]);
+		dropped = dropped || load.Dropped > m_LastDropped[i];
+		growing = growing || growth > 0;
+		fill = std::max(fill, 0 == load.Capacity ? 0.0 : static_cast<double>(load.Backlog) / load.Capacity);
+		// a recorder without backlog keeps up with whatever is sent, its estimate is only a lower bound
+		if (0 != load.Backlog)
+		{
+			slowest = std::min(slowest, m_Throughput[i]);
+		}
+		m_LastBacklog[i] = load.Backlog;
+		m_LastDropped[i] = load.Dropped;
+	}
+	m_LastNs = NowNs;
+	m_LastFired = fired;
+	const double current = rate();
+	if (POLICY_CONSTANT_RATE == m_Policy)
+	{
+		if (!dropped)
+		{
+			return false;
+		}
+		// the throughput estimate lags, step down at least by the margin
+		setRate(RATE_MARGIN * std::min(current, slowest), "recorder dropped frames", Changes);
+		return current != rate();
+	}
+
+	const bool hold = fill >= STOP_WATERMARK;
+	if (hold != m_Hold.load(std::memory_order_relaxed))
+	{
+		m_Hold.store(hold, std::memory_order_relaxed);
+		std::stringstream msg;
+		msg << (hold ? "triggers held, recorder backlog at " : "triggers resumed, recorder backlog at ")
+			<< static_cast<int>(fill * 100) << "%\n";
+		Changes += msg.str();
+	}
+	if (dropped || fill >= HIGH_WATERMARK)
+	{
+		setRate(std::min(current / 2, RATE_MARGIN * slowest), dropped ? "recorder dropped frames" : "recorder backlog high", Changes);
+	}
+	else if (growing && fill >= LOW_WATERMARK)
+	{
+		if (current > RATE_MARGIN * slowest)
+		{
+			setRate(RATE_MARGIN * slowest, "recorder backlog growing", Changes);
+		}
+	}
+	else if (fill < LOW_WATERMARK && !growing && current < m_NominalRate)
+	{
+		setRate(current + RECOVER_STEP * m_NominalRate, "recorders caught up", Changes);
+	}
+	else
+	{
+		return false;
+	}
+	return current != rate();
+}
+
+//
+// Method: setRate()
+//
+// Purpose: clamp and publish a new rate, log it if it changed.
+//
+void TriggerScheduler::setRate(double Rate, const char *reason, std::string &Changes)
+{
+	const double clamped = std::max(MIN_RATE_FRACTION * m_NominalRate, std::min(Rate, m_NominalRate));
+	const uint32_t ratio = static_cast<uint32_t>(clamped / m_NominalRate * RATIO_ONE + 0.5);
+	const uint32_t old = m_Ratio.exchange(ratio, std::memory_order_relaxed);
+	if (old != ratio)
+	{
+		std::stringstream msg;
+		msg.precision(3);
+		msg << "trigger rate " << m_NominalRate * old / RATIO_ONE << " -> " << m_NominalRate * ratio / RATIO_ONE
+			<< " fps, " << reason << "\n";
+		Changes += msg.str();
+	}
+}
+
+const char* TriggerScheduler::policyName(policy Policy)
+{
+	switch (Policy)
+	{
+	case POLICY_CONSTANT_RATE:  return "constant rate";
+	case POLICY_COMPLETE_SETS:  return "complete sets";
+	default:                    return "unknown";
+	}
+}
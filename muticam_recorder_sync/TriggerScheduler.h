@@ -0,0 +1,111 @@
+#ifndef TRIGGER_SCHEDULER_H_
+#define TRIGGER_SCHEDULER_H_
+//qt include
+#include "QtCore/QMutex"
+// std include
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//
+// Backpressure from the recorders to the action command timer.
+//
+// A trigger exposes every camera once, but each recorder drops frames on
+// its own when its encoder falls behind, which leaves incomplete sets. The
+// scheduler watches queue depth and recorder drops of all recorders and
+// thins out the triggers for all cameras alike instead.
+//
+// The command timer keeps its nominal period and asks fire() on every tick.
+// Lowering the rate means skipping whole ticks through a credit counter, so
+// the triggers that are sent stay on the nominal grid (and on the PTP grid).
+//
+// The rate follows the slowest recorder: its throughput is estimated from
+// the triggers sent and the change of its backlog. A growing backlog caps
+// the rate just below that throughput, a recorder drop or a backlog past
+// HIGH_WATERMARK halves it, an empty backlog raises it by a twentieth of
+// the nominal rate per update. Past STOP_WATERMARK no trigger is sent.
+//
+// The constant rate policy only reacts to recorder drops: it steps the
+// rate down to just below the slowest recorder and keeps it there for the
+// rest of the acquisition, so the recordings have a steady frame rate with
+// a few logged steps instead of one that follows the load.
+//
+class TriggerScheduler
+{
+public:
+	enum policy
+	{
+		POLICY_CONSTANT_RATE,                   // trigger at a steady rate, stepped down for good when a recorder drops
+		POLICY_COMPLETE_SETS,                   // lower the rate so every camera records the same triggers
+	};
+	//
+	// state of one recorder at an update
+	//
+	struct recorder_load
+	{
+		uint64_t        Backlog;                // frames queued in memory and spilled
+		uint64_t        Capacity;               // frames the recorder can hold before it drops
+		uint64_t        Dropped;                // frames the recorder dropped since the start
+	};
+
+	TriggerScheduler();
+	//
+	// Method: reset()
+	//
+	// Purpose: start a new acquisition at the nominal rate.
+	//
+	void reset(policy Policy, double NominalRate);
+	//
+	// Method: fire()
+	//
+	// Purpose: called once per tick of the command timer, from its thread.
+	//
+	// Returns: true if this tick sends its action command
+	//
+	bool fire();
+	//
+	// Method: update()
+	//
+	// Purpose: adjust the rate to the recorders, called periodically from one thread.
+	//          NowNs is the steady clock. Every rate change appends a line to Changes.
+	//
+	// Returns: true if the rate changed
+	//
+	bool update(uint64_t NowNs, const std::vector<recorder_load> &Recorders, std::string &Changes);
+
+	policy      currentPolicy() const { return m_Policy; }
+	double      nominalRate()   const { return m_NominalRate; }
+	double      rate()          const;
+	uint64_t    fired()         const { return m_Fired.load(std::memory_order_relaxed); }
+	uint64_t    skipped()       const { return m_Skipped.load(std::memory_order_relaxed); }
+	static const char* policyName(policy Policy);
+
+private:
+	TriggerScheduler(const TriggerScheduler&);
+	TriggerScheduler& operator=(const TriggerScheduler&);
+
+	static const double     HIGH_WATERMARK;     // backlog fraction that halves the rate
+	static const double     LOW_WATERMARK;      // backlog fraction below which the rate recovers
+	static const double     STOP_WATERMARK;     // backlog fraction that holds all triggers
+	static const double     MIN_RATE_FRACTION;  // never below this part of the nominal rate
+
+	void setRate(double Rate, const char *reason, std::string &Changes);
+
+	policy                  m_Policy;
+	double                  m_NominalRate;      // triggers per second of the command timer
+	std::atomic<uint32_t>   m_Ratio;            // rate / nominal rate in 1/65536, read by fire()
+	std::atomic<bool>       m_Hold;             // a recorder is about to drop, send nothing
+	uint32_t                m_Credit;           // fire() side, in 1/65536 of a trigger
+	std::atomic<uint64_t>   m_Fired;
+	std::atomic<uint64_t>   m_Skipped;
+	// update() side
+	bool                    m_HaveLast;
+	uint64_t                m_LastNs;
+	uint64_t                m_LastFired;
+	std::vector<uint64_t>   m_LastBacklog;      // one entry per recorder, sized by the first update()
+	std::vector<uint64_t>   m_LastDropped;
+	std::vector<double>     m_Throughput;       // frames per second, smoothed
+};
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef VIDEO_SINK_H_
+#define VIDEO_SINK_H_
+// open cv include
+#include "opencv2/opencv.hpp"
+//qt include
+#include "QtCore/QSharedPointer"
+#include "QtCore/QString"
+#include "QtCore/QFileInfo"
+// allied vision include
+#include <VimbaCPP/Include/VimbaCPP.h>
+
+#include "ChunkedContainer.h"
+#include "SessionContainer.h"
+#include "SeekIndex.h"
+
+//
+// per frame data that travels with the image to the sink
+//
+struct frame_meta
+{
+	VmbUint64_t         FrameID;            // camera frame ID
+	VmbUint64_t         Timestamp;          // camera time stamp in device ticks
+	VmbUint64_t         HostTime;           // steady clock ns when the frame was queued
+};
+
+//
+// Output file of one recorder segment
+//
+class VideoSink
+{
+public:
+	virtual ~VideoSink() {}
+	virtual bool        isOpened() const = 0;
+	virtual bool        write(const cv::Mat &image, const frame_meta &meta) = 0;
+	//
+	// Method: release()
+	//
+	// Purpose: finish the container, may take long, see SegmentFinalizer.
+	//
+	virtual void        release() = 0;
+	virtual VmbUint64_t bytesWritten() const = 0;
+	//
+	// Method: failed()
+	//
+	// Purpose: a queued write of the container or its index did not reach the disk.
+	//
+	virtual bool        failed() const = 0;
+};
+typedef QSharedPointer<VideoSink> VideoSinkPtr;
+
+//
+// AVI through cv::VideoWriter, the index is only written on release.
+// The seek index can only name the frame number, readers seek by ordinal.
+// The writer owns its file and encodes and writes on the recorder thread,
+// AsyncFileWriter can not take its output. A slow disk shows up as recorder
+// backlog, then spill and recorder drops; use the MCR containers for that.
+//
+class AviSink: public VideoSink
+{
+	cv::VideoWriter     m_Writer;
+	std::string         m_FileName;
+	seek::IndexWriter   m_Index;
+public:
+	AviSink(const std::string &fileName, int fourcc, double fps, cv::Size size, int cam_id, int segment)
+		: m_Writer(fileName, fourcc, fps, size, true)
+		, m_FileName(fileName)
+		, m_Index(fileName + ".idx", cam_id, segment, fps)
+	{
+	}
+	bool        isOpened() const { return m_Writer.isOpened(); }
+	bool        write(const cv::Mat &image, const frame_meta &meta)
+	{
+		m_Writer << image;
+		m_Index.add(meta.FrameID, meta.Timestamp, meta.HostTime, seek::NO_OFFSET);
+		return true;
+	}
+	void        release() { m_Writer.release(); m_Index.close(); }
+	// VideoWriter does not report its size, ask the file system
+	VmbUint64_t bytesWritten() const { return static_cast<VmbUint64_t>(QFileInfo(QString::fromStdString(m_FileName)).size()); }
+	// cv::VideoWriter does not report write errors, only the index can
+	bool        failed() const { return m_Index.failed(); }
+};
+
+//
+// Crash resilient MCR container, see ChunkedContainer.h
+//
+class McrSink: public VideoSink
+{
+	mcr::Writer         m_Writer;
+	seek::IndexWriter   m_Index;
+public:
+	McrSink(const std::string &fileName, double fps, cv::Size size, VmbUint32_t indexInterval, int cam_id, int segment)
+		: m_Writer(fileName, size.width, size.height, fps, indexInterval)
+		, m_Index(fileName + ".idx", cam_id, segment, fps, indexInterval)
+	{
+	}
+	bool        isOpened() const { return m_Writer.isOpened(); }
+	bool        write(const cv::Mat &image, const frame_meta &meta)
+	{
+		if (failed() || !m_Writer.write(image))
+		{
+			return false;
+		}
+		m_Index.add(meta.FrameID, meta.Timestamp, meta.HostTime, m_Writer.lastFrameOffset());
+		return true;
+	}
+	void        release() { m_Writer.release(); m_Index.close(); }
+	VmbUint64_t bytesWritten() const { return m_Writer.bytesWritten(); }
+	bool        failed() const { return m_Writer.failed() || m_Index.failed(); }
+};
+
+//
+// One camera's track in the shared session container.
+// Encodes on the recorder thread, the container interleaves by trigger.
+// No seek index, the container's own index is keyed by trigger already.
+// The container outlives the sink, release() leaves it open.
+//
+class SessionSink: public VideoSink
+{
+	SessionContainerPtr m_pSession;
+	VmbUint32_t         m_Track;
+	std::vector<uchar>  m_Encoded;
+	std::vector<int>    m_EncodeParams;
+public:
+	SessionSink(const SessionContainerPtr &session, VmbUint32_t track)
+		: m_pSession(session)
+		, m_Track(track)
+	{
+		m_EncodeParams.push_back(cv::IMWRITE_JPEG_QUALITY);
+		m_EncodeParams.push_back(90);
+	}
+	bool        isOpened() const { return !m_pSession.isNull() && m_pSession->isOpened(); }
+	bool        write(const cv::Mat &image, const frame_meta &meta)
+	{
+		if (m_pSession->failed() || !cv::imencode(".jpg", image, m_Encoded, m_EncodeParams))
+		{
+			return false;
+		}
+		m_pSession->submit(m_Track, meta.FrameID, meta.Timestamp, &m_Encoded[0], m_Encoded.size());
+		return true;
+	}
+	void        release() {}
+	VmbUint64_t bytesWritten() const { return 0; }
+	bool        failed() const { return !m_pSession.isNull() && m_pSession->failed(); }
+};
+
+#endif
@@ -0,0 +1,221 @@
+#include "VimbaCCapture.h"
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include "AsyncFileWriter.h"
+#include "OpenCVVideoRecorder.h"
+
+VimbaCCapture::VimbaCCapture(DropFrameDetector *pDropDetector, SyncMonitor *pSyncMonitor, ClockMapper *pClockMapper, MotionDetector *pMotionDetector)
+	: m_pDropDetector(pDropDetector)
+	, m_pSyncMonitor(pSyncMonitor)
+	, m_pClockMapper(pClockMapper)
+	, m_pMotionDetector(pMotionDetector)
+	, m_pConsumer(NULL)
+	, m_InCallback(0)
+	, m_FramesPerCamera(0)
+	, m_Capturing(false)
+{
+}
+
+VimbaCCapture::~VimbaCCapture()
+{
+	stop();
+}
+
+VmbError_t VimbaCCapture::open(const std::vector<std::string> &CameraIDs)
+{
+	stop();
+	for (size_t i = 0; i < CameraIDs.size(); i++) {
+		VmbHandle_t handle = NULL;
+		const VmbError_t err = VmbCameraOpen(CameraIDs[i].c_str(), VmbAccessModeFull, &handle);
+		if (VmbErrorSuccess != err)
+		{
+			std::cout << "VimbaC: could not open " << CameraIDs[i] << ", error " << err << std::endl;
+			close();
+			return err;
+		}
+		m_Handles.push_back(handle);
+	}
+	return VmbErrorSuccess;
+}
+
+VmbError_t VimbaCCapture::start(VmbUint32_t FramesPerCamera)
+{
+	const int cams = cameras();
+	if (0 == cams || 0 == FramesPerCamera)
+	{
+		return VmbErrorBadParameter;
+	}
+	// every slot gets the largest payload of all cameras, one allocation for the whole table
+	VmbInt64_t payload = 0;
+	for (int i = 0; i < cams; i++) {
+		VmbInt64_t size = 0;
+		const VmbError_t err = VmbFeatureIntGet(m_Handles[i], "PayloadSize", &size);
+		if (VmbErrorSuccess != err)
+		{
+			return err;
+		}
+		payload = size > payload ? size : payload;
+	}
+	// 64 byte strides keep the buffers on their own cache lines
+	const size_t stride = (static_cast<size_t>(payload) + 63) & ~static_cast<size_t>(63);
+	const size_t frameCount = static_cast<size_t>(cams) * FramesPerCamera;
+	m_FramesPerCamera = FramesPerCamera;
+	m_Frames.reset(new VmbFrame_t[frameCount]);
+	m_Buffers.reset(new VmbUchar_t[frameCount * stride + 63]);
+	VmbUchar_t *pBase = reinterpret_cast<VmbUchar_t*>((reinterpret_cast<uintptr_t>(m_Buffers.get()) + 63) & ~static_cast<uintptr_t>(63));
+
+	VmbError_t err = VmbErrorSuccess;
+	for (size_t slot = 0; slot < frameCount && VmbErrorSuccess == err; slot++) {
+		const int cam = static_cast<int>(slot / FramesPerCamera);
+		VmbFrame_t &frame = m_Frames[slot];
+		memset(&frame, 0, sizeof(frame));
+		frame.buffer = pBase + slot * stride;
+		frame.bufferSize = static_cast<VmbUint32_t>(payload);
+		frame.context[CONTEXT_CAPTURE] = this;
+		frame.context[CONTEXT_INDEX] = reinterpret_cast<void*>(slot);
+		frame.context[CONTEXT_CAMERA] = reinterpret_cast<void*>(static_cast<intptr_t>(cam));
+		err = VmbFrameAnnounce(m_Handles[cam], &frame, sizeof(frame));
+	}
+	for (int i = 0; i < cams && VmbErrorSuccess == err; i++) {
+		err = VmbCaptureStart(m_Handles[i]);
+	}
+	m_Capturing = true;
+	for (size_t slot = 0; slot < frameCount && VmbErrorSuccess == err; slot++) {
+		err = VmbCaptureFrameQueue(m_Handles[slot / FramesPerCamera], &m_Frames[slot], frameCallback);
+	}
+	for (int i = 0; i < cams && VmbErrorSuccess == err; i++) {
+		err = VmbFeatureCommandRun(m_Handles[i], "AcquisitionStart");
+	}
+	if (VmbErrorSuccess != err)
+	{
+		std::cout << "VimbaC: starting the acquisition failed, error " << err << std::endl;
+		stop();
+	}
+	return err;
+}
+
+void VimbaCCapture::stop()
+{
+	if (m_Capturing)
+	{
+		for (size_t i = 0; i < m_Handles.size(); i++) {
+			VmbFeatureCommandRun(m_Handles[i], "AcquisitionStop");
+		}
+		// VmbCaptureEnd waits for the running callbacks
+		for (size_t i = 0; i < m_Handles.size(); i++) {
+			VmbCaptureEnd(m_Handles[i]);
+			VmbCaptureQueueFlush(m_Handles[i]);
+			VmbFrameRevokeAll(m_Handles[i]);
+		}
+		m_Capturing = false;
+	}
+	close();
+	m_Frames.reset();
+	m_Buffers.reset();
+	m_FramesPerCamera = 0;
+}
+
+void VimbaCCapture::close()
+{
+	for (size_t i = 0; i < m_Handles.size(); i++) {
+		VmbCameraClose(m_Handles[i]);
+	}
+	m_Handles.clear();
+}
+
+void VimbaCCapture::setConsumer(IRawFrameConsumer *pConsumer)
+{
+	// sequentially consistent with received(): either it sees NULL, or we see it counted
+	m_pConsumer.store(pConsumer);
+	if (NULL == pConsumer)
+	{
+		while (0 != m_InCallback.load())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+VmbError_t VimbaCCapture::requeue(VmbUint32_t Index)
+{
+	if (!m_Capturing || 0 == m_FramesPerCamera || Index >= m_Handles.size() * m_FramesPerCamera)
+	{
+		return VmbErrorBadParameter;
+	}
+	const int cam = static_cast<int>(Index / m_FramesPerCamera);
+	if (NULL != m_pDropDetector)
+	{
+		m_pDropDetector->frameRequeued(cam);
+	}
+	return VmbCaptureFrameQueue(m_Handles[cam], &m_Frames[Index], frameCallback);
+}
+
+void VMB_CALL VimbaCCapture::frameCallback(const VmbHandle_t /*cameraHandle*/, VmbFrame_t *pFrame)
+{
+	VimbaCCapture *pCapture = static_cast<VimbaCCapture*>(pFrame->context[CONTEXT_CAPTURE]);
+	pCapture->received(static_cast<int>(reinterpret_cast<intptr_t>(pFrame->context[CONTEXT_CAMERA])),
+		static_cast<VmbUint32_t>(reinterpret_cast<uintptr_t>(pFrame->context[CONTEXT_INDEX])), *pFrame);
+}
+
+//
+// Method: received()
+//
+// Purpose: the work of FrameObserver::FrameReceived() on the fields of a VmbFrame_t.
+//
+void VimbaCCapture::received(int cam, VmbUint32_t index, const VmbFrame_t &frame)
+{
+	// take the arrival time first, everything below adds latency
+	const uint64_t arrivalNs = AsyncIoService::nowNs();
+	// counted before the consumer is loaded, setConsumer(NULL) waits for us
+	m_InCallback.fetch_add(1);
+	IRawFrameConsumer *pConsumer = m_pConsumer.load();
+	const VmbFrameStatusType status = static_cast<VmbFrameStatusType>(frame.receiveStatus);
+	if (NULL != m_pDropDetector)
+	{
+		m_pDropDetector->frameReceived(cam, status, frame.frameID, frame.timestamp);
+	}
+	const VmbFrameFlags_t stamped = VmbFrameFlagsFrameID | VmbFrameFlagsTimestamp;
+	const bool haveTimestamp = VmbFrameStatusComplete == status && stamped == (frame.receiveFlags & stamped);
+	if (haveTimestamp && NULL != m_pClockMapper)
+	{
+		m_pClockMapper->observe(cam, frame.timestamp, arrivalNs);
+	}
+	if (haveTimestamp && NULL != m_pSyncMonitor)
+	{
+		m_pSyncMonitor->frameArrived(cam, frame.frameID, frame.timestamp);
+	}
+	if (haveTimestamp && NULL != m_pMotionDetector && m_pMotionDetector->enabled())
+	{
+		m_pMotionDetector->process(cam, static_cast<const VmbUchar_t*>(frame.buffer), frame.imageSize, frame.width, frame.height, static_cast<VmbPixelFormatType>(frame.pixelFormat));
+	}
+
+	if (NULL == pConsumer)
+	{
+		m_InCallback.fetch_sub(1, std::memory_order_release);
+		requeue(index);
+		return;
+	}
+	// the sidecar holds milliseconds on the common timeline, host arrival time until the camera is mapped
+	int64_t commonNs = static_cast<int64_t>(arrivalNs - (NULL != m_pClockMapper ? m_pClockMapper->epochNs() : 0));
+	if (haveTimestamp && NULL != m_pClockMapper)
+	{
+		m_pClockMapper->toCommonNs(cam, frame.timestamp, commonNs);
+	}
+	push(commonNs * 1e-6, cam);
+
+	RawFrameEvent event;
+	event.Camera = cam;
+	event.Index = index;
+	event.Status = status;
+	event.pData = static_cast<const VmbUchar_t*>(frame.buffer);
+	event.ImageSize = frame.imageSize;
+	event.Width = frame.width;
+	event.Height = frame.height;
+	event.PixelFormat = static_cast<VmbPixelFormatType>(frame.pixelFormat);
+	event.FrameID = frame.frameID;
+	event.Timestamp = frame.timestamp;
+	event.ArrivalNs = arrivalNs;
+	pConsumer->OnRawFrame(event);
+	m_InCallback.fetch_sub(1, std::memory_order_release);
+}
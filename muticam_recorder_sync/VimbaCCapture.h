@@ -0,0 +1,130 @@
+#ifndef VIMBA_C_CAPTURE_H_
+#define VIMBA_C_CAPTURE_H_
+// std include
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+// allied vision include
+#include <VimbaC/Include/VimbaC.h>
+
+#include "drop_frame_detection.h"
+#include "SyncMonitor.h"
+#include "ClockMapper.h"
+#include "MotionDetector.h"
+
+//
+// One received frame of the VimbaC backend. The buffer belongs to the frame
+// table and stays valid until the frame is queued again with requeue(Index).
+//
+struct RawFrameEvent
+{
+	int                 Camera;         // index of the camera in the running acquisition
+	VmbUint32_t         Index;          // slot in the frame table, for requeue()
+	VmbFrameStatusType  Status;
+	const VmbUchar_t*   pData;
+	VmbUint32_t         ImageSize;
+	VmbUint32_t         Width;
+	VmbUint32_t         Height;
+	VmbPixelFormatType  PixelFormat;
+	VmbUint64_t         FrameID;
+	VmbUint64_t         Timestamp;
+	uint64_t            ArrivalNs;      // host steady clock at the callback
+};
+
+//
+// Receives the frames of the VimbaC backend on the Vimba thread of the camera.
+//
+class IRawFrameConsumer
+{
+public:
+	virtual ~IRawFrameConsumer() {}
+	virtual void OnRawFrame(const RawFrameEvent &event) = 0;
+};
+
+//
+// Capture backend on the plain VimbaC API.
+//
+// VimbaCPP wraps every frame in a reference counted FramePtr (a mutex per
+// copy) and reaches the observer through a virtual call on an interface
+// pointer. Here the frames are plain VmbFrame_t in one table allocated by
+// start(), all buffers in one block. A frame carries the capture, its table
+// index and its camera in its context pointers, so the C callback finds
+// everything without a lookup and hands the consumer an index, not an
+// object. Consumers queue a frame again with requeue(Index).
+//
+// The cameras are configured by ApiController with VimbaCPP as usual, the
+// settings stay on the devices when they are opened here again.
+//
+class VimbaCCapture
+{
+public:
+	VimbaCCapture(DropFrameDetector *pDropDetector = NULL, SyncMonitor *pSyncMonitor = NULL, ClockMapper *pClockMapper = NULL, MotionDetector *pMotionDetector = NULL);
+	~VimbaCCapture();
+	//
+	// Method: open()
+	//
+	// Purpose: open the cameras with full access, all or none.
+	//
+	VmbError_t open(const std::vector<std::string> &CameraIDs);
+	//
+	// Method: start()
+	//
+	// Purpose: allocate and announce FramesPerCamera frames per camera, queue them and start the acquisition.
+	//
+	VmbError_t start(VmbUint32_t FramesPerCamera);
+	//
+	// Method: stop()
+	//
+	// Purpose: stop the acquisition, revoke the frames and close the cameras.
+	//          No callback runs once it returned.
+	//
+	void stop();
+	//
+	// Method: setConsumer()
+	//
+	// Purpose: the consumer of the frames, NULL queues every frame again right away.
+	//          Setting NULL returns once no callback is inside the old consumer anymore.
+	//
+	void setConsumer(IRawFrameConsumer *pConsumer);
+	//
+	// Method: requeue()
+	//
+	// Purpose: give a frame of the table back to its camera.
+	//
+	VmbError_t requeue(VmbUint32_t Index);
+
+	int         cameras()           const { return static_cast<int>(m_Handles.size()); }
+	VmbHandle_t handle(int cam)     const { return m_Handles[cam]; }
+	//
+	// Method: frameCallback()
+	//
+	// Purpose: the VmbFrameCallback of all frames. Public for the dispatch benchmark,
+	//          which calls it with frames that carry the context of a capture.
+	//
+	static void VMB_CALL frameCallback(const VmbHandle_t cameraHandle, VmbFrame_t *pFrame);
+	// VmbFrame_t::context of the frames: the capture, the table index and the camera index
+	enum { CONTEXT_CAPTURE, CONTEXT_INDEX, CONTEXT_CAMERA };
+
+private:
+	VimbaCCapture(const VimbaCCapture&);
+	VimbaCCapture& operator=(const VimbaCCapture&);
+
+	void received(int cam, VmbUint32_t index, const VmbFrame_t &frame);
+	void close();
+
+	DropFrameDetector*                  m_pDropDetector;
+	SyncMonitor*                        m_pSyncMonitor;
+	ClockMapper*                        m_pClockMapper;
+	MotionDetector*                     m_pMotionDetector;
+	std::atomic<IRawFrameConsumer*>     m_pConsumer;
+	std::atomic<int>                    m_InCallback;       // callbacks that may have loaded m_pConsumer
+	std::vector<VmbHandle_t>            m_Handles;
+	std::unique_ptr<VmbFrame_t[]>       m_Frames;           // camera c owns the slots c * m_FramesPerCamera ...
+	std::unique_ptr<VmbUchar_t[]>       m_Buffers;
+	VmbUint32_t                         m_FramesPerCamera;
+	bool                                m_Capturing;
+};
+
+#endif
@@ -0,0 +1,228 @@
+//
+// clip_extract - cut a clip out of a recorded session through the seek indexes
+//
+// Usage: clip_extract <manifest.txt> (-s seconds | -f frameID | -t timestamp) <duration_s> [out_prefix]
+//
+//   -s  start in seconds after the first frame of the session
+//   -f  frame ID of the first camera in the manifest
+//   -t  device time stamp of the first camera in the manifest
+//
+// The start is turned into host time and every camera is cut to the same
+// host time window, written as <out_prefix>_camNN.avi (MJPG). Only the
+// segments covering the window are opened and each one is entered with a
+// binary search in its <segment>.idx, so the cost does not depend on the
+// length of the session.
+//
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "ChunkedContainer.h"
+#include "SeekIndex.h"
+
+namespace
+{
+	typedef std::map<int, std::string>          SegmentMap;     // segment number -> file
+	typedef std::map<int, SegmentMap>           CameraMap;      // camera -> segments
+
+	bool readManifest(const std::string &fileName, CameraMap &cameras)
+	{
+		FILE *pFile = fopen(fileName.c_str(), "r");
+		if (NULL == pFile)
+		{
+			return false;
+		}
+		char line[1024];
+		while (NULL != fgets(line, sizeof(line), pFile))
+		{
+			char state[16];
+			char name[1000];
+			int cam = 0;
+			int segment = 0;
+			if (4 == sscanf(line, "%15s\t%d\t%d\t%999[^\t\n]", state, &cam, &segment, name)
+				&& std::string("open") == state)
+			{
+				cameras[cam][segment] = name;
+			}
+		}
+		fclose(pFile);
+		return true;
+	}
+
+	bool endsWith(const std::string &s, const std::string &suffix)
+	{
+		return s.size() >= suffix.size() && 0 == s.compare(s.size() - suffix.size(), suffix.size(), suffix);
+	}
+
+	//
+	// copies all frames of one segment with HostTime in [Begin, End)
+	//
+	uint64_t extractSegment(const std::string &fileName, seek::IndexReader &index, uint64_t Begin, uint64_t End, cv::VideoWriter &out)
+	{
+		uint64_t position = index.lowerBound(seek::KEY_HOST_TIME, Begin);
+		seek::record entry;
+		if (!index.read(position, entry) || entry.HostTime >= End)
+		{
+			return 0;
+		}
+		uint64_t frames = 0;
+		if (endsWith(fileName, ".mcr"))
+		{
+			mcr::Reader reader;
+			if (!reader.open(fileName))
+			{
+				return 0;
+			}
+			mcr::chunk_header chunk;
+			std::vector<uchar> payload;
+			for (; index.read(position, entry) && entry.HostTime < End; ++position)
+			{
+				if (reader.readChunk(entry.Offset, chunk, payload))
+				{
+					cv::Mat image = cv::imdecode(cv::Mat(payload), cv::IMREAD_COLOR);
+					if (!image.empty())
+					{
+						out << image;
+						++frames;
+					}
+				}
+			}
+		}
+		else
+		{
+			// AVI has no byte offsets in the index, the capture seeks by frame number
+			cv::VideoCapture capture(fileName);
+			if (!capture.isOpened())
+			{
+				return 0;
+			}
+			capture.set(cv::CAP_PROP_POS_FRAMES, static_cast<double>(entry.Ordinal));
+			cv::Mat image;
+			for (; index.read(position, entry) && entry.HostTime < End && capture.read(image); ++position)
+			{
+				out << image;
+				++frames;
+			}
+		}
+		return frames;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 5)
+	{
+		std::cout << "usage: clip_extract <manifest.txt> (-s seconds | -f frameID | -t timestamp) <duration_s> [out_prefix]" << std::endl;
+		return -1;
+	}
+	const std::string mode = argv[2];
+	const double duration = atof(argv[4]);
+	const std::string prefix = argc > 5 ? argv[5] : "clip";
+
+	CameraMap cameras;
+	if (!readManifest(argv[1], cameras) || cameras.empty())
+	{
+		std::cout << "no segments in " << argv[1] << std::endl;
+		return -1;
+	}
+
+	// resolve the start to host time
+	uint64_t begin = ~0ull;
+	if ("-s" == mode)
+	{
+		for (CameraMap::iterator cam = cameras.begin(); cam != cameras.end(); ++cam)
+		{
+			seek::IndexReader index;
+			seek::record first;
+			if (index.open(cam->second.begin()->second + ".idx") && index.read(0, first))
+			{
+				begin = std::min(begin, first.HostTime);
+			}
+		}
+		if (~0ull != begin)
+		{
+			begin += static_cast<uint64_t>(atof(argv[3]) * 1e9);
+		}
+	}
+	else if ("-f" == mode || "-t" == mode)
+	{
+		const seek::key_type key = "-f" == mode ? seek::KEY_FRAME_ID : seek::KEY_TIMESTAMP;
+		const uint64_t value = strtoull(argv[3], NULL, 10);
+		const SegmentMap &segments = cameras.begin()->second;
+		for (SegmentMap::const_iterator seg = segments.begin(); seg != segments.end() && ~0ull == begin; ++seg)
+		{
+			seek::IndexReader index;
+			seek::record entry;
+			if (index.open(seg->second + ".idx")
+				&& index.read(index.lowerBound(key, value), entry))
+			{
+				begin = entry.HostTime;
+			}
+		}
+	}
+	else
+	{
+		std::cout << "unknown start mode " << mode << std::endl;
+		return -1;
+	}
+	if (~0ull == begin)
+	{
+		std::cout << "start is not in the recording" << std::endl;
+		return -1;
+	}
+	const uint64_t end = begin + static_cast<uint64_t>(duration * 1e9);
+
+	for (CameraMap::iterator cam = cameras.begin(); cam != cameras.end(); ++cam)
+	{
+		std::stringstream outName;
+		outName << prefix << "_cam" << std::setw(2) << std::setfill('0') << cam->first << ".avi";
+		cv::VideoWriter out;
+		uint64_t frames = 0;
+		for (SegmentMap::iterator seg = cam->second.begin(); seg != cam->second.end(); ++seg)
+		{
+			seek::IndexReader index;
+			seek::record first;
+			seek::record last;
+			if (!index.open(seg->second + ".idx")
+				|| !index.read(0, first)
+				|| !index.read(index.size() - 1, last)
+				|| last.HostTime < begin
+				|| first.HostTime >= end)
+			{
+				continue;
+			}
+			if (!out.isOpened())
+			{
+				// the size is taken from the container, all segments of a camera share it
+				cv::Size size;
+				if (endsWith(seg->second, ".mcr"))
+				{
+					mcr::Reader reader;
+					if (reader.open(seg->second))
+					{
+						size = cv::Size(reader.header().Width, reader.header().Height);
+					}
+				}
+				else
+				{
+					cv::VideoCapture capture(seg->second);
+					size = cv::Size(static_cast<int>(capture.get(cv::CAP_PROP_FRAME_WIDTH)), static_cast<int>(capture.get(cv::CAP_PROP_FRAME_HEIGHT)));
+				}
+				out.open(outName.str(), cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), index.header().FPS, size, true);
+				if (!out.isOpened())
+				{
+					std::cout << "could not open " << outName.str() << std::endl;
+					return -1;
+				}
+			}
+			frames += extractSegment(seg->second, index, begin, end, out);
+		}
+		out.release();
+		std::cout << "cam " << cam->first << ": " << frames << " frames written to " << outName.str() << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,222 @@
+//
+// dispatch_bench - per frame cost of handing a frame from the observer to its consumer
+//
+// Usage: dispatch_bench [frames=1000000]
+//
+// before  the frame observer pushed the frame into a locked std::queue and
+//         emitted FrameReceivedSignal(int) (status * 10 + camera) over a
+//         direct connection, the slot fetched the frame again with a
+//         SP_DYN_CAST of the observer and a second locked pop
+// after   FrameObserver calls IFrameConsumer::OnFrameReady() with a FrameEvent
+// VimbaC  the C callback of VimbaCCapture calls IRawFrameConsumer::OnRawFrame()
+//         with the fields of the VmbFrame_t and its table index
+//
+// "after" and "VimbaC" run the whole callback of their backend without
+// monitors attached (receive status, time stamp, sidecar check), "before"
+// only the dispatch, so the difference is a lower bound of what was saved.
+// No camera is needed, the frames are never queued to a camera.
+//
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <queue>
+#include <vector>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include "AsyncFileWriter.h"
+#include "FrameObserver.h"
+#include "VimbaCCapture.h"
+
+using namespace AVT::VmbAPI;
+using AVT::VmbAPI::Examples::FrameEvent;
+using AVT::VmbAPI::Examples::FrameObserver;
+using AVT::VmbAPI::Examples::IFrameConsumer;
+
+//
+// The frame observer as it was before the consumer interface
+//
+class LegacyObserver : public QObject, virtual public IFrameObserver
+{
+	Q_OBJECT
+
+public:
+	LegacyObserver(int id)
+		: IFrameObserver(CameraPtr())
+		, m_Id(id)
+	{
+	}
+
+	virtual void FrameReceived(const FramePtr pFrame)
+	{
+		VmbFrameStatusType eReceiveStatus;
+		if (VmbErrorSuccess == pFrame->GetReceiveStatus(eReceiveStatus))
+		{
+			m_FramesMutex.lock();
+			m_Frames.push(pFrame);
+			m_FramesMutex.unlock();
+			emit FrameReceivedSignal(eReceiveStatus * 10 + m_Id);
+		}
+	}
+
+	FramePtr GetFrame()
+	{
+		QMutexLocker local_lock(&m_FramesMutex);
+		FramePtr res;
+		if (!m_Frames.empty())
+		{
+			res = m_Frames.front();
+			m_Frames.pop();
+		}
+		return res;
+	}
+
+signals:
+	void FrameReceivedSignal(int status);
+
+private:
+	int                     m_Id;
+	std::queue<FramePtr>    m_Frames;
+	QMutex                  m_FramesMutex;
+};
+
+//
+// The slot side as it was, ApiController::GetFrame() included
+//
+class LegacyConsumer : public QObject
+{
+	Q_OBJECT
+
+public:
+	LegacyConsumer(const IFrameObserverPtr &pObserver)
+		: m_pObserver(pObserver)
+		, m_Frames(0)
+	{
+	}
+	uint64_t frames() const { return m_Frames; }
+
+public slots:
+	void OnFrameReady(int msg)
+	{
+		const int cam_index = msg % 10;
+		FramePtr pFrame = SP_DYN_CAST(m_pObserver, LegacyObserver)->GetFrame();
+		if (!SP_ISNULL(pFrame) && 0 == cam_index)
+		{
+			++m_Frames;
+		}
+	}
+
+private:
+	IFrameObserverPtr   m_pObserver;
+	uint64_t            m_Frames;
+};
+
+class CountingConsumer : public IFrameConsumer
+{
+public:
+	CountingConsumer()
+		: m_Frames(0)
+	{
+	}
+	uint64_t frames() const { return m_Frames; }
+
+	virtual void OnFrameReady(const FrameEvent &event)
+	{
+		if (!SP_ISNULL(event.Frame) && 0 == event.Camera)
+		{
+			++m_Frames;
+		}
+	}
+
+private:
+	uint64_t m_Frames;
+};
+
+class CountingRawConsumer : public IRawFrameConsumer
+{
+public:
+	CountingRawConsumer()
+		: m_Frames(0)
+	{
+	}
+	uint64_t frames() const { return m_Frames; }
+
+	virtual void OnRawFrame(const RawFrameEvent &event)
+	{
+		if (NULL != event.pData && 0 == event.Camera)
+		{
+			++m_Frames;
+		}
+	}
+
+private:
+	uint64_t m_Frames;
+};
+
+static double nsPerFrame(VmbFrame_t &frame, uint64_t frames)
+{
+	const uint64_t start = AsyncIoService::nowNs();
+	for (uint64_t i = 0; i < frames; ++i)
+	{
+		VimbaCCapture::frameCallback(NULL, &frame);
+	}
+	return static_cast<double>(AsyncIoService::nowNs() - start) / frames;
+}
+
+static double nsPerFrame(IFrameObserver &observer, const FramePtr &pFrame, uint64_t frames)
+{
+	const uint64_t start = AsyncIoService::nowNs();
+	for (uint64_t i = 0; i < frames; ++i)
+	{
+		observer.FrameReceived(pFrame);
+	}
+	return static_cast<double>(AsyncIoService::nowNs() - start) / frames;
+}
+
+int main(int argc, char *argv[])
+{
+	const long long frames = argc > 1 ? atoll(argv[1]) : 1000000;
+	if (frames <= 0)
+	{
+		std::cout << "usage: dispatch_bench [frames=1000000]" << std::endl;
+		return -1;
+	}
+	// a frame that was never filled reports VmbFrameStatusInvalid, both paths hand it on all the same
+	FramePtr pFrame(new Frame(64));
+
+	IFrameObserverPtr pLegacy(new LegacyObserver(0));
+	LegacyConsumer legacyConsumer(pLegacy);
+	QObject::connect(SP_DYN_CAST(pLegacy, LegacyObserver).get(), SIGNAL(FrameReceivedSignal(int)), &legacyConsumer, SLOT(OnFrameReady(int)), Qt::DirectConnection);
+
+	FrameObserver *pDirect = new FrameObserver(CameraPtr(), 0);
+	IFrameObserverPtr pDirectPtr(pDirect);
+	CountingConsumer directConsumer;
+	pDirect->SetConsumer(&directConsumer);
+
+	// a table entry of the VimbaC backend, slot 0 of camera 0
+	std::vector<VmbUchar_t> buffer(64);
+	VimbaCCapture capture;
+	CountingRawConsumer rawConsumer;
+	capture.setConsumer(&rawConsumer);
+	VmbFrame_t rawFrame;
+	memset(&rawFrame, 0, sizeof(rawFrame));
+	rawFrame.buffer = &buffer[0];
+	rawFrame.bufferSize = static_cast<VmbUint32_t>(buffer.size());
+	rawFrame.receiveStatus = VmbFrameStatusComplete;
+	rawFrame.context[VimbaCCapture::CONTEXT_CAPTURE] = &capture;
+
+	// warm up caches and the connection lookup
+	nsPerFrame(*pLegacy, pFrame, 1000);
+	nsPerFrame(*pDirect, pFrame, 1000);
+	nsPerFrame(rawFrame, 1000);
+	const double before = nsPerFrame(*pLegacy, pFrame, frames);
+	const double after = nsPerFrame(*pDirect, pFrame, frames);
+	const double raw = nsPerFrame(rawFrame, frames);
+
+	std::cout << frames << " frames" << std::endl;
+	std::cout << "before  queue + signal + GetFrame  " << before << " ns per frame, " << legacyConsumer.frames() << " handed on" << std::endl;
+	std::cout << "after   IFrameConsumer             " << after << " ns per frame, " << directConsumer.frames() << " handed on" << std::endl;
+	std::cout << "VimbaC  IRawFrameConsumer          " << raw << " ns per frame, " << rawConsumer.frames() << " handed on" << std::endl;
+	return 0;
+}
+
+#include "dispatch_bench.moc"
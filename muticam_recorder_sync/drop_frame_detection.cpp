@@ -0,0 +1,227 @@
+#include "drop_frame_detection.h"
+
+DropFrameDetector::DropFrameDetector()
+	: m_Cameras(0)
+	, m_Allocated(0)
+	, m_BufferCount(0)
+	, m_SkippedTriggers(0)
+	, m_AlertSequence(0)
+{
+	reset(0, 0);
+}
+
+void DropFrameDetector::reset(int Cameras, uint32_t BufferCount, const std::vector<double> &TickFrequency, double Fps)
+{
+	m_Cameras = Cameras > 0 ? Cameras : 0;
+	m_BufferCount = BufferCount;
+	m_NominalPeriod.assign(m_Cameras, 0);
+	for (int i = 0; i < m_Cameras && i < static_cast<int>(TickFrequency.size()) && Fps > 0; ++i)
+	{
+		m_NominalPeriod[i] = static_cast<VmbUint64_t>(TickFrequency[i] / Fps + 0.5);
+	}
+	m_SkippedTriggers.store(0);
+	if (m_Cameras > m_Allocated)
+	{
+		// only between acquisitions, nobody reads the old state anymore
+		m_State.reset(new camera_state[m_Cameras]);
+		m_Allocated = m_Cameras;
+	}
+	for (int i = 0; i < m_Allocated; ++i)
+	{
+		camera_state &state = m_State[i];
+		state.HaveLast = false;
+		state.PrevFrameID = 0;
+		state.PrevTimestamp = 0;
+		state.Period = i < m_Cameras ? m_NominalPeriod[i] : 0;
+		state.SkipsSeen = 0;
+		state.SkipCredit = 0;
+		state.Outstanding.store(0);
+		state.Starved.store(false);
+		state.Received.store(0);
+		for (int s = 0; s < STAGE_COUNT; ++s)
+		{
+			state.Lost[s].store(0);
+		}
+		state.LastStage.store(STAGE_CAMERA);
+		state.LastFrames.store(0);
+		state.LastFrameID.store(0);
+	}
+}
+
+void DropFrameDetector::frameReceived(int cam, const AVT::VmbAPI::FramePtr &pFrame)
+{
+	bool starved = false;
+	if (!arrive(cam, starved))
+	{
+		return;
+	}
+	VmbFrameStatusType status = VmbFrameStatusIncomplete;
+	VmbUint64_t frameID = 0;
+	VmbUint64_t timestamp = 0;
+	if (VmbErrorSuccess == SP_ACCESS(pFrame)->GetReceiveStatus(status)
+		&& VmbErrorSuccess == SP_ACCESS(pFrame)->GetFrameID(frameID)
+		&& VmbErrorSuccess == SP_ACCESS(pFrame)->GetTimestamp(timestamp))
+	{
+		classify(cam, starved, status, frameID, timestamp);
+	}
+}
+
+void DropFrameDetector::frameReceived(int cam, VmbFrameStatusType Status, VmbUint64_t FrameID, VmbUint64_t Timestamp)
+{
+	bool starved = false;
+	if (arrive(cam, starved))
+	{
+		classify(cam, starved, Status, FrameID, Timestamp);
+	}
+}
+
+//
+// Method: arrive()
+//
+// Purpose: buffer accounting of every frame, Starved tells if the host held all buffers since the last one.
+//
+bool DropFrameDetector::arrive(int cam, bool &Starved)
+{
+	if (cam < 0 || cam >= m_Cameras)
+	{
+		return false;
+	}
+	camera_state &state = m_State[cam];
+	state.Received.fetch_add(1, std::memory_order_relaxed);
+	// the starved flag covers the time since the previous frame
+	Starved = state.Starved.exchange(false, std::memory_order_relaxed);
+	// the frame is ours until it is queued again, holding the last buffer starves the next frames
+	if (state.Outstanding.fetch_add(1, std::memory_order_relaxed) + 1 >= m_BufferCount && 0 != m_BufferCount)
+	{
+		state.Starved.store(true, std::memory_order_relaxed);
+	}
+	return true;
+}
+
+//
+// Method: classify()
+//
+// Purpose: find the stage of the frames lost before this one.
+//
+void DropFrameDetector::classify(int cam, bool starved, VmbFrameStatusType status, VmbUint64_t frameID, VmbUint64_t timestamp)
+{
+	camera_state &state = m_State[cam];
+	if (VmbFrameStatusComplete != status)
+	{
+		// the frame made it to the host, but not all of its packets
+		report(cam, STAGE_LINK, 1, frameID);
+	}
+
+	// skips of the trigger thread up to now, the gap they leave may show at this frame or a later one
+	const uint64_t skips = m_SkippedTriggers.load(std::memory_order_relaxed);
+	// a frame ID going backwards means the camera was restarted, start over
+	if (!state.HaveLast || frameID <= state.PrevFrameID)
+	{
+		state.HaveLast = true;
+		state.PrevFrameID = frameID;
+		state.PrevTimestamp = timestamp;
+		state.SkipsSeen = skips;
+		state.SkipCredit = 0;
+		return;
+	}
+	state.SkipCredit += skips - state.SkipsSeen;
+	state.SkipsSeen = skips;
+	const VmbUint64_t step = frameID - state.PrevFrameID;
+	const VmbUint64_t delta = timestamp - state.PrevTimestamp;
+	state.PrevFrameID = frameID;
+	state.PrevTimestamp = timestamp;
+
+	if (step > 1)
+	{
+		// exposed by the camera but never delivered
+		report(cam, starved ? STAGE_HOST_BUFFER : STAGE_LINK, step - 1, frameID);
+	}
+	if (0 == state.Period)
+	{
+		if (1 == step)
+		{
+			state.Period = delta;
+		}
+		return;
+	}
+	// number of periods the time stamps moved, rounded
+	const VmbUint64_t periods = (delta + state.Period / 2) / state.Period;
+	if (periods > step)
+	{
+		// triggers the host left out are no loss, the rest the camera skipped on its own
+		const uint64_t missing = periods - step;
+		const uint64_t skipped = missing < state.SkipCredit ? missing : state.SkipCredit;
+		state.SkipCredit -= skipped;
+		if (missing > skipped)
+		{
+			report(cam, STAGE_CAMERA, missing - skipped, frameID);
+		}
+	}
+	else if (1 == step && 1 == periods)
+	{
+		// follow slow drift of the trigger clock, 1/16 of the deviation per frame
+		state.Period = static_cast<VmbUint64_t>(static_cast<int64_t>(state.Period) + (static_cast<int64_t>(delta) - static_cast<int64_t>(state.Period)) / 16);
+	}
+}
+
+void DropFrameDetector::frameRequeued(int cam)
+{
+	if (cam >= 0 && cam < m_Cameras && 0 != m_State[cam].Outstanding.load(std::memory_order_relaxed))
+	{
+		m_State[cam].Outstanding.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+
+void DropFrameDetector::recorderDropped(int cam, uint64_t frameID)
+{
+	if (cam >= 0 && cam < m_Cameras)
+	{
+		report(cam, STAGE_RECORDER, 1, frameID);
+	}
+}
+
+void DropFrameDetector::triggersSkipped(uint64_t Count)
+{
+	m_SkippedTriggers.fetch_add(Count, std::memory_order_relaxed);
+}
+
+void DropFrameDetector::report(int cam, drop_stage stage, uint64_t frames, uint64_t frameID)
+{
+	camera_state &state = m_State[cam];
+	state.Lost[stage].fetch_add(frames, std::memory_order_relaxed);
+	state.LastStage.store(stage, std::memory_order_relaxed);
+	state.LastFrames.store(frames, std::memory_order_relaxed);
+	state.LastFrameID.store(frameID, std::memory_order_relaxed);
+	m_AlertSequence.fetch_add(1, std::memory_order_release);
+}
+
+uint64_t DropFrameDetector::lostTotal(int cam) const
+{
+	uint64_t total = 0;
+	for (int s = 0; s < STAGE_COUNT; ++s)
+	{
+		total += lost(cam, static_cast<drop_stage>(s));
+	}
+	return total;
+}
+
+DropFrameDetector::drop_event DropFrameDetector::lastEvent(int cam) const
+{
+	drop_event event;
+	event.Stage = static_cast<drop_stage>(m_State[cam].LastStage.load(std::memory_order_relaxed));
+	event.Frames = m_State[cam].LastFrames.load(std::memory_order_relaxed);
+	event.FrameID = m_State[cam].LastFrameID.load(std::memory_order_relaxed);
+	return event;
+}
+
+const char* DropFrameDetector::stageName(drop_stage stage)
+{
+	switch (stage)
+	{
+	case STAGE_CAMERA:      return "camera";
+	case STAGE_LINK:        return "link";
+	case STAGE_HOST_BUFFER: return "host buffer";
+	case STAGE_RECORDER:    return "recorder queue";
+	default:                return "unknown";
+	}
+}
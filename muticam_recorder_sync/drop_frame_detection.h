@@ -0,0 +1,150 @@
+#ifndef DROP_FRAME_DETECTION_H_
+#define DROP_FRAME_DETECTION_H_
+// std include
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+// allied vision include
+#include <VimbaCPP/Include/VimbaCPP.h>
+
+//
+// Live dropped frame detector.
+//
+// Fed from the frame observer of every camera, it classifies each lost
+// frame by the stage that lost it:
+//
+//   camera       frame ID is consecutive but the device time stamp jumped by
+//                more than one period, the camera never exposed the frame.
+//                Triggers the host left out on purpose (backpressure, PTP
+//                grid slots jumped over) are reported with triggersSkipped()
+//                and do not count
+//   link         frame arrived incomplete, or the frame ID skipped while the
+//                host still had free buffers queued
+//   host buffer  frame ID skipped while all buffers were held by the host,
+//                the transport layer had nowhere to put the frame
+//   recorder     the recorder queue overwrote a frame that was not written
+//
+// The per camera state is allocated by reset(), the per frame work is O(1)
+// and never allocates. Counters are atomics, so the GUI can poll them at frame rate
+// and alert within one frame period (see alertSequence()).
+//
+class DropFrameDetector
+{
+public:
+	enum drop_stage
+	{
+		STAGE_CAMERA,
+		STAGE_LINK,
+		STAGE_HOST_BUFFER,
+		STAGE_RECORDER,
+		STAGE_COUNT,
+	};
+
+	//
+	// last loss seen on a camera, for the alert text
+	//
+	struct drop_event
+	{
+		drop_stage      Stage;
+		uint64_t        Frames;             // frames lost in this event
+		uint64_t        FrameID;            // first frame after the loss
+	};
+
+	DropFrameDetector();
+	//
+	// Method: reset()
+	//
+	// Purpose: clear all counters before an acquisition starts.
+	//          BufferCount is the number of frames announced per camera.
+	//          With the device tick frequencies and the nominal frame rate the
+	//          trigger period is known from the first frame on, without them it
+	//          is taken from the first two frames of each camera.
+	//
+	void reset(int Cameras, uint32_t BufferCount, const std::vector<double> &TickFrequency = std::vector<double>(), double Fps = 0);
+	//
+	// Method: frameReceived()
+	//
+	// Purpose: account a frame handed over by the API, call it from the
+	//          frame observer callback before the frame is passed on.
+	//
+	void frameReceived(int cam, const AVT::VmbAPI::FramePtr &pFrame);
+	//
+	// Method: frameReceived()
+	//
+	// Purpose: the same for a frame whose fields are known already, e.g. from a simulated camera.
+	//
+	void frameReceived(int cam, VmbFrameStatusType Status, VmbUint64_t FrameID, VmbUint64_t Timestamp);
+	//
+	// Method: frameRequeued()
+	//
+	// Purpose: the host gave a frame buffer back to the API.
+	//
+	void frameRequeued(int cam);
+	//
+	// Method: recorderDropped()
+	//
+	// Purpose: the recorder queue of a camera overwrote an unwritten frame.
+	//
+	void recorderDropped(int cam, uint64_t frameID);
+	//
+	// Method: triggersSkipped()
+	//
+	// Purpose: the host left out Count triggers of the nominal rate on purpose,
+	//          the time stamp gaps they leave are no camera losses.
+	//          Call it from the trigger thread when the trigger is dropped.
+	//
+	void triggersSkipped(uint64_t Count);
+
+	int         cameras()                           const { return m_Cameras; }
+	uint64_t    received(int cam)                   const { return m_State[cam].Received.load(std::memory_order_relaxed); }
+	uint64_t    lost(int cam, drop_stage stage)     const { return m_State[cam].Lost[stage].load(std::memory_order_relaxed); }
+	uint64_t    lostTotal(int cam)                  const;
+	//
+	// Method: alertSequence()
+	//
+	// Purpose: grows by one with every loss event of any camera.
+	//          Pollers compare it with the value they saw last time.
+	//
+	uint64_t    alertSequence()                     const { return m_AlertSequence.load(std::memory_order_acquire); }
+	drop_event  lastEvent(int cam)                  const;
+
+	static const char* stageName(drop_stage stage);
+
+private:
+	DropFrameDetector(const DropFrameDetector&);
+	DropFrameDetector& operator=(const DropFrameDetector&);
+
+	struct camera_state
+	{
+		// written by the camera's callback thread only
+		bool                    HaveLast;
+		VmbUint64_t             PrevFrameID;
+		VmbUint64_t             PrevTimestamp;
+		VmbUint64_t             Period;             // running estimate in device ticks, 0 until known
+		uint64_t                SkipsSeen;          // m_SkippedTriggers at the previous frame
+		uint64_t                SkipCredit;         // skipped triggers whose gap was not seen yet
+		// shared with the poller and the host threads
+		std::atomic<uint32_t>   Outstanding;        // buffers held by the host
+		std::atomic<bool>       Starved;            // all buffers were held since the last frame
+		std::atomic<uint64_t>   Received;
+		std::atomic<uint64_t>   Lost[STAGE_COUNT];
+		std::atomic<int>        LastStage;
+		std::atomic<uint64_t>   LastFrames;
+		std::atomic<uint64_t>   LastFrameID;
+	};
+
+	bool arrive(int cam, bool &Starved);
+	void classify(int cam, bool Starved, VmbFrameStatusType Status, VmbUint64_t FrameID, VmbUint64_t Timestamp);
+	void report(int cam, drop_stage stage, uint64_t frames, uint64_t frameID);
+
+	std::unique_ptr<camera_state[]> m_State;
+	int                         m_Cameras;
+	int                         m_Allocated;        // size of m_State
+	uint32_t                    m_BufferCount;
+	std::vector<VmbUint64_t>    m_NominalPeriod;    // per camera in device ticks, 0 if unknown
+	std::atomic<uint64_t>       m_SkippedTriggers;
+	std::atomic<uint64_t>       m_AlertSequence;
+};
+
+#endif
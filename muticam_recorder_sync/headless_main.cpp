@@ -0,0 +1,74 @@
+//
+// Headless recorder: records the cameras of a config file until a stop signal.
+//
+//  headless_recorder <config file>
+//
+// SIGINT / SIGTERM (Ctrl+C) stop the recording, the backlog is written first.
+// SIGUSR1, Ctrl+Break on Windows, is the record event of an armed pre-roll.
+//
+#include <csignal>
+#include <iostream>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QThread>
+#include "HeadlessRecorder.h"
+
+namespace
+{
+	volatile std::sig_atomic_t g_Stop = 0;
+	volatile std::sig_atomic_t g_Record = 0;
+
+	extern "C" void OnStopSignal(int)
+	{
+		g_Stop = 1;
+	}
+
+	extern "C" void OnRecordSignal(int sig)
+	{
+		g_Record = 1;
+		// Windows resets the handler on delivery
+		std::signal(sig, OnRecordSignal);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 2)
+	{
+		std::cerr << "usage: " << argv[0] << " <config file>" << std::endl;
+		return 2;
+	}
+	HeadlessConfig config;
+	std::string error;
+	if (!config.load(argv[1], error))
+	{
+		std::cerr << error << std::endl;
+		return 2;
+	}
+	// QtCore only, the event loop never runs
+	QCoreApplication a(argc, argv);
+	std::signal(SIGINT, OnStopSignal);
+	std::signal(SIGTERM, OnStopSignal);
+#ifdef SIGUSR1
+	std::signal(SIGUSR1, OnRecordSignal);
+#endif
+#ifdef SIGBREAK
+	std::signal(SIGBREAK, OnRecordSignal);
+#endif
+
+	HeadlessRecorder recorder(config);
+	if (!recorder.start())
+	{
+		return 1;
+	}
+	while (!g_Stop && recorder.tick())
+	{
+		if (g_Record)
+		{
+			g_Record = 0;
+			recorder.recordEvent();
+		}
+		QThread::msleep(HeadlessRecorder::TICK_MS);
+	}
+	recorder.stop();
+	return 0;
+}
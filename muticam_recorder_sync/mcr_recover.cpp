@@ -0,0 +1,81 @@
+//
+// mcr_recover - rebuild recordings of an aborted session
+//
+// Usage: mcr_recover <in.mcr> [out.avi]
+//
+// Walks the chunks of an MCR file written by OpenCVRecorder, keeps every
+// frame up to the last complete one and writes
+//   <in>.recovered.mcr  with a fresh index and trailer
+//   out.avi             (optional) MJPG AVI for players without MCR support
+//
+#include <iostream>
+#include <string>
+#include <vector>
+#include "opencv2/opencv.hpp"
+#include "ChunkedContainer.h"
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		std::cout << "usage: mcr_recover <in.mcr> [out.avi]" << std::endl;
+		return -1;
+	}
+	const std::string inName = argv[1];
+	mcr::Reader reader;
+	if (!reader.open(inName))
+	{
+		std::cout << "not an MCR file: " << inName << std::endl;
+		return -1;
+	}
+	const mcr::file_header header = reader.header();
+
+	std::vector<mcr::Reader::chunk_info> chunks;
+	const uint64_t goodEnd = reader.scan(chunks);
+	std::cout << chunks.size() << " complete chunks, last one ends at " << goodEnd << std::endl;
+
+	const std::string fixedName = inName.substr(0, inName.rfind('.')) + ".recovered.mcr";
+	mcr::Writer fixed(fixedName, header.Width, header.Height, header.FPS, 30, header.Tracks);
+	cv::VideoWriter avi;
+	if (argc > 2)
+	{
+		avi.open(argv[2], cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), header.FPS, cv::Size(header.Width, header.Height), true);
+		if (!avi.isOpened())
+		{
+			std::cout << "could not open " << argv[2] << std::endl;
+			return -1;
+		}
+	}
+
+	// payloads are copied as they are, only the AVI needs decoding
+	std::vector<uchar> payload;
+	mcr::chunk_header chunk;
+	uint64_t frames = 0;
+	for (size_t i = 0; i < chunks.size(); ++i)
+	{
+		if (mcr::CHUNK_INDEX == chunks[i].Header.Type
+			|| !reader.readChunk(chunks[i].Offset, chunk, payload))
+		{
+			continue;
+		}
+		if (mcr::CHUNK_FRAME != chunk.Type)
+		{
+			fixed.writeChunk(chunk.Type, chunk.Track, chunk.Sequence, chunk.Aux, payload.empty() ? NULL : &payload[0], chunk.Size);
+			continue;
+		}
+		fixed.writeEncoded(chunk.Track, chunk.Sequence, chunk.Aux, &payload[0], chunk.Size);
+		if (avi.isOpened() && 0 == chunk.Track)
+		{
+			cv::Mat image = cv::imdecode(cv::Mat(payload), cv::IMREAD_COLOR);
+			if (!image.empty())
+			{
+				avi << image;
+			}
+		}
+		++frames;
+	}
+	fixed.release();
+	avi.release();
+	std::cout << frames << " frames written to " << fixedName << std::endl;
+	return 0;
+}
@@ -0,0 +1,461 @@
+//
+// rig_simulator - load test of the per frame pipeline with many cameras
+//
+// Usage: rig_simulator [cameras=24] [seconds=10] [fps=30] [loss_every=500]
+//
+// Runs one thread per simulated camera, the way the Vimba API runs one
+// frame observer thread per camera. All cameras follow a common trigger
+// grid; each one has its own device clock (offset and drift), a few us of
+// exposure jitter and loses roughly one frame in loss_every on the link.
+// Every frame goes through the same per frame work as a VimbaC callback:
+//   DropFrameDetector, ClockMapper, SyncMonitor, MotionDetector and the
+//   time stamp sidecar, then a RawFrameEvent to the consumer
+// and the consumer queues it into the OpenCVRecorder of its camera, as the
+// headless recorder does. The recorders write MCR files with a spill ring,
+// rig_sim_camNN.mcr in the working directory. The main thread refits the
+// clocks and evaluates the triggers every UPDATE_MS, like the metrics timer
+// does, and samples the recorder backlog.
+// Past the last frame the backlog is written before the recorders stop.
+// Even cameras see a moving object in the middle third of the run, odd ones
+// a static scene.
+//
+// At the end the counters are checked against what was simulated:
+//   received and lost frames per camera, no recorder drops and the backlog
+//   written, triggers and incomplete triggers of the sync monitor, fitted
+//   drift, motion only on the moving cameras
+// and the worst per frame cost and the recorder backlog peak are printed.
+//
+// A second pass drives the PtpScheduler in simulated time, no sleeping:
+// the host knows the PTP time with an offset of many years and a small
+// error, action commands reach the cameras a few ms after they are sent and
+// for a short stretch far later than that. It checks the execution times
+// handed out against the grid, that verify() flags exactly the frames whose
+// command arrived late, and that the lead time grows over the stretch and
+// comes back down afterwards. Exits with 0 if all checks pass.
+//
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <set>
+#include <thread>
+#include <vector>
+#include "AsyncFileWriter.h"
+#include "ClockMapper.h"
+#include "drop_frame_detection.h"
+#include "LatencyHistogram.h"
+#include "MotionDetector.h"
+#include "OpenCVVideoRecorder.h"
+#include "PtpScheduler.h"
+#include "SyncMonitor.h"
+#include "VimbaCCapture.h"
+
+static const VmbUint32_t    WIDTH = 320;
+static const VmbUint32_t    HEIGHT = 240;
+static const VmbUint32_t    BUFFER_COUNT = 3;
+static const double         TICK_FREQUENCY = 1e9;      // device ticks are ns
+static const double         DRIFT_RANGE_PPM = 40;
+static const int            UPDATE_MS = 250;
+static const char*          OUTPUT_PREFIX = "rig_sim";
+static const VmbUint64_t    SPILL_BYTES = 16ull << 20;                 // per camera
+static const int            DRAIN_TIMEOUT_MS = 30000;
+// scheduled action commands, all times in ns
+static const uint64_t       PTP_TRIGGERS = 40000;
+static const uint64_t       PTP_OFFSET_NS = 1700000000ull * 1000000000ull;  // PTP epoch vs. the simulated host clock
+static const uint64_t       PTP_HOST_ERROR_NS = 200000;                     // how well the host knows the PTP time
+static const uint64_t       PTP_START_LEAD_NS = 2000000;
+static const uint64_t       PTP_MIN_LEAD_NS = 1000000;
+static const uint64_t       PTP_MAX_LEAD_NS = 500000000;
+static const uint64_t       PTP_TOLERANCE_NS = 100000;
+static const uint64_t       PTP_LATENCY_NS = 4000000;                       // command delivery after a period, plus up to 1 ms jitter
+static const uint64_t       PTP_SPIKE_LATENCY_NS = 80000000;                // delivery during the congested stretch
+static const uint64_t       PTP_SPIKE_TRIGGERS = 60;
+static const uint64_t       PTP_EXPOSE_NS = 20000;                          // trigger latency of the camera
+static const uint64_t       PTP_TRANSFER_NS = 1000000;                      // exposure to the host seeing the frame
+
+struct camera_sim
+{
+	int                     Camera;
+	uint64_t                OffsetTicks;
+	double                  DriftPpm;
+	uint32_t                Random;
+	std::vector<VmbUchar_t> Image;
+	std::vector<uint64_t>   Lost;               // frame IDs never delivered
+	uint64_t                MotionFrames;       // frames the detector saw as moving
+	LatencyHistogram        CostUs;             // per frame work
+};
+
+//
+// The consumer of the raw frame path, as HeadlessRecorder::OnRawFrame():
+// a complete frame goes into the recorder queue of its camera, a full queue
+// counts a recorder drop in the detector.
+//
+class rig_consumer : public IRawFrameConsumer
+{
+public:
+	typedef QSharedPointer<OpenCVRecorder> OpenCVRecorderPtr;
+	std::vector<OpenCVRecorderPtr>  Recorders;
+
+	virtual void OnRawFrame(const RawFrameEvent &event)
+	{
+		if (VmbFrameStatusComplete == event.Status && event.Camera < static_cast<int>(Recorders.size()))
+		{
+			Recorders[event.Camera]->enqueueRaw(event.pData, event.ImageSize, event.Width, event.Height, event.PixelFormat,
+				event.FrameID, event.Timestamp, event.ArrivalNs);
+		}
+	}
+};
+
+struct rig_sim
+{
+	int                     Cameras;
+	uint64_t                Frames;
+	uint64_t                PeriodNs;
+	uint64_t                LossEvery;
+	uint64_t                StartNs;
+	DropFrameDetector       Drops;
+	ClockMapper             Clocks;
+	SyncMonitor             Sync;
+	MotionDetector          Motion;
+	rig_consumer            Consumer;
+	std::atomic<int>        Finished;           // camera threads done
+};
+
+static uint32_t nextRandom(uint32_t &state)
+{
+	// xorshift, enough for jitter and loss patterns
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+//
+// The link loses a frame, never the first two of a camera (the detector
+// needs them for the frame period) and never the last one, after which the
+// sync monitor could not tell that the camera moved past a lost trigger.
+//
+static bool isLost(const rig_sim &rig, uint64_t frame, uint32_t &random)
+{
+	const uint32_t draw = nextRandom(random);
+	return frame >= 2 && frame + 1 < rig.Frames && 0 == draw % rig.LossEvery;
+}
+
+static void drawScene(camera_sim &sim, const rig_sim &rig, uint64_t frame)
+{
+	std::fill(sim.Image.begin(), sim.Image.end(), static_cast<VmbUchar_t>(40 + 4 * (sim.Camera % 16)));
+	if (0 != sim.Camera % 2 || frame < rig.Frames / 3 || frame >= 2 * rig.Frames / 3)
+	{
+		return;
+	}
+	// a 48x48 square crossing the image, a few pixels per frame
+	const VmbUint32_t size = 48;
+	const VmbUint32_t x = static_cast<VmbUint32_t>((frame * 5) % (WIDTH - size));
+	const VmbUint32_t y = HEIGHT / 2 - size / 2;
+	for (VmbUint32_t row = y; row < y + size; ++row)
+	{
+		std::fill(sim.Image.begin() + row * WIDTH + x, sim.Image.begin() + row * WIDTH + x + size, static_cast<VmbUchar_t>(220));
+	}
+}
+
+static void runCamera(camera_sim &sim, rig_sim &rig)
+{
+	for (uint64_t frame = 0; frame < rig.Frames; ++frame)
+	{
+		const uint64_t triggerNs = frame * rig.PeriodNs;
+		// deliver a little after the exposure, like a transfer does
+		const uint64_t dueNs = rig.StartNs + triggerNs + 500000 + nextRandom(sim.Random) % 200000;
+		uint64_t now = AsyncIoService::nowNs();
+		if (dueNs > now)
+		{
+			std::this_thread::sleep_for(std::chrono::nanoseconds(dueNs - now));
+		}
+		if (isLost(rig, frame, sim.Random))
+		{
+			sim.Lost.push_back(frame);
+			continue;
+		}
+		const int64_t jitterTicks = static_cast<int64_t>(nextRandom(sim.Random) % 4000) - 2000;
+		const VmbUint64_t timestamp = sim.OffsetTicks + static_cast<VmbUint64_t>(triggerNs * (1 + sim.DriftPpm * 1e-6) + jitterTicks);
+		drawScene(sim, rig, frame);
+
+		// the per frame work of the callback, as in VimbaCCapture::received()
+		const uint64_t arrivedNs = AsyncIoService::nowNs();
+		rig.Drops.frameReceived(sim.Camera, VmbFrameStatusComplete, frame, timestamp);
+		rig.Clocks.observe(sim.Camera, timestamp, arrivedNs);
+		rig.Sync.frameArrived(sim.Camera, frame, timestamp);
+		if (rig.Motion.process(sim.Camera, &sim.Image[0], static_cast<VmbUint32_t>(sim.Image.size()), WIDTH, HEIGHT, VmbPixelFormatMono8) > 0.005)
+		{
+			++sim.MotionFrames;
+		}
+		int64_t commonNs = static_cast<int64_t>(arrivedNs - rig.Clocks.epochNs());
+		rig.Clocks.toCommonNs(sim.Camera, timestamp, commonNs);
+		push(commonNs * 1e-6, sim.Camera);
+		RawFrameEvent event;
+		event.Camera = sim.Camera;
+		event.Index = static_cast<VmbUint32_t>(frame % BUFFER_COUNT);
+		event.Status = VmbFrameStatusComplete;
+		event.pData = &sim.Image[0];
+		event.ImageSize = static_cast<VmbUint32_t>(sim.Image.size());
+		event.Width = WIDTH;
+		event.Height = HEIGHT;
+		event.PixelFormat = VmbPixelFormatMono8;
+		event.FrameID = frame;
+		event.Timestamp = timestamp;
+		event.ArrivalNs = arrivedNs;
+		rig.Consumer.OnRawFrame(event);
+		rig.Drops.frameRequeued(sim.Camera);
+		sim.CostUs.record((AsyncIoService::nowNs() - arrivedNs) / 1000);
+	}
+	rig.Finished.fetch_add(1);
+}
+
+static bool check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		std::cout << "FAIL: " << what << std::endl;
+	}
+	return ok;
+}
+
+//
+// The PtpScheduler against a simulated PTP clock. The host timer fires once
+// per period with up to 2 ms of lag, schedules the next command and then
+// verifies the frames it has received by now, the way the metrics path does.
+// A camera exposes at the execution time if the command arrived before it,
+// else on arrival.
+//
+static bool runPtpScheduler(uint64_t PeriodNs)
+{
+	PtpScheduler scheduler;
+	scheduler.reset(PeriodNs, PTP_START_LEAD_NS, PTP_MIN_LEAD_NS, PTP_MAX_LEAD_NS, PTP_TOLERANCE_NS);
+	uint32_t random = 0x2545f491u;
+	const uint64_t spikeStart = PTP_TRIGGERS / 4;
+	// device time stamp of every frame by the time the host receives it, and whether its command was late
+	std::multimap<uint64_t, std::pair<uint64_t, bool> > inFlight;
+	bool ok = true;
+	bool haveFirst = false;
+	uint64_t firstNs = 0;
+	uint64_t previousNs = 0;
+	uint64_t offGrid = 0;
+	uint64_t notAhead = 0;
+	uint64_t wrongSkips = 0;
+	uint64_t notCovered = 0;
+	uint64_t lateCommands = 0;
+	uint64_t misjudged = 0;
+	uint64_t lateInLastQuarter = 0;
+	uint64_t peakLeadNs = 0;
+	for (uint64_t tick = 0; tick < PTP_TRIGGERS + PTP_MAX_LEAD_NS / PeriodNs + 2; ++tick)
+	{
+		const uint64_t hostNs = tick * PeriodNs + nextRandom(random) % 2000000;
+		const uint64_t ptpNowNs = PTP_OFFSET_NS + hostNs;
+		while (!inFlight.empty() && inFlight.begin()->first <= ptpNowNs)
+		{
+			const std::pair<uint64_t, bool> frame = inFlight.begin()->second;
+			inFlight.erase(inFlight.begin());
+			if (scheduler.verify(frame.first) != frame.second)
+			{
+				++misjudged;
+			}
+			if (!frame.second && tick >= 3 * PTP_TRIGGERS / 4)
+			{
+				++lateInLastQuarter;
+			}
+		}
+		peakLeadNs = std::max(peakLeadNs, scheduler.leadNs());
+		if (tick >= PTP_TRIGGERS)
+		{
+			// only drain the frames still in flight
+			continue;
+		}
+		const uint64_t knownNs = ptpNowNs + nextRandom(random) % (2 * PTP_HOST_ERROR_NS) - PTP_HOST_ERROR_NS;
+		const uint64_t leadNs = scheduler.leadNs();
+		uint64_t skipped = 0;
+		const uint64_t executeNs = scheduler.next(knownNs, &skipped);
+		if (0 == executeNs)
+		{
+			++notCovered;
+			continue;
+		}
+		if (haveFirst)
+		{
+			offGrid += 0 != (executeNs - firstNs) % PeriodNs || executeNs <= previousNs ? 1 : 0;
+			wrongSkips += executeNs > previousNs && (executeNs - previousNs) / PeriodNs - 1 != skipped ? 1 : 0;
+		}
+		else
+		{
+			haveFirst = true;
+			firstNs = executeNs;
+		}
+		notAhead += executeNs < knownNs + leadNs ? 1 : 0;
+		previousNs = executeNs;
+		const bool spike = tick >= spikeStart && tick < spikeStart + PTP_SPIKE_TRIGGERS;
+		// slower than a period, else rounding up to the next slot would cover the lead
+		const uint64_t arrivalNs = ptpNowNs + (spike ? PTP_SPIKE_LATENCY_NS : PeriodNs + PTP_LATENCY_NS) + nextRandom(random) % 1000000;
+		const uint64_t exposureNs = std::max(executeNs, arrivalNs) + PTP_EXPOSE_NS;
+		// a late exposure that happens to land on another slot can not be told apart
+		const uint64_t aside = (exposureNs - firstNs) % PeriodNs;
+		const bool onSlot = aside <= PTP_TOLERANCE_NS || aside >= PeriodNs - PTP_TOLERANCE_NS;
+		const bool late = arrivalNs > executeNs && !onSlot;
+		lateCommands += late ? 1 : 0;
+		inFlight.insert(std::make_pair(exposureNs + PTP_TRANSFER_NS, std::make_pair(exposureNs, !late)));
+	}
+	ok &= check(0 == offGrid, "execution times on the grid, increasing");
+	ok &= check(0 == notAhead, "execution times at least the lead ahead");
+	ok &= check(0 == wrongSkips, "skipped slots reported");
+	ok &= check(scheduler.scheduled() + notCovered == PTP_TRIGGERS, "scheduled commands");
+	ok &= check(0 != lateCommands && 0 == misjudged, "late commands flagged by verify()");
+	ok &= check(scheduler.late() == lateCommands, "late frame count");
+	ok &= check(peakLeadNs >= PTP_SPIKE_LATENCY_NS, "lead grows over the late stretch");
+	ok &= check(scheduler.leadNs() < PTP_SPIKE_LATENCY_NS / 4 && scheduler.leadNs() > PTP_MIN_LEAD_NS, "lead shrinks back to the delivery latency");
+	// once settled a late frame only marks where the lead shrank a step too far
+	ok &= check(lateInLastQuarter * 100 < PTP_TRIGGERS / 4, "lead settled");
+
+	std::cout << "ptp: " << scheduler.scheduled() << " scheduled, " << scheduler.skipped() << " slots skipped, "
+		<< notCovered << " commands not scheduled, " << scheduler.late() << " late" << std::endl;
+	std::cout << "ptp: lead peak " << peakLeadNs / 1000 << " us, final " << scheduler.leadNs() / 1000 << " us, "
+		<< lateInLastQuarter << " late in the last quarter" << std::endl;
+	return ok;
+}
+
+int main(int argc, char *argv[])
+{
+	const int cameras = argc > 1 ? atoi(argv[1]) : 24;
+	const double seconds = argc > 2 ? atof(argv[2]) : 10;
+	const double fps = argc > 3 ? atof(argv[3]) : 30;
+	const int lossEvery = argc > 4 ? atoi(argv[4]) : 500;
+	if (cameras < 2 || seconds <= 0 || fps <= 0 || lossEvery < 1)
+	{
+		std::cout << "usage: rig_simulator [cameras=24] [seconds=10] [fps=30] [loss_every=500]" << std::endl;
+		return -1;
+	}
+
+	rig_sim rig;
+	rig.Cameras = cameras;
+	rig.Frames = static_cast<uint64_t>(seconds * fps);
+	rig.PeriodNs = static_cast<uint64_t>(1e9 / fps);
+	rig.LossEvery = static_cast<uint64_t>(lossEvery);
+	const std::vector<double> tickFrequency(cameras, TICK_FREQUENCY);
+	rig.Drops.reset(cameras, BUFFER_COUNT);
+	rig.Clocks.reset(tickFrequency);
+	rig.Sync.reset(tickFrequency, static_cast<uint32_t>(fps), &rig.Clocks);
+	rig.Motion.reset(cameras, WIDTH, HEIGHT);
+	rig.Finished.store(0);
+
+	std::vector<camera_sim> sims(cameras);
+	for (int i = 0; i < cameras; ++i)
+	{
+		camera_sim &sim = sims[i];
+		sim.Camera = i;
+		sim.Random = 0x9e3779b9u * (i + 1);
+		sim.OffsetTicks = 1000000000ull * (i + 1) + nextRandom(sim.Random) % 1000000;
+		sim.DriftPpm = DRIFT_RANGE_PPM * (2.0 * i / (cameras - 1) - 1);
+		sim.Image.assign(WIDTH * HEIGHT, 0);
+		sim.MotionFrames = 0;
+	}
+
+	RecorderSettings settings;
+	settings.Container = RecorderSettings::CONTAINER_MCR;
+	settings.DropDetector = &rig.Drops;
+	settings.FrameBytes = WIDTH * HEIGHT;
+	settings.SpillBytes = SpillRing::budget(OUTPUT_PREFIX, SPILL_BYTES, cameras);
+	resetSidecars(cameras);
+	try
+	{
+		for (int i = 0; i < cameras; ++i)
+		{
+			char name[64];
+			snprintf(name, sizeof(name), "%s_cam%02d.avi", OUTPUT_PREFIX, i);
+			rig_consumer::OpenCVRecorderPtr pRecorder = rig_consumer::OpenCVRecorderPtr(new OpenCVRecorder(i, name, fps, WIDTH, HEIGHT, settings));
+			rig.Consumer.Recorders.push_back(pRecorder);
+			pRecorder->start();
+		}
+	}
+	catch (const BaseException &bex)
+	{
+		std::cout << (bex.Function() + " :" + bex.Message()).toStdString() << std::endl;
+		return -1;
+	}
+
+	std::cout << cameras << " cameras, " << rig.Frames << " frames each at " << fps << " fps" << std::endl;
+	rig.StartNs = AsyncIoService::nowNs() + 10000000;
+	std::vector<std::thread> threads;
+	for (int i = 0; i < cameras; ++i)
+	{
+		threads.push_back(std::thread(runCamera, std::ref(sims[i]), std::ref(rig)));
+	}
+	int backlogPeak = 0;
+	while (rig.Finished.load() < cameras)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(UPDATE_MS));
+		rig.Clocks.update();
+		rig.Sync.update();
+		for (int i = 0; i < cameras; ++i)
+		{
+			backlogPeak = std::max(backlogPeak, rig.Consumer.Recorders[i]->m_framequeue_size());
+		}
+	}
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		threads[i].join();
+	}
+	rig.Clocks.update();
+	rig.Sync.update();
+	// the backlog is written before the files close, as in HeadlessRecorder::stop()
+	const uint64_t drainStartNs = AsyncIoService::nowNs();
+	int backlog = 0;
+	do
+	{
+		backlog = 0;
+		for (int i = 0; i < cameras; ++i)
+		{
+			backlog += rig.Consumer.Recorders[i]->m_framequeue_size();
+		}
+		if (0 != backlog)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(UPDATE_MS));
+		}
+	} while (0 != backlog && AsyncIoService::nowNs() - drainStartNs < static_cast<uint64_t>(DRAIN_TIMEOUT_MS) * 1000000);
+	for (int i = 0; i < cameras; ++i)
+	{
+		rig.Consumer.Recorders[i]->stopThread();
+		rig.Consumer.Recorders[i]->wait();
+	}
+	rig.Consumer.Recorders.clear();
+	resetSidecars(0);
+
+	bool ok = true;
+	std::set<uint64_t> incomplete;
+	double worstDrift = 0;
+	uint64_t worstCostUs = 0;
+	for (int i = 0; i < cameras; ++i)
+	{
+		const camera_sim &sim = sims[i];
+		incomplete.insert(sim.Lost.begin(), sim.Lost.end());
+		ok &= check(rig.Drops.received(i) == rig.Frames - sim.Lost.size(), "received frames");
+		ok &= check(rig.Drops.lost(i, DropFrameDetector::STAGE_LINK) == sim.Lost.size(), "link losses");
+		ok &= check(0 == rig.Drops.lost(i, DropFrameDetector::STAGE_RECORDER), "recorders kept up");
+		ok &= check(rig.Drops.lostTotal(i) == sim.Lost.size(), "no losses of other stages");
+		ok &= check(rig.Clocks.fitted(i), "clock fitted");
+		worstDrift = std::max(worstDrift, std::fabs(rig.Clocks.driftPpm(i) - sim.DriftPpm));
+		ok &= check(0 == i % 2 ? 0 != sim.MotionFrames : 0 == sim.MotionFrames, "motion on the moving cameras only");
+		worstCostUs = std::max(worstCostUs, sim.CostUs.percentile(0.99));
+	}
+	ok &= check(0 == backlog, "recorder backlog written");
+	ok &= check(rig.Sync.triggers() == rig.Frames - incomplete.size(), "complete triggers");
+	ok &= check(rig.Sync.incomplete() == incomplete.size(), "incomplete triggers");
+	// the host side of the fit is real sleep jitter, allow a generous error
+	ok &= check(worstDrift < 20, "fitted drift");
+
+	std::cout << "triggers " << rig.Sync.triggers() << " complete, " << rig.Sync.incomplete() << " incomplete" << std::endl;
+	std::cout << "spread p99 " << rig.Sync.spread().Session.percentile(0.99) << " us" << std::endl;
+	std::cout << "worst drift error " << worstDrift << " ppm" << std::endl;
+	std::cout << "worst camera p99 frame cost " << worstCostUs << " us" << std::endl;
+	std::cout << "recorder backlog peak " << backlogPeak << " frames" << std::endl;
+	ok &= runPtpScheduler(rig.PeriodNs);
+	std::cout << (ok ? "PASS" : "FAIL") << std::endl;
+	return ok ? 0 : 1;
+}
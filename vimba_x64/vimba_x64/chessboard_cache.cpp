@@ -0,0 +1,163 @@
+#include "chessboard_cache.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+using namespace std;
+using namespace cv;
+
+namespace {
+	const char MAGIC[4] = { 'C', 'B', 'C', '1' };
+
+	template <class T> void put(ofstream &out, const T &value) {
+		out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+
+	template <class T> bool get(ifstream &in, T &value) {
+		return !!in.read(reinterpret_cast<char*>(&value), sizeof(value));
+	}
+
+	void detect(ChessboardResult &result, const vector<uchar> &data, Size pattern, int bayerCode) {
+		Mat raw = imdecode(data, IMREAD_UNCHANGED);
+		if (raw.empty())
+			return;
+		Mat gray;
+		if (1 == raw.channels())
+			cvtColor(raw, gray, bayerCode);
+		else
+			cvtColor(raw, gray, COLOR_BGR2GRAY);
+		result.imageSize = gray.size();
+		result.found = findChessboardCorners(gray, pattern, result.corners, CALIB_CB_ADAPTIVE_THRESH | CALIB_CB_NORMALIZE_IMAGE | CALIB_CB_FAST_CHECK);
+		if (result.found)
+			cornerSubPix(gray, result.corners, Size(11, 11), Size(-1, -1), TermCriteria(TermCriteria::EPS | TermCriteria::COUNT, 30, 0.1));
+		else
+			result.corners.clear();
+	}
+}
+
+uint64_t contentHash(const vector<uchar> &data) {
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < data.size(); i++) {
+		hash ^= data[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+bool CornerCache::load(const string &path) {
+	m_Entries.clear();
+	m_Dirty = false;
+	ifstream in(path.c_str(), ios::binary);
+	char magic[4];
+	int32_t cols, rows;
+	uint32_t count;
+	if (!in.read(magic, 4) || 0 != memcmp(magic, MAGIC, 4) || !get(in, cols) || !get(in, rows) || !get(in, count)
+		|| cols != m_Pattern.width || rows != m_Pattern.height)
+		return false;
+	for (uint32_t i = 0; i < count; i++) {
+		uint64_t hash;
+		uint8_t found;
+		int32_t width, height;
+		uint32_t corners;
+		if (!get(in, hash) || !get(in, found) || !get(in, width) || !get(in, height) || !get(in, corners)
+			|| corners > static_cast<uint32_t>(m_Pattern.area())) {
+			m_Entries.clear();
+			return false;
+		}
+		entry &e = m_Entries[hash];
+		e.found = 0 != found;
+		e.imageSize = Size(width, height);
+		e.corners.resize(corners);
+		if (corners > 0 && !in.read(reinterpret_cast<char*>(&e.corners[0]), corners * sizeof(Point2f))) {
+			m_Entries.clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool CornerCache::save(const string &path) {
+	// written next to the old one and renamed, a crash never leaves half a cache
+	const string tmp = path + ".tmp";
+	{
+		ofstream out(tmp.c_str(), ios::binary | ios::trunc);
+		out.write(MAGIC, 4);
+		put(out, static_cast<int32_t>(m_Pattern.width));
+		put(out, static_cast<int32_t>(m_Pattern.height));
+		put(out, static_cast<uint32_t>(m_Entries.size()));
+		for (map<uint64_t, entry>::const_iterator it = m_Entries.begin(); it != m_Entries.end(); ++it) {
+			put(out, it->first);
+			put(out, static_cast<uint8_t>(it->second.found ? 1 : 0));
+			put(out, static_cast<int32_t>(it->second.imageSize.width));
+			put(out, static_cast<int32_t>(it->second.imageSize.height));
+			put(out, static_cast<uint32_t>(it->second.corners.size()));
+			if (!it->second.corners.empty())
+				out.write(reinterpret_cast<const char*>(&it->second.corners[0]), it->second.corners.size() * sizeof(Point2f));
+		}
+		if (!out)
+			return false;
+	}
+	::remove(path.c_str());
+	if (0 != ::rename(tmp.c_str(), path.c_str()))
+		return false;
+	m_Dirty = false;
+	return true;
+}
+
+bool CornerCache::find(uint64_t hash, ChessboardResult &result) {
+	lock_guard<mutex> lock(m_Lock);
+	map<uint64_t, entry>::const_iterator it = m_Entries.find(hash);
+	if (it == m_Entries.end())
+		return false;
+	result.found = it->second.found;
+	result.imageSize = it->second.imageSize;
+	result.corners = it->second.corners;
+	return true;
+}
+
+void CornerCache::store(const ChessboardResult &result) {
+	lock_guard<mutex> lock(m_Lock);
+	entry &e = m_Entries[result.hash];
+	e.found = result.found;
+	e.imageSize = result.imageSize;
+	e.corners = result.corners;
+	m_Dirty = true;
+}
+
+vector<ChessboardResult> detectChessboards(const vector<string> &paths, Size pattern, int bayerCode, CornerCache &cache, unsigned threads) {
+	vector<ChessboardResult> results(paths.size());
+	if (0 == threads)
+		threads = max(1u, thread::hardware_concurrency());
+	threads = min<unsigned>(threads, static_cast<unsigned>(max<size_t>(1, paths.size())));
+	// every worker takes the next image, detection times differ a lot between images
+	atomic<size_t> next(0);
+	vector<thread> workers;
+	for (unsigned t = 0; t < threads; t++) {
+		workers.push_back(thread([&]() {
+			for (size_t i = next++; i < paths.size(); i = next++) {
+				ChessboardResult &result = results[i];
+				result.path = paths[i];
+				result.found = false;
+				result.cached = false;
+				ifstream in(paths[i].c_str(), ios::binary);
+				const vector<uchar> data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+				result.hash = contentHash(data);
+				if (data.empty())
+					continue;
+				if (cache.find(result.hash, result)) {
+					result.cached = true;
+					continue;
+				}
+				detect(result, data, pattern, bayerCode);
+				if (0 != result.imageSize.area())
+					cache.store(result);
+			}
+		}));
+	}
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+	return results;
+}
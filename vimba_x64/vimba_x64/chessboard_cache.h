@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Chessboard corners of one calibration image
+struct ChessboardResult {
+	std::string path;
+	uint64_t hash;                      // FNV-1a of the file content
+	bool found;
+	cv::Size imageSize;
+	std::vector<cv::Point2f> corners;   // sub-pixel refined
+	bool cached;                        // taken from the cache, the image was not decoded
+};
+
+// Refined corners of images that were detected before, keyed by the hash
+// of the file content, so a renamed or re-saved image is detected again
+// and an unchanged one never is. Saved as a binary file next to the images.
+class CornerCache {
+public:
+	explicit CornerCache(cv::Size pattern) : m_Pattern(pattern), m_Dirty(false) {}
+
+	// a missing file or one for another pattern is an empty cache
+	bool load(const std::string &path);
+	bool save(const std::string &path);
+	bool find(uint64_t hash, ChessboardResult &result);
+	void store(const ChessboardResult &result);
+	bool dirty() const { return m_Dirty; }
+
+private:
+	struct entry {
+		bool found;
+		cv::Size imageSize;
+		std::vector<cv::Point2f> corners;
+	};
+	cv::Size m_Pattern;
+	std::map<uint64_t, entry> m_Entries;
+	std::mutex m_Lock;
+	bool m_Dirty;
+};
+
+// FNV-1a of a file content, the key of the cache
+uint64_t contentHash(const std::vector<unsigned char> &data);
+
+// Detects the chessboard of every image on all cores, refined once with
+// cornerSubPix. Images whose content is in the cache are only read and
+// hashed. bayerCode converts the raw images to gray, e.g. CV_BayerBG2GRAY.
+std::vector<ChessboardResult> detectChessboards(const std::vector<std::string> &paths, cv::Size pattern, int bayerCode, CornerCache &cache, unsigned threads = 0);
@@ -0,0 +1,176 @@
+#include "live_calibration.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+using namespace cv;
+
+namespace {
+	// a view has to differ by this much in the pose space from every accepted one
+	const double MIN_NOVELTY = 0.15;
+	// mean corner motion on the small level that still counts as holding still
+	const double STILL_PX = 1.0;
+
+	double distance(const Point2f &a, const Point2f &b) {
+		return sqrt((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y));
+	}
+}
+
+void RigCapture::request(uint64_t frameID) {
+	lock_guard<mutex> lock(m_Lock);
+	if (find(m_Requested.begin(), m_Requested.end(), frameID) != m_Requested.end())
+		return;
+	m_Requested.push_back(frameID);
+	if (m_Requested.size() > KEEP)
+		m_Requested.pop_front();
+}
+
+bool RigCapture::requested(uint64_t frameID) {
+	lock_guard<mutex> lock(m_Lock);
+	return find(m_Requested.begin(), m_Requested.end(), frameID) != m_Requested.end();
+}
+
+LiveCalibrator::LiveCalibrator(const string &folder, Size pattern, int grayCode, RigCapture *rig)
+	: m_Folder(folder), m_Pattern(pattern), m_GrayCode(grayCode), m_Rig(rig), m_Cache(pattern), m_Next(0),
+	m_Covered(GRID * GRID, false), m_Stable(0), m_LastCaptured(0) {
+	// continue after the images already in the folder, their corners stay in the cache
+	while (ifstream((m_Folder + to_string(m_Next) + ".png").c_str()).good())
+		m_Next++;
+	m_Cache.load(m_Folder + "corners.bin");
+}
+
+double LiveCalibrator::coverage() const {
+	return (double)count(m_Covered.begin(), m_Covered.end(), true) / m_Covered.size();
+}
+
+LiveCalibrator::pose LiveCalibrator::describe(const vector<Point2f> &corners, Size image) const {
+	// the outer corners of the board
+	const Point2f &tl = corners[0], &tr = corners[m_Pattern.width - 1];
+	const Point2f &bl = corners[corners.size() - m_Pattern.width], &br = corners.back();
+	const double top = distance(tl, tr), bottom = distance(bl, br), left = distance(tl, bl), right = distance(tr, br);
+	const double diagonal = sqrt((double)image.width * image.width + (double)image.height * image.height);
+	pose p;
+	p.v[0] = (tl.x + tr.x + bl.x + br.x) / (4.0 * image.width);
+	p.v[1] = (tl.y + tr.y + bl.y + br.y) / (4.0 * image.height);
+	p.v[2] = (distance(tl, br) + distance(tr, bl)) / (2 * diagonal);
+	// perspective shortens the far edge, the relative difference measures the tilt
+	p.v[3] = 2 * (right - left) / (right + left);
+	p.v[4] = 2 * (bottom - top) / (bottom + top);
+	return p;
+}
+
+double LiveCalibrator::novelty(const pose &p) const {
+	double nearest = 1e9;
+	for (size_t i = 0; i < m_Views.size(); i++) {
+		double d = 0;
+		for (int k = 0; k < 5; k++)
+			d += (p.v[k] - m_Views[i].v[k]) * (p.v[k] - m_Views[i].v[k]);
+		nearest = min(nearest, sqrt(d));
+	}
+	return nearest;
+}
+
+bool LiveCalibrator::capture(const candidate &c, double scale) {
+	// only accepted views are converted and refined at full resolution
+	Mat gray;
+	cvtColor(c.raw, gray, m_GrayCode);
+	ChessboardResult result;
+	result.found = true;
+	result.cached = false;
+	result.imageSize = gray.size();
+	result.corners.resize(c.corners.size());
+	for (size_t i = 0; i < c.corners.size(); i++)
+		result.corners[i] = Point2f((float)((c.corners[i].x + 0.5) * scale - 0.5), (float)((c.corners[i].y + 0.5) * scale - 0.5));
+	const int window = max(5, (int)(scale * 2));
+	cornerSubPix(gray, result.corners, Size(window, window), Size(-1, -1), TermCriteria(TermCriteria::EPS | TermCriteria::COUNT, 30, 0.1));
+
+	vector<uchar> png;
+	if (!imencode(".png", c.raw, png))
+		return false;
+	result.path = m_Folder + to_string(m_Next) + ".png";
+	ofstream out(result.path.c_str(), ios::binary);
+	if (!out.write(reinterpret_cast<const char*>(&png[0]), png.size()))
+		return false;
+	out.close();
+	result.hash = contentHash(png);
+	m_Cache.store(result);
+	m_Cache.save(m_Folder + "corners.bin");
+	ofstream views((m_Folder + "views.txt").c_str(), ios::app);
+	views << m_Next << " " << c.frameID << endl;
+	m_Next++;
+	m_LastCaptured = c.frameID;
+
+	for (size_t i = 0; i < result.corners.size(); i++) {
+		const int gx = min(GRID - 1, max(0, (int)(result.corners[i].x * GRID / gray.cols)));
+		const int gy = min(GRID - 1, max(0, (int)(result.corners[i].y * GRID / gray.rows)));
+		m_Covered[gy * GRID + gx] = true;
+	}
+	return true;
+}
+
+void LiveCalibrator::process(const Mat &raw, uint64_t frameID, Mat &preview) {
+	// averaging the 2x2 Bayer cells gives a half size gray image without a demosaic
+	resize(raw, m_Half, Size(raw.cols / 2, raw.rows / 2), 0, 0, INTER_AREA);
+	double scale = (double)raw.cols / m_Half.cols;
+	m_Small = m_Half;
+	while (m_Small.cols > LIVE_WIDTH) {
+		Mat next;
+		pyrDown(m_Small, next);
+		m_Small = next;
+		scale *= 2;
+	}
+
+	vector<Point2f> corners;
+	const bool found = findChessboardCorners(m_Small, m_Pattern, corners, CALIB_CB_ADAPTIVE_THRESH | CALIB_CB_NORMALIZE_IMAGE | CALIB_CB_FAST_CHECK);
+	bool accepted = false;
+	if (found) {
+		double motion = 1e9;
+		if (m_Last.size() == corners.size()) {
+			motion = 0;
+			for (size_t i = 0; i < corners.size(); i++)
+				motion += distance(corners[i], m_Last[i]);
+			motion /= corners.size();
+		}
+		m_Stable = motion < STILL_PX ? m_Stable + 1 : 0;
+		m_Last = corners;
+
+		candidate c;
+		c.frameID = frameID;
+		c.raw = raw.clone();
+		c.corners = corners;
+		m_Ring.push_back(c);
+		if (m_Ring.size() > RING)
+			m_Ring.pop_front();
+
+		// a still board in a new pose, at most one capture per board position
+		const pose p = describe(corners, m_Small.size());
+		if (m_Stable >= STABLE_FRAMES && novelty(p) >= MIN_NOVELTY) {
+			m_Views.push_back(p);
+			accepted = capture(m_Ring.back(), scale);
+			if (accepted && NULL != m_Rig)
+				m_Rig->request(frameID);
+			m_Stable = 0;
+		}
+	}
+	else {
+		m_Stable = 0;
+		m_Last.clear();
+	}
+	// the same trigger of another camera of the rig
+	if (NULL != m_Rig) {
+		for (size_t i = 0; i < m_Ring.size(); i++) {
+			if (m_Ring[i].frameID > m_LastCaptured && m_Rig->requested(m_Ring[i].frameID)) {
+				m_Views.push_back(describe(m_Ring[i].corners, m_Small.size()));
+				accepted = capture(m_Ring[i], scale) || accepted;
+			}
+		}
+	}
+
+	cvtColor(m_Small, preview, COLOR_GRAY2BGR);
+	drawChessboardCorners(preview, m_Pattern, corners, found);
+	ostringstream status;
+	status << views() << " views, " << (int)(coverage() * 100) << "% covered" << (accepted ? ", captured" : "");
+	putText(preview, status.str(), Point(10, 20), FONT_HERSHEY_SIMPLEX, 0.5, accepted ? Scalar(0, 0, 255) : Scalar(0, 255, 0), 1);
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "chessboard_cache.h"
+
+// Frame IDs a camera of the rig captured, the other cameras capture the
+// same trigger, so every view is a synchronized set for the rig calibration.
+class RigCapture {
+public:
+	enum { KEEP = 64 };
+	void request(uint64_t frameID);
+	bool requested(uint64_t frameID);
+
+private:
+	std::mutex m_Lock;
+	std::deque<uint64_t> m_Requested;   // the last KEEP requests
+};
+
+// Live calibration capture of one camera, run on every frame of its observer.
+//
+// The chessboard is searched on a small pyramid level: the 2x2 Bayer cells
+// are averaged into a half size gray image (no demosaic) and halved again
+// until it is at most LIVE_WIDTH wide, which keeps the detection at preview
+// rate. A view is accepted when the board held still for STABLE_FRAMES
+// frames and its pose differs enough from all accepted views (position,
+// size and tilt of the board). Only then the frame is converted at full
+// resolution and the corners are refined there with cornerSubPix.
+//
+// Accepted views are saved as <folder><n>.png like the manual captures,
+// their refined corners go into the corner cache of the calibration
+// (corners.bin) and views.txt lists "<n> <frame ID>" for the rig tool.
+class LiveCalibrator {
+public:
+	enum { LIVE_WIDTH = 640, STABLE_FRAMES = 3, RING = 4, GRID = 4 };
+
+	// grayCode converts the raw frames to gray, e.g. CV_BayerBG2GRAY
+	LiveCalibrator(const std::string &folder, cv::Size pattern, int grayCode, RigCapture *rig = NULL);
+
+	// a raw frame in, the small view with the detection and the capture state out
+	void process(const cv::Mat &raw, uint64_t frameID, cv::Mat &preview);
+	int views() const { return (int)m_Views.size(); }
+	// share of the GRID x GRID image cells the captured corners reached
+	double coverage() const;
+
+private:
+	struct pose {
+		double v[5];                    // center x, y, size, horizontal and vertical tilt
+	};
+	struct candidate {
+		uint64_t frameID;
+		cv::Mat raw;
+		std::vector<cv::Point2f> corners;
+	};
+
+	pose describe(const std::vector<cv::Point2f> &corners, cv::Size image) const;
+	double novelty(const pose &p) const;
+	bool capture(const candidate &c, double scale);
+
+	std::string m_Folder;
+	cv::Size m_Pattern;
+	int m_GrayCode;
+	RigCapture *m_Rig;
+	CornerCache m_Cache;
+	int m_Next;                         // number of the next image file
+	std::vector<pose> m_Views;
+	std::vector<bool> m_Covered;
+	std::vector<cv::Point2f> m_Last;    // corners of the previous frame, small level
+	int m_Stable;
+	std::deque<candidate> m_Ring;       // frames with a board, for the requests of the other cameras
+	uint64_t m_LastCaptured;
+	cv::Mat m_Half, m_Small;
+};
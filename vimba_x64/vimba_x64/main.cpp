@@ -6,6 +6,10 @@
 #include "VimbaC.h"
 #include "VimbaCPP.h"
 #include "utils.h"
+#include "white_balance.h"
+#include "chessboard_cache.h"
+#include "live_calibration.h"
+#include "rig_calibration.h"
 
 #include <cstring>
 #include <opencv2/core/core.hpp>
@@ -14,6 +18,7 @@
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/videoio.hpp>
 #include <cstdio>
+#include <fstream>
 
 using namespace std;
 using namespace AVT::VmbAPI;
@@ -55,6 +60,11 @@ void test_opencv() {
 	return;
 }
 
+// 'c' in main1 switches the observers to the live calibration capture
+bool liveCalibration = false;
+// views captured by one camera are captured by all of them
+RigCapture rigCapture;
+
 // 1.define observer that reacts on new frames
 class FrameObserver : public IFrameObserver
 {
@@ -63,8 +73,13 @@ public:
 	// and pass a camera objectt
 	string name;
 	Mat cvMat;
+	Mat colorMat;
+	Mat calibMat;
+	BayerWhiteBalance whiteBalance;
+	LiveCalibrator calibrator;
 	CameraPtr pCamera;
-	FrameObserver(CameraPtr pCamera, string s) : IFrameObserver(pCamera)
+	FrameObserver(CameraPtr pCamera, string s) : IFrameObserver(pCamera), whiteBalance(CV_BayerBG2BGR),
+		calibrator("calib\\" + s + "\\", Size(PAT_COLS, PAT_ROWS), CV_BayerBG2GRAY, &rigCapture)
 	{
 		// Put your initialization code here
 		cout << "Init FrameObserver" << endl;
@@ -95,9 +110,18 @@ public:
 				if (VmbErrorSuccess != pFrame->GetImage(pImage))
 					cout << "FAILED to acquire image data of frame!" << endl;
 				cvMat = Mat(nHeight, nWidth, CV_8UC1, pImage);
-				//cvtColor(cvMat, cvMat, CV_BayerBG2BGR);
-
-				imshow("Our Great Window" + name, cvMat);
+				if (liveCalibration) {
+					// the frame ID is the same for a trigger on every camera
+					VmbUint64_t frameID = 0;
+					pFrame->GetFrameID(frameID);
+					calibrator.process(cvMat, frameID, calibMat);
+					imshow("Our Great Window" + name, calibMat);
+				}
+				else {
+					// gains on the mosaic from a cached estimate, the raw frame stays as it is for the calibration images
+					whiteBalance.demosaic(cvMat, colorMat);
+					imshow("Our Great Window" + name, colorMat);
+				}
 				//imwrite("C:\\Users\\NOL\\Desktop\\" + name + ".png", cvMat);
 				waitKey(1);
 			}
@@ -235,6 +259,12 @@ int main1() {
 			key = 0;
 			count++;
 		}
+		if (key == 'c') // live calibration capture on/off
+		{
+			liveCalibration = !liveCalibration;
+			cout << "live calibration " << (liveCalibration ? "on" : "off") << endl;
+			key = 0;
+		}
 		// Set Action Command to Vimba API
 		sys.GetFeatureByName("ActionDeviceKey", pFeature);
 		pFeature->SetValue(deviceKey);
@@ -272,6 +302,55 @@ int main1() {
 	return 0;
 }
 
+// Joint calibration of all cameras calib\0\, calib\1\, ... into calib\rig.xml
+int main2()
+{
+	vector<string> folders;
+	for (int c = 0; ifstream(("calib\\" + to_string(c) + "\\0.png").c_str()).good(); c++)
+		folders.push_back("calib\\" + to_string(c) + "\\");
+	cv::Size size(PAT_COLS, PAT_ROWS);
+	vector<RigObservation> observations;
+	vector<cv::Size> imageSizes;
+	int64 start = getTickCount();
+	const int views = loadRigObservations(folders, size, CV_BayerBG2GRAY, observations, imageSizes);
+	cout << folders.size() << " cameras, " << views << " views, " << observations.size() << " chessboards in "
+		<< (getTickCount() - start) / getTickFrequency() << " s" << endl;
+
+	start = getTickCount();
+	vector<RigCamera> cameras;
+	const double rms = calibrateRig(observations, imageSizes, size, (float)CHESS_SIZE, cameras);
+	if (rms < 0) {
+		cout << "Rig calibration failed" << endl;
+		return -1;
+	}
+	cout << "rms " << rms << " in " << (getTickCount() - start) / getTickFrequency() << " s" << endl;
+
+	FileStorage fs("calib\\rig.xml", FileStorage::WRITE);
+	fs << "cameras" << (int)cameras.size();
+	fs << "rms" << rms;
+	for (size_t c = 0; c < cameras.size(); c++) {
+		if (0 == cameras[c].views) {
+			cout << "camera " << c << " shares no view with camera 0" << endl;
+			continue;
+		}
+		cout << "camera " << c << ": " << cameras[c].views << " views, rms " << cameras[c].rms << endl;
+		cout << Mat(cameras[c].cameraMatrix) << endl << cameras[c].distCoeffs << endl;
+		cout << Mat(cameras[c].rvec).t() << " " << Mat(cameras[c].tvec).t() << endl;
+		Mat R;
+		Rodrigues(cameras[c].rvec, R);
+		fs << "camera" + to_string(c) << "{";
+		fs << "image_size" << cameras[c].imageSize;
+		fs << "intrinsic" << Mat(cameras[c].cameraMatrix);
+		fs << "distortion" << cameras[c].distCoeffs;
+		fs << "R" << R;
+		fs << "T" << Mat(cameras[c].tvec);
+		fs << "rms" << cameras[c].rms;
+		fs << "}";
+	}
+	fs.release();
+	return 0;
+}
+
 int main()
 {
     Mat frame;
@@ -283,78 +362,54 @@ int main()
     
     // File found
     if (fs.isOpened()) {
-        // Image buffer
-        vector<Mat> images;
-        int count = 0;
-        
-        // Calibration loop
-        while (1) {
-            // Get an image
-			frame = imread(filepath + to_string(count) + ".png", -1);
-            if(frame.empty())
-                break;
-			cv::cvtColor(frame, frame, CV_BayerBG2BGR);
-            
-            // Convert to grayscale
-            cv::Mat gray;
-            cv::cvtColor(frame, gray, CV_BGR2GRAY);
-            
-            // Detect a chessboard
-            cv::Size size(PAT_COLS, PAT_ROWS);
-            std::vector<cv::Point2f> corners;
-            bool found = cv::findChessboardCorners(gray, size, corners, cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_NORMALIZE_IMAGE | cv::CALIB_CB_FAST_CHECK);
-            
-            // Chessboard detected
-            if (found) {
-                // Draw it
-                cv::drawChessboardCorners(frame, size, corners, found);
-
-				// Show the image
-				//std::ostringstream stream;
-				//stream << "Captured " << images.size() << " image(s).";
-				//cv::putText(frame, stream.str(), cv::Point(10, 20), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(0, 255, 0), 1, 1);
-				//cv::imshow("Camera Calibration", frame);
-				//waitKey(0);
-				images.push_back(gray);
+        // Images until the first missing number
+        vector<string> paths;
+        for (int count = 0; ifstream((filepath + to_string(count) + ".png").c_str()).good(); count++)
+            paths.push_back(filepath + to_string(count) + ".png");
+
+        // Detect on all cores, corners of images seen before come from the cache
+        cv::Size size(PAT_COLS, PAT_ROWS);
+        CornerCache cache(size);
+        const string cachefile = filepath + "corners.bin";
+        cache.load(cachefile);
+        const int64 start = getTickCount();
+        vector<ChessboardResult> results = detectChessboards(paths, size, CV_BayerBG2GRAY, cache);
+        if (cache.dirty() && !cache.save(cachefile))
+            cout << "could not write " << cachefile << endl;
+        int cached = 0;
+        std::vector< std::vector<cv::Point2f> > corners2D;
+        cv::Size imageSize;
+        for (size_t i = 0; i < results.size(); i++) {
+            cached += results[i].cached ? 1 : 0;
+            if (results[i].found) {
+                corners2D.push_back(results[i].corners);
+                imageSize = results[i].imageSize;
             }
-			count++;
         }
-		destroyAllWindows();
+        cout << paths.size() << " images, " << cached << " from the cache, " << corners2D.size() << " chessboards in "
+            << (getTickCount() - start) / getTickFrequency() << " s" << endl;
 		cout << "Start calibration" << endl;
         
         // We have enough samples
-        if (images.size() > 4) {
-            cv::Size size(PAT_COLS, PAT_ROWS);
-            std::vector< std::vector<cv::Point2f> > corners2D;
+        if (corners2D.size() > 4) {
             std::vector< std::vector<cv::Point3f> > corners3D;
             
-            for (size_t i = 0; i < images.size(); i++) {
-                // Detect a chessboard
-                std::vector<cv::Point2f> tmp_corners2D;
-                bool found = cv::findChessboardCorners(images[i], size, tmp_corners2D);
-                
-                // Chessboard detected
-                if (found) {
-                    // Convert the corners to sub-pixel
-                    cv::cornerSubPix(images[i], tmp_corners2D, cvSize(11, 11), cvSize(-1, -1), cv::TermCriteria(cv::TermCriteria::EPS | cv::TermCriteria::COUNT, 30, 0.1));
-                    corners2D.push_back(tmp_corners2D);
-                    
-                    // Set the 3D position of patterns
-                    const float squareSize = CHESS_SIZE;
-                    std::vector<cv::Point3f> tmp_corners3D;
-                    for (int j = 0; j < size.height; j++) {
-                        for (int k = 0; k < size.width; k++) {
-                            tmp_corners3D.push_back(cv::Point3f((float)(k*squareSize), (float)(j*squareSize), 0.0));
-                        }
+            for (size_t i = 0; i < corners2D.size(); i++) {
+                // Set the 3D position of patterns
+                const float squareSize = CHESS_SIZE;
+                std::vector<cv::Point3f> tmp_corners3D;
+                for (int j = 0; j < size.height; j++) {
+                    for (int k = 0; k < size.width; k++) {
+                        tmp_corners3D.push_back(cv::Point3f((float)(k*squareSize), (float)(j*squareSize), 0.0));
                     }
-                    corners3D.push_back(tmp_corners3D);
                 }
+                corners3D.push_back(tmp_corners3D);
             }
             
             // Estimate camera parameters
             cv::Mat cameraMatrix, distCoeffs;
             std::vector<cv::Mat> rvec, tvec;
-            cv::calibrateCamera(corners3D, corners2D, images[0].size(), cameraMatrix, distCoeffs, rvec, tvec);
+            cv::calibrateCamera(corners3D, corners2D, imageSize, cameraMatrix, distCoeffs, rvec, tvec);
             std::cout << cameraMatrix << std::endl;
             std::cout << distCoeffs << std::endl;
             
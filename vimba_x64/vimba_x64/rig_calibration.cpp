@@ -0,0 +1,526 @@
+#include "rig_calibration.h"
+#include "chessboard_cache.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <thread>
+
+using namespace std;
+using namespace cv;
+
+namespace {
+	// parameters of a camera: fx fy cx cy k1 k2 p1 p2 k3, rvec, tvec
+	enum { NCAM = 15, NINTR = 9, NVIEW = 6 };
+	typedef Vec<double, NCAM> camParams;
+	typedef Vec<double, NVIEW> viewParams;
+
+	const int MAX_ITERATIONS = 50;
+	// views of a camera for its initial cv::calibrateCamera
+	const int INIT_VIEWS = 30;
+
+	// runs job(i) for every i < n on all threads, every worker takes the next index
+	template <class F> void parallel(size_t n, unsigned threads, F job) {
+		threads = min<unsigned>(threads, static_cast<unsigned>(max<size_t>(1, n)));
+		atomic<size_t> next(0);
+		vector<thread> workers;
+		for (unsigned t = 0; t < threads; t++) {
+			workers.push_back(thread([&]() {
+				for (size_t i = next++; i < n; i = next++)
+					job(i);
+			}));
+		}
+		for (size_t t = 0; t < workers.size(); t++)
+			workers[t].join();
+	}
+
+	// rigid transform x' = R * x + t
+	struct pose {
+		Matx33d R;
+		Vec3d t;
+	};
+
+	pose toPose(const Vec3d &r, const Vec3d &t) {
+		pose p;
+		Rodrigues(r, p.R);
+		p.t = t;
+		return p;
+	}
+
+	// a after b
+	pose compose(const pose &a, const pose &b) {
+		pose p;
+		p.R = a.R * b.R;
+		p.t = a.R * b.t + a.t;
+		return p;
+	}
+
+	pose inverse(const pose &a) {
+		pose p;
+		p.R = a.R.t();
+		p.t = -(p.R * a.t);
+		return p;
+	}
+
+	// one camera in one view: its residuals and their share of the normal equations
+	struct edge {
+		int camera, view;
+		const vector<Point2f> *corners;
+		Matx<double, NCAM, NCAM> A;
+		Matx<double, NCAM, NVIEW> W;
+		Matx<double, NVIEW, NVIEW> B;
+		camParams gc;
+		viewParams gv;
+		double cost;
+	};
+
+	void intrinsics(const camParams &p, Matx33d &K, Mat &dist) {
+		K = Matx33d(p[0], 0, p[2], 0, p[1], p[3], 0, 0, 1);
+		dist.create(1, 5, CV_64F);
+		for (int k = 0; k < 5; k++)
+			dist.at<double>(k) = p[4 + k];
+	}
+
+	// residuals of an edge and, with jacobian, its blocks of J^T J and J^T e
+	void linearize(edge &l, const camParams &c, const viewParams &b, const vector<Point3d> &board, bool fixed, bool jacobian) {
+		// board into camera 0 (1), camera 0 into this camera (2)
+		const Vec3d r1(b[0], b[1], b[2]), t1(b[3], b[4], b[5]), r2(c[9], c[10], c[11]), t2(c[12], c[13], c[14]);
+		Mat r3, t3, dr3dr1, dr3dt1, dr3dr2, dr3dt2, dt3dr1, dt3dt1, dt3dr2, dt3dt2;
+		composeRT(r1, t1, r2, t2, r3, t3, dr3dr1, dr3dt1, dr3dr2, dr3dt2, dt3dr1, dt3dt1, dt3dr2, dt3dt2);
+		Matx33d K;
+		Mat dist, J;
+		intrinsics(c, K, dist);
+		vector<Point2d> projected;
+		if (jacobian)
+			projectPoints(board, r3, t3, K, dist, projected, J);
+		else
+			projectPoints(board, r3, t3, K, dist, projected);
+
+		const vector<Point2f> &corners = *l.corners;
+		l.cost = 0;
+		if (jacobian) {
+			l.A = Matx<double, NCAM, NCAM>();
+			l.W = Matx<double, NCAM, NVIEW>();
+			l.B = Matx<double, NVIEW, NVIEW>();
+			l.gc = camParams();
+			l.gv = viewParams();
+		}
+		// projectPoints columns: rvec, tvec, f, c, distortion; the chain rule through composeRT gives the pose blocks
+		const Matx33d Dr3r1 = dr3dr1, Dr3t1 = dr3dt1, Dr3r2 = dr3dr2, Dr3t2 = dr3dt2;
+		const Matx33d Dt3r1 = dt3dr1, Dt3t1 = dt3dt1, Dt3r2 = dt3dr2, Dt3t2 = dt3dt2;
+		for (size_t i = 0; i < corners.size(); i++) {
+			for (int axis = 0; axis < 2; axis++) {
+				const double e = 0 == axis ? corners[i].x - projected[i].x : corners[i].y - projected[i].y;
+				l.cost += e * e;
+				if (!jacobian)
+					continue;
+				const double *j = J.ptr<double>((int)(2 * i + axis));
+				double jc[NCAM], jv[NVIEW];
+				for (int q = 0; q < NINTR; q++)
+					jc[q] = j[6 + q];
+				for (int q = 0; q < 3; q++) {
+					jv[q] = 0;
+					jv[3 + q] = 0;
+					jc[NINTR + q] = 0;
+					jc[NINTR + 3 + q] = 0;
+					for (int k = 0; k < 3; k++) {
+						jv[q] += j[k] * Dr3r1(k, q) + j[3 + k] * Dt3r1(k, q);
+						jv[3 + q] += j[k] * Dr3t1(k, q) + j[3 + k] * Dt3t1(k, q);
+						jc[NINTR + q] += j[k] * Dr3r2(k, q) + j[3 + k] * Dt3r2(k, q);
+						jc[NINTR + 3 + q] += j[k] * Dr3t2(k, q) + j[3 + k] * Dt3t2(k, q);
+					}
+				}
+				// camera 0 defines the rig frame
+				if (fixed)
+					for (int q = NINTR; q < NCAM; q++)
+						jc[q] = 0;
+				for (int r = 0; r < NCAM; r++) {
+					for (int s = r; s < NCAM; s++)
+						l.A(r, s) += jc[r] * jc[s];
+					for (int s = 0; s < NVIEW; s++)
+						l.W(r, s) += jc[r] * jv[s];
+					l.gc[r] += jc[r] * e;
+				}
+				for (int r = 0; r < NVIEW; r++) {
+					for (int s = r; s < NVIEW; s++)
+						l.B(r, s) += jv[r] * jv[s];
+					l.gv[r] += jv[r] * e;
+				}
+			}
+		}
+		if (jacobian) {
+			for (int r = 0; r < NCAM; r++)
+				for (int s = 0; s < r; s++)
+					l.A(r, s) = l.A(s, r);
+			for (int r = 0; r < NVIEW; r++)
+				for (int s = 0; s < r; s++)
+					l.B(r, s) = l.B(s, r);
+		}
+	}
+}
+
+int loadRigObservations(const vector<string> &folders, Size pattern, int bayerCode,
+	vector<RigObservation> &observations, vector<Size> &imageSizes) {
+	observations.clear();
+	imageSizes.assign(folders.size(), Size());
+	// (1, frame ID) for the live captures, (0, image number) for the manual ones
+	map<pair<int, uint64_t>, int> viewOf;
+	for (size_t c = 0; c < folders.size(); c++) {
+		vector<string> paths;
+		for (int count = 0; ifstream((folders[c] + to_string(count) + ".png").c_str()).good(); count++)
+			paths.push_back(folders[c] + to_string(count) + ".png");
+		map<int, uint64_t> frames;
+		ifstream list((folders[c] + "views.txt").c_str());
+		int number;
+		uint64_t frameID;
+		while (list >> number >> frameID)
+			frames[number] = frameID;
+
+		CornerCache cache(pattern);
+		const string cachefile = folders[c] + "corners.bin";
+		cache.load(cachefile);
+		const vector<ChessboardResult> results = detectChessboards(paths, pattern, bayerCode, cache);
+		if (cache.dirty())
+			cache.save(cachefile);
+		for (size_t i = 0; i < results.size(); i++) {
+			if (!results[i].found)
+				continue;
+			imageSizes[c] = results[i].imageSize;
+			map<int, uint64_t>::const_iterator f = frames.find((int)i);
+			const pair<int, uint64_t> key = f != frames.end() ? make_pair(1, f->second) : make_pair(0, (uint64_t)i);
+			map<pair<int, uint64_t>, int>::const_iterator v = viewOf.find(key);
+			if (v == viewOf.end())
+				v = viewOf.insert(make_pair(key, (int)viewOf.size())).first;
+			RigObservation o;
+			o.camera = (int)c;
+			o.view = v->second;
+			o.corners = results[i].corners;
+			observations.push_back(o);
+		}
+	}
+	return (int)viewOf.size();
+}
+
+double calibrateRig(const vector<RigObservation> &observations, const vector<Size> &imageSizes,
+	Size pattern, float squareSize, vector<RigCamera> &cameras, unsigned threads) {
+	if (0 == threads)
+		threads = max(1u, thread::hardware_concurrency());
+	const int ncameras = (int)imageSizes.size();
+	int nviews = 0;
+	for (size_t i = 0; i < observations.size(); i++)
+		nviews = max(nviews, observations[i].view + 1);
+	vector<Point3f> board3f;
+	for (int j = 0; j < pattern.height; j++)
+		for (int k = 0; k < pattern.width; k++)
+			board3f.push_back(Point3f(k * squareSize, j * squareSize, 0));
+	const vector<Point3d> board(board3f.begin(), board3f.end());
+
+	cameras.assign(ncameras, RigCamera());
+	vector<camParams> cam(ncameras);
+	vector<vector<int> > ofCamera(ncameras), ofView(nviews);
+	for (size_t i = 0; i < observations.size(); i++) {
+		if ((int)observations[i].corners.size() != pattern.area())
+			continue;
+		ofCamera[observations[i].camera].push_back((int)i);
+		ofView[observations[i].view].push_back((int)i);
+	}
+
+	// intrinsics of every camera from a spread subset of its views
+	vector<bool> usable(ncameras, false);
+	for (int c = 0; c < ncameras; c++) {
+		cameras[c].imageSize = imageSizes[c];
+		cameras[c].views = 0;
+		cameras[c].rms = 0;
+		const vector<int> &own = ofCamera[c];
+		if (own.size() < 3)
+			continue;
+		vector<vector<Point3f> > objectPoints;
+		vector<vector<Point2f> > imagePoints;
+		const size_t step = max<size_t>(1, own.size() / INIT_VIEWS);
+		for (size_t i = 0; i < own.size(); i += step) {
+			objectPoints.push_back(board3f);
+			imagePoints.push_back(observations[own[i]].corners);
+		}
+		Mat K, dist;
+		try {
+			calibrateCamera(objectPoints, imagePoints, imageSizes[c], K, dist, noArray(), noArray());
+		}
+		catch (const cv::Exception &) {
+			continue;
+		}
+		cam[c] = camParams();
+		cam[c][0] = K.at<double>(0, 0);
+		cam[c][1] = K.at<double>(1, 1);
+		cam[c][2] = K.at<double>(0, 2);
+		cam[c][3] = K.at<double>(1, 2);
+		for (int k = 0; k < 5 && k < (int)dist.total(); k++)
+			cam[c][4 + k] = dist.at<double>(k);
+		usable[c] = true;
+	}
+	if (0 == ncameras || !usable[0])
+		return -1;
+
+	// board pose in its camera for every observation
+	vector<pose> seen(observations.size());
+	parallel(observations.size(), threads, [&](size_t i) {
+		const RigObservation &o = observations[i];
+		if (!usable[o.camera] || (int)o.corners.size() != pattern.area())
+			return;
+		Matx33d K;
+		Mat dist;
+		intrinsics(cam[o.camera], K, dist);
+		Vec3d r, t;
+		solvePnP(board3f, o.corners, K, dist, r, t);
+		seen[i] = toPose(r, t);
+	});
+
+	// extrinsics along the camera pairs that share the most views, starting at camera 0
+	vector<pose> rig(ncameras);
+	vector<bool> reached(ncameras, false);
+	rig[0] = toPose(Vec3d(0, 0, 0), Vec3d(0, 0, 0));
+	reached[0] = true;
+	for (;;) {
+		int best = -1;
+		size_t bestShared = 0;
+		for (int c = 0; c < ncameras; c++) {
+			if (reached[c] || !usable[c])
+				continue;
+			size_t shared = 0;
+			for (size_t i = 0; i < ofCamera[c].size(); i++) {
+				const vector<int> &others = ofView[observations[ofCamera[c][i]].view];
+				for (size_t k = 0; k < others.size(); k++) {
+					if (reached[observations[others[k]].camera]) {
+						shared++;
+						break;
+					}
+				}
+			}
+			if (shared > bestShared) {
+				best = c;
+				bestShared = shared;
+			}
+		}
+		if (best < 0)
+			break;
+		// one estimate per shared view: the mean rotation back onto SO(3), the median translation
+		Matx33d sumR = Matx33d::zeros();
+		vector<double> tx, ty, tz;
+		for (size_t i = 0; i < ofCamera[best].size(); i++) {
+			const int own = ofCamera[best][i];
+			const vector<int> &others = ofView[observations[own].view];
+			for (size_t k = 0; k < others.size(); k++) {
+				const int p = observations[others[k]].camera;
+				if (!reached[p])
+					continue;
+				const pose estimate = compose(seen[own], compose(inverse(seen[others[k]]), rig[p]));
+				sumR += estimate.R;
+				tx.push_back(estimate.t[0]);
+				ty.push_back(estimate.t[1]);
+				tz.push_back(estimate.t[2]);
+				break;
+			}
+		}
+		SVD svd(Mat(sumR), SVD::FULL_UV);
+		Mat R = svd.u * svd.vt;
+		if (determinant(R) < 0)
+			R = -R;
+		const size_t mid = tx.size() / 2;
+		nth_element(tx.begin(), tx.begin() + mid, tx.end());
+		nth_element(ty.begin(), ty.begin() + mid, ty.end());
+		nth_element(tz.begin(), tz.begin() + mid, tz.end());
+		rig[best].R = Matx33d(R);
+		rig[best].t = Vec3d(tx[mid], ty[mid], tz[mid]);
+		reached[best] = true;
+	}
+	for (int c = 0; c < ncameras; c++) {
+		if (!reached[c])
+			continue;
+		Vec3d r;
+		Rodrigues(rig[c].R, r);
+		for (int k = 0; k < 3; k++) {
+			cam[c][NINTR + k] = r[k];
+			cam[c][NINTR + 3 + k] = rig[c].t[k];
+		}
+	}
+
+	// the observations of reached cameras, views renumbered to those that have one
+	vector<edge> links;
+	vector<int> viewIndex(nviews, -1);
+	vector<viewParams> views;
+	for (int v = 0; v < nviews; v++) {
+		for (size_t k = 0; k < ofView[v].size(); k++) {
+			const int i = ofView[v][k];
+			const int c = observations[i].camera;
+			if (!reached[c])
+				continue;
+			if (viewIndex[v] < 0) {
+				// board pose in the rig from the first camera that saw it
+				const pose b = compose(inverse(rig[c]), seen[i]);
+				Vec3d r;
+				Rodrigues(b.R, r);
+				viewParams p;
+				for (int q = 0; q < 3; q++) {
+					p[q] = r[q];
+					p[3 + q] = b.t[q];
+				}
+				viewIndex[v] = (int)views.size();
+				views.push_back(p);
+			}
+			edge l;
+			l.camera = c;
+			l.view = viewIndex[v];
+			l.corners = &observations[i].corners;
+			links.push_back(l);
+		}
+	}
+	const int nv = (int)views.size();
+	vector<vector<int> > linksOfCamera(ncameras), linksOfView(nv);
+	for (size_t i = 0; i < links.size(); i++) {
+		linksOfCamera[links[i].camera].push_back((int)i);
+		linksOfView[links[i].view].push_back((int)i);
+	}
+
+	// Levenberg-Marquardt on the Schur complement of the board poses
+	const int n = NCAM * ncameras;
+	vector<Matx<double, NVIEW, NVIEW> > Binv(nv);
+	vector<viewParams> gv(nv);
+	vector<camParams> trialCam(ncameras);
+	vector<viewParams> trialViews(nv);
+	double lambda = 1e-3;
+	double cost = 0;
+	bool linearized = false;
+	for (int iteration = 0; iteration < MAX_ITERATIONS; iteration++) {
+		if (!linearized) {
+			parallel(links.size(), threads, [&](size_t i) {
+				linearize(links[i], cam[links[i].camera], views[links[i].view], board, 0 == links[i].camera, true);
+			});
+			cost = 0;
+			for (size_t i = 0; i < links.size(); i++)
+				cost += links[i].cost;
+			linearized = true;
+		}
+
+		parallel(nv, threads, [&](size_t v) {
+			Matx<double, NVIEW, NVIEW> B;
+			gv[v] = viewParams();
+			for (size_t k = 0; k < linksOfView[v].size(); k++) {
+				B += links[linksOfView[v][k]].B;
+				gv[v] += links[linksOfView[v][k]].gv;
+			}
+			for (int q = 0; q < NVIEW; q++)
+				B(q, q) += lambda * B(q, q) + 1e-12;
+			Binv[v] = B.inv(DECOMP_CHOLESKY);
+		});
+
+		// S = A - W B^-1 W^T, each thread owns the rows of its camera
+		Mat S(n, n, CV_64F, Scalar(0)), rhs(n, 1, CV_64F, Scalar(0));
+		parallel(ncameras, threads, [&](size_t c1) {
+			const vector<int> &own = linksOfCamera[c1];
+			Matx<double, NCAM, NCAM> A;
+			camParams g;
+			for (size_t k = 0; k < own.size(); k++) {
+				A += links[own[k]].A;
+				g += links[own[k]].gc;
+			}
+			for (int q = 0; q < NCAM; q++)
+				A(q, q) += lambda * A(q, q) + 1e-12;
+			// fixed or unused parameters solve to 0
+			for (int q = 0; q < NCAM; q++)
+				if (own.empty() || (0 == c1 && q >= NINTR))
+					A(q, q) = 1;
+			for (int r = 0; r < NCAM; r++) {
+				double *row = S.ptr<double>((int)c1 * NCAM + r);
+				for (int s = 0; s < NCAM; s++)
+					row[c1 * NCAM + s] += A(r, s);
+				rhs.at<double>((int)c1 * NCAM + r) += g[r];
+			}
+			for (size_t k = 0; k < own.size(); k++) {
+				const edge &l1 = links[own[k]];
+				const Matx<double, NCAM, NVIEW> WB = l1.W * Binv[l1.view];
+				const camParams reduced = WB * gv[l1.view];
+				for (int r = 0; r < NCAM; r++)
+					rhs.at<double>((int)c1 * NCAM + r) -= reduced[r];
+				const vector<int> &shared = linksOfView[l1.view];
+				for (size_t m = 0; m < shared.size(); m++) {
+					const edge &l2 = links[shared[m]];
+					const Matx<double, NCAM, NCAM> block = WB * l2.W.t();
+					for (int r = 0; r < NCAM; r++) {
+						double *row = S.ptr<double>((int)c1 * NCAM + r);
+						for (int s = 0; s < NCAM; s++)
+							row[l2.camera * NCAM + s] -= block(r, s);
+					}
+				}
+			}
+		});
+
+		Mat dc;
+		if (!solve(S, rhs, dc, DECOMP_CHOLESKY)) {
+			lambda *= 10;
+			continue;
+		}
+		for (int c = 0; c < ncameras; c++)
+			for (int q = 0; q < NCAM; q++)
+				trialCam[c][q] = cam[c][q] + dc.at<double>(c * NCAM + q);
+		// back substitution of the board poses
+		parallel(nv, threads, [&](size_t v) {
+			viewParams g = gv[v];
+			for (size_t k = 0; k < linksOfView[v].size(); k++) {
+				const edge &l = links[linksOfView[v][k]];
+				camParams d;
+				for (int q = 0; q < NCAM; q++)
+					d[q] = dc.at<double>(l.camera * NCAM + q);
+				g -= l.W.t() * d;
+			}
+			trialViews[v] = views[v] + Binv[v] * g;
+		});
+
+		vector<double> trialCost(links.size());
+		parallel(links.size(), threads, [&](size_t i) {
+			edge l = links[i];
+			linearize(l, trialCam[l.camera], trialViews[l.view], board, 0 == l.camera, false);
+			trialCost[i] = l.cost;
+		});
+		double newCost = 0;
+		for (size_t i = 0; i < links.size(); i++)
+			newCost += trialCost[i];
+		if (newCost < cost) {
+			const bool converged = cost - newCost < 1e-10 * cost;
+			cam = trialCam;
+			views = trialViews;
+			lambda = max(1e-12, lambda / 10);
+			linearized = false;
+			if (converged)
+				break;
+		}
+		else {
+			lambda *= 10;
+			if (lambda > 1e12)
+				break;
+		}
+	}
+
+	// final residuals per camera
+	parallel(links.size(), threads, [&](size_t i) {
+		linearize(links[i], cam[links[i].camera], views[links[i].view], board, 0 == links[i].camera, false);
+	});
+	double total = 0;
+	size_t points = 0;
+	for (int c = 0; c < ncameras; c++) {
+		if (!reached[c])
+			continue;
+		double own = 0;
+		for (size_t k = 0; k < linksOfCamera[c].size(); k++)
+			own += links[linksOfCamera[c][k]].cost;
+		const size_t ownPoints = linksOfCamera[c].size() * board.size();
+		RigCamera &out = cameras[c];
+		intrinsics(cam[c], out.cameraMatrix, out.distCoeffs);
+		out.rvec = Vec3d(cam[c][NINTR], cam[c][NINTR + 1], cam[c][NINTR + 2]);
+		out.tvec = Vec3d(cam[c][NINTR + 3], cam[c][NINTR + 4], cam[c][NINTR + 5]);
+		out.views = (int)linksOfCamera[c].size();
+		out.rms = ownPoints > 0 ? sqrt(own / ownPoints) : 0;
+		total += own;
+		points += ownPoints;
+	}
+	return points > 0 ? sqrt(total / points) : -1;
+}
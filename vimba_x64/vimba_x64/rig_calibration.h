@@ -0,0 +1,47 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Chessboard corners one camera saw in one synchronized view of the rig
+struct RigObservation {
+	int camera;
+	int view;
+	std::vector<cv::Point2f> corners;
+};
+
+// Calibration of one camera of the rig. The extrinsics map camera 0 into
+// this camera, x = R * x0 + T like cv::stereoCalibrate, camera 0 is the
+// identity.
+struct RigCamera {
+	cv::Size imageSize;
+	cv::Matx33d cameraMatrix;
+	cv::Mat distCoeffs;         // k1 k2 p1 p2 k3
+	cv::Vec3d rvec, tvec;
+	int views;                  // 0 when no view connects the camera to camera 0
+	double rms;
+};
+
+// Reads the images of every camera folder (<folder><n>.png) through the
+// corner cache and matches them into views. Images listed in views.txt of
+// the live capture are matched by frame ID, the others by their number like
+// the manual captures. Returns the number of views.
+int loadRigObservations(const std::vector<std::string> &folders, cv::Size pattern, int bayerCode,
+	std::vector<RigObservation> &observations, std::vector<cv::Size> &imageSizes);
+
+// Joint calibration of the intrinsics and extrinsics of all cameras.
+//
+// Every camera starts from cv::calibrateCamera on a spread subset of its
+// views, the board poses from solvePnP and the extrinsics from the views
+// the cameras share. Levenberg-Marquardt then refines all cameras and board
+// poses together. The normal equations are sparse: a residual depends on
+// one camera (15 parameters) and one board pose (6). The board poses are
+// eliminated by the Schur complement, which leaves a dense system of only
+// 15 parameters per camera, and the board poses follow by back
+// substitution. Jacobians (projectPoints and composeRT), the Schur
+// complement and the cost are evaluated on all cores.
+//
+// Returns the RMS reprojection error in pixels, -1 when camera 0 has no
+// views or an initial calibration fails.
+double calibrateRig(const std::vector<RigObservation> &observations, const std::vector<cv::Size> &imageSizes,
+	cv::Size pattern, float squareSize, std::vector<RigCamera> &cameras, unsigned threads = 0);
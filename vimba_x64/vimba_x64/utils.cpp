@@ -2,56 +2,6 @@
 
 using namespace cv;
 
-Mat PerfectReflectionAlgorithm(Mat src) {
-	int row = src.rows;
-	int col = src.cols;
-	Mat dst(row, col, CV_8UC3);
-	int HistRGB[767] = { 0 };
-	int MaxVal = 0;
-	for (int i = 0; i < row; i++) {
-		for (int j = 0; j < col; j++) {
-			MaxVal = max(MaxVal, (int)src.at<Vec3b>(i, j)[0]);
-			MaxVal = max(MaxVal, (int)src.at<Vec3b>(i, j)[1]);
-			MaxVal = max(MaxVal, (int)src.at<Vec3b>(i, j)[2]);
-			int sum = src.at<Vec3b>(i, j)[0] + src.at<Vec3b>(i, j)[1] + src.at<Vec3b>(i, j)[2];
-			HistRGB[sum]++;
-		}
-	}
-	int Threshold = 0;
-	int sum = 0;
-	for (int i = 766; i >= 0; i--) {
-		sum += HistRGB[i];
-		if (sum > row * col * 0.1) {
-			Threshold = i;
-			break;
-		}
-	}
-	int AvgB = 0;
-	int AvgG = 0;
-	int AvgR = 0;
-	int cnt = 0;
-	for (int i = 0; i < row; i++) {
-		for (int j = 0; j < col; j++) {
-			int sumP = src.at<Vec3b>(i, j)[0] + src.at<Vec3b>(i, j)[1] + src.at<Vec3b>(i, j)[2];
-			if (sumP > Threshold) {
-				AvgB += src.at<Vec3b>(i, j)[0];
-				AvgG += src.at<Vec3b>(i, j)[1];
-				AvgR += src.at<Vec3b>(i, j)[2];
-				cnt++;
-			}
-		}
-	}
-	AvgB /= cnt;
-	AvgG /= cnt;
-	AvgR /= cnt;
-	src.convertTo(src, CV_16UC3);
-	src = src.mul(Scalar(MaxVal, MaxVal, MaxVal));
-	src = src.mul(Scalar(1./AvgB, 1./AvgG, 1./AvgR));
-	src.convertTo(dst, CV_8UC3);
-
-	return dst;
-}
-
 void calibration(string path){
     Mat frame;
     string imgfolder = path; //"calib\\0\\"
@@ -5,5 +5,4 @@
 using namespace std;
 using namespace cv;
 
-Mat PerfectReflectionAlgorithm(Mat src);
 void calibration(string path);
\ No newline at end of file
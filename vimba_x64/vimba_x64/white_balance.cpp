@@ -0,0 +1,168 @@
+#include "white_balance.h"
+#include <algorithm>
+#include <cstring>
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define WB_SSE2
+#endif
+
+using namespace cv;
+
+BayerWhiteBalance::BayerWhiteBalance(int BayerCode, double Smoothing, double WhiteFraction)
+	: m_BayerCode(BayerCode), m_Smoothing(Smoothing), m_WhiteFraction(WhiteFraction), m_HaveGains(false), m_Frames(0) {
+	// OpenCV names a pattern by the second row, second and third column
+	switch (BayerCode) {
+	case COLOR_BayerGB2BGR: m_RedSite = 1; m_BlueSite = 2; break;
+	case COLOR_BayerRG2BGR: m_RedSite = 3; m_BlueSite = 0; break;
+	case COLOR_BayerGR2BGR: m_RedSite = 2; m_BlueSite = 1; break;
+	default:                m_RedSite = 0; m_BlueSite = 3; break;
+	}
+	m_Gains[0] = m_Gains[1] = m_Gains[2] = 1;
+	updateTables();
+}
+
+bool BayerWhiteBalance::estimate(const Mat &raw) {
+	if (raw.type() != CV_8UC1 || raw.rows < 2 || raw.cols < 2)
+		return false;
+	memset(m_Count, 0, sizeof(m_Count));
+	memset(m_Sum, 0, sizeof(m_Sum));
+	const int cells = raw.cols / 2;
+	const int green0 = 0 != m_RedSite && 0 != m_BlueSite ? 0 : (1 != m_RedSite && 1 != m_BlueSite ? 1 : 2);
+	const int green1 = 3 != m_RedSite && 3 != m_BlueSite ? 3 : (2 != m_RedSite && 2 != m_BlueSite ? 2 : 1);
+	for (int y = 0; y + 1 < raw.rows; y += 2 * SUBSAMPLE) {
+		const uint8_t *row[2] = { raw.ptr<uint8_t>(y), raw.ptr<uint8_t>(y + 1) };
+		int cell = 0;
+#ifdef WB_SSE2
+		const __m128i low = _mm_set1_epi16(0x00ff);
+		const __m128i white = _mm_set1_epi16(255);
+		for (; cell + 8 <= cells; cell += 8) {
+			// the even bytes of a row are the left sites of its cells, the odd ones the right sites
+			const __m128i top = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row[0] + 2 * cell));
+			const __m128i bottom = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row[1] + 2 * cell));
+			const __m128i site[4] = { _mm_and_si128(top, low), _mm_srli_epi16(top, 8), _mm_and_si128(bottom, low), _mm_srli_epi16(bottom, 8) };
+			const __m128i r = site[m_RedSite], b = site[m_BlueSite];
+			const __m128i g = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(site[green0], site[green1]), _mm_set1_epi16(1)), 1);
+			// a clipped site says nothing about the color of the light
+			const __m128i clipped = _mm_cmpeq_epi16(_mm_max_epi16(_mm_max_epi16(site[0], site[1]), _mm_max_epi16(site[2], site[3])), white);
+			int16_t rs[8], gs[8], bs[8], skip[8];
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(rs), r);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(gs), g);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(bs), b);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(skip), clipped);
+			for (int k = 0; k < 8; k++) {
+				if (skip[k])
+					continue;
+				const int bin = rs[k] + gs[k] + bs[k];
+				m_Count[bin]++;
+				m_Sum[bin][0] += rs[k];
+				m_Sum[bin][1] += gs[k];
+				m_Sum[bin][2] += bs[k];
+			}
+		}
+#endif
+		for (; cell < cells; cell++) {
+			const int site[4] = { row[0][2 * cell], row[0][2 * cell + 1], row[1][2 * cell], row[1][2 * cell + 1] };
+			if (255 == std::max(std::max(site[0], site[1]), std::max(site[2], site[3])))
+				continue;
+			const int r = site[m_RedSite], g = (site[green0] + site[green1] + 1) >> 1, b = site[m_BlueSite];
+			m_Count[r + g + b]++;
+			m_Sum[r + g + b][0] += r;
+			m_Sum[r + g + b][1] += g;
+			m_Sum[r + g + b][2] += b;
+		}
+	}
+
+	// the brightest cells up to WhiteFraction of all are the white reference
+	uint64_t total = 0;
+	for (int i = 0; i < BINS; i++)
+		total += m_Count[i];
+	uint64_t white = 0, sum[3] = { 0, 0, 0 };
+	for (int i = BINS - 1; i > 0 && white <= total * m_WhiteFraction; i--) {
+		white += m_Count[i];
+		sum[0] += m_Sum[i][0];
+		sum[1] += m_Sum[i][1];
+		sum[2] += m_Sum[i][2];
+	}
+	if (0 == sum[0] || 0 == sum[1] || 0 == sum[2])
+		return false;
+	const double measured[3] = { (double)sum[1] / sum[0], 1.0, (double)sum[1] / sum[2] };
+	for (int c = 0; c < 3; c++) {
+		const double gain = std::min(8.0, std::max(0.125, measured[c]));
+		m_Gains[c] = m_HaveGains ? m_Gains[c] + m_Smoothing * (gain - m_Gains[c]) : gain;
+	}
+	m_HaveGains = true;
+	updateTables();
+	return true;
+}
+
+void BayerWhiteBalance::updateTables() {
+	for (int s = 0; s < 4; s++) {
+		const double gain = s == m_RedSite ? m_Gains[0] : (s == m_BlueSite ? m_Gains[2] : m_Gains[1]);
+		for (int v = 0; v < 256; v++)
+			m_SiteLut[s][v] = (uint8_t)std::min(255.0, v * gain + 0.5);
+	}
+}
+
+void BayerWhiteBalance::demosaic(const Mat &raw, Mat &bgr) {
+	if (0 == m_Frames++ % ESTIMATE_EVERY)
+		estimate(raw);
+	if (!m_HaveGains || raw.type() != CV_8UC1) {
+		cvtColor(raw, bgr, m_BayerCode);
+		return;
+	}
+	m_Balanced.create(raw.rows, raw.cols, CV_8UC1);
+	for (int y = 0; y < raw.rows; y++) {
+		const uint8_t *in = raw.ptr<uint8_t>(y);
+		uint8_t *out = m_Balanced.ptr<uint8_t>(y);
+		const uint8_t *left = m_SiteLut[2 * (y & 1)], *right = m_SiteLut[2 * (y & 1) + 1];
+		int x = 0;
+		for (; x + 1 < raw.cols; x += 2) {
+			out[x] = left[in[x]];
+			out[x + 1] = right[in[x + 1]];
+		}
+		if (x < raw.cols)
+			out[x] = left[in[x]];
+	}
+	cvtColor(m_Balanced, bgr, m_BayerCode);
+}
+
+Mat PerfectReflectionAlgorithm(const Mat &src) {
+	// one pass: brightness histogram with the color sums of every bin, 64 bit for any image size
+	uint64_t count[3 * 255 + 1] = { 0 };
+	uint64_t sums[3 * 255 + 1][3] = { { 0 } };
+	int MaxVal = 0;
+	for (int i = 0; i < src.rows; i++) {
+		const Vec3b *p = src.ptr<Vec3b>(i);
+		for (int j = 0; j < src.cols; j++) {
+			const int b = p[j][0], g = p[j][1], r = p[j][2];
+			MaxVal = max(MaxVal, max(b, max(g, r)));
+			count[b + g + r]++;
+			sums[b + g + r][0] += b;
+			sums[b + g + r][1] += g;
+			sums[b + g + r][2] += r;
+		}
+	}
+	const uint64_t pixels = (uint64_t)src.rows * src.cols;
+	uint64_t cnt = 0, sum[3] = { 0, 0, 0 };
+	for (int i = 3 * 255; i >= 0 && cnt <= pixels * 0.1; i--) {
+		cnt += count[i];
+		sum[0] += sums[i][0];
+		sum[1] += sums[i][1];
+		sum[2] += sums[i][2];
+	}
+	// every channel of the reference white goes to the brightest value, through a table per channel
+	uint8_t lut[3][256];
+	for (int c = 0; c < 3; c++) {
+		const double gain = 0 == sum[c] ? 1.0 : (double)MaxVal * cnt / sum[c];
+		for (int v = 0; v < 256; v++)
+			lut[c][v] = (uint8_t)min(255.0, v * gain + 0.5);
+	}
+	Mat dst(src.rows, src.cols, CV_8UC3);
+	for (int i = 0; i < src.rows; i++) {
+		const Vec3b *p = src.ptr<Vec3b>(i);
+		Vec3b *q = dst.ptr<Vec3b>(i);
+		for (int j = 0; j < src.cols; j++)
+			q[j] = Vec3b(lut[0][p[j][0]], lut[1][p[j][1]], lut[2][p[j][2]]);
+	}
+	return dst;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+
+// White balance of raw 8 bit Bayer frames, for live views.
+//
+// estimate() walks every SUBSAMPLE-th row pair of the mosaic once. SSE2
+// splits the 2x2 cells into R, G and B, and each cell lands in a histogram
+// bin of its brightness that also sums its colors. The brightest tenth of
+// the cells is the white reference (perfect reflection), its mean color
+// gives gains normalized to green. New gains are blended into the cached
+// ones, so the balance does not flicker.
+//
+// demosaic() applies the cached gains to the mosaic through one table per
+// Bayer site and then demosaics. Gains on the raw data need a third of the
+// work of gains on the color image. The estimate only runs every
+// ESTIMATE_EVERY frames.
+class BayerWhiteBalance {
+public:
+	enum { SUBSAMPLE = 4, ESTIMATE_EVERY = 8, BINS = 3 * 255 + 1 };
+
+	// BayerCode is the cv::cvtColor code of the mosaic, e.g. CV_BayerBG2BGR
+	BayerWhiteBalance(int BayerCode, double Smoothing = 0.2, double WhiteFraction = 0.1);
+
+	// measure the gains of one frame and blend them into the cached ones
+	bool estimate(const cv::Mat &raw);
+	// white balanced color image of a frame, estimates every ESTIMATE_EVERY frames
+	void demosaic(const cv::Mat &raw, cv::Mat &bgr);
+	// red, green, blue
+	const double* gains() const { return m_Gains; }
+
+private:
+	void updateTables();
+
+	int         m_BayerCode;
+	int         m_RedSite;          // 0..3, position of red in the 2x2 cell, row major
+	int         m_BlueSite;
+	double      m_Smoothing;
+	double      m_WhiteFraction;
+	bool        m_HaveGains;
+	uint64_t    m_Frames;
+	double      m_Gains[3];
+	uint8_t     m_SiteLut[4][256];  // gains of the four cell sites
+	uint32_t    m_Count[BINS];      // histogram of the cell brightness r + g + b
+	uint32_t    m_Sum[BINS][3];     // color sums of the cells per bin
+	cv::Mat     m_Balanced;         // the mosaic after the gains
+};
+
+// white balance of a color image with the same estimate, for still images
+cv::Mat PerfectReflectionAlgorithm(const cv::Mat &src);